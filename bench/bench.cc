@@ -0,0 +1,204 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-05 10:21:37
+ * @Description: microbenchmark runner, linked into every benchmark target
+ */
+
+#include "bench.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace {
+
+std::atomic<u64> alloc_count{0};
+std::atomic<u64> alloc_bytes{0};
+
+void* counted_alloc(size_t size) {
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (auto ptr = std::malloc(size ? size : 1)) { return ptr; }
+    throw std::bad_alloc();
+}
+
+void* counted_aligned_alloc(size_t size, std::align_val_t align) {
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    void* ptr = nullptr;
+    if (!posix_memalign(&ptr, std::max(sizeof(void*), static_cast<size_t>(align)), size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+}
+
+void* operator new(size_t size) { return counted_alloc(size); }
+
+void* operator new[](size_t size) { return counted_alloc(size); }
+
+void* operator new(size_t size, std::align_val_t align) { return counted_aligned_alloc(size, align); }
+
+void* operator new[](size_t size, std::align_val_t align) { return counted_aligned_alloc(size, align); }
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { std::free(ptr); }
+
+namespace minilsm {
+
+namespace {
+
+struct Bench {
+    string name;
+    BenchFunc func;
+};
+
+vector<Bench>& benches() {
+    static vector<Bench> res;
+    return res;
+}
+
+vector<size_t> parse_list(const char* arg) {
+    vector<size_t> res;
+    for (auto ptr = arg; *ptr; ) {
+        char* end;
+        res.push_back(std::strtoull(ptr, &end, 10));
+        ptr = *end == ',' ? end + 1 : end;
+        if (end == ptr && *ptr) { break; }
+    }
+    return res;
+}
+
+}
+
+AllocStats alloc_stats() {
+    return AllocStats{
+        alloc_count.load(std::memory_order_relaxed), 
+        alloc_bytes.load(std::memory_order_relaxed)
+    };
+}
+
+string BenchParams::to_string() const {
+    return "key=" + std::to_string(this->key_size) + 
+        "/value=" + std::to_string(this->value_size) + 
+        "/n=" + std::to_string(this->num_of_keys);
+}
+
+BenchState::BenchState(size_t ops) : ops_(ops), running_(false), elapsed_(0) {
+    this->resume();
+}
+
+void BenchState::pause() {
+    if (!this->running_) { return; }
+    this->elapsed_ += clock::now() - this->start_;
+    auto allocs = alloc_stats();
+    this->allocs_.count += allocs.count - this->alloc_start_.count;
+    this->allocs_.bytes += allocs.bytes - this->alloc_start_.bytes;
+    this->running_ = false;
+}
+
+void BenchState::resume() {
+    if (this->running_) { return; }
+    this->running_ = true;
+    this->alloc_start_ = alloc_stats();
+    this->start_ = clock::now();
+}
+
+void register_bench(const string& name, BenchFunc func) {
+    benches().push_back(Bench{name, std::move(func)});
+}
+
+vector<string> make_keys(size_t num_of_keys, size_t key_size) {
+    vector<string> keys;
+    keys.reserve(num_of_keys);
+    char buf[32];
+    for (size_t i = 0; i < num_of_keys; i++) {
+        // zero padded, so that equally long keys sort as the numbers do
+        auto len = snprintf(buf, sizeof(buf), "%020zu", i);
+        string key(key_size, '0');
+        auto copied = std::min<size_t>(len, key_size);
+        memcpy(key.data() + key_size - copied, buf + len - copied, copied);
+        keys.push_back(std::move(key));
+    }
+    return keys;
+}
+
+}
+
+using namespace minilsm;
+
+// usage: <bench> [--filter=<substring>] [--min-time-ms=<ms>] 
+//                [--key-size=<n,...>] [--value-size=<n,...>] [--num=<n,...>]
+int main(int argc, char** argv) {
+    string filter;
+    u64 min_time_ms = 200;
+    vector<size_t> key_sizes = {16, 64};
+    vector<size_t> value_sizes = {100};
+    vector<size_t> nums = {10000, 100000};
+    for (int i = 1; i < argc; i++) {
+        auto arg = argv[i];
+        if (!strncmp(arg, "--filter=", 9)) { filter = arg + 9; }
+        else if (!strncmp(arg, "--min-time-ms=", 14)) { min_time_ms = std::strtoull(arg + 14, nullptr, 10); }
+        else if (!strncmp(arg, "--key-size=", 11)) { key_sizes = parse_list(arg + 11); }
+        else if (!strncmp(arg, "--value-size=", 13)) { value_sizes = parse_list(arg + 13); }
+        else if (!strncmp(arg, "--num=", 6)) { nums = parse_list(arg + 6); }
+        else {
+            fprintf(stderr, "unknown argument: %s\n", arg);
+            return 1;
+        }
+    }
+
+    vector<BenchParams> params;
+    for (auto key_size : key_sizes) {
+        for (auto value_size : value_sizes) {
+            for (auto num : nums) {
+                params.push_back(BenchParams{key_size, value_size, num});
+            }
+        }
+    }
+    register_benches(params);
+
+    printf("%-64s %12s %12s %12s %12s\n", "benchmark", "ops", "ns/op", "bytes/op", "allocs/op");
+    for (auto& bench : benches()) {
+        if (!filter.empty() && bench.name.find(filter) == string::npos) { continue; }
+
+        // grow the number of operations until a run lasts long enough
+        size_t ops = 1;
+        while (true) {
+            BenchState state(ops);
+            bench.func(state);
+            state.pause();
+
+            auto elapsed = state.elapsed().count();
+            if (elapsed >= static_cast<i64>(min_time_ms * 1000000) || ops >= (1ULL << 32)) {
+                printf("%-64s %12zu %12.1f %12.1f %12.2f\n", 
+                    bench.name.c_str(), 
+                    ops, 
+                    static_cast<double>(elapsed) / ops,
+                    static_cast<double>(state.allocs().bytes) / ops,
+                    static_cast<double>(state.allocs().count) / ops);
+                break;
+            }
+            // aim at 1.2x of the minimum time, growing 100x at most per round
+            auto next = elapsed ? static_cast<double>(min_time_ms) * 1.2e6 * ops / elapsed : ops * 100.0;
+            ops = std::max(ops + 1, static_cast<size_t>(std::min(next, ops * 100.0)));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-05 10:21:37
+ * @Description: minimal harness for microbenchmarks
+ */
+#ifndef BENCH_BENCH_H
+#define BENCH_BENCH_H
+
+#include "defs.h"
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace minilsm {
+
+using std::string;
+using std::vector;
+
+// allocations made through the global `operator new`, which is replaced by
+// the harness
+struct AllocStats {
+    u64 count = 0;
+    u64 bytes = 0;
+};
+
+AllocStats alloc_stats();
+
+// key/value shape a benchmark is instantiated with
+struct BenchParams {
+    size_t key_size;
+    size_t value_size;
+    size_t num_of_keys;
+
+    // e.g. "key=16/value=100/n=10000"
+    string to_string() const;
+};
+
+// state handed to a benchmark body, which runs `ops()` operations. only the
+// time and allocations between `resume()` and `pause()` are accounted, the
+// body starts resumed.
+class BenchState {
+private:
+    using clock = std::chrono::steady_clock;
+
+    size_t ops_;
+    bool running_;
+    clock::time_point start_;
+    AllocStats alloc_start_;
+    std::chrono::nanoseconds elapsed_;
+    AllocStats allocs_;
+
+public:
+    BenchState(size_t ops);
+
+    size_t ops() const { return this->ops_; }
+
+    // exclude set-up work from the measurement
+    void pause();
+
+    void resume();
+
+    std::chrono::nanoseconds elapsed() const { return this->elapsed_; }
+
+    AllocStats allocs() const { return this->allocs_; }
+};
+
+using BenchFunc = std::function<void(BenchState&)>;
+
+// benchmarks run in registration order
+void register_bench(const string& name, BenchFunc func);
+
+// defined by every benchmark file, registers its benchmarks once per
+// parameter set given on the command line
+void register_benches(const vector<BenchParams>& params);
+
+// `num_of_keys` distinct keys of `key_size` bytes in ascending order
+vector<string> make_keys(size_t num_of_keys, size_t key_size);
+
+// keeps the compiler from discarding the computation of `value`
+template <typename T>
+inline void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+}
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-05 10:21:37
+ * @Description: benchmark for block operations
+ */
+
+#include "bench.h"
+#include "block/block.h"
+#include "block/iterator.h"
+#include "defs.h"
+#include "mvcc/key.h"
+#include "slice.h"
+#include <memory>
+#include <random>
+
+namespace minilsm {
+
+static constexpr size_t BLOCK_SIZE = 4096;
+
+void register_benches(const vector<BenchParams>& params) {
+    for (auto& param : params) {
+        auto keys = std::make_shared<vector<KeySlice>>();
+        for (auto& key : make_keys(param.num_of_keys, param.key_size)) { keys->emplace_back(key); }
+        auto value = Slice(string(param.value_size, 'v'));
+
+        // one full block made of the smallest keys
+        auto block = std::make_shared<shared_ptr<Block>>();
+        auto get_block = [=]() {
+            if (!*block) {
+                BlockBuilder builder(BLOCK_SIZE);
+                for (auto& key : *keys) {
+                    if (!builder.add(key, value)) { break; }
+                }
+                *block = builder.build();
+            }
+            return *block;
+        };
+
+        register_bench("BlockBuilder/add/" + param.to_string(), [=](BenchState& state) {
+            BlockBuilder builder(BLOCK_SIZE);
+            for (size_t i = 0; i < state.ops(); i++) {
+                if (!builder.add((*keys)[i % keys->size()], value)) {
+                    state.pause();
+                    builder = BlockBuilder(BLOCK_SIZE);
+                    state.resume();
+                }
+            }
+            state.pause();
+        });
+
+        register_bench("Block/locate_key/" + param.to_string(), [=](BenchState& state) {
+            state.pause();
+            auto block_ptr = get_block();
+            std::mt19937 gen(0);
+            std::uniform_int_distribution<size_t> distrib(0, block_ptr->num_of_keys() - 1);
+            vector<size_t> order(1024);
+            for (auto& idx : order) { idx = distrib(gen); }
+            state.resume();
+            for (size_t i = 0; i < state.ops(); i++) {
+                do_not_optimize(block_ptr->locate_key((*keys)[order[i % order.size()]]));
+            }
+        });
+
+        register_bench("BlockIterator/scan/" + param.to_string(), [=](BenchState& state) {
+            state.pause();
+            auto block_ptr = get_block();
+            state.resume();
+            auto iter = block_ptr->create_iterator();
+            for (size_t i = 0; i < state.ops(); i++) {
+                if (!iter->is_valid()) { iter = block_ptr->create_iterator(); }
+                do_not_optimize(iter->key_view());
+                iter->next();
+            }
+        });
+    }
+}
+
+}
@@ -0,0 +1,88 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-05 10:21:37
+ * @Description: benchmark for bloom filters
+ */
+
+#include "bench.h"
+#include "defs.h"
+#include "util/bloom.h"
+#include "util/blocked_bloom.h"
+#include <memory>
+
+namespace minilsm {
+
+static constexpr double FALSE_POSITIVE_RATE = 0.01;
+
+void register_benches(const vector<BenchParams>& params) {
+    for (auto& param : params) {
+        auto keys = std::make_shared<vector<string>>(make_keys(param.num_of_keys, param.key_size));
+        // absent keys of the same size
+        auto absent = std::make_shared<vector<string>>(*keys);
+        for (auto& key : *absent) { key.back() = 'x'; }
+
+        auto make_classic = [=]() {
+            bloom_parameters param;
+            param.projected_element_count = keys->size();
+            param.false_positive_probability = FALSE_POSITIVE_RATE;
+            param.compute_optimal_parameters();
+            return bloom_filter(param);
+        };
+        auto make_blocked = [=]() {
+            return BlockedBloomFilter(keys->size(), BlockedBloomFilter::bits_per_key(FALSE_POSITIVE_RATE));
+        };
+
+        register_bench("bloom_filter/insert/" + param.to_string(), [=](BenchState& state) {
+            state.pause();
+            auto bloom = make_classic();
+            state.resume();
+            for (size_t i = 0; i < state.ops(); i++) {
+                auto& key = (*keys)[i % keys->size()];
+                bloom.insert(reinterpret_cast<const u8*>(key.data()), key.size());
+            }
+            state.pause();
+        });
+
+        register_bench("BlockedBloomFilter/insert/" + param.to_string(), [=](BenchState& state) {
+            state.pause();
+            auto bloom = make_blocked();
+            state.resume();
+            for (size_t i = 0; i < state.ops(); i++) {
+                auto& key = (*keys)[i % keys->size()];
+                bloom.insert(reinterpret_cast<const u8*>(key.data()), key.size());
+            }
+            state.pause();
+        });
+
+        for (bool hit : {true, false}) {
+            auto lookups = hit ? keys : absent;
+            auto suffix = string(hit ? "contains_hit/" : "contains_miss/") + param.to_string();
+
+            register_bench("bloom_filter/" + suffix, [=](BenchState& state) {
+                state.pause();
+                auto bloom = make_classic();
+                for (auto& key : *keys) { bloom.insert(key); }
+                state.resume();
+                for (size_t i = 0; i < state.ops(); i++) {
+                    auto& key = (*lookups)[i % lookups->size()];
+                    do_not_optimize(bloom.contains(reinterpret_cast<const u8*>(key.data()), key.size()));
+                }
+                state.pause();
+            });
+
+            register_bench("BlockedBloomFilter/" + suffix, [=](BenchState& state) {
+                state.pause();
+                auto bloom = make_blocked();
+                for (auto& key : *keys) { bloom.insert(reinterpret_cast<const u8*>(key.data()), key.size()); }
+                state.resume();
+                for (size_t i = 0; i < state.ops(); i++) {
+                    auto& key = (*lookups)[i % lookups->size()];
+                    do_not_optimize(bloom.contains(reinterpret_cast<const u8*>(key.data()), key.size()));
+                }
+                state.pause();
+            });
+        }
+    }
+}
+
+}
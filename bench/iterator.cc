@@ -0,0 +1,61 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-05 10:21:37
+ * @Description: benchmark for merging iterators
+ */
+
+#include "bench.h"
+#include "defs.h"
+#include "iterator/merge.h"
+#include "memtable/memtable.h"
+#include "memtable/iterator.h"
+#include "slice.h"
+#include <memory>
+
+namespace minilsm {
+
+void register_benches(const vector<BenchParams>& params) {
+    for (auto& param : params) {
+        for (size_t num_of_sources : {2, 8, 32}) {
+            auto value = Slice(string(param.value_size, 'v'));
+
+            // keys are dealt to the sources in turn, every tenth key is 
+            // also kept by the next source as an older version
+            auto sources = std::make_shared<vector<shared_ptr<MemTable>>>();
+            auto get_sources = [=]() {
+                if (sources->empty()) {
+                    for (size_t i = 0; i < num_of_sources; i++) { sources->push_back(std::make_shared<MemTable>(i)); }
+                    auto keys = make_keys(param.num_of_keys, param.key_size);
+                    for (size_t i = 0; i < keys.size(); i++) {
+                        (*sources)[i % num_of_sources]->put(Slice(keys[i]), value);
+                        if (i % 10 == 0) { (*sources)[(i + 1) % num_of_sources]->put(Slice(keys[i]), value); }
+                    }
+                }
+                return sources;
+            };
+            auto create_iterator = [=]() {
+                vector<shared_ptr<Iterator>> iters;
+                for (auto& source : *get_sources()) { iters.push_back(source->create_iterator()); }
+                return std::make_shared<MergeMultiIterator>(iters);
+            };
+
+            register_bench("MergeMultiIterator/sources=" + std::to_string(num_of_sources) + "/" + param.to_string(),
+                    [=](BenchState& state) {
+                state.pause();
+                auto iter = create_iterator();
+                state.resume();
+                for (size_t i = 0; i < state.ops(); i++) {
+                    if (!iter->is_valid()) {
+                        state.pause();
+                        iter = create_iterator();
+                        state.resume();
+                    }
+                    do_not_optimize(iter->key_view());
+                    iter->next();
+                }
+            });
+        }
+    }
+}
+
+}
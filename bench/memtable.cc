@@ -0,0 +1,73 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-05 10:21:37
+ * @Description: benchmark for memtable operations
+ */
+
+#include "bench.h"
+#include "defs.h"
+#include "memtable/memtable.h"
+#include "memtable/iterator.h"
+#include "slice.h"
+#include <algorithm>
+#include <memory>
+#include <random>
+
+namespace minilsm {
+
+void register_benches(const vector<BenchParams>& params) {
+    for (auto& param : params) {
+        auto keys = std::make_shared<vector<Slice>>();
+        for (auto& key : make_keys(param.num_of_keys, param.key_size)) { keys->emplace_back(key); }
+        // keys are inserted and looked up in random order
+        std::shuffle(keys->begin(), keys->end(), std::mt19937(0));
+        auto value = Slice(string(param.value_size, 'v'));
+
+        // filled on the first run and shared by the following ones
+        auto filled = std::make_shared<shared_ptr<MemTable>>();
+        auto get_filled = [=]() {
+            if (!*filled) {
+                *filled = std::make_shared<MemTable>(0);
+                for (auto& key : *keys) { (*filled)->put(key, value); }
+            }
+            return *filled;
+        };
+
+        register_bench("MemTable/put/" + param.to_string(), [=](BenchState& state) {
+            auto memtable = std::make_shared<MemTable>(0);
+            for (size_t i = 0; i < state.ops(); i++) {
+                auto idx = i % keys->size();
+                if (i && !idx) {
+                    state.pause();
+                    memtable = std::make_shared<MemTable>(0);
+                    state.resume();
+                }
+                memtable->put((*keys)[idx], value);
+            }
+            state.pause();
+        });
+
+        register_bench("MemTable/get/" + param.to_string(), [=](BenchState& state) {
+            state.pause();
+            auto memtable = get_filled();
+            state.resume();
+            for (size_t i = 0; i < state.ops(); i++) {
+                do_not_optimize(memtable->get((*keys)[i % keys->size()]));
+            }
+        });
+
+        register_bench("MemTable/scan/" + param.to_string(), [=](BenchState& state) {
+            state.pause();
+            auto memtable = get_filled();
+            state.resume();
+            auto iter = memtable->create_iterator();
+            for (size_t i = 0; i < state.ops(); i++) {
+                if (!iter->is_valid()) { iter = memtable->create_iterator(); }
+                do_not_optimize(iter->key_view());
+                iter->next();
+            }
+        });
+    }
+}
+
+}
@@ -0,0 +1,93 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-05 10:21:37
+ * @Description: benchmark for sstable operations
+ */
+
+#include "bench.h"
+#include "cache/block_cache.h"
+#include "defs.h"
+#include "mvcc/key.h"
+#include "slice.h"
+#include "sstable/sstable.h"
+#include <filesystem>
+#include <memory>
+#include <random>
+
+namespace minilsm {
+
+static constexpr size_t BLOCK_SIZE = 4096;
+
+void register_benches(const vector<BenchParams>& params) {
+    auto sst_dir = string(PROJECT_ROOT_PATH) + "/binary/bench";
+    std::filesystem::create_directories(sst_dir);
+
+    for (auto& param : params) {
+        auto keys = std::make_shared<vector<KeySlice>>();
+        for (auto& key : make_keys(param.num_of_keys, param.key_size)) { keys->emplace_back(key); }
+        auto value = Slice(string(param.value_size, 'v'));
+        auto sst_path = sst_dir + "/sstable-" + std::to_string(param.key_size) + "-" + 
+            std::to_string(param.value_size) + "-" + std::to_string(param.num_of_keys) + ".sst";
+
+        auto built = std::make_shared<bool>(false);
+        auto ensure_built = [=]() {
+            if (*built) { return; }
+            SSTableBuilder builder(BLOCK_SIZE, keys->size(), 0.01);
+            for (auto& key : *keys) { builder.add(key, value); }
+            builder.build(0, nullptr, sst_path);
+            *built = true;
+        };
+
+        // an op adds a key, the table is built once every `num_of_keys` keys
+        register_bench("SSTableBuilder/build/" + param.to_string(), [=](BenchState& state) {
+            SSTableBuilder builder(BLOCK_SIZE, keys->size(), 0.01);
+            for (size_t i = 0; i < state.ops(); i++) {
+                builder.add((*keys)[i % keys->size()], value);
+                if ((i + 1) % keys->size() == 0 || i + 1 == state.ops()) {
+                    builder.build(0, nullptr, sst_path);
+                    state.pause();
+                    builder = SSTableBuilder(BLOCK_SIZE, keys->size(), 0.01);
+                    state.resume();
+                }
+            }
+            state.pause();
+            *built = false;
+        });
+
+        // reads the meta section and the bloom filter
+        register_bench("SSTable/open/" + param.to_string(), [=](BenchState& state) {
+            state.pause();
+            ensure_built();
+            state.resume();
+            for (size_t i = 0; i < state.ops(); i++) {
+                SSTable sstable(0, nullptr, sst_path);
+                do_not_optimize(sstable.num_of_blocks());
+            }
+        });
+
+        for (bool hit : {true, false}) {
+            register_bench(string("SSTable/get_") + (hit ? "hit/" : "miss/") + param.to_string(), 
+                    [=](BenchState& state) {
+                state.pause();
+                ensure_built();
+                auto sstable = std::make_shared<SSTable>(0, std::make_shared<BlockCache>(), sst_path);
+                // absent keys fall inside the key range of the table
+                vector<Slice> lookups;
+                std::mt19937 gen(0);
+                std::uniform_int_distribution<size_t> distrib(0, keys->size() - 1);
+                for (size_t i = 0; i < 1024; i++) {
+                    auto& picked = (*keys)[distrib(gen)];
+                    auto key = string(reinterpret_cast<const char*>(picked.data()), picked.size());
+                    if (!hit) { key.back() = 'x'; }
+                    lookups.emplace_back(key);
+                }
+                state.resume();
+                for (size_t i = 0; i < state.ops(); i++) {
+                    do_not_optimize(sstable->get(lookups[i % lookups.size()]));
+                }
+            });
+        }
+    }
+}
+
+}
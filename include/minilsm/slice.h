@@ -21,6 +21,16 @@ using std::string;
 using std::array;
 
 namespace minilsm {
+
+// compare two byte ranges by size first, then by lexicographic order
+inline int8_t compare_bytes(const uint8_t* a, size_t a_size, const uint8_t* b, size_t b_size) {
+    if (a_size > b_size) { return 1; }
+    if (a_size < b_size) { return -1; }
+    if (a == b || !a_size) { return 0; }
+    auto r = memcmp(a, b, a_size);
+    return (r > 0) - (r < 0);
+}
+
 class Slice {
 private:
     struct BaseSlice {
@@ -98,12 +108,7 @@ public:
     //  0: a = b
     // -1: a < b
     int8_t compare(const Slice& other) const {
-        if (ctrl_->data == other.data() &&
-            ctrl_->size == other.size()) { return 0; }
-        if (ctrl_->size > other.size()) { return 1; }
-        if (ctrl_->size < other.size()) { return -1; }
-        auto r = memcmp(ctrl_->data, other.data(), ctrl_->size);
-        return (r > 0) - (r < 0);
+        return compare_bytes(ctrl_->data, ctrl_->size, other.data(), other.size());
     }
 
     size_t compute_overlap(const Slice& s) const {
@@ -155,6 +160,34 @@ private:
     }
 };
 
+// non-owning view of bytes, the owner (arena, block, ...) must outlive it
+class SliceView {
+private:
+    const uint8_t* data_;
+    size_t size_;
+
+public:
+    SliceView() : data_(nullptr), size_(0) {}
+
+    SliceView(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+    SliceView(const Slice& slice) : data_(slice.data()), size_(slice.size()) {}
+
+    const uint8_t* data() const { return data_; }
+
+    size_t size() const { return size_; }
+
+    bool empty() const { return size_ == 0; }
+
+    // same order as `Slice::compare`
+    int8_t compare(const SliceView& other) const {
+        return compare_bytes(data_, size_, other.data(), other.size());
+    }
+
+    // copy the viewed bytes into an owning slice
+    Slice to_slice() const { return Slice(data_, size_); }
+};
+
 inline std::ostream& operator<<(std::ostream& output, const Slice& input) {
     std::string converted_input = "";
     for (size_t i = 0; i < input.size(); i++) {
@@ -168,6 +201,13 @@ inline std::ostream& operator<<(std::ostream& output, const Slice& input) {
     return output;
 }
 
+inline std::ostream& operator<<(std::ostream& output, const SliceView& input) {
+    for (size_t i = 0; i < input.size(); i++) {
+        output << (input.data()[i] ? static_cast<char>(input.data()[i]) : '#');
+    }
+    return output;
+}
+
 struct SliceArrayComparator {
     int operator()(const array<Slice, 2>& ca1, const array<Slice, 2>& ca2) const { 
         return ca1[0].compare(ca2[0]) < 0;
@@ -7,111 +7,183 @@
 #include "block.h"
 #include "block/iterator.h"
 #include "mvcc/key.h"
+#include <algorithm>
 #include <cstddef>
 
 namespace minilsm {
 
 using std::make_shared;
 
-Block::Block(const Bytes& buf) {
-    auto size = buf.size();
-    auto entry_offsets_len = buf.get(size - sizeof(u16), sizeof(u16));
-    auto data_end = size - sizeof(u16) - entry_offsets_len * sizeof(u16);
-    for (auto addr = data_end; addr < size - sizeof(u16); addr += sizeof(u16)) {
-        auto offset = buf.get(addr, sizeof(u16));
-        this->offsets.push_back(offset);
+Block::Block(Bytes&& buf) : owned_(std::move(buf)) {
+    this->data_ = this->owned_.outstream();
+    this->size_ = this->owned_.size();
+    this->init();
+}
+
+Block::Block(const u8* data, size_t size, shared_ptr<const void> holder) :
+        holder_(holder), data_(data), size_(size) {
+    this->init();
+}
+
+bool Block::is_valid_encoding(const u8* data, size_t size) {
+    if (size < 4 * sizeof(u16)) { return false; }
+    auto extra = data + size;
+    if (decode_u16(extra - sizeof(u16)) != BLOCK_FORMAT_VERSION) { return false; }
+    size_t num_of_keys = decode_u16(extra - 2 * sizeof(u16));
+    size_t restart_interval = decode_u16(extra - 3 * sizeof(u16));
+    size_t num_of_restarts = decode_u16(extra - 4 * sizeof(u16));
+    if (!num_of_keys || !restart_interval ||
+            num_of_restarts != (num_of_keys + restart_interval - 1) / restart_interval ||
+            size < (4 + num_of_restarts) * sizeof(u16)) {
+        return false;
+    }
+    // every restart point lies within the data section
+    auto restarts_begin = size - (4 + num_of_restarts) * sizeof(u16);
+    for (size_t i = 0; i < num_of_restarts; i++) {
+        if (decode_u16(data + restarts_begin + i * sizeof(u16)) >= restarts_begin) { return false; }
     }
-    
-    this->data.resize(data_end);
-    std::copy_n(buf.cbegin(), data_end, this->data.begin());
+    return true;
+}
 
-    auto first_key_len = buf.get(sizeof(u16), sizeof(u16));
-    this->first_key = KeySlice(buf.outstream() + sizeof(u16) + sizeof(u16), first_key_len);
-    this->first_key.set_ts(buf.get(sizeof(u16) + sizeof(u16) + first_key_len, sizeof(u64)));
+void Block::init() {
+    // blocks from disk are checked by the reader, before they get here
+    DCHECK(is_valid_encoding(this->data_, this->size_));
+    auto extra = this->data_ + this->size_;
+    this->num_of_keys_ = decode_u16(extra - 2 * sizeof(u16));
+    this->restart_interval_ = decode_u16(extra - 3 * sizeof(u16));
+    this->num_of_restarts_ = decode_u16(extra - 4 * sizeof(u16));
+    this->restarts_begin_ = this->size_ - 4 * sizeof(u16) - this->num_of_restarts_ * sizeof(u16);
+
+    auto entry = this->decode_entry(0);
+    DCHECK(!entry.shared_len);
+    this->first_key = decode_internal_key(SliceView(entry.rest, entry.rest_len));
 }
 
 Bytes Block::serialize() {
-    auto buf = this->data;
-    auto offsets_len = this->offsets.size();
-    for (auto offset : offsets) {
-        buf.push(offset, sizeof(u16));
-    }
-    buf.push(offsets_len, sizeof(u16));
+    Bytes buf;
+    buf.instream(this->data_, this->size_);
     return buf;
 }
 
 KeySlice Block::get_key(size_t idx) {
-    DCHECK(idx < this->offsets.size());
-    auto offset = this->offsets[idx];
-    auto overlap_len = this->data.get(offset, sizeof(u16));
-    auto rest_len = this->data.get(offset + sizeof(u16), sizeof(u16));
-    auto key = KeySlice(
-        overlap_len + rest_len,
-        this->first_key.data(),
-        overlap_len,
-        this->data.outstream(offset + sizeof(u16) + sizeof(u16)),
-        rest_len
-    );
-    key.set_ts(this->data.get(offset + sizeof(u16) + sizeof(u16) + rest_len, sizeof(u64)));
-    auto& buf = this->data;
-    auto key_len = buf.get(sizeof(u16), sizeof(u16));
-
-    return key;
+    DCHECK(idx < this->num_of_keys_);
+    static thread_local vector<u8> key_buf;
+
+    // seek to the closest restart point, then replay the deltas
+    auto restart = idx / this->restart_interval_;
+    auto entry = this->decode_entry(this->restart_offset(restart));
+    auto key = SliceView(entry.rest, entry.rest_len);
+    for (auto i = restart * this->restart_interval_; i < idx; i++) {
+        entry = this->decode_entry(entry.next);
+        key = rebuild_key(entry, key, key_buf);
+    }
+    return KeySlice(decode_internal_key(key));
 }
 
 size_t Block::num_of_keys() {
-    return this->offsets.size();
+    return this->num_of_keys_;
 }
 
-size_t Block::locate_key(const KeySlice& key, bool contains, bool start) {
-    if (key.compare(this->first_key) < 0) { return 0; }
-    
+size_t Block::memory_usage() {
+    return sizeof(Block) + this->size_;
+}
+
+size_t Block::seek(const SliceView& key, u64 ts, bool after, BlockEntry* found, KeyView* found_key) {
+    static thread_local vector<u8> key_buf, target_buf;
+    encode_internal_key(key, ts, target_buf);
+    auto target = SliceView(target_buf.data(), target_buf.size());
+    // the entry is past the target if it is greater, or not less with `after`
+    auto is_past = [&](const SliceView& current) {
+        auto res = compare_internal_keys(current, target);
+        return after ? res > 0 : res >= 0;
+    };
+
+    // binary search the last restart point before `key`, restart keys are
+    // stored in full and compared in place
     size_t low = 0;
-    size_t high = this->offsets.size() - 1;
-    KeySlice anchor_key;
+    size_t high = this->num_of_restarts_ - 1;
     while (low < high) {
         auto mid = low + (high - low) / 2 + 1;
-        anchor_key = this->get_key(mid);
-        auto res = anchor_key.compare(key);
-        if (res <= 0) {
+        auto entry = this->decode_entry(this->restart_offset(mid));
+        if (!is_past(SliceView(entry.rest, entry.rest_len))) {
             low = mid;
         } else {
             high = mid - 1;
         } 
     }
-    anchor_key = this->get_key(low);
-    auto res = anchor_key.compare(key);
-    DCHECK(res <= 0);
-    
-    return !start && (res == -1 || (res == 0 && contains)) ? 
-            low + 1: 
-            low;
+
+    // then scan linearly up to the next restart point at most
+    auto idx = low * this->restart_interval_;
+    auto entry = this->decode_entry(this->restart_offset(low));
+    auto current = SliceView(entry.rest, entry.rest_len);
+    while (!is_past(current)) {
+        if (++idx == this->num_of_keys_) { return idx; }
+        entry = this->decode_entry(entry.next);
+        current = rebuild_key(entry, current, key_buf);
+    }
+    if (found) { *found = entry; }
+    if (found_key) { *found_key = decode_internal_key(current); }
+    return idx;
+}
+
+size_t Block::locate_key(const SliceView& key, bool contains, bool start) {
+    // versions of a key are ordered from the newest, so the newest version
+    // sorts first and the oldest one last
+    auto end = this->seek(key, 0, true);
+    if (!end) { return 0; }
+    auto begin = this->seek(key, UINT64_MAX, false);
+    // `key` is absent, the last entry less than it is located
+    if (begin == end) { return start ? end - 1 : end; }
+    return !start && contains ? end : begin;
+}
+
+std::optional<SliceView> Block::get(const SliceView& key, u64 ts, u64* version_ts, ValueType* type) {
+    // the first entry not less than the version `ts` of `key`, the restart
+    // points of newer versions are skipped by the binary search
+    BlockEntry entry;
+    KeyView entry_key;
+    auto idx = this->seek(key, ts, false, &entry, &entry_key);
+    if (idx == this->num_of_keys_ || entry_key.compare(key)) { return std::nullopt; }
+    if (version_ts) { *version_ts = entry_key.get_ts(); }
+    if (type) { *type = entry.type; }
+    return SliceView(entry.value, entry.value_len);
 }
 
 size_t BlockBuilder::estimated_size() {
     return this->data_.size()                    /* data section */ 
-        + this->offsets_.size() * sizeof(u16)    /* offset section */ 
-        + sizeof(u16);                           /* extra */
+        + this->restarts_.size() * sizeof(u16)   /* restart section */ 
+        + 4 * sizeof(u16);                       /* extra */
 }
 
-bool BlockBuilder::add(const KeySlice& key, const Slice& value) {
+bool BlockBuilder::add(const KeySlice& key, const Slice& value, ValueType type) {
     auto offset = this->data_.size();
-    this->offsets_.push_back(offset);
-    
-    auto overlap = key.compute_overlap(this->first_key_);
-    this->data_.push(overlap, sizeof(u16));
-    this->data_.push(key.size() - overlap, sizeof(u16));
-    this->data_.instream(key.data() + overlap, key.size() - overlap);
-    this->data_.push(key.get_ts(), sizeof(u64));
+    auto& internal_key = this->key_buf_;
+    encode_internal_key(key, key.get_ts(), internal_key);
+
+    size_t shared = 0;
+    if (this->num_of_keys_ % this->restart_interval_ == 0) {
+        this->restarts_.push_back(offset);
+    } else {
+        auto limit = std::min(internal_key.size(), this->last_key_.size());
+        while (shared < limit && internal_key[shared] == this->last_key_[shared]) {
+            shared++;
+        }
+    }
+
+    this->data_.push(shared, sizeof(u16));
+    this->data_.push(internal_key.size() - shared, sizeof(u16));
     this->data_.push(value.size(), sizeof(u16));
+    this->data_.push(static_cast<u8>(type), sizeof(u8));
+    this->data_.instream(internal_key.data() + shared, internal_key.size() - shared);
     this->data_.instream(value.data(), value.size());
 
-    // set the first valid key as the first key
-    if (this->first_key_.empty()) {
+    if (!this->num_of_keys_) {
         this->first_key_ = key;
     }
+    this->last_key_.swap(internal_key);
+    this->num_of_keys_++;
 
-    if (this->estimated_size() > this->block_size_) {
+    if (this->estimated_size() > this->block_size_ || this->data_.size() > UINT16_MAX) {
         return false;
     }
 
@@ -123,12 +195,25 @@ shared_ptr<BlockIterator> Block::create_iterator(size_t idx) {
 }
 
 bool BlockBuilder::is_empty() {
-    return this->offsets_.size() == 0;
+    return this->num_of_keys_ == 0;
 }
 
-shared_ptr<Block> BlockBuilder::build() {
+Bytes BlockBuilder::serialize() {
     DCHECK(!this->is_empty());
-    return make_shared<Block>(this->data_, this->offsets_, this->first_key_);
+    auto buf = this->data_;
+    buf.reserve(this->estimated_size());
+    for (auto offset : this->restarts_) {
+        buf.push(offset, sizeof(u16));
+    }
+    buf.push(this->restarts_.size(), sizeof(u16));
+    buf.push(this->restart_interval_, sizeof(u16));
+    buf.push(this->num_of_keys_, sizeof(u16));
+    buf.push(BLOCK_FORMAT_VERSION, sizeof(u16));
+    return buf;
+}
+
+shared_ptr<Block> BlockBuilder::build() {
+    return make_shared<Block>(this->serialize());
 }
 
 KeySlice BlockBuilder::first_key() {
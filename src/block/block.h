@@ -12,6 +12,7 @@
 #include "mvcc/key.h"
 #include <cstddef>
 #include <memory>
+#include <optional>
 #include <type_traits>
 
 namespace minilsm {
@@ -21,54 +22,153 @@ using std::shared_ptr;
 
 /* 
  * block format:
- * ------------------------------------------------------------------------------------------------------------------------
- * |             Data Section             |                       Offset Section                   |         Extra        |
- * ------------------------------------------------------------------------------------------------------------------------
- * | Entry #1 | Entry #2 | ... | Entry #N | Offset #1 (2B) | Offset #2 (2B) | ... | Offset #N (2B) | num_of_elements (2B) |
- * ------------------------------------------------------------------------------------------------------------------------
+ * --------------------------------------------------------------------------------------------------------------------
+ * |        Data Section        |            Restart Section             |                    Extra                   |
+ * --------------------------------------------------------------------------------------------------------------------
+ * | Entry #1 | ... | Entry #N | Restart #1 (2B) | ... | Restart #R (2B) | num_of_restarts (2B) | restart_interval (2B) |
+ * |                            |                                        | num_of_elements (2B) | version (2B)          |
+ * --------------------------------------------------------------------------------------------------------------------
+ * every `restart_interval`-th entry is a restart point, which stores its key in full and whose offset is recorded 
+ * in the restart section. `version` has its high bit set, so it can never be taken for the element count that
+ * closed the retired offset-array format.
  */
 
 /*
  * entry format:
- * -----------------------------------------------------------------------------------------------------------------------
- * |                                                   Entry #1                                                    | ... |
- * -----------------------------------------------------------------------------------------------------------------------
- * | key_len (overlap, 2B) | key_len (rest, 2B) | key (rest) | timestamp (8B) | value_len (2B) | value (value_len) | ... |
- * -----------------------------------------------------------------------------------------------------------------------
+ * -----------------------------------------------------------------------------------------------------------
+ * |                                                 Entry #1                                          | ... |
+ * -----------------------------------------------------------------------------------------------------------
+ * | key_len (shared, 2B) | key_len (rest, 2B) | value_len (2B) | type (1B) | key (rest) | value (value_len) | ... |
+ * -----------------------------------------------------------------------------------------------------------
+ * keys are stored as internal keys (see `encode_internal_key`), which carry the timestamp. `shared` is the
+ * length of the prefix shared with the previous key, always 0 at restart points. `type` is a `ValueType`, point
+ * tombstones have an empty value. entries are sorted by `compare_internal`: keys ascending, the versions of a
+ * key from the newest timestamp to the oldest, so the block is searched with plain memcmp.
  */
 
+static constexpr u16 BLOCK_FORMAT_VERSION = 0x8000 | 4;
+
+// every entry starts within the first 64KB, as addressed by the 2B restart
+// offsets, so a block ends at most one entry past it
+static constexpr size_t MAX_ENTRY_SIZE = 3 * sizeof(u16) + sizeof(u8) + 2 * UINT16_MAX;
+static constexpr size_t MAX_BLOCK_SIZE = UINT16_MAX + MAX_ENTRY_SIZE + (4 + UINT16_MAX) * sizeof(u16);
+
 class BlockIterator;
 
+// entry decoded in place, all pointers refer to the buffer of the block
+struct BlockEntry {
+    // length of the prefix shared with the previous key
+    u16 shared_len;
+    // length and bytes of the remaining internal key
+    u16 rest_len;
+    const u8* rest;
+    u16 value_len;
+    ValueType type;
+    const u8* value;
+    // offset of the following entry
+    size_t next;
+};
+
 class Block : public std::enable_shared_from_this<Block> {
+private:
+    // encoded block owned by the block itself, empty when borrowed
+    Bytes owned_;
+    // keeps borrowed memory (e.g. a mapped file) alive
+    shared_ptr<const void> holder_;
+    // encoded block, decoded lazily and in place
+    const u8* data_;
+    size_t size_;
+    // start of the restart section in `data_`
+    size_t restarts_begin_;
+    size_t num_of_restarts_;
+    size_t restart_interval_;
+    // number of entries
+    size_t num_of_keys_;
+
 public:
-    // data section
-    Bytes data;
-    // offset section
-    vector<u16> offsets;
-    // first key
-    KeySlice first_key;
+    // first key, viewing the first entry of `data_`
+    KeyView first_key;
 
 public:
-    Block(const Bytes& data, 
-            const vector<u16>& offsets, 
-            const KeySlice& first_key) :
-        data(data), 
-        offsets(offsets), 
-        first_key(first_key) {}
+    // take over an encoded block without copying
+    Block(Bytes&& buf);
+
+    // borrow `size` encoded bytes at `data`, which stay valid as long as
+    // `holder` is alive
+    Block(const u8* data, size_t size, shared_ptr<const void> holder);
 
     // deserialize from Bytes
-    Block(const Bytes& buf);
+    Block(const Bytes& buf) : Block(Bytes(buf)) {}
+
+    // whether `size` bytes at `data` frame a block of the current format,
+    // blocks read from disk are checked before being decoded
+    static bool is_valid_encoding(const u8* data, size_t size);
+
+    Block(const Block&) = delete;
+
+    Block& operator=(const Block&) = delete;
 
     // serialize to Bytes
     Bytes serialize();
 
     // get the key according to `idx`
     KeySlice get_key(size_t idx);
+
+    // decode the entry starting at `offset` without copying
+    BlockEntry decode_entry(size_t offset) const {
+        auto ptr = this->data_ + offset;
+        BlockEntry entry;
+        entry.shared_len = decode_u16(ptr); ptr += sizeof(u16);
+        entry.rest_len = decode_u16(ptr); ptr += sizeof(u16);
+        entry.value_len = decode_u16(ptr); ptr += sizeof(u16);
+        entry.type = ValueType(*ptr); ptr += sizeof(u8);
+        entry.rest = ptr; ptr += entry.rest_len;
+        entry.value = ptr; ptr += entry.value_len;
+        entry.next = ptr - this->data_;
+        return entry;
+    }
+
+    // offset of the `idx`-th restart point
+    size_t restart_offset(size_t idx) const {
+        DCHECK(idx < this->num_of_restarts_);
+        return decode_u16(this->data_ + this->restarts_begin_ + idx * sizeof(u16));
+    }
+
+    size_t restart_interval() const { return this->restart_interval_; }
+
+    // rebuild the internal key of `entry` from the internal key `prev`
+    // preceding it. keys of restart points are viewed in place, others are
+    // assembled in `key_buf`, which `prev` may point into.
+    static SliceView rebuild_key(const BlockEntry& entry, const SliceView& prev, vector<u8>& key_buf) {
+        if (!entry.shared_len) {
+            return SliceView(entry.rest, entry.rest_len);
+        }
+        DCHECK(entry.shared_len <= prev.size());
+        if (prev.data() == key_buf.data()) {
+            key_buf.resize(entry.shared_len);
+        } else {
+            key_buf.assign(prev.data(), prev.data() + entry.shared_len);
+        }
+        key_buf.insert(key_buf.end(), entry.rest, entry.rest + entry.rest_len);
+        return SliceView(key_buf.data(), key_buf.size());
+    }
     
     // locate the position of the last key less or equal to `key` in the block.
     // the result will be tuned according to extra limitations such as whether 
-    // the key is start/end of scanning, or the key can be included.
-    size_t locate_key(const KeySlice& key, bool contains = true, bool start = true);
+    // the key is start/end of scanning, or the key can be included. the
+    // versions of a key are never split: a start position is the newest
+    // version of the key, an end position follows its oldest one or
+    // precedes its newest one.
+    size_t locate_key(const SliceView& key, bool contains = true, bool start = true);
+
+    // value of the newest version of `key` whose timestamp is not greater 
+    // than `ts`, viewing the memory of the block. nullopt when absent. the
+    // timestamp and the type of the found version are stored to
+    // `version_ts` and `type` if given, a point tombstone is found with an
+    // empty value. the newer versions are skipped without being decoded
+    // unless they share a restart interval with the found one.
+    std::optional<SliceView> get(const SliceView& key, u64 ts = UINT64_MAX, u64* version_ts = nullptr,
+        ValueType* type = nullptr);
 
     // number of keys in current block
     size_t num_of_keys();
@@ -76,51 +176,71 @@ public:
     // create a iterator starting from the `idx` key
     shared_ptr<BlockIterator> create_iterator(size_t idx = 0);
 
+    // bytes held by the block, charged against the block cache
+    size_t memory_usage();
+
 #ifdef Debug
     bool debug_equal(const Block& other) {
-        if (this->data.size() != other.data.size()) { return false; }
-        if (this->offsets.size() != other.offsets.size()) { return false; }
-        for (size_t i = 0; i < this->data.size(); i++) {
-            if (this->data.get(i) != other.data.get(i)) {
-                return false;
-            }
-        }
-        for (size_t i = 0; i < this->offsets.size(); i++) {
-            if (this->offsets[i] != other.offsets[i]) {
-                return false;
-            }
-        }
-        return true;
+        if (this->size_ != other.size_) { return false; }
+        return !memcmp(this->data_, other.data_, this->size_);
     }
 #endif
+
+private:
+    // parse the extra section and the first key
+    void init();
+
+    // index of the first entry not less than the version `ts` of `key`
+    // (greater with `after`) in the internal order, the number of entries
+    // if there is none. the entry and its key are stored to `found` and
+    // `found_key` if given, the key stays valid until the next seek of the
+    // thread.
+    size_t seek(const SliceView& key, u64 ts, bool after, BlockEntry* found = nullptr,
+        KeyView* found_key = nullptr);
 };
 
 class BlockBuilder {
 private:
-    // offset vector before encoded
-    vector<u16> offsets_;
-    // block data after encoded
+    // offsets of restart points
+    vector<u16> restarts_;
+    // entries after encoded
     Bytes data_;
     // targeted block size
-    size_t block_size_;
+    size_t block_size_ = 0;
+    // distance between restart points
+    size_t restart_interval_ = DEFAULT_RESTART_INTERVAL;
+    // number of entries
+    size_t num_of_keys_ = 0;
     // first key in block
     KeySlice first_key_;
+    // internal key of the previous entry, the base of the next delta
+    vector<u8> last_key_;
+    // internal key of the entry being added
+    vector<u8> key_buf_;
 
 public:
+    static constexpr size_t DEFAULT_RESTART_INTERVAL = 16;
+
     BlockBuilder() = default;
 
-    BlockBuilder(size_t block_size) : block_size_(block_size) {}
+    BlockBuilder(size_t block_size, size_t restart_interval = DEFAULT_RESTART_INTERVAL) : 
+        block_size_(block_size),
+        restart_interval_(restart_interval) {}
 
     // estimated size of current block, which can be slightly exceed 
     // the `block_size`
     size_t estimated_size();
 
     // add `key` and `value` pair into block until first exceed the 
-    // `block_size`
-    bool add(const KeySlice& key, const Slice& value);
+    // `block_size` or the 64KB the restart offsets address, keys are added
+    // in the order of `compare_internal`
+    bool add(const KeySlice& key, const Slice& value, ValueType type = ValueType::VALUE);
 
     bool is_empty() ;
 
+    // encode the entries added so far
+    Bytes serialize();
+
     // build a shared pointer pointing to a new block
     shared_ptr<Block> build();
 
@@ -130,4 +250,4 @@ public:
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,134 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-19 15:20:36
+ * @Description: implementation of index block
+ */
+
+#include "block/index.h"
+#include <algorithm>
+
+namespace minilsm {
+
+IndexBlock::IndexBlock(Bytes&& buf) : data_(std::move(buf)) {
+    auto size = this->data_.size();
+    DCHECK(size >= 3 * sizeof(u32));
+    this->num_of_entries_ = this->data_.get(size - sizeof(u32), sizeof(u32));
+    this->restart_interval_ = this->data_.get(size - 2 * sizeof(u32), sizeof(u32));
+    this->num_of_restarts_ = this->data_.get(size - 3 * sizeof(u32), sizeof(u32));
+    this->restarts_begin_ = size - 3 * sizeof(u32) - this->num_of_restarts_ * sizeof(u32);
+    DCHECK(this->num_of_entries_ > 0);
+}
+
+SliceView IndexBlock::restart_key(size_t idx) const {
+    auto ptr = this->data_.outstream(this->restart_offset(idx));
+    DCHECK(!decode_u16(ptr));
+    return SliceView(ptr + 2 * sizeof(u16), decode_u16(ptr + sizeof(u16)));
+}
+
+size_t IndexBlock::locate(const SliceView& key) const {
+    // last restart point whose separator is less than `key`, the entries
+    // before it all end before `key`
+    size_t low = 0;
+    size_t high = this->num_of_restarts_;
+    while (low + 1 < high) {
+        auto mid = low + (high - low) / 2;
+        if (this->restart_key(mid).compare(key) < 0) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    IndexCursor cursor(this, low * this->restart_interval_);
+    for (; cursor.is_valid(); cursor.next()) {
+        if (cursor.entry().separator.compare(key) >= 0) { break; }
+    }
+    return cursor.idx();
+}
+
+IndexCursor::IndexCursor(const IndexBlock* index, size_t idx) : index_(index), idx_(0) {
+    if (idx >= index->num_of_entries_) {
+        this->idx_ = index->num_of_entries_;
+        return;
+    }
+    auto restart = idx / index->restart_interval_;
+    this->seek_restart(restart);
+    while (this->idx_ < idx) { this->next(); }
+}
+
+void IndexCursor::seek_restart(size_t restart) {
+    this->idx_ = restart * this->index_->restart_interval_;
+    this->next_offset_ = this->index_->restart_offset(restart);
+    this->decode();
+}
+
+void IndexCursor::next() {
+    DCHECK(this->is_valid());
+    if (++this->idx_ < this->index_->num_of_entries_) {
+        this->decode();
+    }
+}
+
+void IndexCursor::decode() {
+    auto base = this->index_->data_.outstream();
+    auto ptr = base + this->next_offset_;
+
+    auto shared = decode_u16(ptr); ptr += sizeof(u16);
+    auto rest_len = decode_u16(ptr); ptr += sizeof(u16);
+    auto rest = ptr; ptr += rest_len;
+    if (!shared) {
+        this->entry_.separator = SliceView(rest, rest_len);
+    } else {
+        // the previous separator may view the index or `key_buf_`
+        DCHECK(shared <= this->entry_.separator.size());
+        if (this->entry_.separator.data() == this->key_buf_.data()) {
+            this->key_buf_.resize(shared);
+        } else {
+            auto prev = this->entry_.separator.data();
+            this->key_buf_.assign(prev, prev + shared);
+        }
+        this->key_buf_.insert(this->key_buf_.end(), rest, rest + rest_len);
+        this->entry_.separator = SliceView(this->key_buf_.data(), this->key_buf_.size());
+    }
+    this->entry_.block_offset = decode_u32(ptr); ptr += sizeof(u32);
+    this->next_offset_ = ptr - base;
+}
+
+void IndexBlockBuilder::add(const SliceView& separator, size_t block_offset) {
+    DCHECK(block_offset <= UINT32_MAX);
+    size_t shared = 0;
+    if (this->num_of_entries_ % this->restart_interval_ == 0) {
+        this->restarts_.push_back(this->data_.size());
+    } else {
+        auto limit = std::min(separator.size(), this->prev_key_.size());
+        while (shared < limit && separator.data()[shared] == this->prev_key_[shared]) {
+            shared++;
+        }
+    }
+    this->data_.push(shared, sizeof(u16));
+    this->data_.push(separator.size() - shared, sizeof(u16));
+    this->data_.instream(separator.data() + shared, separator.size() - shared);
+    this->data_.push(block_offset, sizeof(u32));
+
+    this->prev_key_.assign(separator.data(), separator.data() + separator.size());
+    this->num_of_entries_++;
+}
+
+size_t IndexBlockBuilder::estimated_size() const {
+    return this->data_.size()                       /* entry section */
+        + this->restarts_.size() * sizeof(u32)      /* restart section */
+        + 3 * sizeof(u32);                          /* extra */
+}
+
+void IndexBlockBuilder::serialize(Bytes& buf) const {
+    DCHECK(!this->is_empty());
+    buf.instream(this->data_.outstream(), this->data_.size());
+    for (auto offset : this->restarts_) {
+        buf.push(offset, sizeof(u32));
+    }
+    buf.push(this->restarts_.size(), sizeof(u32));
+    buf.push(this->restart_interval_, sizeof(u32));
+    buf.push(this->num_of_entries_, sizeof(u32));
+}
+
+}
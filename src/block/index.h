@@ -0,0 +1,143 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-19 15:20:36
+ * @Description: prefix-compressed index block of sstables
+ */
+#ifndef BLOCK_INDEX_H
+#define BLOCK_INDEX_H
+
+#include "defs.h"
+#include "slice.h"
+#include "mvcc/key.h"
+#include "util/bytes.h"
+#include <memory>
+#include <vector>
+
+namespace minilsm {
+
+using std::vector;
+
+/*
+ * index block format:
+ * ------------------------------------------------------------------------------------------------------------
+ * |       Entry Section       |            Restart Section             |                  Extra                |
+ * ------------------------------------------------------------------------------------------------------------
+ * | Entry #1 | ... | Entry #N | Restart #1 (4B) | ... | Restart #R (4B) | num_of_restarts (4B)                 |
+ * |                           |                                        | restart_interval (4B) | num_of_entries (4B) |
+ * ------------------------------------------------------------------------------------------------------------
+ * one entry per data block:
+ * ------------------------------------------------------------------------------------
+ * | shared (2B) | rest_len (2B) | separator (rest) | block_offset (4B) |
+ * ------------------------------------------------------------------------------------
+ * the separator of a block is a user key not less than the last key of the block and not greater than the first
+ * key of the next one. it shares `shared` bytes with the separator of the previous block, 0 at restart points.
+ * offsets are 4 bytes wide, so that the index of a large sstable is not limited to 64KB like data blocks.
+ */
+
+// block described by an index entry, the separator views the index or the
+// buffer of the cursor decoding it
+struct IndexEntry {
+    SliceView separator;
+    size_t block_offset;
+};
+
+class IndexBlock {
+private:
+    Bytes data_;
+    // start of the restart section in `data_`
+    size_t restarts_begin_;
+    size_t num_of_restarts_;
+    size_t restart_interval_;
+    size_t num_of_entries_;
+
+    friend class IndexCursor;
+
+public:
+    // take over an encoded index without copying
+    IndexBlock(Bytes&& buf);
+
+    IndexBlock(const IndexBlock&) = delete;
+
+    IndexBlock& operator=(const IndexBlock&) = delete;
+
+    size_t num_of_entries() const { return this->num_of_entries_; }
+
+    // index of the first block whose separator is not less than `key`, the
+    // only block which may hold the first version of `key`.
+    // `num_of_entries` if every block ends before `key`.
+    size_t locate(const SliceView& key) const;
+
+    // bytes held by the index, charged against the block cache
+    size_t memory_usage() const { return sizeof(IndexBlock) + this->data_.size(); }
+
+private:
+    size_t restart_offset(size_t idx) const {
+        DCHECK(idx < this->num_of_restarts_);
+        return decode_u32(this->data_.outstream(this->restarts_begin_ + idx * sizeof(u32)));
+    }
+
+    // separator of the restart point `idx`, stored in full
+    SliceView restart_key(size_t idx) const;
+};
+
+// sequential decoder of index entries, separators are rebuilt into a buffer
+// owned by the cursor and stay valid until the next move
+class IndexCursor {
+private:
+    const IndexBlock* index_;
+    size_t idx_;
+    // offset of the entry following the current one
+    size_t next_offset_;
+    IndexEntry entry_;
+    vector<u8> key_buf_;
+
+public:
+    // positioned at the `idx`-th entry, `index` must outlive the cursor
+    IndexCursor(const IndexBlock* index, size_t idx = 0);
+
+    bool is_valid() const { return this->idx_ < this->index_->num_of_entries_; }
+
+    size_t idx() const { return this->idx_; }
+
+    const IndexEntry& entry() const { return this->entry_; }
+
+    void next();
+
+private:
+    void seek_restart(size_t restart);
+
+    // decode the entry at `next_offset_` as the current one
+    void decode();
+};
+
+class IndexBlockBuilder {
+private:
+    // offsets of restart points
+    vector<u32> restarts_;
+    Bytes data_;
+    size_t restart_interval_;
+    size_t num_of_entries_ = 0;
+    // the previous separator, the base of the next delta
+    vector<u8> prev_key_;
+
+public:
+    static constexpr size_t DEFAULT_RESTART_INTERVAL = 16;
+
+    IndexBlockBuilder(size_t restart_interval = DEFAULT_RESTART_INTERVAL) :
+        restart_interval_(restart_interval) {}
+
+    // add the block at `block_offset` ending at `separator`, blocks are
+    // added in key order
+    void add(const SliceView& separator, size_t block_offset);
+
+    bool is_empty() const { return !this->num_of_entries_; }
+
+    size_t estimated_size() const;
+
+    // append the encoded index to `buf`
+    void serialize(Bytes& buf) const;
+};
+
+}
+
+#endif
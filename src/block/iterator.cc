@@ -9,32 +9,29 @@
 
 namespace minilsm {
 
-KeySlice BlockIterator::key() const {
-    auto offset = this->block_ptr_->offsets[this->current_];
-    auto overlap_len = this->block_ptr_->data.get(offset, sizeof(u16));
-    auto rest_len = this->block_ptr_->data.get(offset + sizeof(u16), sizeof(u16));
-    auto key = KeySlice(
-        overlap_len + rest_len, 
-        this->first_key_.data(),
-        overlap_len,
-        this->block_ptr_->data.outstream(offset + sizeof(u16) * 2),
-        rest_len
-    );
-    key.set_ts(this->block_ptr_->data.get(offset + sizeof(u16) * 2 + rest_len, sizeof(u64)));
-    return key;
-}
-
-Slice BlockIterator::value() const {
-    auto offset = this->block_ptr_->offsets[this->current_];
-    auto key_rest_len = this->block_ptr_->data.get(offset + sizeof(u16), sizeof(u16));
-    auto value_offset = offset + sizeof(u16) + sizeof(u16) + key_rest_len + sizeof(u64);
-    auto value_len = this->block_ptr_->data.get(value_offset, sizeof(u16));
-    Slice value(this->block_ptr_->data.outstream(value_offset + sizeof(u16)), value_len);
-    return value;
+KeyView BlockIterator::key_view() const {
+    DCHECK(this->is_valid());
+    return decode_internal_key(this->key_);
+}
+
+SliceView BlockIterator::internal_key() const {
+    DCHECK(this->is_valid());
+    return this->key_;
+}
+
+SliceView BlockIterator::value_view() const {
+    DCHECK(this->is_valid());
+    return this->value_;
+}
+
+ValueType BlockIterator::value_type() const {
+    DCHECK(this->is_valid());
+    return this->value_type_;
 }
 
 bool BlockIterator::is_valid() const { 
-    if (this->current_ >= this->block_ptr_->offsets.size()) { 
+    // a block that could not be read has no entries
+    if (!this->block_ptr_ || this->current_ >= this->block_ptr_->num_of_keys()) { 
         return false;
     }
     return true;
@@ -43,10 +40,34 @@ bool BlockIterator::is_valid() const {
 void BlockIterator::next() {
     DCHECK(this->is_valid());
     this->current_++;
+    this->decode();
 }
 
 size_t BlockIterator::num_active_iterators() {
     return this->is_valid();
 }
 
-}
\ No newline at end of file
+void BlockIterator::seek(size_t idx) {
+    if (!this->is_valid()) { return; }
+
+    auto interval = this->block_ptr_->restart_interval();
+    this->current_ = idx / interval * interval;
+    this->next_offset_ = this->block_ptr_->restart_offset(idx / interval);
+    this->decode();
+    while (this->current_ < idx) {
+        this->current_++;
+        this->decode();
+    }
+}
+
+void BlockIterator::decode() {
+    if (!this->is_valid()) { return; }
+
+    auto entry = this->block_ptr_->decode_entry(this->next_offset_);
+    this->key_ = Block::rebuild_key(entry, this->key_, this->key_buf_);
+    this->value_ = SliceView(entry.value, entry.value_len);
+    this->value_type_ = entry.type;
+    this->next_offset_ = entry.next;
+}
+
+}
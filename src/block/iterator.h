@@ -24,8 +24,15 @@ private:
     shared_ptr<Block> block_ptr_;
     // current index of the iterator
     size_t current_;
-    // first key in the block
-    KeySlice first_key_;
+    // offset of the entry following the current one
+    size_t next_offset_;
+    // internal key and value of the current entry
+    SliceView key_;
+    SliceView value_;
+    ValueType value_type_;
+    // keys sharing a prefix with the previous key are rebuilt here, the 
+    // buffer is reused across entries
+    vector<u8> key_buf_;
 
     friend class LevelIterator;
     friend class SSTableIterator;
@@ -34,20 +41,32 @@ public:
 
     BlockIterator(shared_ptr<Block> block_ptr, size_t idx) : 
             block_ptr_(block_ptr),
-            current_(idx),
-            first_key_(block_ptr_->first_key) {}
+            current_(idx) {
+        this->seek(idx);
+    }
 
-    KeySlice key() const override;
+    KeyView key_view() const override;
 
-    Slice value() const override;
+    SliceView internal_key() const override;
+
+    SliceView value_view() const override;
+
+    ValueType value_type() const override;
 
     bool is_valid() const override;
 
     void next() override;
 
     size_t num_active_iterators() override;
+
+private:
+    // position at the `idx`-th entry, starting from the closest restart point
+    void seek(size_t idx);
+
+    // decode the entry at `next_offset_` as the current one
+    void decode();
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,280 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-28 10:17:42
+ * @Description: implementation of range tombstones
+ */
+
+#include "block/range_del.h"
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <optional>
+
+namespace minilsm {
+
+Slice key_before(const Slice& key) {
+    DCHECK(!key.empty());
+    vector<u8> buf(key.data(), key.data() + key.size());
+    // 0x00.. is preceded by the largest key one byte shorter, 0xff..
+    auto i = buf.size();
+    while (i > 0 && !buf[i - 1]) { buf[--i] = 0xff; }
+    if (i) {
+        buf[i - 1]--;
+    } else {
+        buf.pop_back();
+    }
+    return Slice(buf.data(), buf.size());
+}
+
+Slice key_after(const Slice& key) {
+    vector<u8> buf(key.data(), key.data() + key.size());
+    // 0xff.. is followed by the smallest key one byte longer, 0x00..
+    auto i = buf.size();
+    while (i > 0 && buf[i - 1] == 0xff) { buf[--i] = 0; }
+    if (i) {
+        buf[i - 1]++;
+    } else {
+        buf.push_back(0);
+    }
+    return Slice(buf.data(), buf.size());
+}
+
+std::optional<Slice> resolve(const std::optional<SliceView>& value, u64 version_ts, ValueType type,
+        const RangeTombstone* tombstone, u64 read_ts, bool* deleted) {
+    // a range tombstone deletes the versions older than it
+    if (value && !(tombstone && tombstone->deletes(version_ts, read_ts))) {
+        if (type == ValueType::VALUE) { return value->to_slice(); }
+        if (deleted) { *deleted = true; }
+        return std::nullopt;
+    }
+    if (deleted && tombstone && tombstone->newest(read_ts)) { *deleted = true; }
+    return std::nullopt;
+}
+
+// union of two lists of timestamps sorted from the newest
+static vector<u64> merge_timestamps(const vector<u64>& lhs, const vector<u64>& rhs) {
+    vector<u64> res;
+    res.reserve(lhs.size() + rhs.size());
+    std::merge(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), std::back_inserter(res), std::greater<u64>());
+    res.erase(std::unique(res.begin(), res.end()), res.end());
+    return res;
+}
+
+void RangeTombstones::add(const RangeTombstones& other) {
+    if (other.empty()) { return; }
+    auto& lhs = this->tombstones_;
+    auto& rhs = other.tombstones_;
+    RangeTombstones merged;
+    merged.tombstones_.reserve(lhs.size() + rhs.size());
+    // tombstones under the sweep, their first keys move past the parts
+    // already appended
+    std::optional<RangeTombstone> a, b;
+    size_t i = 0, j = 0;
+    while (true) {
+        if (!a && i < lhs.size()) { a = lhs[i++]; }
+        if (!b && j < rhs.size()) { b = rhs[j++]; }
+        if (!a || !b) {
+            if (!a && !b) { break; }
+            merged.append(std::move(a ? *a : *b));
+            a.reset();
+            b.reset();
+            continue;
+        }
+
+        auto cmp = a->first.compare(b->first);
+        if (cmp) {
+            // the part of the tombstone starting first which the other one
+            // does not overlap
+            auto& lo = cmp < 0 ? a : b;
+            auto& hi = cmp < 0 ? b : a;
+            if (lo->last.compare(hi->first) < 0) {
+                merged.append(std::move(*lo));
+                lo.reset();
+            } else {
+                merged.append({lo->first, key_before(hi->first), lo->timestamps});
+                lo->first = hi->first;
+            }
+            continue;
+        }
+
+        // both start at the same key, the shorter one is overlapped as a whole
+        auto last_cmp = a->last.compare(b->last);
+        auto& shorter = last_cmp <= 0 ? a : b;
+        auto& longer = last_cmp <= 0 ? b : a;
+        merged.append({shorter->first, shorter->last, merge_timestamps(a->timestamps, b->timestamps)});
+        if (last_cmp) {
+            longer->first = key_after(shorter->last);
+        } else {
+            longer.reset();
+        }
+        shorter.reset();
+    }
+    this->tombstones_.swap(merged.tombstones_);
+}
+
+void RangeTombstones::append(RangeTombstone&& tombstone) {
+    if (!this->tombstones_.empty()) {
+        auto& back = this->tombstones_.back();
+        if (back.timestamps == tombstone.timestamps && !key_after(back.last).compare(tombstone.first)) {
+            back.last = tombstone.last;
+            return;
+        }
+    }
+    this->tombstones_.push_back(std::move(tombstone));
+}
+
+size_t RangeTombstones::lower_bound(const SliceView& key) const {
+    auto iter = std::lower_bound(this->tombstones_.begin(), this->tombstones_.end(), key,
+        [](const RangeTombstone& tombstone, const SliceView& key) {
+            return SliceView(tombstone.last).compare(key) < 0;
+        });
+    return iter - this->tombstones_.begin();
+}
+
+const RangeTombstone* RangeTombstones::find(const SliceView& key) const {
+    auto idx = this->lower_bound(key);
+    if (idx == this->tombstones_.size()) { return nullptr; }
+    auto& tombstone = this->tombstones_[idx];
+    if (SliceView(tombstone.first).compare(key) > 0) { return nullptr; }
+    return &tombstone;
+}
+
+bool RangeTombstones::covers(const SliceView& first, const SliceView& last) const {
+    // touching tombstones carry different timestamps, a covered range may
+    // span several of them
+    auto idx = this->lower_bound(first);
+    if (idx == this->tombstones_.size() || SliceView(this->tombstones_[idx].first).compare(first) > 0) {
+        return false;
+    }
+    for (; idx < this->tombstones_.size(); idx++) {
+        auto& tombstone = this->tombstones_[idx];
+        if (SliceView(tombstone.last).compare(last) >= 0) { return true; }
+        if (idx + 1 == this->tombstones_.size() ||
+                key_after(tombstone.last).compare(this->tombstones_[idx + 1].first)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+RangeTombstones RangeTombstones::clip(const Bound& lower, const Bound& upper) const {
+    RangeTombstones res;
+    if ((lower.infin_ptr && lower.infin_ptr->inf) || (upper.infin_ptr && !upper.infin_ptr->inf)) {
+        return res;
+    }
+
+    std::optional<Slice> first, last;
+    if (lower.fin_ptr) {
+        auto& key = lower.fin_ptr->key;
+        first = lower.fin_ptr->contains ? key : key_after(key);
+    }
+    if (upper.fin_ptr) {
+        auto& key = upper.fin_ptr->key;
+        // nothing precedes the empty key
+        if (!upper.fin_ptr->contains && key.empty()) { return res; }
+        last = upper.fin_ptr->contains ? key : key_before(key);
+    }
+
+    for (auto idx = first ? this->lower_bound(*first) : 0; idx < this->tombstones_.size(); idx++) {
+        auto tombstone = this->tombstones_[idx];
+        if (last && tombstone.first.compare(*last) > 0) { break; }
+        if (first && tombstone.first.compare(*first) < 0) { tombstone.first = *first; }
+        if (last && tombstone.last.compare(*last) > 0) { tombstone.last = *last; }
+        if (tombstone.first.compare(tombstone.last) <= 0) { res.tombstones_.push_back(tombstone); }
+    }
+    return res;
+}
+
+RangeTombstones RangeTombstones::visible(u64 read_ts) const {
+    RangeTombstones res;
+    for (auto& tombstone : this->tombstones_) {
+        RangeTombstone visible{tombstone.first, tombstone.last, {}};
+        for (auto ts : tombstone.timestamps) {
+            if (ts <= read_ts) { visible.timestamps.push_back(ts); }
+        }
+        if (!visible.timestamps.empty()) { res.append(std::move(visible)); }
+    }
+    return res;
+}
+
+RangeTombstones RangeTombstones::without(u64 ts) const {
+    RangeTombstones res;
+    for (auto& tombstone : this->tombstones_) {
+        RangeTombstone kept{tombstone.first, tombstone.last, {}};
+        for (auto tombstone_ts : tombstone.timestamps) {
+            if (tombstone_ts != ts) { kept.timestamps.push_back(tombstone_ts); }
+        }
+        if (!kept.timestamps.empty()) { res.append(std::move(kept)); }
+    }
+    return res;
+}
+
+RangeTombstones RangeTombstones::compact(u64 oldest_ts, bool bottommost) const {
+    RangeTombstones res;
+    for (auto& tombstone : this->tombstones_) {
+        RangeTombstone compacted{tombstone.first, tombstone.last, {}};
+        for (auto ts : tombstone.timestamps) {
+            if (ts > oldest_ts) {
+                compacted.timestamps.push_back(ts);
+            } else {
+                if (!bottommost) { compacted.timestamps.push_back(ts); }
+                break;
+            }
+        }
+        if (!compacted.timestamps.empty()) { res.append(std::move(compacted)); }
+    }
+    return res;
+}
+
+u64 RangeTombstones::max_ts() const {
+    u64 res = 0;
+    for (auto& tombstone : this->tombstones_) {
+        res = std::max(res, tombstone.timestamps.front());
+    }
+    return res;
+}
+
+void RangeTombstones::encode(Bytes& buf) const {
+    buf.push(this->tombstones_.size(), sizeof(u32));
+    for (auto& tombstone : this->tombstones_) {
+        for (auto key : {&tombstone.first, &tombstone.last}) {
+            DCHECK(key->size() <= std::numeric_limits<u16>::max());
+            buf.push(key->size(), sizeof(u16));
+            buf.instream(key->data(), key->size());
+        }
+        DCHECK(tombstone.timestamps.size() <= std::numeric_limits<u16>::max());
+        buf.push(tombstone.timestamps.size(), sizeof(u16));
+        for (auto ts : tombstone.timestamps) { buf.push(ts, sizeof(u64)); }
+    }
+}
+
+bool RangeTombstones::decode(const u8* src, size_t len, size_t& pos) {
+    this->tombstones_.clear();
+    if (pos + sizeof(u32) > len) { return false; }
+    auto num_of_tombstones = decode_u32(src + pos);
+    pos += sizeof(u32);
+    for (u32 i = 0; i < num_of_tombstones; i++) {
+        RangeTombstone tombstone;
+        for (auto key : {&tombstone.first, &tombstone.last}) {
+            if (pos + sizeof(u16) > len) { return false; }
+            auto key_len = decode_u16(src + pos);
+            pos += sizeof(u16);
+            if (pos + key_len > len) { return false; }
+            *key = Slice(src + pos, key_len);
+            pos += key_len;
+        }
+        if (pos + sizeof(u16) > len) { return false; }
+        auto num_of_ts = decode_u16(src + pos);
+        pos += sizeof(u16);
+        if (!num_of_ts || pos + num_of_ts * sizeof(u64) > len) { return false; }
+        for (u16 j = 0; j < num_of_ts; j++) {
+            tombstone.timestamps.push_back(decode_u64(src + pos));
+            pos += sizeof(u64);
+        }
+        this->tombstones_.push_back(std::move(tombstone));
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,164 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-28 10:17:42
+ * @Description: range tombstones of memtables and sstables
+ */
+#ifndef BLOCK_RANGE_DEL_H
+#define BLOCK_RANGE_DEL_H
+
+#include "defs.h"
+#include "mvcc/key.h"
+#include "slice.h"
+#include "util/bytes.h"
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace minilsm {
+
+using std::vector;
+using std::shared_ptr;
+
+// keys are ordered by length first, so every key has an exact neighbour on
+// both sides: the half-open range `[begin, end)` holds the same keys as
+// `[begin, key_before(end)]`. `key` must not be empty for `key_before`.
+Slice key_before(const Slice& key);
+
+Slice key_after(const Slice& key);
+
+// deletes the versions of the keys from `first` to `last` (both included)
+// older than the deletion. every deletion of the range is kept by its
+// timestamp, from the newest to the oldest, so that snapshots older than
+// the newest deletion still see what the older ones left.
+struct RangeTombstone {
+    Slice first;
+    Slice last;
+    vector<u64> timestamps;
+
+    // newest deletion a read at `read_ts` sees, nullopt if there is none
+    std::optional<u64> newest(u64 read_ts) const {
+        for (auto ts : this->timestamps) {
+            if (ts <= read_ts) { return ts; }
+        }
+        return std::nullopt;
+    }
+
+    // whether a read at `read_ts` sees a deletion of the version `ts`
+    bool deletes(u64 ts, u64 read_ts) const {
+        auto newest = this->newest(read_ts);
+        return newest && *newest > ts;
+    }
+};
+
+// result of a read at `read_ts` given the newest version of the key it sees
+// (`value` written at `version_ts` with `type`, none if absent) and the
+// tombstone covering the key. `deleted` is set when the key is deleted
+// rather than absent.
+std::optional<Slice> resolve(const std::optional<SliceView>& value, u64 version_ts, ValueType type,
+    const RangeTombstone* tombstone, u64 read_ts, bool* deleted);
+
+/*
+ * range tombstones of a table, fragmented into sorted tombstones that do
+ * not overlap. overlapping deletions are split where they overlap, each
+ * fragment carrying the timestamps of the deletions covering it. touching
+ * fragments with the same timestamps are merged.
+ *
+ * encoded as the range-del block of sstables:
+ * --------------------------------------------------------------------------------------------------------
+ * | num_of_tombstones (4B) | first_len (2B) | first | last_len (2B) | last | num_of_ts (2B) | ts (8B) | ... |
+ * --------------------------------------------------------------------------------------------------------
+ */
+class RangeTombstones {
+private:
+    vector<RangeTombstone> tombstones_;
+
+public:
+    RangeTombstones() = default;
+
+    // tombstone deleting `[first, last]` at `ts`
+    RangeTombstones(const Slice& first, const Slice& last, u64 ts = 0) :
+        tombstones_{{first, last, {ts}}} {}
+
+    void add(const Slice& first, const Slice& last, u64 ts = 0) {
+        this->add(RangeTombstones(first, last, ts));
+    }
+
+    void add(const RangeTombstones& other);
+
+    // index of the first tombstone whose last key is not less than `key`
+    size_t lower_bound(const SliceView& key) const;
+
+    // tombstone covering `key`, null if there is none
+    const RangeTombstone* find(const SliceView& key) const;
+
+    // whether every key of `[first, last]` is covered
+    bool covers(const SliceView& first, const SliceView& last) const;
+
+    // parts of the tombstones within the bounds
+    RangeTombstones clip(const Bound& lower, const Bound& upper) const;
+
+    // deletions a read at `read_ts` sees, every covered version of an older
+    // table is deleted for such a read
+    RangeTombstones visible(u64 read_ts) const;
+
+    // every deletion but the one at `ts`
+    RangeTombstones without(u64 ts) const;
+
+    // deletions left once the versions below `oldest_ts` which no snapshot
+    // reads are dropped: only the newest deletion not newer than
+    // `oldest_ts` still matters, and none of them once nothing older is
+    // left below (`bottommost`)
+    RangeTombstones compact(u64 oldest_ts, bool bottommost) const;
+
+    // newest timestamp of the deletions, 0 if there are none
+    u64 max_ts() const;
+
+    size_t size() const { return this->tombstones_.size(); }
+
+    bool empty() const { return this->tombstones_.empty(); }
+
+    const RangeTombstone& operator[](size_t idx) const { return this->tombstones_[idx]; }
+
+    void encode(Bytes& buf) const;
+
+    // decode from `pos` on and move `pos` past the tombstones, returns false
+    // on malformed input
+    bool decode(const u8* src, size_t len, size_t& pos);
+
+private:
+    // append `tombstone`, merging it into the last one when they touch and
+    // carry the same timestamps
+    void append(RangeTombstone&& tombstone);
+};
+
+// looks up keys visited in ascending order, moving forward over the
+// tombstones instead of searching them again for every key
+class RangeTombstoneCursor {
+private:
+    shared_ptr<const RangeTombstones> tombstones_;
+    size_t idx_;
+
+public:
+    RangeTombstoneCursor(shared_ptr<const RangeTombstones> tombstones = nullptr) :
+        tombstones_(tombstones), idx_(0) {}
+
+    // tombstone covering `key`, null if there is none. `key` must not be
+    // less than the keys looked up before.
+    const RangeTombstone* seek(const SliceView& key) {
+        if (!this->tombstones_) { return nullptr; }
+        auto& tombstones = *this->tombstones_;
+        while (this->idx_ < tombstones.size() && SliceView(tombstones[this->idx_].last).compare(key) < 0) {
+            this->idx_++;
+        }
+        if (this->idx_ == tombstones.size() || SliceView(tombstones[this->idx_].first).compare(key) > 0) {
+            return nullptr;
+        }
+        return &tombstones[this->idx_];
+    }
+
+    const shared_ptr<const RangeTombstones>& tombstones() const { return this->tombstones_; }
+};
+
+}
+
+#endif
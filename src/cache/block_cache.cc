@@ -0,0 +1,124 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-09-25 19:31:06
+ * @Description: implementation of block cache
+ */
+
+#include "cache/block_cache.h"
+
+namespace minilsm {
+
+BlockCache::BlockCache(size_t capacity, size_t shard_bits) :
+        capacity_(capacity),
+        shard_bits_(shard_bits),
+        shards_(1ULL << shard_bits) {
+    auto per_shard = (capacity + this->shards_.size() - 1) / this->shards_.size();
+    for (auto& shard : this->shards_) {
+        shard.capacity = per_shard;
+    }
+}
+
+BlockCache::Shard& BlockCache::shard_of(const BlockCacheKey& key) {
+    auto hash = BlockCacheKeyHash()(key);
+    // the low bits are consumed by the hash table of the shard
+    return this->shards_[this->shard_bits_ ? hash >> (64 - this->shard_bits_) : 0];
+}
+
+shared_ptr<Block> BlockCache::lookup(u64 sst_id, u64 block_idx) {
+    DCHECK(block_idx != INDEX_BLOCK_IDX);
+    return std::static_pointer_cast<Block>(this->lookup_entry(BlockCacheKey{sst_id, block_idx}));
+}
+
+void BlockCache::insert(u64 sst_id, u64 block_idx, shared_ptr<Block> block) {
+    DCHECK(block_idx != INDEX_BLOCK_IDX);
+    auto charge = block->memory_usage();
+    this->insert_entry(BlockCacheKey{sst_id, block_idx}, std::move(block), charge);
+}
+
+shared_ptr<IndexBlock> BlockCache::lookup_index(u64 sst_id) {
+    return std::static_pointer_cast<IndexBlock>(
+        this->lookup_entry(BlockCacheKey{sst_id, INDEX_BLOCK_IDX}));
+}
+
+void BlockCache::insert_index(u64 sst_id, shared_ptr<IndexBlock> index) {
+    auto charge = index->memory_usage();
+    this->insert_entry(BlockCacheKey{sst_id, INDEX_BLOCK_IDX}, std::move(index), charge);
+}
+
+shared_ptr<void> BlockCache::lookup_entry(const BlockCacheKey& key) {
+    auto& shard = this->shard_of(key);
+
+    std::lock_guard<mutex> lock(shard.mtx);
+    auto res = shard.table.find(key);
+    if (res == shard.table.end()) {
+        shard.misses++;
+        return nullptr;
+    }
+    shard.hits++;
+    shard.lru.splice(shard.lru.begin(), shard.lru, res->second);
+    return res->second->value;
+}
+
+void BlockCache::insert_entry(const BlockCacheKey& key, shared_ptr<void> value, size_t charge) {
+    auto& shard = this->shard_of(key);
+
+    std::lock_guard<mutex> lock(shard.mtx);
+    if (charge > shard.capacity) { return; }
+
+    auto res = shard.table.find(key);
+    if (res != shard.table.end()) {
+        shard.usage -= res->second->charge;
+        shard.lru.erase(res->second);
+        shard.table.erase(res);
+    }
+
+    while (shard.usage + charge > shard.capacity && !shard.lru.empty()) {
+        auto& victim = shard.lru.back();
+        shard.usage -= victim.charge;
+        shard.table.erase(victim.key);
+        shard.lru.pop_back();
+        shard.evictions++;
+    }
+
+    shard.lru.push_front(Entry{key, std::move(value), charge});
+    shard.table[key] = shard.lru.begin();
+    shard.usage += charge;
+    shard.insertions++;
+}
+
+void BlockCache::erase(u64 sst_id, u64 block_idx) {
+    BlockCacheKey key{sst_id, block_idx};
+    auto& shard = this->shard_of(key);
+
+    std::lock_guard<mutex> lock(shard.mtx);
+    auto res = shard.table.find(key);
+    if (res == shard.table.end()) { return; }
+    shard.usage -= res->second->charge;
+    shard.lru.erase(res->second);
+    shard.table.erase(res);
+}
+
+void BlockCache::clear() {
+    for (auto& shard : this->shards_) {
+        std::lock_guard<mutex> lock(shard.mtx);
+        shard.lru.clear();
+        shard.table.clear();
+        shard.usage = 0;
+    }
+}
+
+BlockCacheStats BlockCache::stats() {
+    BlockCacheStats res;
+    for (auto& shard : this->shards_) {
+        std::lock_guard<mutex> lock(shard.mtx);
+        res.hits += shard.hits;
+        res.misses += shard.misses;
+        res.insertions += shard.insertions;
+        res.evictions += shard.evictions;
+        res.usage += shard.usage;
+        res.entries += shard.lru.size();
+    }
+    return res;
+}
+
+}
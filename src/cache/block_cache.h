@@ -0,0 +1,125 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-09-25 19:31:06
+ * @Description: sharded lru cache for decoded blocks
+ */
+#ifndef CACHE_BLOCK_CACHE_H
+#define CACHE_BLOCK_CACHE_H
+
+#include "defs.h"
+#include "block/block.h"
+#include "block/index.h"
+#include <list>
+#include <unordered_map>
+
+namespace minilsm {
+
+using std::list;
+using std::unordered_map;
+using std::mutex;
+
+// a block is identified by the sstable it belongs to and its index there
+struct BlockCacheKey {
+    u64 sst_id;
+    u64 block_idx;
+
+    bool operator==(const BlockCacheKey& other) const {
+        return this->sst_id == other.sst_id && this->block_idx == other.block_idx;
+    }
+};
+
+struct BlockCacheKeyHash {
+    size_t operator()(const BlockCacheKey& key) const {
+        // 64-bit finalizer of murmur3 over the combined key
+        u64 h = key.sst_id * 0x9E3779B97F4A7C15ULL ^ key.block_idx;
+        h ^= h >> 33; h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33; h *= 0xC4CEB9FE1A85EC53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+};
+
+struct BlockCacheStats {
+    u64 hits = 0;
+    u64 misses = 0;
+    u64 insertions = 0;
+    u64 evictions = 0;
+    // bytes charged by the cached blocks
+    u64 usage = 0;
+    // number of cached blocks
+    u64 entries = 0;
+};
+
+// the capacity is split evenly across `2 ^ shard_bits` shards, each shard
+// is an independent lru list guarded by its own mutex. evicted blocks stay
+// alive as long as some iterator still references them. index blocks of
+// sstables may be cached along with data blocks.
+class BlockCache {
+private:
+    struct Entry {
+        BlockCacheKey key;
+        // `Block`, or `IndexBlock` under `INDEX_BLOCK_IDX`
+        shared_ptr<void> value;
+        size_t charge;
+    };
+
+    struct Shard {
+        mutex mtx;
+        // most recently used at the front
+        list<Entry> lru;
+        unordered_map<BlockCacheKey, list<Entry>::iterator, BlockCacheKeyHash> table;
+        size_t capacity = 0;
+        size_t usage = 0;
+        u64 hits = 0;
+        u64 misses = 0;
+        u64 insertions = 0;
+        u64 evictions = 0;
+    };
+
+    size_t capacity_;
+    size_t shard_bits_;
+    vector<Shard> shards_;
+
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 64 * 1024 * 1024;
+    static constexpr size_t DEFAULT_SHARD_BITS = 4;
+    // block index reserved for the index block of an sstable
+    static constexpr u64 INDEX_BLOCK_IDX = UINT64_MAX;
+
+    BlockCache(size_t capacity = DEFAULT_CAPACITY, size_t shard_bits = DEFAULT_SHARD_BITS);
+
+    BlockCache(const BlockCache&) = delete;
+
+    BlockCache& operator=(const BlockCache&) = delete;
+
+    // returns null on miss
+    shared_ptr<Block> lookup(u64 sst_id, u64 block_idx);
+
+    // insert or replace the block, evicting the least recently used blocks
+    // of the shard until it fits. blocks larger than a shard are not cached.
+    void insert(u64 sst_id, u64 block_idx, shared_ptr<Block> block);
+
+    // returns null on miss
+    shared_ptr<IndexBlock> lookup_index(u64 sst_id);
+
+    void insert_index(u64 sst_id, shared_ptr<IndexBlock> index);
+
+    void erase(u64 sst_id, u64 block_idx);
+
+    void clear();
+
+    size_t capacity() const { return this->capacity_; }
+
+    BlockCacheStats stats();
+
+private:
+    Shard& shard_of(const BlockCacheKey& key);
+
+    shared_ptr<void> lookup_entry(const BlockCacheKey& key);
+
+    void insert_entry(const BlockCacheKey& key, shared_ptr<void> value, size_t charge);
+};
+
+}
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-18 10:02:41
+ * @Description: implementation of table cache
+ */
+
+#include "cache/table_cache.h"
+#include <cstdio>
+
+namespace minilsm {
+
+TableCache::TableCache(size_t capacity, bool use_mmap, shared_ptr<IoBackend> io, size_t shard_bits) :
+        capacity_(std::max<size_t>(capacity, 1)),
+        use_mmap_(use_mmap),
+        io_(io ? io : IoBackend::pread_backend()) {
+    while (shard_bits && (1ULL << shard_bits) > this->capacity_) { shard_bits--; }
+    this->shard_bits_ = shard_bits;
+    this->shards_ = vector<Shard>(1ULL << shard_bits);
+}
+
+TableCache::~TableCache() {
+    this->purge_obsolete();
+}
+
+shared_ptr<FileObject> TableCache::get(u64 id, const string& path) {
+    auto& shard = this->shard_of(id);
+    {
+        std::lock_guard<mutex> lock(shard.mtx);
+        auto res = shard.table.find(id);
+        if (res != shard.table.end()) {
+            shard.hits++;
+            shard.lru.splice(shard.lru.begin(), shard.lru, res->second);
+            return res->second->file;
+        }
+        shard.misses++;
+    }
+
+    // opened without the lock, so that a slow open stalls no other reader
+    auto file = std::make_shared<FileObject>(path, true, this->use_mmap_, this->io_);
+    if (!file->is_open()) {
+        LOG(ERROR) << "failed to open " << path;
+        return nullptr;
+    }
+
+    std::lock_guard<mutex> lock(shard.mtx);
+    // opened by another reader meanwhile
+    auto res = shard.table.find(id);
+    if (res != shard.table.end()) {
+        shard.lru.splice(shard.lru.begin(), shard.lru, res->second);
+        return res->second->file;
+    }
+
+    while (shard.lru.size() >= this->capacity_ >> this->shard_bits_) {
+        shard.table.erase(shard.lru.back().id);
+        shard.lru.pop_back();
+        shard.evictions++;
+    }
+    shard.lru.push_front(Entry{id, file});
+    shard.table[id] = shard.lru.begin();
+    return file;
+}
+
+void TableCache::erase(u64 id) {
+    auto& shard = this->shard_of(id);
+    std::lock_guard<mutex> lock(shard.mtx);
+    auto res = shard.table.find(id);
+    if (res == shard.table.end()) { return; }
+    shard.lru.erase(res->second);
+    shard.table.erase(res);
+}
+
+void TableCache::retire(u64 id, const string& path) {
+    this->erase(id);
+    std::lock_guard<mutex> lock(this->obsolete_mtx_);
+    this->obsolete_.push_back(path);
+}
+
+void TableCache::purge_obsolete() {
+    vector<string> paths;
+    {
+        std::lock_guard<mutex> lock(this->obsolete_mtx_);
+        paths.swap(this->obsolete_);
+    }
+    for (auto& path : paths) { std::remove(path.c_str()); }
+}
+
+TableCacheStats TableCache::stats() {
+    TableCacheStats res;
+    for (auto& shard : this->shards_) {
+        std::lock_guard<mutex> lock(shard.mtx);
+        res.hits += shard.hits;
+        res.misses += shard.misses;
+        res.evictions += shard.evictions;
+        res.entries += shard.lru.size();
+    }
+    return res;
+}
+
+}
@@ -0,0 +1,114 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-18 10:02:41
+ * @Description: lru cache bounding the open files of sstables
+ */
+#ifndef CACHE_TABLE_CACHE_H
+#define CACHE_TABLE_CACHE_H
+
+#include "defs.h"
+#include "sstable/sstable.h"
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace minilsm {
+
+using std::list;
+using std::unordered_map;
+using std::mutex;
+using std::string;
+using std::vector;
+
+struct TableCacheStats {
+    u64 hits = 0;
+    u64 misses = 0;
+    u64 evictions = 0;
+    // number of cached handles
+    u64 entries = 0;
+};
+
+// file handles of sstables keyed by sstable id, at most `capacity` of them
+// are kept open. the decoded meta and bloom filter stay with the sstable,
+// an evicted handle costs a reopen only. evicted handles are closed once
+// the last reader drops them, so the number of open files may exceed the
+// capacity by the reads in flight. the capacity is split across shards
+// guarded by their own mutex, sstable ids are handed out in sequence and
+// their low bits pick the shard.
+class TableCache {
+private:
+    struct Entry {
+        u64 id;
+        shared_ptr<FileObject> file;
+    };
+
+    struct Shard {
+        mutex mtx;
+        // most recently used at the front
+        list<Entry> lru;
+        unordered_map<u64, list<Entry>::iterator> table;
+        u64 hits = 0;
+        u64 misses = 0;
+        u64 evictions = 0;
+    };
+
+    size_t capacity_;
+    size_t shard_bits_;
+    vector<Shard> shards_;
+    // map the opened files instead of reading them with `pread`
+    bool use_mmap_;
+    // backend of the batched reads of the opened files
+    shared_ptr<IoBackend> io_;
+
+    // files of obsolete sstables waiting to be removed
+    mutex obsolete_mtx_;
+    vector<string> obsolete_;
+
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 1000;
+    static constexpr size_t DEFAULT_SHARD_BITS = 4;
+
+    // a capacity below `2 ^ shard_bits` takes fewer shards, so that the
+    // capacity is never exceeded
+    TableCache(size_t capacity = DEFAULT_CAPACITY, bool use_mmap = false,
+        shared_ptr<IoBackend> io = nullptr, size_t shard_bits = DEFAULT_SHARD_BITS);
+
+    TableCache(const TableCache&) = delete;
+
+    TableCache& operator=(const TableCache&) = delete;
+
+    // obsolete files left are removed
+    ~TableCache();
+
+    // handle of the sstable `id`, the file at `path` is opened on a miss.
+    // null if the file fails to open.
+    shared_ptr<FileObject> get(u64 id, const string& path);
+
+    void erase(u64 id);
+
+    // drop the handle of the obsolete sstable `id`, its file at `path` is
+    // removed by the next `purge_obsolete` instead of by the reader which
+    // happens to drop the sstable last
+    void retire(u64 id, const string& path);
+
+    // remove the files of the retired sstables, called by the background
+    // threads
+    void purge_obsolete();
+
+    size_t capacity() const { return this->capacity_; }
+
+    bool use_mmap() const { return this->use_mmap_; }
+
+    const shared_ptr<IoBackend>& io_backend() const { return this->io_; }
+
+    TableCacheStats stats();
+
+private:
+    Shard& shard_of(u64 id) { return this->shards_[id & (this->shards_.size() - 1)]; }
+};
+
+}
+
+#endif
@@ -15,9 +15,23 @@ using std::shared_ptr;
 
 class Iterator {
 public:
-    virtual Slice value() const = 0;
+    // views of the current entry, valid until the iterator moves
+    virtual KeyView key_view() const = 0;
 
-    virtual KeySlice key() const = 0;
+    // the current version as an internal key (see `encode_internal_key`),
+    // which merges compare with a single memcmp
+    virtual SliceView internal_key() const = 0;
+
+    virtual SliceView value_view() const = 0;
+
+    // point tombstones are surfaced by every iterator but the one returned
+    // by scans of the storage
+    virtual ValueType value_type() const = 0;
+
+    // owning copies of the current entry
+    virtual Slice value() const { return this->value_view().to_slice(); }
+
+    virtual KeySlice key() const { return KeySlice(this->key_view()); }
 
     // mark whether the iter reach the end
     virtual bool is_valid() const = 0;
@@ -26,6 +40,8 @@ public:
     virtual void next() = 0;
 
     virtual u64 num_active_iterators() { return 1; }
+
+    virtual ~Iterator() = default;
 };
 }
 
@@ -18,31 +18,43 @@ MergeBinIterator::MergeBinIterator(shared_ptr<Iterator> a, shared_ptr<Iterator>
 bool MergeBinIterator::choose_a() {
     if (!a_ptr_->is_valid()) return false;
     if (!b_ptr_->is_valid()) return true;
-    return a_ptr_->key().compare(b_ptr_->key()) < 0;
+    return compare_internal_keys(a_ptr_->internal_key(), b_ptr_->internal_key()) < 0;
 }
 
 void MergeBinIterator::skip_b() {
     if (this->a_ptr_->is_valid() && this->b_ptr_->is_valid()
-        && !this->a_ptr_->key().compare(this->b_ptr_->key())) {
+        && !compare_internal_keys(this->a_ptr_->internal_key(), this->b_ptr_->internal_key())) {
         this->b_ptr_->next();
     }
 }
 
-KeySlice MergeBinIterator::key() const {
+KeyView MergeBinIterator::key_view() const {
     if (this->choose_a_) {
         DCHECK(this->a_ptr_->is_valid());
-        return this->a_ptr_->key();
+        return this->a_ptr_->key_view();
     } else {
         DCHECK(this->b_ptr_->is_valid());
-        return this->b_ptr_->key();
+        return this->b_ptr_->key_view();
     }
 }
 
-Slice MergeBinIterator::value() const {
+SliceView MergeBinIterator::internal_key() const {
+    return this->choose_a_ ? this->a_ptr_->internal_key() : this->b_ptr_->internal_key();
+}
+
+SliceView MergeBinIterator::value_view() const {
+    if (this->choose_a_) {
+        return this->a_ptr_->value_view();
+    } else {
+        return this->b_ptr_->value_view();
+    }
+}
+
+ValueType MergeBinIterator::value_type() const {
     if (this->choose_a_) {
-        return this->a_ptr_->value();
+        return this->a_ptr_->value_type();
     } else {
-        return this->b_ptr_->value();
+        return this->b_ptr_->value_type();
     }
 }
 
@@ -68,64 +80,100 @@ size_t MergeBinIterator::num_active_iterators() {
     return this->a_ptr_->num_active_iterators() + this->b_ptr_->num_active_iterators();
 }
 
-MergeMultiIterator::MergeMultiIterator(const vector<shared_ptr<Iterator>>& iters) {
-    for (size_t i = 0; i < iters.size(); i++) {
-        if (iters[i]->is_valid()) {
+MergeMultiIterator::MergeMultiIterator(const vector<shared_ptr<Iterator>>& iters) :
+        iters_(iters),
+        keys_(iters.size()),
+        valid_(iters.size()),
+        tree_(iters.size()),
+        num_active_iter_(0) {
+    for (size_t i = 0; i < this->iters_.size(); i++) {
+        this->valid_[i] = this->iters_[i]->is_valid();
+        if (this->valid_[i]) {
+            this->keys_[i] = this->iters_[i]->internal_key();
             this->num_active_iter_++;
-            this->iters_.push(
-                    HeapWrapper{i, iters[i]}
-            );
         }
     }
+    if (!this->tree_.empty()) {
+        this->tree_[0] = this->tree_.size() == 1 ? 0 : this->build(1);
+    }
+}
 
-    this->current_ = this->iters_.top();
-    this->iters_.pop();
+size_t MergeMultiIterator::build(size_t node) {
+    // leaves are numbered from k to 2k - 1
+    auto k = this->iters_.size();
+    if (node >= k) { return node - k; }
+    auto lhs = this->build(node * 2);
+    auto rhs = this->build(node * 2 + 1);
+    if (this->beats(lhs, rhs)) {
+        this->tree_[node] = rhs;
+        return lhs;
+    }
+    this->tree_[node] = lhs;
+    return rhs;
 }
 
-KeySlice MergeMultiIterator::key() const {
-    return this->current_.iterator->key();
+void MergeMultiIterator::advance(size_t idx) {
+    auto& iter = this->iters_[idx];
+    iter->next();
+    this->valid_[idx] = iter->is_valid();
+    if (this->valid_[idx]) {
+        this->keys_[idx] = iter->internal_key();
+    } else {
+        this->num_active_iter_--;
+    }
+}
+
+void MergeMultiIterator::replay(size_t idx) {
+    auto winner = idx;
+    for (auto node = (idx + this->iters_.size()) / 2; node > 0; node /= 2) {
+        if (this->beats(this->tree_[node], winner)) {
+            std::swap(this->tree_[node], winner);
+        }
+    }
+    this->tree_[0] = winner;
 }
 
-Slice MergeMultiIterator::value() const {
-    return this->current_.iterator->value();
+KeyView MergeMultiIterator::key_view() const {
+    DCHECK(this->is_valid());
+    return decode_internal_key(this->keys_[this->tree_[0]]);
+}
+
+SliceView MergeMultiIterator::internal_key() const {
+    DCHECK(this->is_valid());
+    return this->keys_[this->tree_[0]];
+}
+
+SliceView MergeMultiIterator::value_view() const {
+    DCHECK(this->is_valid());
+    return this->iters_[this->tree_[0]]->value_view();
+}
+
+ValueType MergeMultiIterator::value_type() const {
+    DCHECK(this->is_valid());
+    return this->iters_[this->tree_[0]]->value_type();
 }
 
 bool MergeMultiIterator::is_valid() const {
-    return this->current_.iterator->is_valid() || iters_.size();
+    return !this->tree_.empty() && this->valid_[this->tree_[0]];
 }
 
 void MergeMultiIterator::next() {
     DCHECK(this->is_valid());
 
-    auto current_key = this->current_.iterator->key();
-    this->current_.iterator->next();
-    if (this->current_.iterator->is_valid()) {
-        this->iters_.push(this->current_);
-    } else {
-        this->num_active_iter_--;
-    }
+    // the view dies with the move of the winner, keep a copy of its bytes
+    auto winner = this->tree_[0];
+    auto& key = this->keys_[winner];
+    this->last_key_.assign(key.data(), key.data() + key.size());
+    auto last_key = SliceView(this->last_key_.data(), this->last_key_.size());
 
-    while (true) {
-        if (this->iters_.empty()) { break; }
-
-        auto top = this->iters_.top();
-        if (!current_key.compare(top.iterator->key())) {
-            this->iters_.pop();
-            top.iterator->next();
-            if (top.iterator->is_valid()) {
-                this->iters_.push(top);
-            } else {
-                this->num_active_iter_--;
-            }
-        } else {
-            DCHECK(current_key.compare(top.iterator->key()) < 0);
-            break;
-        }
-    }
+    this->advance(winner);
+    this->replay(winner);
 
-    if (!this->iters_.empty()) {
-        this->current_ = this->iters_.top();
-        this->iters_.pop();
+    // the same version in older children loses every tie, so it surfaces next
+    while (this->is_valid() && !compare_internal_keys(this->keys_[this->tree_[0]], last_key)) {
+        winner = this->tree_[0];
+        this->advance(winner);
+        this->replay(winner);
     }
 }
 
@@ -133,4 +181,44 @@ size_t MergeMultiIterator::num_active_iterators() {
     return this->num_active_iter_;
 }
 
-}
\ No newline at end of file
+SnapshotIterator::SnapshotIterator(shared_ptr<Iterator> iter, u64 ts,
+        shared_ptr<const RangeTombstones> tombstones) :
+        iter_(iter), ts_(ts), tombstones_(tombstones) {
+    this->settle();
+}
+
+void SnapshotIterator::next() {
+    DCHECK(this->is_valid());
+    this->skip_key();
+    this->settle();
+}
+
+void SnapshotIterator::skip_key() {
+    // the view dies with the move, keep a copy of its bytes
+    auto key = this->iter_->key_view();
+    this->last_key_.assign(key.data(), key.data() + key.size());
+    auto last_key = SliceView(this->last_key_.data(), this->last_key_.size());
+    do {
+        this->iter_->next();
+    } while (this->iter_->is_valid() && !this->iter_->key_view().compare(last_key));
+}
+
+void SnapshotIterator::settle() {
+    while (this->iter_->is_valid()) {
+        auto key = this->iter_->key_view();
+        // newer than the snapshot
+        if (key.get_ts() > this->ts_) {
+            this->iter_->next();
+            continue;
+        }
+        // the newest visible version, which decides for the whole key
+        auto tombstone = this->tombstones_.seek(key);
+        if (this->iter_->value_type() == ValueType::VALUE &&
+                !(tombstone && tombstone->deletes(key.get_ts(), this->ts_))) {
+            return;
+        }
+        this->skip_key();
+    }
+}
+
+}
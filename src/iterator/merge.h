@@ -7,15 +7,15 @@
 #define ITERATOR_MERGE_H
 
 #include "defs.h"
+#include "block/range_del.h"
 #include "iterator/iterator.h"
 #include "mvcc/key.h"
 #include <cstddef>
 #include <memory>
-#include <queue>
+#include <vector>
 
 namespace minilsm {
 
-using std::priority_queue;
 using std::vector;
 using std::make_shared;
 
@@ -28,9 +28,13 @@ private:
 public:
     MergeBinIterator(shared_ptr<Iterator> a, shared_ptr<Iterator> b);
 
-    KeySlice key() const override;
+    KeyView key_view() const override;
 
-    Slice value() const override;
+    SliceView internal_key() const override;
+
+    SliceView value_view() const override;
+
+    ValueType value_type() const override;
 
     bool is_valid() const override;
 
@@ -45,24 +49,21 @@ private:
 
 };
 
-struct HeapWrapper {
-    size_t idx;
-    shared_ptr<Iterator> iterator = nullptr;
-};
-
-// min heap
-struct HeapComparator {
-    bool operator()(const HeapWrapper& lhs, const HeapWrapper& rhs) {
-        auto res = lhs.iterator->key().compare(rhs.iterator->key());
-        if (res) return res > 0;
-        else return lhs.idx > rhs.idx;
-    }
-};
-
+// k-way merge on a loser tree. `tree_[0]` holds the winner and every 
+// internal node the loser of the match played there, so moving the winner 
+// replays a single leaf-to-root path of about log2(k) comparisons. internal
+// keys of the children are cached as views and refreshed only when a child
+// moves, every comparison is a single memcmp.
 class MergeMultiIterator : public Iterator {
 private:
-    priority_queue<HeapWrapper, vector<HeapWrapper>, HeapComparator> iters_;
-    HeapWrapper current_;
+    vector<shared_ptr<Iterator>> iters_;
+    // cached internal key of every child, meaningless once the child is exhausted
+    vector<SliceView> keys_;
+    vector<bool> valid_;
+    // indexes of the children, see above
+    vector<size_t> tree_;
+    // key of the previous winner, used to skip the same version in older children
+    vector<u8> last_key_;
     size_t num_active_iter_;
 
 public:
@@ -71,15 +72,77 @@ public:
     // data in sstable corresponding to iterator
     MergeMultiIterator(const vector<shared_ptr<Iterator>>& iters);
 
-    KeySlice key() const override;
+    KeyView key_view() const override;
+
+    SliceView internal_key() const override;
 
-    Slice value() const override;
+    SliceView value_view() const override;
+
+    ValueType value_type() const override;
 
     bool is_valid() const override;
 
     void next() override;
 
     size_t num_active_iterators() override;
+
+private:
+    // whether child `a` wins over child `b` in the order of
+    // `compare_internal`, the newer child wins a tie
+    bool beats(size_t a, size_t b) const {
+        if (!this->valid_[a]) { return false; }
+        if (!this->valid_[b]) { return true; }
+        auto res = compare_internal_keys(this->keys_[a], this->keys_[b]);
+        return res ? res < 0 : a < b;
+    }
+
+    // play the matches of the subtree rooted at `node`, returns its winner
+    size_t build(size_t node);
+
+    // move child `idx` forward and refresh its cached key
+    void advance(size_t idx);
+
+    // replay the matches from leaf `idx` up to the root
+    void replay(size_t idx);
+};
+
+// reads `iter`, which yields every version in the order of
+// `compare_internal`, as of timestamp `ts`: only the newest version visible
+// at `ts` of every key is yielded, unless it is a point tombstone or
+// deleted by `tombstones` (every range tombstone of the merged tables).
+// the skipped versions are stepped over as views, nothing is copied.
+class SnapshotIterator : public Iterator {
+private:
+    shared_ptr<Iterator> iter_;
+    u64 ts_;
+    RangeTombstoneCursor tombstones_;
+    // key being skipped, its view dies with the move of `iter_`
+    vector<u8> last_key_;
+
+public:
+    SnapshotIterator(shared_ptr<Iterator> iter, u64 ts = UINT64_MAX,
+        shared_ptr<const RangeTombstones> tombstones = nullptr);
+
+    KeyView key_view() const override { return this->iter_->key_view(); }
+
+    SliceView internal_key() const override { return this->iter_->internal_key(); }
+
+    SliceView value_view() const override { return this->iter_->value_view(); }
+
+    ValueType value_type() const override { return ValueType::VALUE; }
+
+    bool is_valid() const override { return this->iter_->is_valid(); }
+
+    void next() override;
+
+    size_t num_active_iterators() override { return this->iter_->num_active_iterators(); }
+
+private:
+    // move past every version of the current key
+    void skip_key();
+
+    // move to the first key whose newest visible version is live
+    void settle();
 };
 
 }
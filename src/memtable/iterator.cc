@@ -10,26 +10,48 @@
 
 namespace minilsm {
 
-KeySlice MemTableIterator::key() const {
+KeyView MemTableIterator::key_view() const {
     DCHECK(this->iterator_.good());
-    return KeySlice(this->iterator_->key);
+    return this->iterator_->key_view();
 }
 
-Slice MemTableIterator::value() const {
+SliceView MemTableIterator::internal_key() const {
     DCHECK(this->iterator_.good());
-    return this->iterator_->value;
+    return this->iterator_->internal_key;
+}
+
+SliceView MemTableIterator::value_view() const {
+    DCHECK(this->iterator_.good());
+    return this->iterator_->value();
+}
+
+ValueType MemTableIterator::value_type() const {
+    DCHECK(this->iterator_.good());
+    return this->iterator_->type();
 }
 
 void MemTableIterator::next() {
     DCHECK(this->iterator_ != this->acer_.end());
     this->iterator_ = std::next(this->iterator_);
+    this->skip_deleted();
+}
+
+void MemTableIterator::skip_deleted() {
+    while (this->iterator_.good()) {
+        auto tombstone = this->deleted_.seek(this->iterator_->key_view());
+        if (!tombstone) { return; }
+        // jump over the whole tombstone instead of stepping through it, the
+        // newest version of the following key sorts first
+        auto after = key_after(tombstone->last);
+        this->iterator_ = this->acer_.lower_bound(KVPair::probe(after));
+    }
 }
 
 bool MemTableIterator::is_valid() const {
     if (this->iterator_ == this->acer_.end()) { return false; }
     auto end_ptr = this->end_.fin_ptr;
     if (!end_ptr) { return true; }
-    auto cmp_res = this->key().compare(end_ptr->key);
+    auto cmp_res = this->iterator_->key_view().compare(end_ptr->key);
     if (cmp_res == -1) { return true; } 
     else if (cmp_res == 0 && end_ptr->contains) { return true; } 
     else { return false; }
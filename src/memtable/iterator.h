@@ -24,26 +24,42 @@ using SkipListIterator = SkipListType::iterator;
 class MemTableIterator : public Iterator {
 private:
     const SkipListAccessor acer_;
+    // keeps the bytes referenced by the skiplist alive
+    shared_ptr<Arena> arena_;
     SkipListIterator iterator_;
     const Bound end_;
+    // tombstones of newer tables, covered entries are skipped
+    RangeTombstoneCursor deleted_;
 
 public:
     MemTableIterator(const SkipListAccessor& acer, 
+            shared_ptr<Arena> arena,
             SkipListIterator& start, 
-            const Bound& end = Bound(true)) : 
+            const Bound& end = Bound(true),
+            shared_ptr<const RangeTombstones> deleted = nullptr) : 
         acer_(acer),
+        arena_(arena),
         iterator_(start),
-        end_(end) {}
+        end_(end),
+        deleted_(deleted) { this->skip_deleted(); }
     
-    KeySlice key() const override;
+    KeyView key_view() const override;
 
-    Slice value() const override;
+    SliceView internal_key() const override;
+
+    SliceView value_view() const override;
+
+    ValueType value_type() const override;
 
     void next() override;
 
     bool is_valid() const override;
 
     size_t num_active_iterators() override;
+
+private:
+    // move past the entries covered by `deleted_`
+    void skip_deleted();
 };
 
 }
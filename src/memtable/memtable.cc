@@ -8,63 +8,253 @@
 #include "iterator/iterator.h"
 #include "memtable/iterator.h"
 #include "slice.h"
+#include "sstable/sstable.h"
 
 namespace minilsm {
 
 using std::shared_ptr;
 using std::make_shared;
 
+const u8 KVPair::TOMBSTONE[sizeof(u32)] = {0xff, 0xff, 0xff, 0xff};
+
 Slice MemTable::get(Slice key) {
     SkipListType::Accessor acer(this->map_);
-    auto res = acer.lower_bound({key, Slice()});
-    if (res != acer.end() && !key.compare(res->key)) return res->value;
+    auto res = acer.lower_bound(KVPair::probe(key));
+    if (res.good() && !res->key_view().compare(key)) return res->value().to_slice();
     return Slice();
 }
 
-void MemTable::put(Slice key, Slice value) { // todo : return status
-    // unique_lock<shared_mutex> mtx_w(this->snapshot_mtx_);
-    auto estimated_size = key.size() + value.size();
-    
+// result of a read at `ts` given `version`, the newest version of the key
+// visible at `ts` if any
+static std::optional<Slice> resolve(const KVPair* version, const RangeTombstone* tombstone, u64 ts,
+        bool* deleted) {
+    if (!version) { return resolve(std::nullopt, 0, ValueType::VALUE, tombstone, ts, deleted); }
+    return resolve(version->value(), version->key_view().get_ts(), version->type(), tombstone, ts, deleted);
+}
+
+std::optional<Slice> MemTable::find(const Slice& key, bool* deleted, u64 ts) {
     SkipListType::Accessor acer(this->map_);
-    acer.add({key, value});
-    this->approximate_size_ += estimated_size;
-    // todo
-    // wal
+    // the newer versions sort before the newest one visible at `ts`
+    auto res = acer.lower_bound(KVPair::probe(key, ts));
+    auto version = res.good() && !res->key_view().compare(key) ? &*res : nullptr;
+    auto tombstones = this->range_tombstones();
+    return resolve(version, tombstones ? tombstones->find(key) : nullptr, ts, deleted);
 }
 
-shared_ptr<MemTableIterator> MemTable::scan(const Bound& start, const Bound& end) {
+void MemTable::multi_find(const vector<Slice>& keys, vector<std::optional<Slice>>& values,
+        vector<bool>* deleted, u64 ts) {
+    vector<size_t> idxs(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) { idxs[i] = i; }
+    this->multi_find(keys, idxs, values, deleted, ts);
+}
+
+void MemTable::multi_find(const vector<Slice>& keys, const vector<size_t>& idxs,
+        vector<std::optional<Slice>>& values, vector<bool>* deleted, u64 ts) {
+    DCHECK(keys.size() == values.size());
+    DCHECK(!deleted || deleted->size() == keys.size());
+    SkipListType::Accessor acer(this->map_);
+    RangeTombstoneCursor cursor(this->range_tombstones());
+    // the skipper only moves forward, every key resumes the search from
+    // the position of the previous one
+    SkipListType::Skipper skipper(acer);
+    for (size_t j = 0; j < idxs.size(); j++) {
+        auto i = idxs[j];
+        DCHECK(!j || keys[idxs[j - 1]].compare(keys[i]) <= 0);
+        const KVPair* version = nullptr;
+        if (skipper.good()) {
+            skipper.to(KVPair::probe(keys[i], ts));
+            if (skipper.good() && !skipper.data().key_view().compare(keys[i])) { version = &skipper.data(); }
+        }
+        bool key_deleted = false;
+        values[i] = resolve(version, cursor.seek(keys[i]), ts, &key_deleted);
+        if (deleted && key_deleted) { (*deleted)[i] = true; }
+    }
+}
+
+shared_ptr<MemTable> MemTable::create_with_wal(u64 id, const string& path,
+        const WalOptions& options) {
+    auto memtable = make_shared<MemTable>(id);
+    memtable->wal_ = Wal::create(path, options);
+    // writes would not be logged
+    if (!memtable->wal_) { return nullptr; }
+    return memtable;
+}
+
+shared_ptr<MemTable> MemTable::recover_from_wal(u64 id, const string& path,
+        const WalOptions& options) {
+    auto memtable = make_shared<MemTable>(id);
+    memtable->wal_ = Wal::recover(path, 
+        [&](ValueType type, const KeySlice& key, const Slice& value) {
+            memtable->apply(type, key, value, key.get_ts());
+        }, 
+        options);
+    // writes would not be logged
+    if (!memtable->wal_) { return nullptr; }
+    return memtable;
+}
+
+bool MemTable::put(Slice key, Slice value, u64 ts) {
+    Wal::Writer writer;
+    if (!this->log(writer, ValueType::VALUE, key, value, ts)) { return false; }
+    this->apply(ValueType::VALUE, key, value, ts);
+    return this->wait_logged(writer);
+}
+
+bool MemTable::remove(const Slice& key, u64 ts) {
+    Wal::Writer writer;
+    if (!this->log(writer, ValueType::DELETION, key, Slice(), ts)) { return false; }
+    this->apply(ValueType::DELETION, key, Slice(), ts);
+    return this->wait_logged(writer);
+}
+
+bool MemTable::delete_range(const Slice& begin, const Slice& end, u64 ts) {
+    if (begin.compare(end) >= 0) { return true; }
+    Wal::Writer writer;
+    if (!this->log(writer, ValueType::RANGE_DELETION, begin, end, ts)) { return false; }
+    this->apply(ValueType::RANGE_DELETION, begin, end, ts);
+    return this->wait_logged(writer);
+}
+
+bool MemTable::log(Wal::Writer& writer, ValueType type, const Slice& key, const Slice& value, u64 ts) {
+    if (key.size() > MAX_KEY_SIZE || (type == ValueType::RANGE_DELETION && value.size() > MAX_KEY_SIZE)) {
+        LOG(ERROR) << "key of " << std::max(key.size(), value.size()) << " bytes is too long";
+        return false;
+    }
+    if (value.size() > MAX_VALUE_SIZE) {
+        LOG(ERROR) << "value of " << value.size() << " bytes is too long";
+        return false;
+    }
+    return !this->wal_ || this->wal_->append(writer, key, value, type, ts);
+}
+
+void MemTable::apply(ValueType type, const Slice& key, const Slice& value, u64 ts) {
+    switch (type) {
+    case ValueType::VALUE: this->put_to_map(key, value, ts); break;
+    case ValueType::DELETION: this->set_value(key, ts, KVPair::TOMBSTONE); break;
+    case ValueType::RANGE_DELETION: this->delete_range_in_map(key, key_before(value), ts); break;
+    }
+}
+
+void MemTable::rollback(ValueType type, const Slice& key, const Slice& value, u64 ts) {
+    if (type != ValueType::RANGE_DELETION) {
+        SkipListType::Accessor acer(this->map_);
+        acer.remove(KVPair::probe(key, ts));
+        return;
+    }
+    std::lock_guard<std::mutex> lock(this->range_mtx_);
+    auto tombstones = this->range_tombstones_.load();
+    if (!tombstones) { return; }
+    auto res = make_shared<RangeTombstones>(tombstones->without(ts));
+    if (res->empty()) { res = nullptr; }
+    this->range_tombstones_.store(res);
+}
+
+bool MemTable::wait_logged(Wal::Writer& writer) {
+    return !this->wal_ || this->wal_->wait(writer);
+}
+
+shared_ptr<const RangeTombstones> MemTable::range_tombstones() const {
+    return this->range_tombstones_.load();
+}
+
+void MemTable::put_to_map(const Slice& key, const Slice& value, u64 ts) {
+    DCHECK(value.size() < KVPair::TOMBSTONE_LEN);
+    auto value_buf = this->arena_->allocate(sizeof(u32) + value.size());
+    u32 value_len = value.size();
+    memcpy(value_buf, &value_len, sizeof(u32));
+    if (!value.empty()) { memcpy(value_buf + sizeof(u32), value.data(), value.size()); }
+    this->set_value(key, ts, value_buf);
+}
+
+void MemTable::delete_range_in_map(const Slice& first, const Slice& last, u64 ts) {
+    // the covered versions stay for the readers of older snapshots
+    {
+        std::lock_guard<std::mutex> lock(this->range_mtx_);
+        auto tombstones = this->range_tombstones_.load();
+        auto res = tombstones ? make_shared<RangeTombstones>(*tombstones) : make_shared<RangeTombstones>();
+        res->add(first, last, ts);
+        this->range_tombstones_.store(res);
+    }
+    this->update_max_ts(ts);
+}
+
+void MemTable::set_value(const Slice& key, u64 ts, const u8* value_buf) {
+    SkipListType::Accessor acer(this->map_);
+    // overwrite in place, the key bytes are only copied for a new version
+    auto probe = KVPair::probe(key, ts);
+    auto res = acer.find(probe);
+    if (res != acer.end()) {
+        res->value_ptr.store(value_buf, std::memory_order_release);
+        return;
+    }
+
+    auto& internal_key = probe.internal_key;
+    auto key_buf = this->arena_->allocate(internal_key.size());
+    memcpy(key_buf, internal_key.data(), internal_key.size());
+    auto added = acer.add(KVPair(SliceView(key_buf, internal_key.size()), value_buf));
+    if (!added.second) {
+        // lost the race against a concurrent insertion of the same version
+        added.first->value_ptr.store(value_buf, std::memory_order_release);
+    }
+    this->update_max_ts(ts);
+}
+
+void MemTable::update_max_ts(u64 ts) {
+    auto max_ts = this->max_ts_.load(std::memory_order_relaxed);
+    while (max_ts < ts && !this->max_ts_.compare_exchange_weak(max_ts, ts, std::memory_order_acq_rel)) {}
+}
+
+shared_ptr<MemTableIterator> MemTable::scan(const Bound& start, const Bound& end,
+        shared_ptr<const RangeTombstones> deleted) {
     SkipListType::Accessor acer(this->map_);
     SkipListType::iterator start_iter = acer.begin(), end_iter = acer.end();
 
-    if (!start.compare(end)) { return make_shared<MemTableIterator>(acer, end_iter); }
+    if (!start.compare(end)) { return make_shared<MemTableIterator>(acer, this->arena_, end_iter); }
 
     if (start.fin_ptr) {
+        // the newest version of the start key sorts first
         start_iter =  
-            acer.lower_bound(KVPair{start.fin_ptr->key, Slice()});
-        if (start_iter.good() && 
-                (start_iter->key.compare(start.fin_ptr->key) ||
-                !start.fin_ptr->contains)) {
+            acer.lower_bound(KVPair::probe(start.fin_ptr->key));
+        while (start_iter.good() && 
+                !start_iter->key_view().compare(start.fin_ptr->key) &&
+                !start.fin_ptr->contains) {
             start_iter = std::next(start_iter);
         }
     } 
 
-    return make_shared<MemTableIterator>(acer, start_iter, end);
+    return make_shared<MemTableIterator>(acer, this->arena_, start_iter, end, deleted);
 }
 
 shared_ptr<MemTableIterator> MemTable::create_iterator() { 
     SkipListType::Accessor acer(this->map_);
     SkipListType::iterator iter = acer.begin();
-    return make_shared<MemTableIterator>(acer, iter);
+    return make_shared<MemTableIterator>(acer, this->arena_, iter);
 }
 
-void MemTable::flush() {}
+void MemTable::flush(SSTableBuilder& builder) {
+    SkipListType::Accessor acer(this->map_);
+    for (auto iter = acer.begin(); iter != acer.end(); iter = std::next(iter)) {
+        builder.add(KeySlice(iter->key_view()), iter->value().to_slice(), iter->type());
+    }
+    if (auto tombstones = this->range_tombstones()) { builder.add_range_tombstones(*tombstones); }
+}
+
+bool MemTable::remove_wal() {
+    if (!this->wal_) { return true; }
+    // kept around for the writers still waiting on it
+    return this->wal_->remove();
+}
+
+bool MemTable::sync_wal() {
+    return !this->wal_ || this->wal_->sync();
+}
 
 u64 MemTable::get_id() { return this->id_; }
 
 u64 MemTable::get_size() { return this->map_->size(); }
 
-u64 MemTable::get_approximate_size() { return this->approximate_size_; }
+u64 MemTable::get_approximate_size() { return this->arena_->allocated_bytes(); }
 
-bool MemTable::is_empty() { return this->map_->empty(); }
+bool MemTable::is_empty() { return this->map_->empty() && !this->range_tombstones(); }
 
 }
\ No newline at end of file
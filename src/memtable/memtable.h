@@ -7,9 +7,17 @@
 #define MEMTABLE_H
 
 #include "defs.h"
+#include "block/range_del.h"
 #include "iterator/iterator.h"
 #include "slice.h"
 #include "mvcc/key.h"
+#include "util/arena.h"
+#include "util/bytes.h"
+#include "folly/concurrency/AtomicSharedPtr.h"
+#include <limits>
+#include <mutex>
+#include <optional>
+#include "wal/wal.h"
 
 using folly::ConcurrentSkipList;
 using std::vector;
@@ -28,69 +36,183 @@ namespace minilsm {
 using std::shared_ptr;
 using std::make_shared;
 
+// entry of the skiplist, a version of a key. both the internal key (see
+// `encode_internal_key`) and the value bytes live in the arena of the
+// memtable that owns the skiplist. entries are ordered by a memcmp of
+// their internal keys, which is `compare_internal`, so the versions of a
+// key follow each other from the newest. the value is stored as
+// `| value_len (u32) | value |` and swapped atomically when the same
+// version is written again (e.g. by the replay of the wal), the replaced
+// bytes stay valid until the arena is released. a point tombstone points
+// to `TOMBSTONE` instead.
 struct KVPair {
-    KeySlice key;
-    Slice value;
+    static constexpr u32 TOMBSTONE_LEN = std::numeric_limits<u32>::max();
+    static const u8 TOMBSTONE[sizeof(u32)];
+
+    SliceView internal_key;
+    mutable std::atomic<const u8*> value_ptr;
+
+    KVPair(const SliceView& internal_key, const u8* value_ptr = nullptr) : 
+        internal_key(internal_key), value_ptr(value_ptr) {}
+
+    KVPair(const KVPair& other) : 
+        internal_key(other.internal_key), value_ptr(other.value_ptr.load(std::memory_order_acquire)) {}
+
+    KVPair& operator=(const KVPair& other) {
+        this->internal_key = other.internal_key;
+        this->value_ptr.store(other.value_ptr.load(std::memory_order_acquire), std::memory_order_release);
+        return *this;
+    }
+
+    // entry to look up the version `ts` of `key` with. the internal key is
+    // encoded to a buffer of the thread, valid until its next probe. the
+    // default timestamp sorts before every version.
+    static KVPair probe(const SliceView& key, u64 ts = UINT64_MAX) {
+        thread_local vector<u8> buf;
+        encode_internal_key(key, ts, buf);
+        return KVPair(SliceView(buf.data(), buf.size()));
+    }
+
+    KeyView key_view() const { return decode_internal_key(this->internal_key); }
+
+    SliceView value() const {
+        auto ptr = this->value_ptr.load(std::memory_order_acquire);
+        if (!ptr || decode_u32(ptr) == TOMBSTONE_LEN) { return SliceView(); }
+        return SliceView(ptr + sizeof(u32), decode_u32(ptr));
+    }
+
+    ValueType type() const {
+        auto ptr = this->value_ptr.load(std::memory_order_acquire);
+        return ptr && decode_u32(ptr) == TOMBSTONE_LEN ? ValueType::DELETION : ValueType::VALUE;
+    }
 
     bool operator==(const KVPair& other) const {
-        return this->key.compare(other.key) == 0;
+        return this->internal_key.compare(other.internal_key) == 0;
     }
 
     bool operator<(const KVPair& other) const {
-        return this->key.compare(other.key) < 0;
+        return compare_internal_keys(this->internal_key, other.internal_key) < 0;
     }
 };
 
 using SkipListType = ConcurrentSkipList<KVPair>;
 
 class MemTableIterator;
+class SSTableBuilder;
+
 class MemTable {
 private:
     shared_ptr<SkipListType> map_;
+    // storage of keys and values, released together with the memtable
+    shared_ptr<Arena> arena_;
     u64 id_;
-    // todo
-    // optional<Wal> wal_;
-    atomic<u64> approximate_size_;
+    // write-ahead log, null when the memtable is not durable
+    std::unique_ptr<Wal> wal_;
+    // range tombstones deleting the older versions of the memtable itself
+    // and the entries of older tables. replaced as a whole under
+    // `range_mtx_`, readers keep their snapshot.
+    folly::atomic_shared_ptr<const RangeTombstones> range_tombstones_;
+    std::mutex range_mtx_;
+    // newest timestamp written
+    atomic<u64> max_ts_;
 
 public:
     MemTable(u64 id) : 
         map_(SkipListType::createInstance(10)),
+        arena_(make_shared<Arena>()),
         id_(id),
-        // wal_(nullopt),
-        approximate_size_(0) {}
-
-    // todo
-    // MemTable(u64 id, string path) :
-    //     id_(id),
-    //     wal_(path),
-    //     approximate_size_(0),
-    //     map_(SkipListType::createInstance(10)) {}
-        
+        wal_(nullptr),
+        max_ts_(0) {}
     
     ~MemTable() = default;
 
-    void create_with_wal(); // todo
+    // create an empty memtable logging to a fresh wal under `path`, null if
+    // the wal cannot be created
+    static shared_ptr<MemTable> create_with_wal(u64 id, const string& path,
+        const WalOptions& options = WalOptions());
 
-    void recover_from_val(); // todo
+    // rebuild a memtable from the wal under `path`, the recovered memtable
+    // keeps logging to the same wal. null if the wal cannot be recovered.
+    static shared_ptr<MemTable> recover_from_wal(u64 id, const string& path,
+        const WalOptions& options = WalOptions());
 
+    // newest value of the key
     Slice get(Slice);
 
-    void put(Slice, Slice);
+    // value of the newest version of `key` visible at `ts`, nullopt when
+    // absent. unlike `get`, an empty value can be told apart from a missing
+    // key. `deleted` is set when the key is deleted by the memtable, older
+    // tables must not be consulted then.
+    std::optional<Slice> find(const Slice& key, bool* deleted = nullptr, u64 ts = UINT64_MAX);
+
+    // look up the sorted `keys` at `ts` in a single pass over the skiplist,
+    // the value of `keys[i]` is stored in `values[i]` when found and
+    // `(*deleted)[i]` is set when it is deleted
+    void multi_find(const vector<Slice>& keys, vector<std::optional<Slice>>& values,
+        vector<bool>* deleted = nullptr, u64 ts = UINT64_MAX);
+
+    // `multi_find` of the keys at the positions `idxs` of `keys`, in key
+    // order. the results are stored at the same positions.
+    void multi_find(const vector<Slice>& keys, const vector<size_t>& idxs,
+        vector<std::optional<Slice>>& values, vector<bool>* deleted, u64 ts);
 
+    // add the version `ts` of `key`. returns false when the record cannot
+    // be logged, or the key or value is longer than `MAX_KEY_SIZE` or
+    // `MAX_VALUE_SIZE`. the memtable is left untouched in that case. a
+    // record that is queued but fails to be written stays in the memtable.
+    bool put(Slice, Slice, u64 ts = 0);
+
+    // delete `key` with a point tombstone at `ts`
+    bool remove(const Slice& key, u64 ts = 0);
+
+    // delete the versions older than `ts` of every key of `[begin, end)`,
+    // nothing happens if `begin` is not less than `end`
+    bool delete_range(const Slice& begin, const Slice& end, u64 ts = 0);
+
+    // a write in three steps, for callers that order the records of their
+    // writes: `log` queues the record behind those logged before, `apply`
+    // adds it to the memtable and `wait_logged` waits for it to be written.
+    // `apply` must not be called when `log` fails.
+    bool log(Wal::Writer& writer, ValueType type, const Slice& key, const Slice& value, u64 ts);
+
+    void apply(ValueType type, const Slice& key, const Slice& value, u64 ts);
+
+    // undo `apply` of a record that failed to be logged, before any reader
+    // may see `ts`
+    void rollback(ValueType type, const Slice& key, const Slice& value, u64 ts);
+
+    bool wait_logged(Wal::Writer& writer);
+
+    // snapshot of the range tombstones, null if there are none
+    shared_ptr<const RangeTombstones> range_tombstones() const;
+
+    // every version between the bounds, including point tombstones. keys
+    // covered by `deleted` (tombstones of newer tables) are skipped.
     shared_ptr<MemTableIterator> scan(
         const Bound& lower = Bound(false), 
-        const Bound& upper = Bound(true));
+        const Bound& upper = Bound(true),
+        shared_ptr<const RangeTombstones> deleted = nullptr);
 
     shared_ptr<MemTableIterator> create_iterator();
 
-    void flush(); // todo
+    // add every entry and the range tombstones to `builder` in key order
+    void flush(SSTableBuilder& builder);
 
-    void sync_wal(); // todo
+    // newest timestamp written, 0 if none
+    u64 max_ts() const { return this->max_ts_.load(std::memory_order_acquire); }
+
+    // delete the wal once the memtable is persisted elsewhere, writes still
+    // waiting for the wal succeed and later ones fail
+    bool remove_wal();
+
+    bool sync_wal();
 
     u64 get_id();
 
     u64 get_size();
 
+    // bytes allocated from the arena of the memtable, blocks reserved but
+    // not used yet are not counted
     u64 get_approximate_size();
 
     bool is_empty();
@@ -99,12 +221,25 @@ public:
     void debug_traverse() {
         SkipListType::Accessor acer(this->map_);
         for (auto iter = acer.begin(); iter != acer.end(); iter = std::next(iter)) {
-            auto key = iter->key;
-            auto value = iter->value;
-            LOG(INFO) << key << ":" << value;
+            auto key = iter->key_view();
+            auto value = iter->value();
+            LOG(INFO) << key << "@" << key.get_ts() << ":" << value;
         }
     }
 #endif
+
+private:
+    // insert into the skiplist without logging
+    void put_to_map(const Slice& key, const Slice& value, u64 ts);
+
+    // point the version `ts` of `key` to `value_buf`, inserting the version
+    // if it is absent
+    void set_value(const Slice& key, u64 ts, const u8* value_buf);
+
+    // register `[first, last]` without logging
+    void delete_range_in_map(const Slice& first, const Slice& last, u64 ts);
+
+    void update_max_ts(u64 ts);
 };
 }
 
@@ -8,23 +8,124 @@
 
 #include "slice.h"
 #include "defs.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <vector>
 
 namespace minilsm {
 
+// kind of an entry, deletions shadow the older versions of the key
+enum class ValueType : u8 {
+    VALUE = 0,
+    // point tombstone, its value is empty
+    DELETION = 1,
+    // range tombstone, only logged in the wal with the deleted range
+    // `[key, value)`. tables keep them apart from their entries.
+    RANGE_DELETION = 2,
+};
+
+class KeySlice;
+
+// non-owning counterpart of `KeySlice`, valid as long as the viewed bytes
+class KeyView : public SliceView {
+private:
+    u64 ts_ = 0;
+
+public:
+    using SliceView::SliceView;
+
+    KeyView(const u8* data, size_t size, u64 ts) : SliceView(data, size), ts_(ts) {}
+
+    KeyView(const KeySlice& key);
+
+    u64 get_ts() const { return this->ts_; }
+
+    void set_ts(u64 ts) { this->ts_ = ts; }
+};
+
 class KeySlice : public Slice {
 private:
-    u64 ts_;
+    u64 ts_ = 0;
 
 public:
     using Slice::Slice;
 
     KeySlice(const Slice& slice) : Slice(slice) {}
+
+    // copy the viewed key
+    KeySlice(const KeyView& view) : Slice(view.data(), view.size()), ts_(view.get_ts()) {}
  
     u64 get_ts() const;
 
     void set_ts(u64 ts);
 };
 
+inline KeyView::KeyView(const KeySlice& key) : SliceView(key), ts_(key.get_ts()) {}
+
+// order of the entries in every table: user keys ascending, the versions
+// of a key from the newest to the oldest
+inline int compare_internal(const KeyView& a, const KeyView& b) {
+    auto res = a.compare(b);
+    if (res) { return res; }
+    if (a.get_ts() == b.get_ts()) { return 0; }
+    return a.get_ts() > b.get_ts() ? -1 : 1;
+}
+
+/*
+ * internal key, a version encoded so that a single memcmp gives the order
+ * of `compare_internal`:
+ * ------------------------------------
+ * | key_len (2B) | key | ~ts (8B) |
+ * ------------------------------------
+ * both integers are big-endian. the fixed-width length goes first as user
+ * keys are ordered by length first, the timestamp is inverted so that the
+ * newer versions sort first.
+ */
+static constexpr size_t INTERNAL_KEY_OVERHEAD = sizeof(u16) + sizeof(u64);
+
+// longest user key, its internal key must fit the u16 lengths of the blocks
+static constexpr size_t MAX_KEY_SIZE = std::numeric_limits<u16>::max() - INTERNAL_KEY_OVERHEAD;
+
+// longest value, blocks store its length as a u16
+static constexpr size_t MAX_VALUE_SIZE = std::numeric_limits<u16>::max();
+
+// encode the version `ts` of `key` to `dst`, which holds
+// `key.size() + INTERNAL_KEY_OVERHEAD` bytes
+inline void encode_internal_key(const SliceView& key, u64 ts, u8* dst) {
+    DCHECK(key.size() <= std::numeric_limits<u16>::max());
+    dst[0] = key.size() >> 8;
+    dst[1] = key.size();
+    if (key.size()) { memcpy(dst + sizeof(u16), key.data(), key.size()); }
+    auto ptr = dst + sizeof(u16) + key.size();
+    auto inverted = ~ts;
+    for (int i = sizeof(u64) - 1; i >= 0; i--, inverted >>= 8) { ptr[i] = inverted; }
+}
+
+// encode to `buf`, replacing its content
+inline void encode_internal_key(const SliceView& key, u64 ts, std::vector<u8>& buf) {
+    buf.resize(key.size() + INTERNAL_KEY_OVERHEAD);
+    encode_internal_key(key, ts, buf.data());
+}
+
+// user key and timestamp of an internal key, the user key views its bytes
+inline KeyView decode_internal_key(const SliceView& internal_key) {
+    DCHECK(internal_key.size() >= INTERNAL_KEY_OVERHEAD);
+    auto key_len = internal_key.size() - INTERNAL_KEY_OVERHEAD;
+    auto ptr = internal_key.data() + sizeof(u16) + key_len;
+    u64 inverted = 0;
+    for (size_t i = 0; i < sizeof(u64); i++) { inverted = inverted << 8 | ptr[i]; }
+    return KeyView(internal_key.data() + sizeof(u16), key_len, ~inverted);
+}
+
+// `compare_internal` of two internal keys. keys of different lengths differ
+// within the length prefix already, so the sizes only break exact ties.
+inline int compare_internal_keys(const SliceView& a, const SliceView& b) {
+    auto res = memcmp(a.data(), b.data(), std::min(a.size(), b.size()));
+    if (res) { return res; }
+    return (a.size() > b.size()) - (a.size() < b.size());
+}
+
 }
 
 #endif
\ No newline at end of file
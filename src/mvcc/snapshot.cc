@@ -0,0 +1,59 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-11-02 15:20:31
+ * @Description: implementation of the timestamp oracle
+ */
+
+#include "mvcc/snapshot.h"
+
+namespace minilsm {
+
+Snapshot::~Snapshot() {
+    this->oracle_->release(this->ts_);
+}
+
+u64 TimestampOracle::begin_write() {
+    std::lock_guard<std::mutex> lock(this->mtx_);
+    auto ts = ++this->last_ts_;
+    this->inflight_.insert(ts);
+    return ts;
+}
+
+void TimestampOracle::end_write(u64 ts) {
+    {
+        std::lock_guard<std::mutex> lock(this->mtx_);
+        this->inflight_.erase(ts);
+    }
+    this->write_cv_.notify_all();
+}
+
+u64 TimestampOracle::read_ts() {
+    std::lock_guard<std::mutex> lock(this->mtx_);
+    return this->read_ts_locked();
+}
+
+void TimestampOracle::wait_for(u64 ts) {
+    std::unique_lock<std::mutex> lock(this->mtx_);
+    this->write_cv_.wait(lock, [&]() { return this->read_ts_locked() >= ts; });
+}
+
+shared_ptr<const Snapshot> TimestampOracle::create_snapshot() {
+    std::lock_guard<std::mutex> lock(this->mtx_);
+    auto ts = this->read_ts_locked();
+    this->snapshots_.insert(ts);
+    return std::make_shared<const Snapshot>(shared_from_this(), ts);
+}
+
+u64 TimestampOracle::oldest_ts() {
+    std::lock_guard<std::mutex> lock(this->mtx_);
+    return this->snapshots_.empty() ? this->read_ts_locked() : *this->snapshots_.begin();
+}
+
+void TimestampOracle::release(u64 ts) {
+    std::lock_guard<std::mutex> lock(this->mtx_);
+    auto iter = this->snapshots_.find(ts);
+    DCHECK(iter != this->snapshots_.end());
+    this->snapshots_.erase(iter);
+}
+
+}
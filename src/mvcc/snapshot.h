@@ -0,0 +1,91 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-11-02 15:20:31
+ * @Description: timestamps of writes and snapshots of readers
+ */
+#ifndef MVCC_SNAPSHOT_H
+#define MVCC_SNAPSHOT_H
+
+#include "defs.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+
+namespace minilsm {
+
+using std::shared_ptr;
+
+class TimestampOracle;
+
+// a timestamp pinned by a reader, the versions visible at it are kept by
+// the compactions until the snapshot is dropped
+class Snapshot {
+private:
+    shared_ptr<TimestampOracle> oracle_;
+    u64 ts_;
+
+public:
+    Snapshot(shared_ptr<TimestampOracle> oracle, u64 ts) : oracle_(oracle), ts_(ts) {}
+
+    Snapshot(const Snapshot&) = delete;
+
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    ~Snapshot();
+
+    u64 ts() const { return this->ts_; }
+};
+
+/*
+ * hands out the timestamps of writes, each write gets a new one. a write is
+ * in flight from `begin_write` to `end_write`, the read timestamp stays
+ * below the oldest write in flight, so that a snapshot never sees a write
+ * that is only partly applied or misses one applied later.
+ */
+class TimestampOracle : public std::enable_shared_from_this<TimestampOracle> {
+private:
+    std::mutex mtx_;
+    // last timestamp handed out
+    u64 last_ts_;
+    std::set<u64> inflight_;
+    // signaled when a write ends
+    std::condition_variable write_cv_;
+    // timestamps of the live snapshots
+    std::multiset<u64> snapshots_;
+
+public:
+    // timestamps from `last_ts + 1` on are handed out
+    TimestampOracle(u64 last_ts = 0) : last_ts_(last_ts) {}
+
+    u64 begin_write();
+
+    void end_write(u64 ts);
+
+    // newest timestamp at which every write is done
+    u64 read_ts();
+
+    // block until every write up to `ts` is done
+    void wait_for(u64 ts);
+
+    // snapshot at the read timestamp
+    shared_ptr<const Snapshot> create_snapshot();
+
+    // oldest timestamp still read, the read timestamp if there is no live
+    // snapshot. the versions older than the newest one visible at it are
+    // never read again.
+    u64 oldest_ts();
+
+private:
+    friend class Snapshot;
+
+    u64 read_ts_locked() const {
+        return this->inflight_.empty() ? this->last_ts_ : *this->inflight_.begin() - 1;
+    }
+
+    void release(u64 ts);
+};
+
+}
+
+#endif
@@ -6,26 +6,51 @@
 
 #include "sstable/iterator.h"
 #include "sstable/sstable.h"
+#include <algorithm>
 
 namespace minilsm {
 
 SSTableIterator::SSTableIterator(shared_ptr<SSTable> table,
             size_t block_idx, 
-            size_t key_idx) :
+            size_t key_idx,
+            size_t readahead_limit,
+            size_t readahead_blocks,
+            shared_ptr<const RangeTombstones> deleted,
+            shared_ptr<ThreadPool> readahead_pool) :
         table_ptr_(table),
         current_block_idx_(block_idx),
-        current_key_idx_(key_idx) {
-    this->current_block_iter_ = make_shared<BlockIterator>(
-        table->get_block(this->current_block_idx_), 
-        this->current_key_idx_);
+        current_key_idx_(key_idx),
+        readahead_blocks_(readahead_blocks),
+        readahead_limit_(readahead_limit),
+        readahead_pool_(readahead_pool),
+        deleted_(deleted) {
+    auto block = table->get_block(this->current_block_idx_);
+    this->current_block_iter_ = make_shared<BlockIterator>(block, this->current_key_idx_);
+    if (this->readahead_blocks_) { this->readahead(); }
+    // a position past the last key of the block starts from the next one,
+    // a corrupted block ends the iteration
+    if (block && !this->current_block_iter_->is_valid()) { this->move_to_block(this->current_block_idx_ + 1); }
+    this->skip_deleted();
 }
 
-Slice SSTableIterator::value() const {
-    return this->current_block_iter_->value();
+SSTableIterator::~SSTableIterator() {
+    this->cancel_readahead();
 }
 
-KeySlice SSTableIterator::key() const {
-    return this->current_block_iter_->key();
+SliceView SSTableIterator::value_view() const {
+    return this->current_block_iter_->value_view();
+}
+
+KeyView SSTableIterator::key_view() const {
+    return this->current_block_iter_->key_view();
+}
+
+SliceView SSTableIterator::internal_key() const {
+    return this->current_block_iter_->internal_key();
+}
+
+ValueType SSTableIterator::value_type() const {
+    return this->current_block_iter_->value_type();
 }
 
 bool SSTableIterator::is_valid() const {
@@ -35,19 +60,119 @@ bool SSTableIterator::is_valid() const {
 
 void SSTableIterator::next() {
     DCHECK(this->is_valid());
+    this->step();
+    this->skip_deleted();
+}
+
+void SSTableIterator::step() {
     this->current_block_iter_->next();
     if (!this->current_block_iter_->is_valid()) {
-        this->current_block_idx_++;
-        this->current_key_idx_ = 0;
-        if (this->current_block_idx_ < this->table_ptr_->num_of_blocks()) {
-            this->current_block_iter_ = make_shared<BlockIterator>(
-                this->table_ptr_->get_block(this->current_block_idx_), 0);
-        }
+        this->move_to_block(this->current_block_idx_ + 1);
     } else {
         this->current_key_idx_++;
     }
 }
 
+void SSTableIterator::move_to_block(size_t block_idx) {
+    DCHECK(block_idx > this->current_block_idx_);
+    auto skipped = block_idx - this->current_block_idx_ - 1;
+    this->current_block_idx_ = block_idx;
+    this->current_key_idx_ = 0;
+    if (block_idx >= this->table_ptr_->num_of_blocks()) {
+        this->cancel_readahead();
+        return;
+    }
+
+    shared_ptr<Block> block;
+    if (skipped < this->readahead_.size()) {
+        this->readahead_.erase(this->readahead_.begin(), this->readahead_.begin() + skipped);
+        auto& pending = this->readahead_.front();
+        block = pending.first.get()[pending.second];
+        this->readahead_.pop_front();
+    } else {
+        this->cancel_readahead();
+        block = this->table_ptr_->get_block(block_idx);
+    }
+    this->current_block_iter_ = make_shared<BlockIterator>(block, 0);
+    // moved past a block, the scan is sequential
+    this->readahead();
+}
+
+void SSTableIterator::skip_deleted() {
+    while (this->is_valid()) {
+        auto tombstone = this->deleted_.seek(this->key_view());
+        if (!tombstone) { return; }
+        // every key of a block up to its separator lies within the
+        // tombstone, such blocks are skipped without being read
+        auto num_of_blocks = this->table_ptr_->num_of_blocks();
+        auto block_idx = this->current_block_idx_;
+        while (block_idx < num_of_blocks && 
+                this->table_ptr_->block_separator(block_idx).compare(tombstone->last) <= 0) {
+            block_idx++;
+        }
+        if (block_idx > this->current_block_idx_) {
+            this->move_to_block(block_idx);
+        } else {
+            this->step();
+        }
+    }
+}
+
+void SSTableIterator::readahead() {
+    if (!this->readahead_pool_) { return; }
+    if (!this->readahead_blocks_) {
+        this->readahead_blocks_ = INITIAL_READAHEAD_BLOCKS;
+    } else if (this->readahead_.size() > this->readahead_blocks_ / 2) {
+        return;
+    } else {
+        this->readahead_blocks_ = std::min(this->readahead_blocks_ * 2, MAX_READAHEAD_BLOCKS);
+    }
+
+    auto limit = std::min(this->readahead_limit_, this->table_ptr_->num_of_blocks());
+    auto next = this->current_block_idx_ + 1 + this->readahead_.size();
+    vector<size_t> block_idxs;
+    for (; next < limit && this->readahead_.size() + block_idxs.size() < this->readahead_blocks_; next++) {
+        block_idxs.push_back(next);
+    }
+    if (block_idxs.empty()) { return; }
+
+    if (!this->cancelled_) { this->cancelled_ = std::make_shared<std::atomic<bool>>(false); }
+    auto& table = this->table_ptr_;
+    auto& cancelled = this->cancelled_;
+    if (table->has_async_io()) {
+        std::shared_future<vector<shared_ptr<Block>>> reads = this->readahead_pool_->submit(
+            [table, block_idxs, cancelled]() {
+            if (*cancelled) { return vector<shared_ptr<Block>>(); }
+            return table->get_blocks(block_idxs);
+        });
+        for (size_t i = 0; i < block_idxs.size(); i++) {
+            this->readahead_.emplace_back(reads, i);
+        }
+        return;
+    }
+    for (auto idx : block_idxs) {
+        this->readahead_.emplace_back(this->readahead_pool_->submit([table, idx, cancelled]() {
+            if (*cancelled) { return vector<shared_ptr<Block>>(); }
+            return vector<shared_ptr<Block>>{table->get_block(idx)};
+        }).share(), 0);
+    }
+}
+
+void SSTableIterator::cancel_readahead() {
+    this->readahead_.clear();
+    if (this->cancelled_) {
+        *this->cancelled_ = true;
+        this->cancelled_.reset();
+    }
+}
+
+bool SSTableIterator::is_read_ahead() {
+    if (!this->readahead_pool_) { return false; }
+    auto limit = std::min(this->readahead_limit_, this->table_ptr_->num_of_blocks());
+    return this->readahead_blocks_ &&
+        this->current_block_idx_ + 1 + this->readahead_.size() >= limit;
+}
+
 size_t SSTableIterator::num_active_iterators() {
     return this->is_valid();
 }
@@ -55,36 +180,58 @@ size_t SSTableIterator::num_active_iterators() {
 LevelIterator::LevelIterator(shared_ptr<Level> level_ptr, 
             const array<size_t, 3>& start,
             const array<size_t, 3>& end,
-            const Bound& start_bound) : 
+            const Bound& start_bound,
+            shared_ptr<const RangeTombstones> deleted,
+            shared_ptr<ThreadPool> readahead_pool) : 
         level_(level_ptr),
         end_(end),
-        current_(start) {
+        current_(start),
+        deleted_(deleted),
+        readahead_pool_(readahead_pool) {
     this->current_sst_iter_ = make_shared<SSTableIterator>(
         level_ptr->get_sstable(start[0]),
         start[1],
-        start[2]);
-    if (start_bound.fin_ptr && 
-            (this->key().compare(start_bound.fin_ptr->key) < 0 ||
-            (this->key().compare(start_bound.fin_ptr->key) == 0 && 
+        start[2],
+        this->readahead_limit(start[0]),
+        0,
+        deleted,
+        readahead_pool);
+    this->settle();
+    // every version of an excluded start key
+    while (start_bound.fin_ptr && this->is_valid() &&
+            (this->key_view().compare(start_bound.fin_ptr->key) < 0 ||
+            (this->key_view().compare(start_bound.fin_ptr->key) == 0 && 
             !start_bound.fin_ptr->contains))) {
         this->next();
     }
 }
 
-KeySlice LevelIterator::key() const {
-    return this->current_sst_iter_->key();
+LevelIterator::~LevelIterator() {
+    if (!this->next_sst_iter_.valid()) { return; }
+    *this->cancelled_ = true;
+    // the iterator is released here instead of along with the task
+    this->next_sst_iter_.get();
+}
+
+KeyView LevelIterator::key_view() const {
+    return this->current_sst_iter_->key_view();
+}
+
+SliceView LevelIterator::internal_key() const {
+    return this->current_sst_iter_->internal_key();
 }
 
-Slice LevelIterator::value() const {
-    return this->current_sst_iter_->value();
+SliceView LevelIterator::value_view() const {
+    return this->current_sst_iter_->value_view();
+}
+
+ValueType LevelIterator::value_type() const {
+    return this->current_sst_iter_->value_type();
 }
 
 bool LevelIterator::is_valid() const {
-    if (!this->current_sst_iter_->is_valid()) { return false; }
-    if (this->current_[0] < this->end_[0]) { return true; }
-    if (this->current_[1] < this->end_[1]) { return true; }
-    if (this->current_[2] < this->end_[2]) { return true; }
-    return false;
+    // skipping deleted entries may jump past the end
+    return this->current_sst_iter_->is_valid() && this->current_ < this->end_;
 }
 
 void LevelIterator::next() {
@@ -95,21 +242,66 @@ void LevelIterator::next() {
         this->current_[2]++;
     } else {
         this->current_sst_iter_->next();
-        if (!this->current_sst_iter_->is_valid()) {
-            this->current_ = {this->current_[0] + 1, 0, 0};
-            if (this->current_[0] < this->level_->num_of_ssts()) {
-                this->current_sst_iter_ = make_shared<SSTableIterator>(
-                    this->level_->get_sstable(this->current_[0]),
-                    0, 0); 
-            } 
+        this->settle();
+    }
+}
+
+void LevelIterator::settle() {
+    while (!this->current_sst_iter_->is_valid()) {
+        auto sst_idx = this->next_live_sstable(this->current_[0] + 1);
+        this->current_ = {sst_idx, 0, 0};
+        if (sst_idx > this->end_[0] || sst_idx >= this->level_->num_of_ssts()) { return; }
+        auto sst = this->level_->get_sstable(sst_idx);
+        if (this->next_sst_iter_.valid()) {
+            this->current_sst_iter_ = this->next_sst_iter_.get();
+            DCHECK(this->current_sst_iter_->table_ptr_ == sst);
         } else {
-            this->current_ = {
-                this->current_[0],
-                this->current_sst_iter_->current_block_idx_,
-                this->current_sst_iter_->current_key_idx_
-            };
+            this->current_sst_iter_ = make_shared<SSTableIterator>(
+                sst, 0, 0, this->readahead_limit(sst_idx), 0, this->deleted_, this->readahead_pool_);
         }
     }
+    this->current_ = {
+        this->current_[0],
+        this->current_sst_iter_->current_block_idx_,
+        this->current_sst_iter_->current_key_idx_
+    };
+    this->readahead_next_sstable();
+}
+
+size_t LevelIterator::readahead_limit(size_t sst_idx) const {
+    if (sst_idx != this->end_[0]) { return SIZE_MAX; }
+    return this->end_[2] ? this->end_[1] + 1 : this->end_[1];
+}
+
+size_t LevelIterator::next_live_sstable(size_t sst_idx) const {
+    if (!this->deleted_) { return sst_idx; }
+    for (; sst_idx < this->level_->num_of_ssts() && sst_idx <= this->end_[0]; sst_idx++) {
+        auto sst = this->level_->get_sstable(sst_idx);
+        if (!this->deleted_->covers(sst->first_key, sst->last_key)) { break; }
+    }
+    return sst_idx;
+}
+
+void LevelIterator::readahead_next_sstable() {
+    auto next = this->next_live_sstable(this->current_[0] + 1);
+    if (this->next_sst_iter_.valid() || next > this->end_[0] || 
+            next >= this->level_->num_of_ssts() ||
+            !this->current_sst_iter_->is_read_ahead()) {
+        return;
+    }
+    // the next sstable goes on with the readahead of the current one
+    if (!this->cancelled_) { this->cancelled_ = std::make_shared<std::atomic<bool>>(false); }
+    this->next_sst_iter_ = this->readahead_pool_->submit(
+        [sst = this->level_->get_sstable(next), 
+            limit = this->readahead_limit(next), 
+            blocks = this->current_sst_iter_->readahead_blocks_,
+            deleted = this->deleted_,
+            pool = std::weak_ptr<ThreadPool>(this->readahead_pool_),
+            cancelled = this->cancelled_]() -> shared_ptr<SSTableIterator> {
+        if (*cancelled) { return nullptr; }
+        // the pool is held by this iterator until the task is done
+        return make_shared<SSTableIterator>(sst, 0, 0, limit, blocks, deleted, pool.lock());
+    });
 }
 
 size_t LevelIterator::num_active_iterators() {
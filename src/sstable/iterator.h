@@ -8,40 +8,118 @@
 
 #include "block/block.h"
 #include "block/iterator.h"
+#include "block/range_del.h"
 #include "defs.h"
 #include "iterator/iterator.h"
 #include "mvcc/key.h"
 #include "slice.h"
 #include "sstable/sstable.h"
+#include "util/thread_pool.h"
+#include <atomic>
 #include <cstddef>
+#include <deque>
+#include <future>
 #include <type_traits>
 
 namespace minilsm {
 
 class LevelIterator;
 
+/*
+ * readahead: once the iterator moves past the block it started in, the
+ * following blocks are read in the background. the number of blocks in
+ * flight starts at `INITIAL_READAHEAD_BLOCKS` and doubles every time half
+ * of them are consumed, up to `MAX_READAHEAD_BLOCKS`. with an asynchronous
+ * io backend the blocks of a refill are read in a single batch, otherwise
+ * every block is read by a task of its own. the reads run on the given
+ * pool, without one nothing is read ahead. reads still queued once their
+ * blocks are dropped (by the iterator skipping past them or going away)
+ * are cancelled.
+ */
 class SSTableIterator : public Iterator {
 private:
     shared_ptr<SSTable> table_ptr_;
     shared_ptr<BlockIterator> current_block_iter_;
     size_t current_block_idx_;
     size_t current_key_idx_;
+    // block read in the background, the `second`-th of the blocks read by
+    // the task `first`
+    using PendingBlock = pair<std::shared_future<vector<shared_ptr<Block>>>, size_t>;
+
+    // blocks read in the background, from `current_block_idx_ + 1` on
+    std::deque<PendingBlock> readahead_;
+    // blocks kept in flight, 0 until the access turns sequential
+    size_t readahead_blocks_;
+    // blocks from this index on are never read ahead
+    size_t readahead_limit_;
+    shared_ptr<ThreadPool> readahead_pool_;
+    // set once the reads in `readahead_` are dropped, created along with
+    // the first of them
+    shared_ptr<std::atomic<bool>> cancelled_;
+    // tombstones of newer tables, covered entries are skipped and so are
+    // the blocks they cover as a whole
+    RangeTombstoneCursor deleted_;
 
     friend class LevelIterator;
 public:
+    static constexpr size_t INITIAL_READAHEAD_BLOCKS = 2;
+    static constexpr size_t MAX_READAHEAD_BLOCKS = 64;
+
+    // with `readahead_blocks` the access is taken as sequential from the
+    // start, e.g. for the next sstable of a level being scanned
     SSTableIterator(shared_ptr<SSTable> table,
         size_t block_idx = 0, 
-        size_t key_idx = 0);
+        size_t key_idx = 0,
+        size_t readahead_limit = SIZE_MAX,
+        size_t readahead_blocks = 0,
+        shared_ptr<const RangeTombstones> deleted = nullptr,
+        shared_ptr<ThreadPool> readahead_pool = nullptr);
+
+    SSTableIterator(const SSTableIterator&) = delete;
+
+    SSTableIterator& operator=(const SSTableIterator&) = delete;
+
+    ~SSTableIterator();
+
+    SliceView value_view() const override;
 
-    Slice value() const override;
+    KeyView key_view() const override;
 
-    KeySlice key() const override;
+    SliceView internal_key() const override;
+
+    ValueType value_type() const override;
 
     bool is_valid() const override;
 
     void next() override;
 
     size_t num_active_iterators() override;
+
+#ifdef Debug
+    size_t debug_get_readahead_blocks() const { return this->readahead_blocks_; }
+
+    size_t debug_get_num_of_readahead() const { return this->readahead_.size(); }
+#endif
+
+private:
+    // move to the next entry without looking at the tombstones
+    void step();
+
+    // move to the first entry of block `block_idx`, the blocks read ahead
+    // before it are dropped
+    void move_to_block(size_t block_idx);
+
+    // move past the entries covered by `deleted_`
+    void skip_deleted();
+
+    // keep the window of blocks in flight filled
+    void readahead();
+
+    // drop every block read ahead, the reads still queued are skipped
+    void cancel_readahead();
+
+    // every block up to the limit is read or in flight
+    bool is_read_ahead();
 };
 
 class LevelIterator : public Iterator {
@@ -55,20 +133,56 @@ private:
     array<size_t, 3> end_;
     array<size_t, 3> current_;
     shared_ptr<SSTableIterator> current_sst_iter_;
+    // iterator of the next sstable, opened in the background once the
+    // current one is read ahead to its end
+    std::future<shared_ptr<SSTableIterator>> next_sst_iter_;
+    // tombstones of newer tables, sstables covered as a whole are not opened
+    shared_ptr<const RangeTombstones> deleted_;
+    shared_ptr<ThreadPool> readahead_pool_;
+    // set once `next_sst_iter_` is not wanted anymore
+    shared_ptr<std::atomic<bool>> cancelled_;
 
 public:
     LevelIterator(shared_ptr<Level> level_ptr, const array<size_t, 3>& start,
-        const array<size_t, 3>& end, const Bound& start_bound);
+        const array<size_t, 3>& end, const Bound& start_bound,
+        shared_ptr<const RangeTombstones> deleted = nullptr,
+        shared_ptr<ThreadPool> readahead_pool = nullptr);
+
+    LevelIterator(const LevelIterator&) = delete;
+
+    LevelIterator& operator=(const LevelIterator&) = delete;
+
+    // waits for the next sstable if it is being opened, so that its
+    // iterator, which holds the pool, is not dropped on a thread of the pool
+    ~LevelIterator();
+
+    KeyView key_view() const override;
 
-    KeySlice key() const override;
+    SliceView internal_key() const override;
 
-    Slice value() const override;
+    SliceView value_view() const override;
+
+    ValueType value_type() const override;
 
     bool is_valid() const override;
 
     void next() override;
 
     size_t num_active_iterators() override;
+
+private:
+    // blocks of the `sst_idx`-th sstable from the end on are not read ahead,
+    // the end block itself only if the end lies within it
+    size_t readahead_limit(size_t sst_idx) const;
+
+    // first sstable from `sst_idx` on which is not covered by `deleted_`
+    size_t next_live_sstable(size_t sst_idx) const;
+
+    // open the following sstables while the current one is exhausted, then
+    // take the position of the sstable iterator
+    void settle();
+
+    void readahead_next_sstable();
 };
 }
 
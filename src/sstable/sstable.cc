@@ -6,221 +6,577 @@
 
 #include "sstable/sstable.h"
 #include "sstable/iterator.h"
+#include "cache/table_cache.h"
+#include <cstdio>
 
 namespace minilsm {
 
-size_t BlockMeta::estimated_size(const vector<BlockMeta>& block_meta_list) {
-    size_t estimated_size = sizeof(u32); // number of blocks
-    for (auto& meta : block_meta_list) {
-        estimated_size += 
-            sizeof(u32) + // size of offset
-            sizeof(u16) + // size of (first) key size
-            meta.first_key.size() + // size of first key
-            sizeof(u64) + // size of (first) key timestamp
-            sizeof(u16) + // size of (last) key size
-            meta.last_key.size() + // size of last key
-            sizeof(u64); // size of (last) key timestamp
-    }
-    estimated_size += sizeof(u64); // max timestamp
-    estimated_size += sizeof(u32); // checksum
-    return estimated_size;
-}
-
-void BlockMeta::encode_block_meta(const vector<BlockMeta>& block_meta_list, u64 max_ts, Bytes& buf) {
-    auto size_prev = buf.size();
-    
-    buf.push(block_meta_list.size(), sizeof(u32)); // size of block_meta size
-    size_t size_curr = 0;
-    for (auto& meta : block_meta_list) {
-        buf.push(meta.offset, sizeof(u32)); size_curr += sizeof(u32);
-        buf.push(meta.first_key.size(), sizeof(u16)); size_curr += sizeof(u16);
-        buf.instream(meta.first_key.data(), meta.first_key.size()); size_curr += meta.first_key.size();
-        buf.push(meta.first_key.get_ts(), sizeof(u64)); size_curr += sizeof(u64);
-        buf.push(meta.last_key.size(), sizeof(u16)); size_curr += sizeof(u16);
-        buf.instream(meta.last_key.data(), meta.last_key.size());  size_curr += meta.last_key.size();
-        buf.push(meta.last_key.get_ts(), sizeof(u64)); size_curr += sizeof(u64);
-    }
-    buf.push(max_ts, sizeof(u64)); 
-    size_curr += sizeof(u64);
-
-    auto checksum_crc = folly::crc32(
-        buf.outstream() + size_prev + sizeof(u32) /* start from the first block_meta */, 
-        size_curr /* all block_metas as well as max_ts */);
-    buf.push(checksum_crc, sizeof(u32));
-}
-
-pair<vector<BlockMeta>, u64> BlockMeta::decode_block_meta(const Bytes& buf, size_t meta_offset) {
-    pair<vector<BlockMeta>, u64> res;
-
-    auto num = buf.get(meta_offset, sizeof(u32));
-    auto idx = sizeof(u32) + meta_offset;
-    for (size_t i = 0; i < num; i++) {
-        auto offset = buf.get(idx, sizeof(u32)); idx += sizeof(u32);
-        auto first_key_len = buf.get(idx, sizeof(u16)); idx += sizeof(u16);
-        auto first_key = KeySlice{buf.outstream(idx), first_key_len}; idx += first_key_len;
-        first_key.set_ts(buf.get(idx, sizeof(u64))); idx += sizeof(u64);
-        auto last_key_len = buf.get(idx, sizeof(u16)); idx += sizeof(u16);
-        auto last_key = KeySlice{buf.outstream(idx), last_key_len}; idx += last_key_len;
-        last_key.set_ts(buf.get(idx, sizeof(u64))); idx += sizeof(u64);
-        res.first.emplace_back(BlockMeta{offset, first_key, last_key});
-    }
-    
-    auto max_ts = buf.get(idx, sizeof(u64)); idx += sizeof(u64);
-    res.second = max_ts;
-
-    auto checksum_crc = folly::crc32(
-        buf.outstream() + meta_offset + sizeof(u32), 
-        idx - meta_offset - sizeof(u32));
-    DCHECK(checksum_crc == buf.get(idx, sizeof(u32)));
-
-    return res;
-}
-
 Bytes FileObject::read(size_t offset, size_t len) {
+    if (this->mmap_) {
+        Bytes buf;
+        DCHECK(offset + len <= this->mmap_->size());
+        buf.instream(this->mmap_->data() + offset, len);
+        return buf;
+    }
     Bytes buf = file_.read(offset, len);
     return buf;
 }
 
-void FileObject::write(const Bytes& buf) {
-    if (file_.write(buf.outstream(), buf.size())) {
-        size_ += buf.size();
+shared_ptr<ReadBatch> FileObject::read_async(const vector<pair<size_t, size_t>>& ranges) {
+    auto batch = make_shared<ReadBatch>(this->file_.fd(), shared_from_this());
+    for (auto& [offset, len] : ranges) { batch->add(offset, len); }
+    if (!this->mmap_) {
+        this->io_->submit(batch);
+        return batch;
+    }
+    for (auto& req : batch->requests) {
+        DCHECK(req.offset + req.len <= this->mmap_->size());
+        req.buf.instream(this->mmap_->data() + req.offset, req.len);
+        req.ok = true;
     }
-    DCHECK((size_t)file_.size() == buf.size());
+    return batch;
 }
 
-bool FileObject::is_open() { return this->file_.is_open(); }
+const u8* FileObject::view(size_t offset) {
+    if (!this->mmap_) { return nullptr; }
+    DCHECK(offset <= this->mmap_->size());
+    return this->mmap_->data() + offset;
+}
 
-bool FileObject::close() { return this->file_.close(); }
+shared_ptr<const void> FileObject::mapping() { return this->mmap_; }
 
-size_t FileObject::size() { return this->size_; }
+bool FileObject::sync() { return this->file_.sync(); }
 
-SSTable::SSTable(size_t id, shared_ptr<BlockCache> cache, const string& file_path) :
-        file_obj_(FileObject(file_path, true)), block_cache_(cache) {
-    auto len = file_obj_.size();
-    auto bloom_offset = file_obj_.
-        read(len - sizeof(u32), sizeof(u32)).
-        get(0, sizeof(u32));
-    bloom_filter bloom(file_obj_.read(bloom_offset, len - sizeof(u32) - bloom_offset));
+bool FileObject::write(const Bytes& buf) {
+    if (!this->file_.write(buf.outstream(), buf.size())) { return false; }
+    this->size_ += buf.size();
+    return true;
+}
+
+bool FileObject::is_open() { return this->file_.is_open(); }
 
-    auto meta_offset = file_obj_.
-        read(bloom_offset - sizeof(u32), sizeof(u32)).
-        get(0, sizeof(u32));
-    auto meta_buf = file_obj_.read(meta_offset, bloom_offset - sizeof(u32) - meta_offset);
-    auto pair = BlockMeta::decode_block_meta(meta_buf);
+bool FileObject::close() { return this->file_.close(); }
 
-    this->block_meta_ = std::move(pair.first);
-    this->block_meta_offset_ = meta_offset;
-    this->bloom_ = std::move(bloom);
+size_t FileObject::size() { return this->size_; }
 
-    this->max_ts = pair.second;
-    this->first_key = this->block_meta_.begin()->first_key;
-    this->last_key = this->block_meta_.rbegin()->last_key;
+SSTable::SSTable(size_t id, shared_ptr<BlockCache> cache, const string& file_path,
+            bool use_mmap) :
+        id(id),
+        path_(file_path),
+        file_obj_(make_shared<FileObject>(file_path, true, use_mmap)),
+        file_size_(file_obj_->size()),
+        meta_loaded_(true),
+        obsolete_(false),
+        cache_index_(false),
+        has_range_tombstones_(false),
+        block_cache_(cache) {
+    this->max_ts = 0;
+    if (!this->read_meta(&this->max_ts, &this->first_key, &this->last_key)) {
+        LOG(ERROR) << "failed to read the meta of " << file_path;
+    }
+    this->has_range_tombstones_ = !this->range_tombstones_.empty();
 }
 
-SSTable::SSTable(size_t id, const string& file_path, vector<BlockMeta>& meta, 
-    size_t meta_offset, shared_ptr<BlockCache> cache, bloom_filter& bloom, u64 ts) :
+SSTable::SSTable(size_t id, const string& file_path, shared_ptr<IndexBlock> index, 
+    const KeySlice& first_key, const KeySlice& last_key,
+    size_t meta_offset, size_t meta_size, shared_ptr<BlockCache> cache,
+    BlockedBloomFilter& bloom, u64 ts, const RangeTombstones& range_tombstones, bool use_mmap,
+    shared_ptr<TableCache> table_cache, bool cache_index) :
     id(id), 
-    first_key(meta.begin()->first_key), 
-    last_key(meta.rbegin()->last_key), 
+    first_key(first_key),
+    last_key(last_key),
     max_ts(ts),
-    file_obj_(FileObject(file_path, true)),
-    block_meta_(meta), 
-    block_meta_offset_(meta_offset),
+    path_(file_path),
+    file_obj_(table_cache ? nullptr : make_shared<FileObject>(file_path, true, use_mmap)),
+    table_cache_(table_cache),
+    file_size_(0),
+    meta_loaded_(true),
+    obsolete_(false),
+    cache_index_(cache_index && cache),
+    num_of_blocks_(index->num_of_entries()),
+    meta_offset_(meta_offset),
+    meta_size_(meta_size),
     bloom_(bloom),
+    range_tombstones_(range_tombstones),
+    has_range_tombstones_(!range_tombstones.empty()),
+    block_cache_(cache) {
+    auto file = this->file();
+    this->file_size_ = file ? file->size() : 0;
+    if (this->cache_index_) {
+        this->block_cache_->insert_index(this->id, index);
+    } else {
+        this->index_ = index;
+    }
+}
+
+SSTable::SSTable(size_t id, const KeySlice& first_key, const KeySlice& last_key, u64 max_ts,
+    u64 file_size, shared_ptr<BlockCache> cache, shared_ptr<TableCache> table_cache,
+    const string& file_path, bool cache_index, bool has_range_tombstones) :
+    id(id),
+    first_key(first_key),
+    last_key(last_key),
+    max_ts(max_ts),
+    path_(file_path),
+    file_obj_(table_cache ? nullptr : make_shared<FileObject>(file_path, true)),
+    table_cache_(table_cache),
+    file_size_(file_size),
+    meta_loaded_(false),
+    obsolete_(false),
+    cache_index_(cache_index && cache),
+    num_of_blocks_(0),
+    meta_offset_(0),
+    meta_size_(0),
+    has_range_tombstones_(has_range_tombstones),
     block_cache_(cache) {}
 
-shared_ptr<Block> SSTable::get_block(size_t block_idx) {
-    auto res = this->block_cache_->find(block_idx);
-    if (res != this->block_cache_->end()) {
-        return res->second;
+SSTable::~SSTable() {
+    if (!this->obsolete_) { return; }
+    // no block is cached before the meta is loaded
+    if (this->block_cache_ && this->meta_loaded_) {
+        for (size_t i = 0; i < this->num_of_blocks_; i++) {
+            this->block_cache_->erase(this->id, i);
+        }
+        this->block_cache_->erase(this->id, BlockCache::INDEX_BLOCK_IDX);
+    }
+    this->file_obj_.reset();
+    // a reader may drop the sstable last, the file is removed in the
+    // background then
+    if (this->table_cache_) {
+        this->table_cache_->retire(this->id, this->path_);
     } else {
-        auto block_ptr = get_block_from_encoded(block_idx);
-        this->block_cache_->assign(block_idx, block_ptr);
-        return block_ptr;
+        std::remove(this->path_.c_str());
     }
 }
 
-size_t SSTable::locate_block(const KeySlice& key) {
-    if (key.compare(this->block_meta_[0].first_key) < 0) { return  0; }
-    
-    size_t low = 0;
-    size_t high = this->block_meta_.size() - 1;
-    while (low < high) {
-        auto mid = low + (high - low) / 2 + 1;
-        auto& anchor_block = this->block_meta_[mid];
-        auto res = anchor_block.first_key.compare(key);
-        if (res <= 0) {
-            low = mid;
-        } else {
-            high = mid - 1;
+shared_ptr<FileObject> SSTable::file() {
+    if (!this->table_cache_) { return this->file_obj_; }
+    return this->table_cache_->get(this->id, this->path_);
+}
+
+bool SSTable::load_meta() {
+    if (this->meta_loaded_.load(std::memory_order_acquire)) { return true; }
+    std::lock_guard<std::mutex> lock(this->meta_mtx_);
+    if (this->meta_loaded_.load(std::memory_order_relaxed)) { return true; }
+    // tried again by the next reader
+    if (!this->read_meta()) { return false; }
+    this->meta_loaded_.store(true, std::memory_order_release);
+    return true;
+}
+
+bool SSTable::read_meta(u64* max_ts, KeySlice* first_key, KeySlice* last_key) {
+    auto file = this->file();
+    auto len = this->file_size_;
+    if (!file || len < 2 * sizeof(u32)) { return false; }
+    auto extra = file->read(len - sizeof(u32), sizeof(u32));
+    if (extra.size() != sizeof(u32)) { return false; }
+    size_t bloom_offset = extra.get(0, sizeof(u32));
+    if (bloom_offset < sizeof(u32) || bloom_offset > len - sizeof(u32)) { return false; }
+    auto bloom_buf = file->read(bloom_offset, len - sizeof(u32) - bloom_offset);
+    if (bloom_buf.size() != len - sizeof(u32) - bloom_offset) { return false; }
+
+    auto meta_offset_buf = file->read(bloom_offset - sizeof(u32), sizeof(u32));
+    if (meta_offset_buf.size() != sizeof(u32)) { return false; }
+    size_t meta_offset = meta_offset_buf.get(0, sizeof(u32));
+    if (meta_offset + sizeof(u32) > bloom_offset - sizeof(u32)) { return false; }
+    this->meta_offset_ = meta_offset;
+    this->meta_size_ = bloom_offset - sizeof(u32) - meta_offset;
+
+    auto index = this->read_index(max_ts, first_key, last_key, &this->range_tombstones_);
+    if (!index) { return false; }
+    this->bloom_ = BlockedBloomFilter(bloom_buf);
+    this->num_of_blocks_ = index->num_of_entries();
+    if (this->cache_index_) {
+        this->block_cache_->insert_index(this->id, index);
+    } else {
+        this->index_ = index;
+    }
+    return true;
+}
+
+shared_ptr<IndexBlock> SSTable::read_index(u64* max_ts, KeySlice* first_key, KeySlice* last_key,
+        RangeTombstones* range_tombstones) {
+    auto file = this->file();
+    if (!file) { return nullptr; }
+    auto meta_buf = file->read(this->meta_offset_, this->meta_size_);
+    if (meta_buf.size() != this->meta_size_) { return nullptr; }
+    auto checksum_crc = folly::crc32(meta_buf.outstream(), this->meta_size_ - sizeof(u32));
+    if (checksum_crc != meta_buf.get(this->meta_size_ - sizeof(u32), sizeof(u32))) {
+        LOG(ERROR) << "checksum mismatch in the meta of sstable " << this->id;
+        return nullptr;
+    }
+
+    size_t pos = 0;
+    for (auto key : {first_key, last_key}) {
+        auto len = meta_buf.get(pos, sizeof(u16)); pos += sizeof(u16);
+        if (key) {
+            *key = KeySlice(meta_buf.outstream(pos), len);
+            key->set_ts(meta_buf.get(pos + len, sizeof(u64)));
         }
+        pos += len + sizeof(u64);
     }
+    if (max_ts) { *max_ts = meta_buf.get(pos, sizeof(u64)); }
+    pos += sizeof(u64);
+    RangeTombstones tombstones;
+    if (!tombstones.decode(meta_buf.outstream(), this->meta_size_ - sizeof(u32), pos)) { return nullptr; }
+    if (range_tombstones) { *range_tombstones = std::move(tombstones); }
+
+    Bytes index_buf;
+    index_buf.instream(meta_buf.outstream(pos), this->meta_size_ - sizeof(u32) - pos);
+    return make_shared<IndexBlock>(std::move(index_buf));
+}
 
-    return low;
+shared_ptr<IndexBlock> SSTable::index() {
+    if (!this->load_meta()) { return nullptr; }
+    if (this->index_) { return this->index_; }
+
+    auto index = this->block_cache_->lookup_index(this->id);
+    if (!index) {
+        index = this->read_index();
+        if (index) { this->block_cache_->insert_index(this->id, index); }
+    }
+    return index;
 }
 
-shared_ptr<SSTableIterator> SSTable::create_iterator(size_t blk_idx, size_t key_idx) {
-    return make_shared<SSTableIterator>(shared_from_this(), blk_idx, key_idx);
+pair<size_t, size_t> SSTable::block_range(const IndexBlock& index, size_t block_idx) {
+    DCHECK(block_idx < index.num_of_entries());
+    IndexCursor cursor(&index, block_idx);
+    auto offset = cursor.entry().block_offset;
+    cursor.next();
+    auto offset_end = cursor.is_valid() ? cursor.entry().block_offset : this->meta_offset_;
+    return {offset, offset_end};
 }
 
-size_t SSTable::num_of_blocks() { return this->block_meta_.size(); }
+shared_ptr<Block> SSTable::get_block(size_t block_idx) {
+    if (!this->block_cache_) {
+        return get_block_from_encoded(block_idx);
+    }
 
-u64 SSTable::table_size() { return this->file_obj_.size(); }
+    auto block_ptr = this->block_cache_->lookup(this->id, block_idx);
+    if (!block_ptr) {
+        block_ptr = get_block_from_encoded(block_idx);
+        if (block_ptr) { this->block_cache_->insert(this->id, block_idx, block_ptr); }
+    }
+    return block_ptr;
+}
+
+vector<shared_ptr<Block>> SSTable::get_blocks(const vector<size_t>& block_idxs) {
+    vector<shared_ptr<Block>> res(block_idxs.size());
+    vector<size_t> missing;
+    for (size_t i = 0; i < block_idxs.size(); i++) {
+        if (this->block_cache_) { res[i] = this->block_cache_->lookup(this->id, block_idxs[i]); }
+        if (!res[i]) { missing.push_back(i); }
+    }
+    if (missing.empty()) { return res; }
+
+    // a mapped file is read in place
+    auto file = this->file();
+    if (!file || file->view(0)) {
+        for (auto i : missing) { res[i] = this->get_block(block_idxs[i]); }
+        return res;
+    }
+
+    auto index = this->index();
+    if (!index) { return res; }
+    vector<pair<size_t, size_t>> ranges;
+    for (auto i : missing) {
+        auto range = this->block_range(*index, block_idxs[i]);
+        ranges.emplace_back(range.first, range.second - range.first);
+    }
+    auto batch = file->read_async(ranges);
+    batch->wait();
+    for (size_t j = 0; j < missing.size(); j++) {
+        auto i = missing[j];
+        auto& req = batch->requests[j];
+        // a failed read is retried on its own
+        res[i] = req.ok ?
+            this->decode_block(std::move(req.buf)) :
+            this->get_block_from_encoded(block_idxs[i]);
+        if (this->block_cache_ && res[i]) { this->block_cache_->insert(this->id, block_idxs[i], res[i]); }
+    }
+    return res;
+}
+
+bool SSTable::has_async_io() {
+    auto file = this->file();
+    return file && file->io_backend()->is_async() && !file->view(0);
+}
+
+size_t SSTable::locate_block(const KeySlice& key, bool last) {
+    auto index = this->index();
+    if (!index) { return 0; }
+    auto block_idx = index->locate(SliceView(key));
+    if (last) {
+        // the versions continue into the next block while the separator is `key`
+        IndexCursor cursor(index.get(), block_idx);
+        for (; cursor.is_valid() && !cursor.entry().separator.compare(SliceView(key)); cursor.next()) {
+            block_idx = cursor.idx() + 1;
+        }
+    }
+    return std::min(block_idx, index->num_of_entries() - 1);
+}
+
+std::optional<Slice> SSTable::get(const SliceView& key) {
+    return this->get(key, UINT64_MAX);
+}
+
+std::optional<Slice> SSTable::get(const SliceView& key, u64 ts, bool* deleted) {
+    if (SliceView(this->first_key).compare(key) > 0 || 
+            SliceView(this->last_key).compare(key) < 0) {
+        return std::nullopt;
+    }
+    // an unreadable sstable is logged when it fails, and holds no version
+    if (!this->load_meta()) { return std::nullopt; }
+    auto tombstone = this->range_tombstones_.find(key);
+    if (!this->bloom_.contains(key.data(), key.size())) {
+        return resolve(std::nullopt, 0, ValueType::VALUE, tombstone, ts, deleted);
+    }
+
+    // first block whose separator is not less than `key`, versions of
+    // `key` continue into the following blocks while the separator is
+    // `key`. the first version visible at `ts` is the newest one.
+    auto index = this->index();
+    if (!index) { return std::nullopt; }
+    for (IndexCursor cursor(index.get(), index->locate(key)); cursor.is_valid(); cursor.next()) {
+        // the block is kept alive by `block_ptr` while its value is copied
+        auto block_ptr = this->get_block(cursor.idx());
+        // a corrupted block holds no readable version
+        if (!block_ptr) { break; }
+        u64 version_ts = 0;
+        auto type = ValueType::VALUE;
+        if (auto value = block_ptr->get(key, ts, &version_ts, &type)) {
+            return resolve(value, version_ts, type, tombstone, ts, deleted);
+        }
+        if (cursor.entry().separator.compare(key) > 0) { break; }
+    }
+    return resolve(std::nullopt, 0, ValueType::VALUE, tombstone, ts, deleted);
+}
+
+void SSTable::multi_get(const vector<Slice>& keys, vector<std::optional<Slice>>& values, u64 ts,
+        vector<bool>* deleted) {
+    vector<size_t> idxs(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) { idxs[i] = i; }
+    this->multi_get(keys, idxs, 0, idxs.size(), values, ts, deleted);
+}
+
+void SSTable::multi_get(const vector<Slice>& keys, const vector<size_t>& idxs, size_t begin, size_t end,
+        vector<std::optional<Slice>>& values, u64 ts, vector<bool>* deleted) {
+    DCHECK(keys.size() == values.size());
+    DCHECK(!deleted || deleted->size() == keys.size());
+    DCHECK(begin <= end && end <= idxs.size());
+    if (begin == end || !this->load_meta()) { return; }
+
+    // keys within the range of the sstable, their bloom buckets are
+    // fetched before any of them is probed
+    vector<size_t> candidates;
+    vector<u64> hashes;
+    for (auto j = begin; j < end; j++) {
+        auto i = idxs[j];
+        if (this->first_key.compare(keys[i]) > 0 || this->last_key.compare(keys[i]) < 0) { continue; }
+        candidates.push_back(i);
+        hashes.push_back(BlockedBloomFilter::hash(keys[i].data(), keys[i].size()));
+        this->bloom_.prefetch_hash(hashes.back());
+    }
+
+    // keys grouped by block, the sorted keys are located with one binary
+    // search per block
+    auto index = this->index();
+    if (!index) { return; }
+    vector<size_t> block_idxs;
+    vector<vector<size_t>> groups;
+    std::optional<Slice> separator;
+    for (size_t j = 0; j < candidates.size(); j++) {
+        auto i = candidates[j];
+        if (!this->bloom_.contains_hash(hashes[j])) { continue; }
+        if (!separator || separator->compare(keys[i]) < 0) {
+            auto block_idx = index->locate(SliceView(keys[i]));
+            if (block_idx == index->num_of_entries()) { break; }
+            separator = IndexCursor(index.get(), block_idx).entry().separator.to_slice();
+            block_idxs.push_back(block_idx);
+            groups.emplace_back();
+        }
+        groups.back().push_back(i);
+    }
+    auto blocks = this->get_blocks(block_idxs);
+    for (size_t b = 0; b < blocks.size(); b++) {
+        auto block_separator = IndexCursor(index.get(), block_idxs[b]).entry().separator.to_slice();
+        for (auto i : groups[b]) {
+            bool key_deleted = false;
+            // versions continuing into the next block
+            if (!block_separator.compare(keys[i])) {
+                values[i] = this->get(SliceView(keys[i]), ts, &key_deleted);
+            } else if (blocks[b]) {
+                u64 version_ts = 0;
+                auto type = ValueType::VALUE;
+                auto value = blocks[b]->get(SliceView(keys[i]), ts, &version_ts, &type);
+                values[i] = resolve(value, version_ts, type,
+                    this->range_tombstones_.find(keys[i]), ts, &key_deleted);
+            }
+            if (deleted && key_deleted) { (*deleted)[i] = true; }
+        }
+    }
+    if (!deleted || this->range_tombstones_.empty()) { return; }
+
+    // keys without a version visible here, rejected by the bloom filter
+    // among them, may still be deleted by a range tombstone
+    for (auto i : candidates) {
+        if (values[i] || (*deleted)[i]) { continue; }
+        auto tombstone = this->range_tombstones_.find(keys[i]);
+        if (tombstone && tombstone->newest(ts)) { (*deleted)[i] = true; }
+    }
+}
+
+const RangeTombstones& SSTable::range_tombstones() {
+    if (this->has_range_tombstones_) { this->load_meta(); }
+    return this->range_tombstones_;
+}
+
+shared_ptr<SSTableIterator> SSTable::create_iterator(size_t blk_idx, size_t key_idx,
+        shared_ptr<ThreadPool> readahead_pool) {
+    return make_shared<SSTableIterator>(shared_from_this(), blk_idx, key_idx, SIZE_MAX, 0, 
+        nullptr, readahead_pool);
+}
+
+size_t SSTable::num_of_blocks() {
+    return this->load_meta() ? this->num_of_blocks_ : 0;
+}
+
+u64 SSTable::table_size() { return this->file_size_; }
+
+Slice SSTable::block_separator(size_t block_idx) {
+    auto index = this->index();
+    if (!index) { return Slice(); }
+    DCHECK(block_idx < index->num_of_entries());
+    return IndexCursor(index.get(), block_idx).entry().separator.to_slice();
+}
+
+u64 SSTable::block_size(size_t block_idx) {
+    auto index = this->index();
+    if (!index) { return 0; }
+    auto range = this->block_range(*index, block_idx);
+    return range.second - range.first;
+}
 
 shared_ptr<Block> SSTable::get_block_from_encoded(size_t block_idx) {
-    DCHECK(block_idx < this->block_meta_.size());
-    auto offset = this->block_meta_[block_idx].offset;
-    auto offset_end = (block_idx == this->block_meta_.size() - 1) ?
-        this->block_meta_offset_ : this->block_meta_[block_idx + 1].offset;
-    
-    auto raw_block = this->file_obj_.read(offset, offset_end - offset - sizeof(u32));
-    auto checksum_crc_stored = this->file_obj_.read(offset_end - sizeof(u32), sizeof(u32)).get(0, sizeof(u32));
+    auto index = this->index();
+    auto file = this->file();
+    if (!index || !file || block_idx >= index->num_of_entries()) { return nullptr; }
+    auto range = this->block_range(*index, block_idx);
+    auto offset = range.first;
+    auto len = range.second - offset - BLOCK_TRAILER_SIZE;
+
+    // mapped file, a raw block borrows the mapping
+    if (auto ptr = file->view(offset)) {
+        auto checksum_crc = folly::crc32(ptr, len + sizeof(u8));
+        if (checksum_crc != decode_u32(ptr + len + sizeof(u8))) {
+            LOG(ERROR) << "checksum mismatch in block " << block_idx << " of sstable " << this->id;
+            return nullptr;
+        }
+        auto type = CompressionType(ptr[len]);
+        auto codec = get_codec(type);
+        if (!codec && type != CompressionType::NONE) {
+            LOG(ERROR) << "unknown compression of block " << block_idx << " of sstable " << this->id;
+            return nullptr;
+        }
+        if (!codec) {
+            if (!Block::is_valid_encoding(ptr, len)) {
+                LOG(ERROR) << "bad block " << block_idx << " of sstable " << this->id;
+                return nullptr;
+            }
+            return make_shared<Block>(ptr, len, file->mapping());
+        }
 
-    auto blk_ptr = make_shared<Block>(raw_block);
-    auto checksum_crc = folly::crc32(raw_block.data(), raw_block.size());
-    DCHECK(checksum_crc == checksum_crc_stored);
+        Bytes block;
+        if (!codec->decompress(ptr, len, block, MAX_BLOCK_SIZE) || 
+                !Block::is_valid_encoding(block.data(), block.size())) {
+            LOG(ERROR) << "bad block " << block_idx << " of sstable " << this->id;
+            return nullptr;
+        }
+        return make_shared<Block>(std::move(block));
+    }
 
-    return blk_ptr;
+    // block and its trailer in a single read
+    return this->decode_block(file->read(offset, len + BLOCK_TRAILER_SIZE));
+}
+
+shared_ptr<Block> SSTable::decode_block(Bytes&& raw_block) {
+    if (raw_block.size() < BLOCK_TRAILER_SIZE) {
+        LOG(ERROR) << "short block read from sstable " << this->id;
+        return nullptr;
+    }
+    auto len = raw_block.size() - BLOCK_TRAILER_SIZE;
+    auto checksum_crc_stored = raw_block.get(len + sizeof(u8), sizeof(u32));
+    auto checksum_crc = folly::crc32(raw_block.data(), len + sizeof(u8));
+    if (checksum_crc != checksum_crc_stored) {
+        LOG(ERROR) << "checksum mismatch in a block of sstable " << this->id;
+        return nullptr;
+    }
+    auto type = CompressionType(raw_block.get(len));
+    auto codec = get_codec(type);
+    Bytes block;
+    if (!codec && type != CompressionType::NONE) {
+        LOG(ERROR) << "unknown compression of a block in sstable " << this->id;
+        return nullptr;
+    } else if (!codec) {
+        raw_block.resize(len);
+        block = std::move(raw_block);
+    } else if (!codec->decompress(raw_block.data(), len, block, MAX_BLOCK_SIZE)) {
+        LOG(ERROR) << "undecodable block in sstable " << this->id;
+        return nullptr;
+    }
+    if (!Block::is_valid_encoding(block.data(), block.size())) {
+        LOG(ERROR) << "bad block in sstable " << this->id;
+        return nullptr;
+    }
+    return make_shared<Block>(std::move(block));
 }
 
 SSTableBuilder::SSTableBuilder(size_t block_size, 
             size_t estimated_key_cnt, 
-            double expected_false_positive_rate) :
+            double expected_false_positive_rate,
+            CompressionType compression) :
         builder_(BlockBuilder(block_size)),
         first_key_(),
         last_key_(),
         data_(),
         block_size_(block_size),
-        max_ts_(0) {
-    bloom_parameters param;
-    param.projected_element_count = estimated_key_cnt;
-    param.false_positive_probability = expected_false_positive_rate;
-    param.compute_optimal_parameters();
-    bloom_ = bloom_filter(param);
+        bits_per_key_(BlockedBloomFilter::bits_per_key(expected_false_positive_rate)),
+        max_ts_(0),
+        codec_(get_codec(compression)),
+        pending_offset_(0),
+        pending_(false) {
+    this->key_hashes_.reserve(estimated_key_cnt);
 }
 
-bool SSTableBuilder::add(const KeySlice& key, const Slice& value) {
+bool SSTableBuilder::add(const KeySlice& key, const Slice& value, ValueType type) {
     // block is empty, mark as first key
     if (this->first_key_.empty()) {
         this->first_key_ = key;
     }
+    if (this->pending_) {
+        this->add_index_entry();
+    }
 
     if (key.get_ts() > this->max_ts_) {
         this->max_ts_ = key.get_ts();
     }
 
-    this->bloom_.insert(key.data(), key.size());
+    this->key_hashes_.push_back(BlockedBloomFilter::hash(key.data(), key.size()));
     this->last_key_ = key;
 
     // block is full, add the key then 
     // switch to the new block 
-    if (!this->builder_.add(key, value)) {
+    if (!this->builder_.add(key, value, type)) {
         this->finish_block();
         return false;
     }
     return true;
 }
 
+void SSTableBuilder::add_range_tombstones(const RangeTombstones& tombstones) {
+    this->range_tombstones_.add(tombstones);
+    this->max_ts_ = std::max(this->max_ts_, tombstones.max_ts());
+}
+
 size_t SSTableBuilder::estimated_size() {
     return this->data_.size();
 }
@@ -228,24 +584,68 @@ size_t SSTableBuilder::estimated_size() {
 shared_ptr<SSTable> SSTableBuilder::build(
         size_t id, 
         shared_ptr<BlockCache> block_cache, 
-        const string& path) {
+        const string& path,
+        bool use_mmap,
+        shared_ptr<TableCache> table_cache,
+        bool cache_index) {
+    auto& tombstones = this->range_tombstones_;
+    // every sstable has a block, a point tombstone stands in for the
+    // entries of an sstable made of range tombstones only. it is as old as
+    // the oldest deletion of the key, so that it deletes nothing that the
+    // range tombstones do not.
+    if (this->key_hashes_.empty() && !tombstones.empty()) {
+        KeySlice key(tombstones[0].first);
+        key.set_ts(tombstones[0].timestamps.back());
+        this->add(key, Slice(), ValueType::DELETION);
+    }
+    if (this->key_hashes_.empty()) { return nullptr; }
     if (!this->last_key_.empty()) {
         this->finish_block();
     }
+    auto first_key = this->first_key_;
+    auto last_key = this->pending_key_;
+    this->add_index_entry();
+    // the key range covers the range tombstones as well
+    if (!tombstones.empty()) {
+        if (tombstones[0].first.compare(first_key) < 0) { first_key = KeySlice(tombstones[0].first); }
+        auto& last = tombstones[tombstones.size() - 1].last;
+        if (last.compare(last_key) > 0) { last_key = KeySlice(last); }
+    }
     
+    this->bloom_ = BlockedBloomFilter(this->key_hashes_.size(), this->bits_per_key_);
+    for (auto hash : this->key_hashes_) {
+        this->bloom_.insert_hash(hash);
+    }
+
     auto& buf = this->data_;
     auto meta_offset = buf.size();
 
+    Bytes index_buf;
+    this->index_builder_.serialize(index_buf);
+    Bytes tombstones_buf;
+    tombstones.encode(tombstones_buf);
+    auto meta_size = 
+        2 * (sizeof(u16) + sizeof(u64)) + first_key.size() + last_key.size() +
+        sizeof(u64) + tombstones_buf.size() + index_buf.size() + sizeof(u32);
+
     buf.reserve(
         buf.size() + // block section size
-        BlockMeta::estimated_size(this->meta) +  // meta section size
+        meta_size +  // meta section size
         sizeof(u32) + // meta offset size
         this->bloom_.estimated_size() + // bloom data size 
         sizeof(u32) // bloom offset size
     );
 
     /******************** Meta Section ********************/
-    BlockMeta::encode_block_meta(this->meta, this->max_ts_, buf);      
+    for (auto key : {&first_key, &last_key}) {
+        buf.push(key->size(), sizeof(u16));
+        buf.instream(key->data(), key->size());
+        buf.push(key->get_ts(), sizeof(u64));
+    }
+    buf.push(this->max_ts_, sizeof(u64));
+    buf.instream(tombstones_buf.outstream(), tombstones_buf.size());
+    buf.instream(index_buf.outstream(), index_buf.size());
+    buf.push(folly::crc32(buf.outstream(meta_offset), meta_size - sizeof(u32)), sizeof(u32));
     /******************** Meta Section ********************/
 
     /******************** Extra Section ********************/
@@ -257,78 +657,142 @@ shared_ptr<SSTable> SSTableBuilder::build(
     buf.push(bloom_offset, sizeof(u32));
     /******************** Extra Section ********************/
 
+    // durable along with its directory entry before anything refers to it
     FileObject file(path, false);
-    if (file.is_open()) {
-        file.write(buf);
-        file.close();
+    if (!file.is_open() || !file.write(buf) || !file.sync() || !file.close() ||
+            !sync_dir(dir_of(path))) {
+        LOG(ERROR) << "failed to write sstable " << path;
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        return nullptr;
     }
 
     return make_shared<SSTable>(
         id,
         path,
-        this->meta,
+        make_shared<IndexBlock>(std::move(index_buf)),
+        first_key,
+        last_key,
         meta_offset,
+        meta_size,
         block_cache,
         this->bloom_,
-        this->max_ts_
+        this->max_ts_,
+        tombstones,
+        use_mmap,
+        table_cache,
+        cache_index
     );
 }
 
 void SSTableBuilder::finish_block() {
     auto size_prev = this->data_.size();
-    auto encoded_block = this->builder_.build()->serialize();
-    auto checksum_crc = 
-        folly::crc32(encoded_block.data(), encoded_block.size());
+    auto encoded_block = this->builder_.serialize();
+    const Bytes* block = &encoded_block;
+    auto type = CompressionType::NONE;
+    if (this->codec_) {
+        this->compressed_.resize(0);
+        this->codec_->compress(encoded_block.data(), encoded_block.size(), this->compressed_);
+        // keep the block raw unless it shrinks by at least 1/8
+        if (this->compressed_.size() < encoded_block.size() - encoded_block.size() / 8) {
+            block = &this->compressed_;
+            type = this->codec_->type();
+        }
+    }
 
-    this->data_.reserve(size_prev + encoded_block.size() + sizeof(u32));
-    this->data_.instream(encoded_block.outstream(), encoded_block.size());
+    this->data_.reserve(size_prev + block->size() + BLOCK_TRAILER_SIZE);
+    this->data_.instream(block->outstream(), block->size());
+    this->data_.push(static_cast<u8>(type), sizeof(u8));
+    auto checksum_crc = 
+        folly::crc32(this->data_.outstream(size_prev), block->size() + sizeof(u8));
     this->data_.push(checksum_crc, sizeof(u32));
-    this->meta.emplace_back(
-        BlockMeta{
-            size_prev, 
-            this->builder_.first_key().clone(), 
-            this->last_key_.clone()
-        }
-    );
+    this->pending_key_ = this->last_key_.clone();
+    this->pending_key_.set_ts(this->last_key_.get_ts());
+    this->pending_offset_ = size_prev;
+    this->pending_ = true;
 
     this->builder_ = BlockBuilder(this->block_size_);
-    this->last_key_.clear();
+    // `last_key_` shares its bytes with the caller's key, detach instead of clearing
+    this->last_key_ = KeySlice();
 }
 
-shared_ptr<LevelIterator> Level::scan(const Bound& start, const Bound& end) {
-    if (!start.compare(end)) { return nullptr; }
+void SSTableBuilder::add_index_entry() {
+    DCHECK(this->pending_);
+    this->index_builder_.add(SliceView(this->pending_key_), this->pending_offset_);
+    this->pending_ = false;
+}
+
+bool overlaps(const Bound& lower, const Bound& upper, const Slice& first, const Slice& last) {
+    if ((lower.infin_ptr && lower.infin_ptr->inf) || (upper.infin_ptr && !upper.infin_ptr->inf)) {
+        return false;
+    }
+    if (lower.fin_ptr) {
+        auto res = SliceView(last).compare(SliceView(lower.fin_ptr->key));
+        if (res < 0 || (!res && !lower.fin_ptr->contains)) { return false; }
+    }
+    if (upper.fin_ptr) {
+        auto res = SliceView(first).compare(SliceView(upper.fin_ptr->key));
+        if (res > 0 || (!res && !upper.fin_ptr->contains)) { return false; }
+    }
+    return true;
+}
+
+shared_ptr<LevelIterator> Level::scan(const Bound& start, const Bound& end,
+        shared_ptr<const RangeTombstones> deleted, shared_ptr<ThreadPool> readahead_pool) {
+    if (!start.compare(end) || this->ssts_.empty()) { return nullptr; }
+    // outside of the bounds, no block is read
+    if (!overlaps(start, end, this->ssts_.front()->first_key, this->ssts_.back()->last_key)) {
+        return nullptr;
+    }
 
-    auto level_size = this->num_of_ssts();
-    auto last_sst_size = this->ssts_[level_size - 1]->num_of_blocks();
-    auto last_blk_size = 
-        this->ssts_[level_size - 1]->get_block(last_sst_size - 1)->num_of_keys();
     array<size_t, 3> start_idx = {0};
-    array<size_t, 3> end_idx = {
-        level_size,
-        last_sst_size,
-        last_blk_size
-    };
+    array<size_t, 3> end_idx = {0};
 
     if (start.fin_ptr) {
         start_idx[0] = this->locate_sstable(start.fin_ptr->key);
         start_idx[1] = this->ssts_[start_idx[0]]->locate_block(start.fin_ptr->key);
-        start_idx[2] = this->ssts_[start_idx[0]]->get_block(start_idx[1])->locate_key(
-            start.fin_ptr->key, 
-            start.fin_ptr->contains, 
-            true);
-    } else if (start.infin_ptr->inf) {
-        start_idx = end_idx;
-    } 
+        auto block = this->ssts_[start_idx[0]]->get_block(start_idx[1]);
+        start_idx[2] = block ? block->locate_key(start.fin_ptr->key, start.fin_ptr->contains, true) : 0;
+    }
 
     if (end.fin_ptr) {
         end_idx[0] = this->locate_sstable(end.fin_ptr->key);
-        end_idx[1] = this->ssts_[end_idx[0]]->locate_block(end.fin_ptr->key);
-        end_idx[2] = this->ssts_[end_idx[0]]->get_block(end_idx[1])->locate_key(
-            end.fin_ptr->key, 
-            end.fin_ptr->contains, 
-            false);
-    } 
-    return make_shared<LevelIterator>(shared_from_this(), start_idx, end_idx, start);
+        end_idx[1] = this->ssts_[end_idx[0]]->locate_block(end.fin_ptr->key, end.fin_ptr->contains);
+        auto block = this->ssts_[end_idx[0]]->get_block(end_idx[1]);
+        end_idx[2] = block ? block->locate_key(end.fin_ptr->key, end.fin_ptr->contains, false) : 0;
+    } else {
+        // past every entry of the level, the last block is read only here.
+        // an sstable whose meta cannot be read has no block.
+        auto level_size = this->num_of_ssts();
+        auto last_sst_size = this->ssts_[level_size - 1]->num_of_blocks();
+        auto last_blk = last_sst_size ? this->ssts_[level_size - 1]->get_block(last_sst_size - 1) : nullptr;
+        end_idx = {level_size, last_sst_size, last_blk ? last_blk->num_of_keys() : 0};
+    }
+    return make_shared<LevelIterator>(shared_from_this(), start_idx, end_idx, start, deleted, readahead_pool);
+}
+
+std::optional<Slice> Level::get(const Slice& key, bool* deleted, u64 ts) {
+    if (this->ssts_.empty()) { return std::nullopt; }
+    return this->ssts_[this->locate_sstable(key)]->get(key, ts, deleted);
+}
+
+void Level::multi_get(const vector<Slice>& keys, const vector<size_t>& idxs,
+        vector<std::optional<Slice>>& values, vector<bool>* deleted, u64 ts) {
+    DCHECK(keys.size() == values.size());
+    if (this->ssts_.empty()) { return; }
+    // the sorted keys fall into the sstables in order
+    for (size_t begin = 0; begin < idxs.size();) {
+        auto sst_idx = this->locate_sstable(KeySlice(keys[idxs[begin]]));
+        auto end = begin + 1;
+        if (sst_idx + 1 < this->ssts_.size()) {
+            auto& next_first_key = this->ssts_[sst_idx + 1]->first_key;
+            while (end < idxs.size() && next_first_key.compare(keys[idxs[end]]) > 0) { end++; }
+        } else {
+            end = idxs.size();
+        }
+        this->ssts_[sst_idx]->multi_get(keys, idxs, begin, end, values, ts, deleted);
+        begin = end;
+    }
 }
 
 shared_ptr<SSTable> Level::get_sstable(size_t idx) {
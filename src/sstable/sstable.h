@@ -9,63 +9,81 @@
 #include "block/iterator.h"
 #include "defs.h"
 #include "block/block.h"
+#include "block/index.h"
+#include "block/range_del.h"
+#include "cache/block_cache.h"
 #include "folly/container/Access.h"
 #include "mvcc/key.h"
 #include "folly/hash/Checksum.h"
-#include "folly/concurrency/ConcurrentHashMap.h"
 #include "slice.h"
-#include "util/bloom.h"
+#include "util/blocked_bloom.h"
 #include "util/bytes.h"
+#include "util/compression.h"
 #include "util/file.h"
+#include "util/io.h"
 #include <bits/types/FILE.h>
 #include <cstddef>
+#include <atomic>
 #include <ios>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 
 namespace minilsm {
 
 using std::pair;
 
-// abstract of block
-struct BlockMeta {
-public:
-    // offset of the block
-    size_t offset;
-    // first key of the block
-    KeySlice first_key;
-    // last key of the block
-    KeySlice last_key;
-
-public: 
-    static size_t estimated_size(const vector<BlockMeta>& block_meta_list);
-
-    static void encode_block_meta(const vector<BlockMeta>& block_meta_list, u64 max_ts, Bytes& buf);
-
-    static pair<vector<BlockMeta>, u64> decode_block_meta(const Bytes& buf, size_t meta_offset = 0);
-};
-
 using std::ios_base;
 
-class FileObject {
+class FileObject : public std::enable_shared_from_this<FileObject> {
 private:
     File file_;
     u64 size_;
+    // mapping of the whole file, null unless opened readonly with `use_mmap`
+    shared_ptr<MmapRegion> mmap_;
+    // backend of batched reads
+    shared_ptr<IoBackend> io_;
 
 public:
-    // default mode : overwrite
-    FileObject(const string& path, bool readonly) :
+    // default mode : overwrite. batched reads go through `io`, blocking
+    // `pread` if null.
+    FileObject(const string& path, bool readonly, bool use_mmap = false,
+            shared_ptr<IoBackend> io = nullptr) :
         file_(File(path, 
             readonly ? 
                 ios_base::in : 
                 ios_base::out | ios_base::trunc)),
-        size_(file_.size()) {}
+        size_(file_.size()),
+        io_(io ? io : IoBackend::pread_backend()) {
+        if (readonly && use_mmap) {
+            auto region = std::make_shared<MmapRegion>(this->file_);
+            if (region->is_valid()) { this->mmap_ = region; }
+        }
+    }
 
     FileObject(string&& input);
 
+    // positional read, safe to be called concurrently
     Bytes read(size_t offset, size_t len);
 
-    void write(const Bytes& buf);
+    // submit the reads of the `(offset, len)` pairs of `ranges` at once,
+    // the file stays open until they complete. a mapped file is copied
+    // from before returning.
+    shared_ptr<ReadBatch> read_async(const vector<pair<size_t, size_t>>& ranges);
+
+    const shared_ptr<IoBackend>& io_backend() const { return this->io_; }
+
+    // address of `offset` inside the mapping, null if the file is not mapped
+    const u8* view(size_t offset);
+
+    // owner of the memory returned by `view`
+    shared_ptr<const void> mapping();
+
+    bool sync();
+
+    // append `buf`, false if it is not written as a whole
+    bool write(const Bytes& buf);
 
     bool is_open();
 
@@ -77,66 +95,180 @@ public:
 using std::shared_ptr;
 using std::make_shared;
 using std::tuple;
-using BlockCache = folly::ConcurrentHashMap<size_t, shared_ptr<Block>>;
-
-/*
- * -------------------------------------------------------------------------------------------
- * |         Block Section         |          Meta Section         |          Extra          |
- * -------------------------------------------------------------------------------------------
- * | data block | ... | data block |            metadata           | meta block offset (u32) |
- * -------------------------------------------------------------------------------------------
- */
 
 class SSTableIterator;
+class TableCache;
+class ThreadPool;
+
+// compression type (u8) and crc (u32) following every data block
+constexpr size_t BLOCK_TRAILER_SIZE = sizeof(u8) + sizeof(u32);
 
 class SSTable : public std::enable_shared_from_this<SSTable> {
 public:
     // sstable id
     size_t id;
-    // first key in sstable
+    // first key in sstable, range tombstones included
     KeySlice first_key;
-    // last key in sstable
+    // last key in sstable, range tombstones included
     KeySlice last_key;
     // max timestamp in sstable
     u64 max_ts;
 
 private:
     // sstable file path
-    FileObject file_obj_;
-    // vector of block meta
-    vector<BlockMeta> block_meta_;
-    // offset of block meta
-    size_t block_meta_offset_;
+    string path_;
+    // handle owned by the sstable, null when handles come from `table_cache_`
+    shared_ptr<FileObject> file_obj_;
+    // bounded cache of open files shared by sstables, null when every
+    // sstable keeps its file open
+    shared_ptr<TableCache> table_cache_;
+    u64 file_size_;
+    // index and bloom filter are read on first use, sstables which are
+    // never read cost no io when opened
+    std::atomic<bool> meta_loaded_;
+    std::mutex meta_mtx_;
+    // the file is removed once the last reader drops the sstable
+    std::atomic<bool> obsolete_;
+    // index of the blocks, null when it is kept in the block cache
+    shared_ptr<IndexBlock> index_;
+    // store the index in the block cache, so that it can be evicted
+    bool cache_index_;
+    size_t num_of_blocks_;
+    // offset of the meta section, which follows the last block
+    size_t meta_offset_;
+    size_t meta_size_;
     // bloom filter
-    bloom_filter bloom_;
-    // block cache
+    BlockedBloomFilter bloom_;
+    // range tombstones, loaded along with the index
+    RangeTombstones range_tombstones_;
+    // false if the sstable is known to have no range tombstones, its meta
+    // is not loaded to look them up then
+    bool has_range_tombstones_;
+    // block cache shared by sstables, blocks are keyed by `id` and block
+    // index. null when blocks are not cached.
     shared_ptr<BlockCache> block_cache_;
 
 public:
-    // build sstable with block metas (without specific block) from file
-    SSTable(size_t id, shared_ptr<BlockCache> cache, const string& file_path);
+    // build sstable with block metas (without specific block) from file.
+    // with `use_mmap` the file is mapped and blocks borrow the mapping 
+    // instead of being read into private buffers
+    SSTable(size_t id, shared_ptr<BlockCache> cache, const string& file_path,
+        bool use_mmap = false);
+
+    // with a `table_cache` the file is opened through it and `use_mmap` of
+    // the table cache applies. with `cache_index` the index is kept in the
+    // block cache instead of the sstable.
+    SSTable(size_t id, const string& file_path, shared_ptr<IndexBlock> index, 
+        const KeySlice& first_key, const KeySlice& last_key, size_t meta_offset, size_t meta_size, shared_ptr<BlockCache> cache,
+        BlockedBloomFilter& bloom, u64 ts, const RangeTombstones& range_tombstones, bool use_mmap = false,
+        shared_ptr<TableCache> table_cache = nullptr, bool cache_index = false);
+
+    // sstable described by the manifest, nothing is read until the first
+    // lookup. without a `table_cache` the file is opened right away.
+    SSTable(size_t id, const KeySlice& first_key, const KeySlice& last_key, u64 max_ts,
+        u64 file_size, shared_ptr<BlockCache> cache, shared_ptr<TableCache> table_cache,
+        const string& file_path, bool cache_index = false, bool has_range_tombstones = true);
+
+    ~SSTable();
+
+    // remove the file once the sstable is dropped by every reader, by the
+    // table cache if there is one
+    void mark_obsolete() { this->obsolete_ = true; }
+
+    // null if the block is corrupted or of an unknown format
+    shared_ptr<Block> get_block(size_t block_idx);
 
-    SSTable(size_t id, const string& file_path, vector<BlockMeta>& meta, 
-        size_t meta_offset, shared_ptr<BlockCache> cache, bloom_filter& bloom, u64 ts);
+    // blocks `block_idxs`, those missing from the block cache are read in a
+    // single batch
+    vector<shared_ptr<Block>> get_blocks(const vector<size_t>& block_idxs);
 
-    shared_ptr<Block> get_block(size_t block_idx);
+    // whether `get_blocks` reads the missing blocks concurrently
+    bool has_async_io();
 
-    size_t locate_block(const KeySlice& key);
+    // block where the versions of `key` start, or end with `last`, as
+    // they may continue over several blocks
+    size_t locate_block(const KeySlice& key, bool last = false);
 
-    shared_ptr<SSTableIterator> create_iterator(size_t blk_idx = 0, size_t key_idx = 0);
+    // value of `key`, the newest version wins. keys rejected by the bloom 
+    // filter cost no block read.
+    std::optional<Slice> get(const SliceView& key);
+
+    // value of the newest version of `key` visible at timestamp `ts`, newer
+    // versions are skipped. `deleted` is set when the key is deleted by a
+    // point tombstone or a range tombstone of the sstable, older tables
+    // must not be consulted then.
+    std::optional<Slice> get(const SliceView& key, u64 ts, bool* deleted = nullptr);
+
+    // `get` of the sorted `keys`, the value of `keys[i]` is stored in
+    // `values[i]` when found and `(*deleted)[i]` is set when it is deleted.
+    // the bloom filter is probed for every key first, the blocks of the
+    // remaining keys are read in a single batch.
+    void multi_get(const vector<Slice>& keys, vector<std::optional<Slice>>& values,
+        u64 ts = UINT64_MAX, vector<bool>* deleted = nullptr);
+
+    // `multi_get` of the keys at the positions `idxs[begin, end)` of `keys`,
+    // in key order. the results are stored at the same positions.
+    void multi_get(const vector<Slice>& keys, const vector<size_t>& idxs, size_t begin, size_t end,
+        vector<std::optional<Slice>>& values, u64 ts, vector<bool>* deleted);
+
+    // range tombstones deleting the older versions of the sstable itself
+    // and the entries of older tables
+    const RangeTombstones& range_tombstones();
+
+    bool has_range_tombstones() const { return this->has_range_tombstones_; }
+
+    // blocks are read ahead on `readahead_pool` once the scan turns
+    // sequential, never without one
+    shared_ptr<SSTableIterator> create_iterator(size_t blk_idx = 0, size_t key_idx = 0,
+        shared_ptr<ThreadPool> readahead_pool = nullptr);
 
     size_t num_of_blocks();
 
     u64 table_size();
 
-#ifdef Debug
-    vector<BlockMeta>& debug_get_block_meta() { return this->block_meta_; }
+    // user key not less than the last key of block `block_idx` and not
+    // greater than the first key of the next block
+    Slice block_separator(size_t block_idx);
 
-    bloom_filter& debug_get_bloom() { return this->bloom_; }
+    // bytes taken by block `block_idx` in the file, compressed and with
+    // its trailer
+    u64 block_size(size_t block_idx);
+
+#ifdef Debug
+    BlockedBloomFilter& debug_get_bloom() { this->load_meta(); return this->bloom_; }
 #endif
 
 private:
     shared_ptr<Block> get_block_from_encoded(size_t block_idx);
+
+    // check and decompress a block read along with its trailer, null if
+    // the block does not check out
+    shared_ptr<Block> decode_block(Bytes&& raw_block);
+
+    shared_ptr<FileObject> file();
+
+    // read index and bloom filter unless they are loaded, false if they
+    // cannot be read
+    bool load_meta();
+
+    // read index and bloom filter, the max timestamp and the key range of
+    // the sstable are stored to the pointers given. false if the file
+    // cannot be read or its meta does not check out.
+    bool read_meta(u64* max_ts = nullptr, KeySlice* first_key = nullptr, KeySlice* last_key = nullptr);
+
+    // decode the index from the meta section, the max timestamp, the key
+    // range and the range tombstones stored along are returned through the
+    // pointers given. null if the meta cannot be read or is corrupted.
+    shared_ptr<IndexBlock> read_index(u64* max_ts = nullptr,
+        KeySlice* first_key = nullptr, KeySlice* last_key = nullptr,
+        RangeTombstones* range_tombstones = nullptr);
+
+    // pinned or cached index, read again once evicted
+    shared_ptr<IndexBlock> index();
+
+    // offset of block `block_idx` and of the end of it
+    pair<size_t, size_t> block_range(const IndexBlock& index, size_t block_idx);
+
 };
 
 /*
@@ -150,23 +282,24 @@ private:
  * in detail:
  *     - Block Section
  *         - data block
- *             - block data (encoded)
- *             - crc (u32)
+ *             - block data (encoded, compressed unless the type is `NONE`)
+ *             - compression type (u8, see `CompressionType`)
+ *             - crc (u32) of the block data and the compression type
  *     - Meta Section
- *         - meta number (u32)
- *         - metadata
- *             - meta offset (u32)
- *             - meta first key size (u16)
- *             - meta first key data
- *             - meta first timestamp (u64)
- *             - meta last key size (u16)
- *             - meta last key data
- *             - meta last key timestamp (u64)
+ *         - first key size (u16)
+ *         - first key data
+ *         - first key timestamp (u64)
+ *         - last key size (u16)
+ *         - last key data
+ *         - last key timestamp (u64)
  *         - max timestamp (u64)
+ *         - range tombstones (see `RangeTombstones`)
+ *         - index block (see `IndexBlock`), the offset and separator of
+ *           every data block
  *         - crc (u32)
  *     - Extra
  *         - meta section offset (u32)
- *         - bloom filter (serialized)
+ *         - bloom filter (serialized, see `BlockedBloomFilter`)
  *         - bloom filter offset (u32)
  */
 class SSTableBuilder {
@@ -181,26 +314,49 @@ private:
     Bytes data_;
     // block size threshold
     size_t block_size_;
-    // bloom filter for keys in the sstable
-    bloom_filter bloom_;
+    // bloom filter for keys in the sstable, sized by the number of keys
+    // actually added once the sstable is built
+    BlockedBloomFilter bloom_;
+    // hashes of the added keys
+    vector<u64> key_hashes_;
+    double bits_per_key_;
     // max timestamp of keys in current sstable
     u64 max_ts_;
+    // codec of the data blocks, null to write them raw
+    const Codec* codec_;
+    // compressed block, reused across blocks
+    Bytes compressed_;
+    // an entry for every finished block
+    IndexBlockBuilder index_builder_;
+    // last key of the last finished block, its index entry is added once
+    // the next block starts or the sstable is built
+    KeySlice pending_key_;
+    size_t pending_offset_;
+    bool pending_;
+    RangeTombstones range_tombstones_;
 
 public:
-    vector<BlockMeta> meta;
+    SSTableBuilder(size_t block_size, size_t estimated_key_cnt, 
+        double expected_false_positive_rate, CompressionType compression = CompressionType::NONE);
 
-public:
-    SSTableBuilder() = default;
+    // keys are added in the order of `compare_internal`, the versions of a
+    // key from the newest
+    bool add(const KeySlice& key, const Slice& value, ValueType type = ValueType::VALUE);
 
-    SSTableBuilder(size_t block_size, size_t estimated_key_cnt, 
-        double expected_false_positive_rate);
+    // range tombstones of the sstable, stored in its meta section
+    void add_range_tombstones(const RangeTombstones& tombstones);
 
-    bool add(const KeySlice& key, const Slice& value);
+    bool has_range_tombstones() const { return !this->range_tombstones_.empty(); }
 
     size_t estimated_size();
 
+    bool is_empty() const { return this->key_hashes_.empty() && this->range_tombstones_.empty(); }
+
+    // write the sstable to `path`, null if nothing was added or the file
+    // cannot be written
     shared_ptr<SSTable> build(size_t id, shared_ptr<BlockCache> block_cache, 
-        const string& path);
+        const string& path, bool use_mmap = false, shared_ptr<TableCache> table_cache = nullptr,
+        bool cache_index = false);
 
 #ifdef Debug
     KeySlice debug_get_first_key() {
@@ -216,8 +372,17 @@ public:
 private:
 #endif
     void finish_block();
+
+private:
+    // add the index entry of the last finished block, its last key is the
+    // separator. keys are ordered by length first, a shorter separator
+    // bounding the block would not exist.
+    void add_index_entry();
 };
 
+// the keys from `first` to `last` meet the range between `lower` and `upper`
+bool overlaps(const Bound& lower, const Bound& upper, const Slice& first, const Slice& last);
+
 class Level : public std::enable_shared_from_this<Level> {
 public:
     size_t id;
@@ -226,15 +391,36 @@ private:
     vector<shared_ptr<SSTable>> ssts_;
 
 public:
-    Level(int id, vector<shared_ptr<SSTable>>& sstables) :
+    Level(size_t id, vector<shared_ptr<SSTable>>& sstables) :
         id(id),
         ssts_(sstables) {}
     
     size_t num_of_ssts();
 
+    // sstables of the level sorted by key
+    const vector<shared_ptr<SSTable>>& sstables() const { return this->ssts_; }
+
+    // every version between the bounds, including point tombstones. keys
+    // covered by `deleted` (tombstones of newer tables) are skipped. blocks
+    // are read ahead on `readahead_pool`, never past the upper bound. null
+    // if no sstable lies within the bounds.
     shared_ptr<LevelIterator> scan(
         const Bound& lower = Bound(false), 
-        const Bound& upper = Bound(true));
+        const Bound& upper = Bound(true),
+        shared_ptr<const RangeTombstones> deleted = nullptr,
+        shared_ptr<ThreadPool> readahead_pool = nullptr);
+
+    // value of the newest version of `key` visible at `ts` in the level,
+    // at most one sstable is read. `deleted` is set when the key is deleted
+    // by the level.
+    std::optional<Slice> get(const Slice& key, bool* deleted = nullptr, u64 ts = UINT64_MAX);
+
+    // `get` of the keys at the positions `idxs` of `keys`, in key order. the
+    // value of `keys[i]` is stored in `values[i]` when found and
+    // `(*deleted)[i]` is set when it is deleted. the keys of every sstable
+    // are looked up together.
+    void multi_get(const vector<Slice>& keys, const vector<size_t>& idxs,
+        vector<std::optional<Slice>>& values, vector<bool>* deleted = nullptr, u64 ts = UINT64_MAX);
 
     shared_ptr<SSTable> get_sstable(size_t idx);
 
@@ -0,0 +1,524 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-12 10:21:47
+ * @Description: implementation of leveled and tiered compaction
+ */
+
+#include "iterator/merge.h"
+#include "sstable/iterator.h"
+#include "storage/storage.h"
+#include <algorithm>
+
+namespace minilsm {
+
+static bool overlaps(const shared_ptr<SSTable>& sst, const KeySlice& first, const KeySlice& last) {
+    return sst->last_key.compare(first) >= 0 && sst->first_key.compare(last) <= 0;
+}
+
+static u64 total_size(const vector<shared_ptr<SSTable>>& ssts) {
+    u64 size = 0;
+    for (auto& sst : ssts) { size += sst->table_size(); }
+    return size;
+}
+
+u64 LsmStorage::level_target_size(size_t level) const {
+    DCHECK(level >= 1);
+    u64 size = this->options_.level_size_base;
+    for (size_t i = 1; i < level; i++) {
+        size *= this->options_.level_size_multiplier;
+    }
+    return size;
+}
+
+size_t LsmStorage::num_of_sorted_runs(const StorageState& state) const {
+    auto res = state.l0_sstables.size();
+    if (this->options_.compaction_style == CompactionStyle::TIERED) {
+        res += state.levels.size();
+    }
+    return res;
+}
+
+void LsmStorage::wait_for_compaction() {
+    if (!this->options_.num_compaction_threads) { return; }
+    std::unique_lock<mutex> lock(this->state_lock_);
+    this->compaction_cv_.wait(lock, [this]() {
+        return this->closed_ ||
+            (this->compacting_.empty() && (this->compaction_failed_ || !this->pick_compaction()));
+    });
+}
+
+void LsmStorage::compaction_loop() {
+    while (true) {
+        std::optional<CompactionTask> task;
+        {
+            std::unique_lock<mutex> lock(this->state_lock_);
+            // a failed compaction would be picked again and fail the same way
+            this->compaction_cv_.wait(lock, [&]() {
+                return this->closed_ || this->compaction_failed_ ||
+                    (task = this->pick_compaction()).has_value();
+            });
+            if (!task) { return; }
+            for (auto& sst : task->inputs()) { this->compacting_.insert(sst->id); }
+            // snapshots created later read at newer timestamps
+            task->oldest_ts = this->oracle_->oldest_ts();
+        }
+        auto outputs = this->run_compaction(*task);
+        if (outputs) {
+            this->install_compaction(*task, *outputs);
+        } else {
+            // the inputs stay in place
+            LOG(ERROR) << "failed to write the outputs of a compaction";
+            {
+                std::lock_guard<mutex> lock(this->state_lock_);
+                for (auto& sst : task->inputs()) { this->compacting_.erase(sst->id); }
+                this->compaction_failed_ = true;
+            }
+            this->compaction_cv_.notify_all();
+            this->flush_cv_.notify_all();
+        }
+        // the inputs are dropped here unless a reader still holds them
+        task.reset();
+        outputs.reset();
+        this->table_cache_->purge_obsolete();
+    }
+}
+
+std::optional<CompactionTask> LsmStorage::pick_compaction() {
+    if (this->options_.compaction_style == CompactionStyle::TIERED) {
+        return this->pick_tiered_compaction();
+    }
+    return this->pick_leveled_compaction();
+}
+
+std::optional<CompactionTask> LsmStorage::pick_leveled_compaction() {
+    auto state = this->snapshot();
+    auto is_compacting = [this](const shared_ptr<SSTable>& sst) {
+        return this->compacting_.count(sst->id) > 0;
+    };
+
+    // lower sstables of a task, empty if one of them is taken already
+    auto collect_lower = [&](CompactionTask& task, const KeySlice& first, const KeySlice& last) {
+        for (auto& sst : state->levels[task.level]->sstables()) {
+            if (!overlaps(sst, first, last)) { continue; }
+            if (is_compacting(sst)) { return false; }
+            task.lower.push_back(sst);
+        }
+        return true;
+    };
+
+    // levels with a score of at least 1, the most urgent first. the last
+    // level is never compacted.
+    vector<pair<double, size_t>> scores;
+    if (!state->l0_sstables.empty()) {
+        scores.emplace_back(
+            double(state->l0_sstables.size()) / this->options_.level0_compaction_trigger, 0);
+    }
+    for (size_t level = 1; level < this->options_.max_levels; level++) {
+        auto& ssts = state->levels[level - 1]->sstables();
+        if (ssts.empty()) { continue; }
+        scores.emplace_back(double(total_size(ssts)) / this->level_target_size(level), level);
+    }
+    std::sort(scores.begin(), scores.end(), [](auto& a, auto& b) { return a.first > b.first; });
+
+    // whether no level below `level + 1` overlaps the inputs of `task`
+    auto is_bottommost = [&](const CompactionTask& task) {
+        auto inputs = task.inputs();
+        auto first = inputs[0]->first_key, last = inputs[0]->last_key;
+        for (auto& sst : inputs) {
+            if (sst->first_key.compare(first) < 0) { first = sst->first_key; }
+            if (sst->last_key.compare(last) > 0) { last = sst->last_key; }
+        }
+        for (size_t i = task.level + 1; i < state->levels.size(); i++) {
+            for (auto& sst : state->levels[i]->sstables()) {
+                if (overlaps(sst, first, last)) { return false; }
+            }
+        }
+        return true;
+    };
+
+    for (auto [score, level] : scores) {
+        if (score < 1) { break; }
+        CompactionTask task{level, {}, {}, {}};
+
+        if (!level) {
+            // a running L0 compaction holds every sstable of L0 flushed
+            // before it started
+            if (std::any_of(state->l0_sstables.begin(), state->l0_sstables.end(), is_compacting)) {
+                continue;
+            }
+            task.upper = state->l0_sstables;
+            auto first = task.upper[0]->first_key, last = task.upper[0]->last_key;
+            for (auto& sst : task.upper) {
+                if (sst->first_key.compare(first) < 0) { first = sst->first_key; }
+                if (sst->last_key.compare(last) > 0) { last = sst->last_key; }
+            }
+            if (!collect_lower(task, first, last)) { continue; }
+        } else {
+            // start after the key range compacted last time
+            auto& ssts = state->levels[level - 1]->sstables();
+            size_t start = 0;
+            if (auto& pointer = this->compact_pointers_[level]) {
+                while (start < ssts.size() && ssts[start]->first_key.compare(*pointer) <= 0) {
+                    start++;
+                }
+            }
+            for (size_t i = 0; i < ssts.size() && task.upper.empty(); i++) {
+                auto& sst = ssts[(start + i) % ssts.size()];
+                if (is_compacting(sst)) { continue; }
+                task.lower.clear();
+                if (collect_lower(task, sst->first_key, sst->last_key)) {
+                    task.upper.push_back(sst);
+                }
+            }
+            if (task.upper.empty()) { continue; }
+        }
+
+        task.bottommost = is_bottommost(task);
+        return task;
+    }
+    return std::nullopt;
+}
+
+std::optional<CompactionTask> LsmStorage::pick_tiered_compaction() {
+    auto state = this->snapshot();
+    auto& l0 = state->l0_sstables;
+    auto& levels = state->levels;
+
+    // sorted runs from the newest to the oldest: every L0 sstable is a run
+    // of its own, followed by the runs in `levels`
+    auto n = this->num_of_sorted_runs(*state);
+    if (n < std::max<size_t>(this->options_.level0_compaction_trigger, 2)) { return std::nullopt; }
+
+    vector<u64> sizes(n);
+    vector<bool> compacting(n);
+    for (size_t i = 0; i < n; i++) {
+        const auto& ssts = i < l0.size() ?
+            vector<shared_ptr<SSTable>>{l0[i]} :
+            levels[i - l0.size()]->sstables();
+        sizes[i] = total_size(ssts);
+        compacting[i] = std::any_of(ssts.begin(), ssts.end(), [this](auto& sst) {
+            return this->compacting_.count(sst->id) > 0;
+        });
+    }
+
+    // merge the runs in [begin, end). the output is a run of `levels`, so
+    // a task starting in L0 takes every older L0 sstable as well.
+    auto make_task = [&](size_t begin, size_t end) -> std::optional<CompactionTask> {
+        if (begin < l0.size()) { end = std::max(end, l0.size()); }
+        if (std::any_of(compacting.begin() + begin, compacting.begin() + end, [](bool c) { return c; })) {
+            return std::nullopt;
+        }
+        CompactionTask task{0, {}, {}, {}};
+        for (size_t i = begin; i < end; i++) {
+            if (i < l0.size()) {
+                task.upper.push_back(l0[i]);
+            } else {
+                task.runs.push_back(levels[i - l0.size()]);
+            }
+        }
+        task.bottommost = end == n;
+        return task;
+    };
+
+    // the space taken by the runs but the oldest one would be reclaimed by
+    // a full compaction in the worst case
+    u64 newer = 0;
+    for (size_t i = 0; i + 1 < n; i++) { newer += sizes[i]; }
+    if (newer * 100 >= this->options_.max_size_amplification_percent * sizes[n - 1]) {
+        if (auto task = make_task(0, n)) { return task; }
+    }
+
+    // merge the newest runs of similar size, a run joins the candidate
+    // when it is not much larger than the runs picked before it
+    for (size_t begin = 0; begin < n; begin++) {
+        if (compacting[begin]) { continue; }
+        auto candidate = sizes[begin];
+        auto end = begin + 1;
+        while (end < n && end - begin < this->options_.max_merge_width && !compacting[end] &&
+                sizes[end] * 100 <= candidate * (100 + this->options_.size_ratio_percent)) {
+            candidate += sizes[end];
+            end++;
+        }
+        if (end - begin < std::max<size_t>(this->options_.min_merge_width, 2)) { continue; }
+        if (auto task = make_task(begin, end)) { return task; }
+    }
+
+    // too many runs anyway, merge the newest ones to get below the trigger
+    auto width = std::max<size_t>(n - this->options_.level0_compaction_trigger + 1, 2);
+    return make_task(0, std::min(width, n));
+}
+
+vector<KeySlice> LsmStorage::split_compaction(const CompactionTask& task) {
+    // every block is an anchor at its separator weighted by its size
+    vector<pair<KeySlice, u64>> anchors;
+    u64 total = 0;
+    for (auto& sst : task.inputs()) {
+        for (size_t i = 0; i < sst->num_of_blocks(); i++) {
+            anchors.emplace_back(KeySlice(sst->block_separator(i)), sst->block_size(i));
+            total += anchors.back().second;
+        }
+    }
+
+    // a subcompaction writes at least one full sstable
+    auto num_of_ranges = std::min<u64>(this->options_.max_subcompactions,
+        std::max<u64>(total / std::max<u64>(this->options_.target_file_size, 1), 1));
+    vector<KeySlice> bounds;
+    if (num_of_ranges <= 1) { return bounds; }
+
+    std::sort(anchors.begin(), anchors.end(), [](auto& a, auto& b) {
+        return a.first.compare(b.first) < 0;
+    });
+    u64 acc = 0;
+    for (auto& [key, size] : anchors) {
+        if (bounds.size() + 1 == num_of_ranges) { break; }
+        if (acc >= total * (bounds.size() + 1) / num_of_ranges && acc &&
+                (bounds.empty() || key.compare(bounds.back()) > 0)) {
+            bounds.push_back(key);
+        }
+        acc += size;
+    }
+    return bounds;
+}
+
+std::optional<vector<shared_ptr<SSTable>>> LsmStorage::run_compaction(const CompactionTask& task) {
+    auto bounds = this->split_compaction(task);
+    if (bounds.empty()) {
+        return this->run_subcompaction(task, Bound(false), Bound(true));
+    }
+
+    // range `i` is [bounds[i - 1], bounds[i]), the first one runs on the
+    // current thread. bounds are user keys, the versions of a key fall in
+    // a single range.
+    DCHECK(this->subcompaction_pool_);
+    this->num_of_subcompactions_ += bounds.size() + 1;
+    vector<std::optional<vector<shared_ptr<SSTable>>>> outputs(bounds.size() + 1);
+    vector<std::future<void>> pending;
+    for (size_t i = 1; i <= bounds.size(); i++) {
+        pending.push_back(this->subcompaction_pool_->submit([&, i]() {
+            outputs[i] = this->run_subcompaction(task,
+                Bound(bounds[i - 1]),
+                i < bounds.size() ? Bound(bounds[i], false) : Bound(true));
+        }));
+    }
+    outputs[0] = this->run_subcompaction(task, Bound(false), Bound(bounds[0], false));
+    for (auto& res : pending) { res.wait(); }
+
+    // the outputs of the other ranges are dropped along with a failed one
+    vector<shared_ptr<SSTable>> res;
+    bool failed = false;
+    for (auto& output : outputs) {
+        if (!output) {
+            failed = true;
+            continue;
+        }
+        res.insert(res.end(), output->begin(), output->end());
+    }
+    if (failed) {
+        for (auto& sst : res) { sst->mark_obsolete(); }
+        return std::nullopt;
+    }
+    return res;
+}
+
+std::optional<vector<shared_ptr<SSTable>>> LsmStorage::run_subcompaction(const CompactionTask& task,
+        const Bound& lower_bound, const Bound& upper_bound) {
+    // versions older than the one visible at `oldest_ts` are never read
+    auto oldest_ts = task.oldest_ts;
+
+    // newer data goes first, so that it wins on equal versions. every run
+    // skips the keys deleted by the range tombstones of the newer runs that
+    // every snapshot sees.
+    vector<shared_ptr<Iterator>> iters;
+    // range tombstones of the runs added so far, within the bounds
+    RangeTombstones tombstones;
+    auto add_run = [&](size_t id, vector<shared_ptr<SSTable>> ssts) {
+        if (ssts.empty()) { return; }
+        auto visible = tombstones.visible(oldest_ts);
+        auto deleted = visible.empty() ? nullptr : std::make_shared<const RangeTombstones>(std::move(visible));
+        if (auto iter = std::make_shared<Level>(id, ssts)->scan(lower_bound, upper_bound, deleted,
+                this->readahead_pool_)) {
+            iters.push_back(iter);
+        }
+        for (auto& sst : ssts) {
+            if (!sst->has_range_tombstones()) { continue; }
+            tombstones.add(sst->range_tombstones().clip(lower_bound, upper_bound));
+        }
+    };
+    if (!task.level) {
+        for (auto& sst : task.upper) { add_run(0, {sst}); }
+    } else {
+        add_run(task.level, task.upper);
+    }
+    add_run(task.level + 1, task.lower);
+    for (auto& run : task.runs) { add_run(run->id, run->sstables()); }
+    MergeMultiIterator iter(iters);
+    // the deletions left in the outputs
+    auto kept = tombstones.compact(oldest_ts, task.bottommost);
+
+    vector<shared_ptr<SSTable>> outputs;
+    bool failed = false;
+    std::unique_ptr<SSTableBuilder> builder;
+    // first key of the output being written, none for the first output
+    std::optional<Slice> cut;
+    // an output is cut at the first key following it, which bounds the
+    // range tombstones it takes
+    auto finish = [&](const Bound& upper) {
+        builder->add_range_tombstones(cut ?
+            kept.clip(Bound(*cut), upper) :
+            kept.clip(lower_bound, upper));
+        auto id = this->next_id_++;
+        auto empty = builder->is_empty();
+        auto sst = builder->build(id, this->block_cache_, this->sst_path(id),
+            this->options_.use_mmap, this->table_cache_, this->options_.cache_index_blocks);
+        if (sst) {
+            outputs.push_back(sst);
+        } else if (!empty) {
+            failed = true;
+        }
+        builder.reset();
+    };
+
+    // runs of the tiered style are logged as L1
+    auto compression = this->compression_of(
+        this->options_.compaction_style == CompactionStyle::TIERED ? 1 : task.level + 1);
+    auto new_builder = [&]() {
+        builder = std::make_unique<SSTableBuilder>(this->options_.block_size, 0,
+            this->options_.bloom_false_positive_rate, compression);
+    };
+    RangeTombstoneCursor cursor(std::make_shared<const RangeTombstones>(std::move(tombstones)));
+    // key of the previous entry, and whether a version of it visible at
+    // `oldest_ts` is met already
+    vector<u8> last_key;
+    bool has_last_key = false;
+    bool visible_met = false;
+    bool full = false;
+    for (; iter.is_valid(); iter.next()) {
+        auto key_view = iter.key_view();
+        auto type = iter.value_type();
+        auto new_key = !has_last_key || SliceView(last_key.data(), last_key.size()).compare(key_view);
+        if (new_key) {
+            last_key.assign(key_view.data(), key_view.data() + key_view.size());
+            has_last_key = true;
+            visible_met = false;
+        }
+        // the versions newer than `oldest_ts` may be read by some snapshot,
+        // of the older ones only the newest, which every snapshot reading
+        // the key at all sees
+        if (key_view.get_ts() <= oldest_ts) {
+            if (visible_met) { continue; }
+            visible_met = true;
+            // deleted for every snapshot, the deletion stays in `kept`
+            auto tombstone = cursor.seek(key_view);
+            if (tombstone && tombstone->deletes(key_view.get_ts(), oldest_ts)) { continue; }
+            // nothing older is left for a point tombstone to delete
+            if (task.bottommost && type == ValueType::DELETION) { continue; }
+        }
+
+        KeySlice key(key_view);
+        // the versions of a key are never split between outputs, whose
+        // key ranges would overlap otherwise
+        if (full && new_key) {
+            finish(Bound(key, false));
+            if (failed) { break; }
+            cut = key;
+            full = false;
+        }
+        if (!builder) { new_builder(); }
+        builder->add(key, iter.value(), type);
+        full = builder->estimated_size() >= this->options_.target_file_size;
+    }
+    // an output made of range tombstones only
+    if (!builder && !kept.empty()) { new_builder(); }
+    if (builder && !failed) { finish(upper_bound); }
+    if (failed) {
+        for (auto& sst : outputs) { sst->mark_obsolete(); }
+        return std::nullopt;
+    }
+    return outputs;
+}
+
+void LsmStorage::install_compaction(const CompactionTask& task,
+        const vector<shared_ptr<SSTable>>& outputs) {
+    auto inputs = task.inputs();
+    std::unordered_set<u64> removed;
+    for (auto& sst : inputs) { removed.insert(sst->id); }
+    auto is_removed = [&](const shared_ptr<SSTable>& sst) { return removed.count(sst->id) > 0; };
+
+    bool tiered = this->options_.compaction_style == CompactionStyle::TIERED;
+    // a merged run holds data as new as the newest of its inputs
+    u64 run_id = 0;
+    if (tiered) {
+        for (auto& sst : task.upper) { run_id = std::max<u64>(run_id, sst->id + 1); }
+        for (auto& run : task.runs) { run_id = std::max<u64>(run_id, run->id); }
+    }
+
+    {
+        std::lock_guard<mutex> lock(this->state_lock_);
+        VersionEdit edit;
+        for (auto& sst : outputs) {
+            edit.added.push_back(tiered ?
+                FileMeta::of(sst, 1, run_id) :
+                FileMeta::of(sst, task.level + 1));
+        }
+        for (auto& sst : inputs) { edit.removed.push_back(sst->id); }
+        edit.next_id = this->next_id_;
+        if (!this->manifest_->append(edit)) {
+            LOG(ERROR) << "failed to log a compaction";
+            // leave the inputs in place, the outputs are dropped
+            for (auto id : removed) { this->compacting_.erase(id); }
+            for (auto& sst : outputs) { sst->mark_obsolete(); }
+            this->compaction_failed_ = true;
+            this->compaction_cv_.notify_all();
+            this->flush_cv_.notify_all();
+            return;
+        }
+
+        auto state = std::make_shared<StorageState>(*this->snapshot());
+        auto& l0 = state->l0_sstables;
+        l0.erase(std::remove_if(l0.begin(), l0.end(), is_removed), l0.end());
+
+        if (tiered) {
+            // the output takes the place of the merged runs, runs flushed
+            // or merged meanwhile are located elsewhere
+            auto& levels = state->levels;
+            auto pos = levels.begin();
+            if (!task.runs.empty()) {
+                pos = std::find(levels.begin(), levels.end(), task.runs[0]);
+                DCHECK(pos + task.runs.size() <= levels.end());
+                pos = levels.erase(pos, pos + task.runs.size());
+            }
+            if (!outputs.empty()) {
+                auto ssts = outputs;
+                levels.insert(pos, std::make_shared<Level>(run_id, ssts));
+            }
+        } else {
+            if (task.level) {
+                auto upper = state->levels[task.level - 1]->sstables();
+                upper.erase(std::remove_if(upper.begin(), upper.end(), is_removed), upper.end());
+                state->levels[task.level - 1] = std::make_shared<Level>(task.level, upper);
+                this->compact_pointers_[task.level] = task.upper.back()->last_key;
+            }
+
+            // outputs cover the key range of `lower`, which no other
+            // sstable of the level overlaps
+            auto lower = state->levels[task.level]->sstables();
+            lower.erase(std::remove_if(lower.begin(), lower.end(), is_removed), lower.end());
+            lower.insert(lower.end(), outputs.begin(), outputs.end());
+            std::sort(lower.begin(), lower.end(), [](auto& a, auto& b) {
+                return a->first_key.compare(b->first_key) < 0;
+            });
+            state->levels[task.level] = std::make_shared<Level>(task.level + 1, lower);
+        }
+
+        this->install_state(state);
+        for (auto id : removed) { this->compacting_.erase(id); }
+    }
+    this->compaction_cv_.notify_all();
+    this->flush_cv_.notify_all();
+
+    // snapshots still holding the inputs keep reading them, the files are
+    // removed once the last snapshot is gone
+    for (auto& sst : inputs) { sst->mark_obsolete(); }
+}
+
+}
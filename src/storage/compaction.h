@@ -0,0 +1,63 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-12 10:21:47
+ * @Description: compaction tasks of lsm storage
+ */
+#ifndef STORAGE_COMPACTION_H
+#define STORAGE_COMPACTION_H
+
+#include "defs.h"
+#include "sstable/sstable.h"
+#include <memory>
+#include <vector>
+
+namespace minilsm {
+
+using std::shared_ptr;
+using std::vector;
+
+enum class CompactionStyle : u8 {
+    // every level below L0 is a single sorted run, exponentially larger
+    // than the one above
+    LEVELED,
+    // sorted runs of similar size are merged into a larger run, which
+    // rewrites less data than leveled compaction but leaves more runs
+    // for reads to merge
+    TIERED,
+};
+
+// sstables picked by one compaction.
+// leveled: `upper` of `level` and `lower` are merged into `level + 1`.
+// tiered: the L0 sstables in `upper` and the sorted `runs` are merged into
+// a single run, `level` is unused.
+struct CompactionTask {
+    // level compacted from, 0 for L0
+    size_t level;
+    // sstables taken from `level`, newest first for L0 and sorted by key
+    // otherwise
+    vector<shared_ptr<SSTable>> upper;
+    // sstables of `level + 1` overlapping `upper`, sorted by key
+    vector<shared_ptr<SSTable>> lower;
+    // adjacent runs of `StorageState::levels`, newest first
+    vector<shared_ptr<Level>> runs;
+    // no table older than the inputs holds a key of their range, so that
+    // tombstones have nothing left to delete and are dropped
+    bool bottommost = false;
+    // oldest timestamp still read once the task is picked, only the newest
+    // version visible at it and the newer ones are kept
+    u64 oldest_ts = UINT64_MAX;
+
+    // every sstable of the task
+    vector<shared_ptr<SSTable>> inputs() const {
+        auto res = this->upper;
+        res.insert(res.end(), this->lower.begin(), this->lower.end());
+        for (auto& run : this->runs) {
+            res.insert(res.end(), run->sstables().begin(), run->sstables().end());
+        }
+        return res;
+    }
+};
+
+}
+
+#endif
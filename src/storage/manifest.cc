@@ -0,0 +1,188 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-16 09:12:30
+ * @Description: implementation of manifest
+ */
+
+#include "storage/manifest.h"
+#include "folly/hash/Checksum.h"
+#include <filesystem>
+#include <limits>
+
+namespace minilsm {
+
+static const size_t RECORD_HEADER_SIZE = sizeof(u32) + sizeof(u32);
+static const u32 MANIFEST_MAGIC = 0x4d4e4654;
+static const size_t FILE_HEADER_SIZE = sizeof(u32) + sizeof(u32);
+
+static void encode_key(const KeySlice& key, Bytes& buf) {
+    DCHECK(key.size() <= std::numeric_limits<u16>::max());
+    buf.push(key.size(), sizeof(u16));
+    buf.instream(key.data(), key.size());
+    buf.push(key.get_ts(), sizeof(u64));
+}
+
+static bool decode_key(const u8* src, size_t len, size_t& pos, KeySlice& key) {
+    if (pos + sizeof(u16) > len) { return false; }
+    auto key_len = decode_u16(src + pos);
+    pos += sizeof(u16);
+    if (pos + key_len + sizeof(u64) > len) { return false; }
+    key = KeySlice(src + pos, key_len);
+    pos += key_len;
+    key.set_ts(decode_u64(src + pos));
+    pos += sizeof(u64);
+    return true;
+}
+
+void VersionEdit::encode(Bytes& buf) const {
+    buf.push(this->added.size(), sizeof(u32));
+    for (auto& file : this->added) {
+        buf.push(file.id, sizeof(u64));
+        buf.push(file.level, sizeof(u32));
+        buf.push(file.run, sizeof(u64));
+        encode_key(file.first_key, buf);
+        encode_key(file.last_key, buf);
+        buf.push(file.max_ts, sizeof(u64));
+        buf.push(file.size, sizeof(u64));
+        buf.push(file.has_range_tombstones, sizeof(u8));
+    }
+    buf.push(this->removed.size(), sizeof(u32));
+    for (auto id : this->removed) {
+        buf.push(id, sizeof(u64));
+    }
+    buf.push(this->next_id, sizeof(u64));
+}
+
+bool VersionEdit::decode(const u8* src, size_t len) {
+    size_t pos = 0;
+    if (pos + sizeof(u32) > len) { return false; }
+    auto num_added = decode_u32(src + pos);
+    pos += sizeof(u32);
+    for (u32 i = 0; i < num_added; i++) {
+        FileMeta file;
+        if (pos + sizeof(u64) + sizeof(u32) + sizeof(u64) > len) { return false; }
+        file.id = decode_u64(src + pos); pos += sizeof(u64);
+        file.level = decode_u32(src + pos); pos += sizeof(u32);
+        file.run = decode_u64(src + pos); pos += sizeof(u64);
+        if (!decode_key(src, len, pos, file.first_key)) { return false; }
+        if (!decode_key(src, len, pos, file.last_key)) { return false; }
+        if (pos + sizeof(u64) + sizeof(u64) + sizeof(u8) > len) { return false; }
+        file.max_ts = decode_u64(src + pos); pos += sizeof(u64);
+        file.size = decode_u64(src + pos); pos += sizeof(u64);
+        file.has_range_tombstones = src[pos]; pos += sizeof(u8);
+        this->added.push_back(std::move(file));
+    }
+
+    if (pos + sizeof(u32) > len) { return false; }
+    auto num_removed = decode_u32(src + pos);
+    pos += sizeof(u32);
+    if (pos + num_removed * sizeof(u64) + sizeof(u64) > len) { return false; }
+    for (u32 i = 0; i < num_removed; i++) {
+        this->removed.push_back(decode_u64(src + pos));
+        pos += sizeof(u64);
+    }
+    this->next_id = decode_u64(src + pos);
+    return pos + sizeof(u64) == len;
+}
+
+Manifest::Manifest(const string& path) : 
+        file_(path, std::ios_base::out | std::ios_base::app),
+        size_(file_.size()),
+        broken_(false) {}
+
+std::optional<vector<VersionEdit>> Manifest::recover(const string& path) {
+    vector<VersionEdit> edits;
+    if (!std::filesystem::exists(path)) { return edits; }
+    File file(path, std::ios_base::in);
+    if (!file.is_open()) { return std::nullopt; }
+    auto len = file.size();
+    auto buf = file.read(0, len);
+    if (buf.size() != len) { return std::nullopt; }
+    if (len < FILE_HEADER_SIZE || buf.get(0, sizeof(u32)) != MANIFEST_MAGIC) {
+        LOG(ERROR) << path << " is not a manifest";
+        return std::nullopt;
+    }
+    auto version = buf.get(sizeof(u32), sizeof(u32));
+    if (version != MANIFEST_FORMAT_VERSION) {
+        LOG(ERROR) << "unsupported version " << version << " of manifest " << path;
+        return std::nullopt;
+    }
+
+    size_t idx = FILE_HEADER_SIZE;
+    while (idx + RECORD_HEADER_SIZE <= len) {
+        auto checksum_crc_stored = buf.get(idx, sizeof(u32));
+        auto payload_len = buf.get(idx + sizeof(u32), sizeof(u32));
+        if (idx + RECORD_HEADER_SIZE + payload_len > len) { break; }
+        auto checksum_crc = folly::crc32(
+            buf.outstream(idx + sizeof(u32)), sizeof(u32) + payload_len);
+        auto end = idx + RECORD_HEADER_SIZE + payload_len;
+        if (checksum_crc != checksum_crc_stored) {
+            // only the last record may be torn
+            if (end == len) { break; }
+            return std::nullopt;
+        }
+
+        VersionEdit edit;
+        if (!edit.decode(buf.outstream(idx + RECORD_HEADER_SIZE), payload_len)) { return std::nullopt; }
+        edits.push_back(std::move(edit));
+        idx = end;
+    }
+    return edits;
+}
+
+std::unique_ptr<Manifest> Manifest::create(const string& path, const VersionEdit& snapshot) {
+    // the old manifest stays valid until the new one is renamed over it
+    auto tmp_path = path + ".tmp";
+    {
+        Bytes buf;
+        buf.push(MANIFEST_MAGIC, sizeof(u32));
+        buf.push(MANIFEST_FORMAT_VERSION, sizeof(u32));
+        encode_record(snapshot, buf);
+        File file(tmp_path, std::ios_base::out | std::ios_base::trunc);
+        if (!file.write(buf.outstream(), buf.size()) || !file.sync()) { return nullptr; }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) { return nullptr; }
+
+    auto dir = std::filesystem::path(path).parent_path().string();
+    if (!sync_dir(dir.empty() ? "." : dir)) { return nullptr; }
+
+    std::unique_ptr<Manifest> manifest(new Manifest(path));
+    if (!manifest->file_.is_open()) { return nullptr; }
+    return manifest;
+}
+
+bool Manifest::append(const VersionEdit& edit) {
+    if (this->broken_) { return false; }
+#ifdef Debug
+    if (this->debug_appends_left_) {
+        if (!*this->debug_appends_left_) { return false; }
+        (*this->debug_appends_left_)--;
+    }
+#endif
+    Bytes buf;
+    encode_record(edit, buf);
+    if (this->file_.write(buf.outstream(), buf.size()) && this->file_.sync()) {
+        this->size_ += buf.size();
+        return true;
+    }
+
+    // a partial record followed by the next one would read as corruption
+    this->broken_ = ftruncate(this->file_.fd(), this->size_) || !this->file_.sync();
+    return false;
+}
+
+void Manifest::encode_record(const VersionEdit& edit, Bytes& buf) {
+    auto start = buf.size();
+    buf.push(0, sizeof(u32)); // crc placeholder
+    buf.push(0, sizeof(u32)); // length placeholder
+    edit.encode(buf);
+
+    auto payload_len = buf.size() - start - RECORD_HEADER_SIZE;
+    buf.push(start + sizeof(u32), payload_len, sizeof(u32));
+    auto checksum_crc = folly::crc32(buf.outstream(start + sizeof(u32)), sizeof(u32) + payload_len);
+    buf.push(start, checksum_crc, sizeof(u32));
+}
+
+}
@@ -0,0 +1,118 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-16 09:12:30
+ * @Description: manifest logging the sstables of every level
+ */
+#ifndef STORAGE_MANIFEST_H
+#define STORAGE_MANIFEST_H
+
+#include "defs.h"
+#include "mvcc/key.h"
+#include "sstable/sstable.h"
+#include "util/bytes.h"
+#include "util/file.h"
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace minilsm {
+
+using std::string;
+using std::vector;
+
+// where an sstable lives in the storage
+struct FileMeta {
+    u64 id;
+    // 0 for L0. leveled: the level. tiered: 1 for every sorted run.
+    u32 level;
+    // tiered: id of the sorted run, runs with larger ids hold newer data
+    u64 run;
+    KeySlice first_key;
+    KeySlice last_key;
+    u64 max_ts;
+    // bytes of the file, so that it is opened without reading its footer
+    u64 size;
+    // sstables without range tombstones are not read by scans to look
+    // them up
+    bool has_range_tombstones;
+
+    static FileMeta of(const shared_ptr<SSTable>& sst, u32 level, u64 run = 0) {
+        return FileMeta{
+            sst->id, level, run, sst->first_key, sst->last_key, sst->max_ts, sst->table_size(),
+            sst->has_range_tombstones()};
+    }
+};
+
+// one atomic change of the set of sstables
+struct VersionEdit {
+    vector<FileMeta> added;
+    // ids of the removed sstables
+    vector<u64> removed;
+    // every id below was handed out to a memtable or an sstable
+    u64 next_id = 0;
+
+    void encode(Bytes& buf) const;
+
+    // returns false on malformed input
+    bool decode(const u8* src, size_t len);
+};
+
+/*
+ * the manifest is a log of version edits, replaying them from the start
+ * gives the current sstables of every level. it starts with a header:
+ * ------------------------------
+ * | magic (4B) | version (4B) |
+ * ------------------------------
+ * a manifest of any other version is rejected. each record after it is:
+ * ---------------------------------------------------
+ * | crc (4B) | payload_len (4B) | encoded VersionEdit |
+ * ---------------------------------------------------
+ * the crc covers `payload_len` and the payload. a torn tail is dropped, the
+ * edit it carried was never acknowledged. a failed append is cut off before
+ * the next one, so a bad record anywhere else is corruption.
+ *
+ * the manifest is rewritten as a single edit every time the storage is
+ * opened, so that it does not grow without bound.
+ */
+// bumped whenever the encoding of the version edits changes
+static constexpr u32 MANIFEST_FORMAT_VERSION = 1;
+
+class Manifest {
+private:
+    File file_;
+    // end of the last record appended in full
+    size_t size_;
+    // a failed append could not be cut off, nothing is appended any more
+    bool broken_;
+#ifdef Debug
+    // appends left to succeed, every one fails afterwards
+    std::optional<size_t> debug_appends_left_;
+#endif
+
+    Manifest(const string& path);
+
+public:
+    // read the edits logged at `path`, nothing is read if it is missing.
+    // nullopt if it cannot be read, is corrupted or of another version.
+    static std::optional<vector<VersionEdit>> recover(const string& path);
+
+    // replace the manifest at `path` by a new one holding `snapshot` only
+    static std::unique_ptr<Manifest> create(const string& path, const VersionEdit& snapshot);
+
+    // returns once the edit is durable. on failure the manifest is cut
+    // back to the previous edit.
+    bool append(const VersionEdit& edit);
+
+#ifdef Debug
+    void debug_fail_after(size_t appends) { this->debug_appends_left_ = appends; }
+#endif
+
+private:
+    // append the record of `edit` to `buf`
+    static void encode_record(const VersionEdit& edit, Bytes& buf);
+};
+
+}
+
+#endif
@@ -0,0 +1,532 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-08 14:05:12
+ * @Description: implementation of lsm storage engine
+ */
+
+#include "storage/storage.h"
+#include "iterator/merge.h"
+#include "memtable/iterator.h"
+#include "sstable/iterator.h"
+#include <algorithm>
+#include <filesystem>
+#include <map>
+
+namespace minilsm {
+
+LsmStorage::LsmStorage(const string& path, const StorageOptions& options) :
+        path_(path),
+        options_(options),
+        block_cache_(std::make_shared<BlockCache>(options.block_cache_capacity)),
+        table_cache_(std::make_shared<TableCache>(options.max_open_files, options.use_mmap,
+            IoBackend::create(options.io_backend))),
+        next_id_(0),
+        oracle_(std::make_shared<TimestampOracle>()),
+        closed_(false),
+        flush_failed_(false),
+        compaction_failed_(false),
+        num_of_subcompactions_(0),
+        compact_pointers_(options.max_levels + 1) {}
+
+std::unique_ptr<LsmStorage> LsmStorage::open(const string& path, const StorageOptions& options) {
+    std::filesystem::create_directories(path);
+    std::unique_ptr<LsmStorage> storage(new LsmStorage(path, options));
+
+    auto state = std::make_shared<StorageState>();
+    if (!storage->recover(*state)) { return nullptr; }
+    state->memtable = storage->create_memtable(storage->next_id_++);
+    if (!state->memtable) { return nullptr; }
+    storage->state_.store(state);
+
+    if (options.readahead_threads) {
+        storage->readahead_pool_ = std::make_shared<ThreadPool>(options.readahead_threads);
+    }
+    if (options.max_subcompactions > 1) {
+        storage->subcompaction_pool_ = std::make_unique<ThreadPool>(options.max_subcompactions - 1);
+    }
+    storage->flush_thread_ = std::thread([ptr = storage.get()]() { ptr->flush_loop(); });
+    for (size_t i = 0; i < options.num_compaction_threads; i++) {
+        storage->compaction_threads_.emplace_back([ptr = storage.get()]() {
+            ptr->compaction_loop();
+        });
+    }
+    return storage;
+}
+
+bool LsmStorage::recover(StorageState& state) {
+    std::map<u64, FileMeta> files;
+    u64 next_id = 0;
+    // writes go on after the newest timestamp recovered
+    u64 last_ts = 0;
+    auto edits = Manifest::recover(this->manifest_path());
+    if (!edits) {
+        LOG(ERROR) << "corrupted manifest " << this->manifest_path();
+        return false;
+    }
+    for (auto& edit : *edits) {
+        for (auto& file : edit.added) { files[file.id] = file; }
+        for (auto id : edit.removed) { files.erase(id); }
+        next_id = std::max(next_id, edit.next_id);
+    }
+
+    // sstables missing from the manifest were written by interrupted
+    // flushes or compactions, they are removed once the rest is recovered
+    vector<std::filesystem::path> orphans;
+    std::map<u64, vector<std::filesystem::path>> wal_files;
+    for (auto& entry : std::filesystem::directory_iterator(this->path_)) {
+        auto name = entry.path().filename().string();
+        char* end;
+        auto id = std::strtoull(name.c_str(), &end, 10);
+        if (end == name.c_str()) { continue; }
+        if (!strcmp(end, ".sst")) {
+            if (!files.count(id)) { orphans.push_back(entry.path()); }
+        } else if (!strncmp(end, ".wal.", 5)) {
+            wal_files[id].push_back(entry.path());
+        } else {
+            continue;
+        }
+        next_id = std::max<u64>(next_id, id + 1);
+    }
+    // every manifest holds at least the edit it was created with, the
+    // sstables are not swept when it is gone
+    if (edits->empty() && !orphans.empty()) {
+        LOG(ERROR) << "manifest missing from " << this->path_;
+        return false;
+    }
+
+    for (auto& [id, paths] : wal_files) {
+        // flushed, but the wal was not deleted yet
+        if (files.count(id)) {
+            for (auto& wal_path : paths) { std::filesystem::remove(wal_path); }
+            continue;
+        }
+        auto memtable = MemTable::recover_from_wal(id, this->wal_path(id), this->options_.wal_options);
+        if (!memtable) { return false; }
+        last_ts = std::max(last_ts, memtable->max_ts());
+        if (memtable->is_empty()) {
+            memtable->remove_wal();
+        } else {
+            state.imm_memtables.insert(state.imm_memtables.begin(), memtable);
+        }
+    }
+
+    // sstables written under another compaction style are put in L0
+    bool tiered = this->options_.compaction_style == CompactionStyle::TIERED;
+    vector<vector<shared_ptr<SSTable>>> levels(tiered ? 0 : this->options_.max_levels);
+    std::map<u64, vector<shared_ptr<SSTable>>, std::greater<u64>> runs;
+    VersionEdit snapshot;
+    for (auto& [id, file] : files) {
+        // sstables are opened on their first read
+        std::error_code ec;
+        if (std::filesystem::file_size(this->sst_path(id), ec) != file.size || ec) { return false; }
+        auto sst = std::make_shared<SSTable>(
+            id, file.first_key, file.last_key, file.max_ts, file.size,
+            this->block_cache_, this->table_cache_, this->sst_path(id),
+            this->options_.cache_index_blocks, file.has_range_tombstones);
+        last_ts = std::max(last_ts, file.max_ts);
+        if (tiered && file.run) {
+            runs[file.run].push_back(sst);
+        } else if (!tiered && !file.run && file.level && file.level <= levels.size()) {
+            levels[file.level - 1].push_back(sst);
+        } else {
+            // ids of L0 sstables grow with the age of their memtables
+            state.l0_sstables.insert(state.l0_sstables.begin(), sst);
+            file.level = 0;
+            file.run = 0;
+        }
+        snapshot.added.push_back(file);
+    }
+
+    auto by_first_key = [](auto& a, auto& b) { return a->first_key.compare(b->first_key) < 0; };
+    for (size_t level = 1; level <= levels.size(); level++) {
+        std::sort(levels[level - 1].begin(), levels[level - 1].end(), by_first_key);
+        state.levels.push_back(std::make_shared<Level>(level, levels[level - 1]));
+    }
+    for (auto& [run, ssts] : runs) {
+        std::sort(ssts.begin(), ssts.end(), by_first_key);
+        state.levels.push_back(std::make_shared<Level>(run, ssts));
+    }
+
+    this->next_id_ = next_id;
+    this->oracle_ = std::make_shared<TimestampOracle>(last_ts);
+    snapshot.next_id = next_id;
+    this->manifest_ = Manifest::create(this->manifest_path(), snapshot);
+    if (!this->manifest_) { return false; }
+    for (auto& orphan : orphans) { std::filesystem::remove(orphan); }
+    return true;
+}
+
+LsmStorage::~LsmStorage() {
+    // failed to open
+    if (!this->snapshot()) { return; }
+
+    this->force_freeze();
+    {
+        std::lock_guard<mutex> lock(this->state_lock_);
+        this->closed_ = true;
+    }
+    this->flush_cv_.notify_all();
+    this->stall_cv_.notify_all();
+    this->compaction_cv_.notify_all();
+    if (this->flush_thread_.joinable()) {
+        this->flush_thread_.join();
+    }
+    for (auto& thd : this->compaction_threads_) {
+        thd.join();
+    }
+    // queued reads hold their sstables, let them finish before the purge
+    this->readahead_pool_.reset();
+    this->table_cache_->purge_obsolete();
+    // nothing was written since the last freeze
+    this->snapshot()->memtable->remove_wal();
+}
+
+shared_ptr<MemTable> LsmStorage::create_memtable(u64 id) {
+    if (!this->options_.enable_wal) {
+        return std::make_shared<MemTable>(id);
+    }
+    return MemTable::create_with_wal(id, this->wal_path(id), this->options_.wal_options);
+}
+
+string LsmStorage::sst_path(u64 id) const {
+    char name[32];
+    snprintf(name, sizeof(name), "/%05lu.sst", id);
+    return this->path_ + name;
+}
+
+string LsmStorage::wal_path(u64 id) const {
+    char name[32];
+    snprintf(name, sizeof(name), "/%05lu.wal", id);
+    return this->path_ + name;
+}
+
+string LsmStorage::manifest_path() const {
+    return this->path_ + "/MANIFEST";
+}
+
+CompressionType LsmStorage::compression_of(size_t level) const {
+    auto& types = this->options_.compression_per_level;
+    if (types.empty()) { return CompressionType::NONE; }
+    return types[std::min(level, types.size() - 1)];
+}
+
+shared_ptr<StorageState> LsmStorage::snapshot() const {
+    return this->state_.load(std::memory_order_acquire);
+}
+
+void LsmStorage::install_state(shared_ptr<StorageState> state) {
+    this->state_.store(state, std::memory_order_release);
+}
+
+bool LsmStorage::write(ValueType type, const Slice& key, const Slice& value) {
+    shared_ptr<MemTable> memtable;
+    Wal::Writer writer;
+    u64 ts = 0;
+    while (!memtable) {
+        {
+            std::shared_lock<shared_mutex> lock(this->write_mtx_);
+            auto state = this->snapshot();
+            if (state->imm_memtables.size() < this->options_.max_immutable_memtables) {
+                memtable = state->memtable;
+                {
+                    // taken under the lock, so that the timestamps of a memtable
+                    // are all newer than those of the memtables frozen before.
+                    // a torn wal thus loses the newest writes only.
+                    std::lock_guard<mutex> order_lock(this->order_mtx_);
+                    ts = this->oracle_->begin_write();
+                    if (!memtable->log(writer, type, key, value, ts)) {
+                        this->oracle_->end_write(ts);
+                        return false;
+                    }
+                }
+                // versions are told apart by their timestamps, the inserts
+                // need no order
+                memtable->apply(type, key, value, ts);
+                break;
+            }
+        }
+
+        // too many memtables waiting for the flush, stall the writer
+        std::unique_lock<mutex> lock(this->state_lock_);
+        this->stall_cv_.wait(lock, [this]() {
+            return this->closed_ || this->flush_failed_ ||
+                this->snapshot()->imm_memtables.size() < this->options_.max_immutable_memtables;
+        });
+        // the queue would never drain
+        if (this->flush_failed_) { return false; }
+    }
+
+    // a freeze does not wait for the sync, the flush waits for the write
+    // instead. reads see the write once it ends, a failed one is undone
+    // before.
+    auto ok = memtable->wait_logged(writer);
+    if (!ok) { memtable->rollback(type, key, value, ts); }
+    this->oracle_->end_write(ts);
+    if (!ok) { return false; }
+
+    if (memtable->get_approximate_size() >= this->options_.memtable_size) {
+        this->freeze(memtable);
+    }
+    return true;
+}
+
+bool LsmStorage::put(const Slice& key, const Slice& value) {
+    return this->write(ValueType::VALUE, key, value);
+}
+
+bool LsmStorage::remove(const Slice& key) {
+    return this->write(ValueType::DELETION, key, Slice());
+}
+
+bool LsmStorage::delete_range(const Slice& begin, const Slice& end) {
+    if (begin.compare(end) >= 0) { return true; }
+    return this->write(ValueType::RANGE_DELETION, begin, end);
+}
+
+shared_ptr<const Snapshot> LsmStorage::create_snapshot() {
+    return this->oracle_->create_snapshot();
+}
+
+std::optional<Slice> LsmStorage::get(const Slice& key, u64 ts) {
+    // never written, and too long to be encoded
+    if (key.size() > MAX_KEY_SIZE) { return std::nullopt; }
+    if (ts == UINT64_MAX) { ts = this->oracle_->read_ts(); }
+    auto state = this->snapshot();
+
+    // a deletion hides the key from every older table
+    bool deleted = false;
+    if (auto value = state->memtable->find(key, &deleted, ts); value || deleted) { return value; }
+    for (auto& memtable : state->imm_memtables) {
+        if (auto value = memtable->find(key, &deleted, ts); value || deleted) { return value; }
+    }
+    for (auto& sst : state->l0_sstables) {
+        if (auto value = sst->get(key, ts, &deleted); value || deleted) { return value; }
+    }
+    for (auto& level : state->levels) {
+        if (auto value = level->get(key, &deleted, ts); value || deleted) { return value; }
+    }
+    return std::nullopt;
+}
+
+vector<std::optional<Slice>> LsmStorage::multi_get(const vector<Slice>& keys, u64 ts) {
+    if (ts == UINT64_MAX) { ts = this->oracle_->read_ts(); }
+    auto state = this->snapshot();
+    vector<std::optional<Slice>> res(keys.size());
+
+    // positions of the keys not found yet, in key order. keys too long to
+    // be written are never found.
+    vector<size_t> pending;
+    pending.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (keys[i].size() <= MAX_KEY_SIZE) { pending.push_back(i); }
+    }
+    std::sort(pending.begin(), pending.end(), [&](size_t a, size_t b) {
+        return keys[a].compare(keys[b]) < 0;
+    });
+
+    // look the pending keys up in a table, newer tables go first so that
+    // a found or deleted key is not looked up any further. the tables store
+    // their results at the positions of the keys.
+    vector<bool> deleted(keys.size());
+    auto lookup = [&](auto&& multi_get) {
+        if (pending.empty()) { return; }
+        multi_get();
+        size_t num_of_pending = 0;
+        for (auto i : pending) {
+            if (!res[i] && !deleted[i]) { pending[num_of_pending++] = i; }
+        }
+        pending.resize(num_of_pending);
+    };
+
+    lookup([&]() { state->memtable->multi_find(keys, pending, res, &deleted, ts); });
+    for (auto& memtable : state->imm_memtables) {
+        lookup([&]() { memtable->multi_find(keys, pending, res, &deleted, ts); });
+    }
+    for (auto& sst : state->l0_sstables) {
+        lookup([&]() { sst->multi_get(keys, pending, 0, pending.size(), res, ts, &deleted); });
+    }
+    for (auto& level : state->levels) {
+        lookup([&]() { level->multi_get(keys, pending, res, &deleted, ts); });
+    }
+    return res;
+}
+
+shared_ptr<Iterator> LsmStorage::scan(const Bound& lower, const Bound& upper, u64 ts) {
+    if (ts == UINT64_MAX) { ts = this->oracle_->read_ts(); }
+    auto state = this->snapshot();
+
+    // range tombstones of the tables scanned so far within the bounds. the
+    // deletions visible at `ts` delete every covered entry of the older
+    // tables, which skip them. the sets are copied when they grow, the
+    // iterators keep the ones they were given.
+    shared_ptr<const RangeTombstones> all;
+    shared_ptr<const RangeTombstones> deleted;
+    auto add_deleted = [&](const RangeTombstones& tombstones) {
+        auto clipped = tombstones.clip(lower, upper);
+        if (clipped.empty()) { return; }
+        auto res = all ? std::make_shared<RangeTombstones>(*all) : std::make_shared<RangeTombstones>();
+        res->add(clipped);
+        all = res;
+        auto visible = clipped.visible(ts);
+        if (visible.empty()) { return; }
+        res = deleted ? std::make_shared<RangeTombstones>(*deleted) : std::make_shared<RangeTombstones>();
+        res->add(visible);
+        deleted = res;
+    };
+
+    // newer tables go first, so that they win on equal versions
+    vector<shared_ptr<Iterator>> iters;
+    for (size_t i = 0; i <= state->imm_memtables.size(); i++) {
+        auto& memtable = i ? state->imm_memtables[i - 1] : state->memtable;
+        iters.push_back(memtable->scan(lower, upper, deleted));
+        if (auto tombstones = memtable->range_tombstones()) { add_deleted(*tombstones); }
+    }
+    for (auto& sst : state->l0_sstables) {
+        // out of the bounds or deleted as a whole by newer tables, its own
+        // tombstones lie within its key range as well
+        if (!overlaps(lower, upper, sst->first_key, sst->last_key)) { continue; }
+        if (deleted && deleted->covers(sst->first_key, sst->last_key)) { continue; }
+        vector<shared_ptr<SSTable>> ssts = {sst};
+        if (auto iter = std::make_shared<Level>(0, ssts)->scan(lower, upper, deleted, this->readahead_pool_)) {
+            iters.push_back(iter);
+        }
+        if (sst->has_range_tombstones()) { add_deleted(sst->range_tombstones()); }
+    }
+    for (auto& level : state->levels) {
+        if (!level->num_of_ssts()) { continue; }
+        if (auto iter = level->scan(lower, upper, deleted, this->readahead_pool_)) {
+            iters.push_back(iter);
+        }
+        for (auto& sst : level->sstables()) {
+            if (sst->has_range_tombstones() && overlaps(lower, upper, sst->first_key, sst->last_key)) {
+                add_deleted(sst->range_tombstones());
+            }
+        }
+    }
+    return std::make_shared<SnapshotIterator>(std::make_shared<MergeMultiIterator>(iters), ts, all);
+}
+
+void LsmStorage::force_freeze() {
+    auto state = this->snapshot();
+    if (!state->memtable->is_empty()) {
+        this->freeze(state->memtable);
+    }
+}
+
+void LsmStorage::wait_for_flush() {
+    std::unique_lock<mutex> lock(this->state_lock_);
+    this->stall_cv_.wait(lock, [this]() {
+        return this->flush_failed_ || this->snapshot()->imm_memtables.empty();
+    });
+}
+
+void LsmStorage::freeze(const shared_ptr<MemTable>& memtable) {
+    // frozen by another writer already
+    if (this->snapshot()->memtable != memtable) { return; }
+    // the wal is created outside of the lock, readers and writers taking it
+    // do not wait on the disk
+    auto new_memtable = this->create_memtable(this->next_id_++);
+    // the writes keep going to the full memtable, the next one retries
+    if (!new_memtable) { return; }
+    {
+        std::lock_guard<mutex> lock(this->state_lock_);
+        // lost the race against another writer
+        if (this->snapshot()->memtable != memtable) {
+            new_memtable->remove_wal();
+            return;
+        }
+        std::unique_lock<shared_mutex> write_lock(this->write_mtx_);
+        auto state = std::make_shared<StorageState>(*this->snapshot());
+        state->imm_memtables.insert(state->imm_memtables.begin(), memtable);
+        state->memtable = new_memtable;
+        this->install_state(state);
+    }
+    this->flush_cv_.notify_one();
+}
+
+void LsmStorage::flush_loop() {
+    while (true) {
+        {
+            std::unique_lock<mutex> lock(this->state_lock_);
+            // too many sorted runs slow down every read, let the compaction
+            // catch up first
+            this->flush_cv_.wait(lock, [this]() {
+                if (this->closed_ || this->flush_failed_) { return true; }
+                auto state = this->snapshot();
+                return !state->imm_memtables.empty() && 
+                    (!this->options_.num_compaction_threads || this->compaction_failed_ ||
+                    this->num_of_sorted_runs(*state) < this->options_.level0_stop_writes_trigger);
+            });
+            // pending memtables are flushed before the storage is closed
+            if (this->flush_failed_ || this->snapshot()->imm_memtables.empty()) { return; }
+        }
+        this->flush_next();
+        this->table_cache_->purge_obsolete();
+    }
+}
+
+bool LsmStorage::flush_next() {
+    shared_ptr<MemTable> memtable;
+    {
+        std::lock_guard<mutex> lock(this->state_lock_);
+        auto state = this->snapshot();
+        if (state->imm_memtables.empty()) { return false; }
+        memtable = state->imm_memtables.back();
+    }
+
+    // the writes of a frozen memtable are all applied, the ones still
+    // logging may be undone yet
+    this->oracle_->wait_for(memtable->max_ts());
+
+    // readers keep finding the keys in the memtable while it is written out
+    shared_ptr<SSTable> sst;
+    if (!memtable->is_empty()) {
+        SSTableBuilder builder(
+            this->options_.block_size,
+            memtable->get_size(),
+            this->options_.bloom_false_positive_rate,
+            this->compression_of(0));
+        memtable->flush(builder);
+        auto id = memtable->get_id();
+        sst = builder.build(id, this->block_cache_, this->sst_path(id),
+            this->options_.use_mmap, this->table_cache_, this->options_.cache_index_blocks);
+        if (!sst) {
+            LOG(ERROR) << "failed to flush memtable " << memtable->get_id();
+            this->flush_failed_ = true;
+        }
+    }
+
+    {
+        std::lock_guard<mutex> lock(this->state_lock_);
+        if (sst) {
+            VersionEdit edit;
+            edit.added.push_back(FileMeta::of(sst, 0));
+            edit.next_id = this->next_id_;
+            // an sstable unknown to the manifest would be swept on the next
+            // open, the memtable is kept along with its wal instead
+            if (!this->manifest_->append(edit)) {
+                LOG(ERROR) << "failed to log the flush of memtable " << memtable->get_id();
+                sst->mark_obsolete();
+                this->flush_failed_ = true;
+            }
+        }
+
+        if (!this->flush_failed_) {
+            auto state = std::make_shared<StorageState>(*this->snapshot());
+            DCHECK(state->imm_memtables.back() == memtable);
+            state->imm_memtables.pop_back();
+            if (sst) {
+                state->l0_sstables.insert(state->l0_sstables.begin(), sst);
+            }
+            this->install_state(state);
+        }
+    }
+    this->stall_cv_.notify_all();
+    this->compaction_cv_.notify_all();
+
+    if (this->flush_failed_) { return false; }
+    memtable->remove_wal();
+    return true;
+}
+
+}
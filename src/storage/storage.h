@@ -0,0 +1,349 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-08 14:05:12
+ * @Description: lsm storage engine tying memtables and sstables together
+ */
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include "defs.h"
+#include "cache/block_cache.h"
+#include "cache/table_cache.h"
+#include "iterator/iterator.h"
+#include "memtable/memtable.h"
+#include "mvcc/snapshot.h"
+#include "slice.h"
+#include "sstable/sstable.h"
+#include "storage/compaction.h"
+#include "storage/manifest.h"
+#include "util/thread_pool.h"
+#include "wal/wal.h"
+#include "folly/concurrency/AtomicSharedPtr.h"
+#include <condition_variable>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+
+namespace minilsm {
+
+using std::string;
+using std::mutex;
+using std::shared_mutex;
+using std::condition_variable;
+
+struct StorageOptions {
+    // targeted size of the blocks in sstables
+    size_t block_size = 4096;
+    // compression of the blocks written to each level, L0 first, deeper
+    // levels use the last entry. tiered: runs are written as L1. blocks
+    // are not compressed if empty.
+    vector<CompressionType> compression_per_level;
+    // the mutable memtable is frozen once its arena exceeds this size
+    size_t memtable_size = 4 * 1024 * 1024;
+    // writers stall while this many memtables are waiting to be flushed
+    size_t max_immutable_memtables = 4;
+    double bloom_false_positive_rate = 0.01;
+    size_t block_cache_capacity = BlockCache::DEFAULT_CAPACITY;
+    // keep the index of sstables in the block cache, so that it is evicted
+    // along with the blocks instead of staying resident for open sstables
+    bool cache_index_blocks = false;
+    // log every write before it is applied to the memtable
+    bool enable_wal = true;
+    WalOptions wal_options;
+    // map sstables instead of reading blocks with `pread`
+    bool use_mmap = false;
+    // backend of batched block reads (readahead), `PREAD` is used where
+    // io_uring is not available
+    IoBackendType io_backend = IoBackendType::PREAD;
+    // sstables kept open at once, the least recently used ones are closed
+    // and reopened on their next read
+    size_t max_open_files = TableCache::DEFAULT_CAPACITY;
+    // threads reading the blocks of scans and compactions ahead, shared by
+    // every iterator of the storage. 0 disables readahead.
+    size_t readahead_threads = 4;
+
+    // cannot be changed once the storage is created
+    CompactionStyle compaction_style = CompactionStyle::LEVELED;
+    // background threads running compactions, 0 disables compaction
+    size_t num_compaction_threads = 1;
+    // leveled: L0 is compacted into L1 once it holds this many sstables.
+    // tiered: runs are merged once there are this many of them, every L0
+    // sstable counting as a run.
+    size_t level0_compaction_trigger = 4;
+    // flushes wait for the compaction once L0 (leveled) or the sorted runs
+    // (tiered) are this many
+    size_t level0_stop_writes_trigger = 12;
+    // sstables written by compactions are cut once they reach this size
+    size_t target_file_size = 8 * 1024 * 1024;
+    // a compaction is split into at most this many key ranges merged in
+    // parallel, a range spans at least `target_file_size` bytes. the ranges
+    // but the first one go to a pool of `max_subcompactions - 1` threads.
+    size_t max_subcompactions = 1;
+
+    // leveled: number of levels below L0
+    size_t max_levels = 6;
+    // leveled: targeted size of L1, every deeper level is
+    // `level_size_multiplier` times larger than the one above
+    size_t level_size_base = 64 * 1024 * 1024;
+    size_t level_size_multiplier = 10;
+
+    // tiered: every run is merged once the runs but the oldest take this
+    // many percents of the size of the oldest run
+    size_t max_size_amplification_percent = 200;
+    // tiered: a run is merged with the newer runs before it if it is at
+    // most `100 + size_ratio_percent` percents of their total size
+    size_t size_ratio_percent = 1;
+    // tiered: bounds of the number of runs merged by size ratio
+    size_t min_merge_width = 2;
+    size_t max_merge_width = SIZE_MAX;
+};
+
+// version of the tables making up the storage. it is immutable and
+// replaced as a whole (copy-on-write) whenever a memtable is frozen or
+// flushed or a compaction finishes, readers hold on to the version they
+// loaded for as long as they need it.
+struct StorageState {
+    // the only memtable accepting writes
+    shared_ptr<MemTable> memtable;
+    // frozen memtables waiting to be flushed, newest first
+    vector<shared_ptr<MemTable>> imm_memtables;
+    // sstables flushed from memtables, which may overlap, newest first
+    vector<shared_ptr<SSTable>> l0_sstables;
+    // leveled: the levels below L0, `levels[0]` is L1, always `max_levels`
+    // of them. tiered: sorted runs, newest first, identified by one more
+    // than the id of the newest memtable they hold data of.
+    vector<shared_ptr<Level>> levels;
+};
+
+/*
+ * write path: a write is logged and applied to the mutable memtable, which
+ * is frozen into the immutable queue once it grows beyond `memtable_size`.
+ * a background thread flushes the oldest immutable memtable into a new L0
+ * sstable, writers only wait when the queue is full.
+ *
+ * read path: memtables, L0 sstables and levels are consulted from the
+ * newest to the oldest, scans merge all of them.
+ *
+ * versions: every write gets a timestamp of its own and adds a version of
+ * its key (or a deletion) instead of replacing it. a read at a timestamp
+ * sees the newest version not newer than it, so a snapshot reads the same
+ * data no matter what is written meanwhile. compactions drop the versions
+ * that no live snapshot can read any more.
+ *
+ * leveled compaction: a pool of background threads merges the level with
+ * the highest score into the level below. the score of L0 is its number of
+ * sstables over `level0_compaction_trigger`, the score of a deeper level
+ * its size over its targeted size. L0 is compacted as a whole, deeper
+ * levels one sstable at a time, round-robin over their key range.
+ *
+ * tiered compaction: once there are `level0_compaction_trigger` sorted
+ * runs, every run is merged if the space amplification is too high,
+ * otherwise the newest runs of similar size, otherwise just enough of the
+ * newest runs to get below the trigger.
+ *
+ * compactions sharing no sstable run concurrently.
+ *
+ * files under `path`: `<id>.sst` for sstables, `<id>.wal.<seq>` for the
+ * wal segments of the memtable that will be flushed into `<id>.sst` and
+ * `MANIFEST` logging which sstables make up L0 and the levels. every flush
+ * and compaction is logged in the manifest before it is installed, files
+ * missing from the manifest are leftovers of interrupted jobs.
+ */
+class LsmStorage {
+private:
+    string path_;
+    StorageOptions options_;
+    shared_ptr<BlockCache> block_cache_;
+    shared_ptr<TableCache> table_cache_;
+    // ids of memtables and sstables, a memtable is flushed to the sstable
+    // of the same id
+    std::atomic<u64> next_id_;
+    // timestamps of the writes and the live snapshots
+    shared_ptr<TimestampOracle> oracle_;
+
+    // current version, loaded by readers without any lock
+    folly::atomic_shared_ptr<StorageState> state_;
+    // writers to the mutable memtable hold it shared, a memtable is frozen
+    // with it held exclusively so that no write to it is still running
+    shared_mutex write_mtx_;
+    // orders the writes: timestamps are handed out in the order in which
+    // the records reach the wal
+    mutex order_mtx_;
+
+    // serializes the replacement of `state_` and the manifest appends,
+    // also used by the waits below
+    mutex state_lock_;
+    std::unique_ptr<Manifest> manifest_;
+    // signaled when a memtable is frozen or the storage is closed
+    condition_variable flush_cv_;
+    // signaled when a memtable is flushed
+    condition_variable stall_cv_;
+    bool closed_;
+    // set once a flush cannot be logged, the frozen memtables are kept with
+    // their wals and stalled writers fail
+    std::atomic<bool> flush_failed_;
+    std::thread flush_thread_;
+
+    // signaled when the tables change or the storage is closed
+    condition_variable compaction_cv_;
+    vector<std::thread> compaction_threads_;
+    // set once a compaction cannot be written or logged, nothing is
+    // compacted any more and flushes no longer wait for the compactions
+    std::atomic<bool> compaction_failed_;
+    // merges the key ranges of split compactions but the first one, shared
+    // by the compaction threads. null when compactions are not split.
+    std::unique_ptr<ThreadPool> subcompaction_pool_;
+    // reads blocks ahead of sequential scans, held by the iterators as well
+    // since they may outlive the storage. null when readahead is disabled.
+    shared_ptr<ThreadPool> readahead_pool_;
+    // key ranges merged by split compactions so far
+    std::atomic<u64> num_of_subcompactions_;
+    // ids of the sstables taken by running compactions
+    std::unordered_set<u64> compacting_;
+    // largest key compacted out of every level by the last compaction
+    vector<std::optional<KeySlice>> compact_pointers_;
+
+public:
+    // open the storage under `path`, recovering the sstables and the
+    // memtables logged in the wal
+    static std::unique_ptr<LsmStorage> open(const string& path,
+        const StorageOptions& options = StorageOptions());
+
+    LsmStorage(const LsmStorage&) = delete;
+
+    LsmStorage& operator=(const LsmStorage&) = delete;
+
+    // flush every memtable and stop the background thread
+    ~LsmStorage();
+
+    // returns false when the write cannot be logged, or the key or value is
+    // longer than `MAX_KEY_SIZE` or `MAX_VALUE_SIZE`
+    bool put(const Slice& key, const Slice& value);
+
+    // delete `key`, returns false when the deletion cannot be logged
+    bool remove(const Slice& key);
+
+    // delete every key of `[begin, end)` with a single range tombstone,
+    // nothing happens if `begin` is not less than `end`
+    bool delete_range(const Slice& begin, const Slice& end);
+
+    // pin the timestamp of the writes applied so far, reads at it see the
+    // same versions for as long as the snapshot is held, compactions
+    // included
+    shared_ptr<const Snapshot> create_snapshot();
+
+    // value of `key` as of timestamp `ts`, by default the newest one at
+    // which every write is done, so that no write still being logged is
+    // seen. a timestamp older than every live snapshot may miss versions
+    // dropped by compactions.
+    std::optional<Slice> get(const Slice& key, u64 ts = UINT64_MAX);
+
+    // `get` of many keys at once, the value of `keys[i]` goes to the i-th
+    // result. the keys are sorted once and every table looks up the keys
+    // still missing in one pass, reading their blocks in one batch.
+    vector<std::optional<Slice>> multi_get(const vector<Slice>& keys, u64 ts = UINT64_MAX);
+
+    // merged view of every table in the key range as of timestamp `ts`,
+    // deleted keys left out
+    shared_ptr<Iterator> scan(
+        const Bound& lower = Bound(false),
+        const Bound& upper = Bound(true),
+        u64 ts = UINT64_MAX);
+
+    // freeze the mutable memtable even if it is not full yet
+    void force_freeze();
+
+    // block until every frozen memtable is flushed, or a flush failed
+    void wait_for_flush();
+
+    // block until no level needs to be compacted
+    void wait_for_compaction();
+
+    // current version, valid as long as the returned pointer is held
+    shared_ptr<StorageState> snapshot() const;
+
+    const StorageOptions& options() const { return this->options_; }
+
+#ifdef Debug
+    u64 debug_num_of_subcompactions() const { return this->num_of_subcompactions_; }
+
+    // fail every manifest append after the next `appends` ones
+    void debug_fail_manifest_after(size_t appends) {
+        std::lock_guard<mutex> lock(this->state_lock_);
+        this->manifest_->debug_fail_after(appends);
+    }
+#endif
+
+private:
+    LsmStorage(const string& path, const StorageOptions& options);
+
+    // null if its wal cannot be created
+    shared_ptr<MemTable> create_memtable(u64 id);
+
+    string sst_path(u64 id) const;
+
+    string wal_path(u64 id) const;
+
+    string manifest_path() const;
+
+    // compression of the sstables written to `level`
+    CompressionType compression_of(size_t level) const;
+
+    // reload the sstables of the manifest, returns false on io error
+    bool recover(StorageState& state);
+
+    // log and apply a write to the mutable memtable, stalling while too
+    // many memtables wait for the flush. the wal is synced without any
+    // lock held, the write is visible once it is.
+    bool write(ValueType type, const Slice& key, const Slice& value);
+
+    // freeze `memtable` if it is still the mutable one
+    void freeze(const shared_ptr<MemTable>& memtable);
+
+    void install_state(shared_ptr<StorageState> state);
+
+    void flush_loop();
+
+    // flush the oldest immutable memtable, returns false if there is none
+    // or its sstable cannot be logged
+    bool flush_next();
+
+    void compaction_loop();
+
+    // pick the most urgent compaction whose sstables are not taken by a
+    // running one, called with `state_lock_` held
+    std::optional<CompactionTask> pick_compaction();
+
+    std::optional<CompactionTask> pick_leveled_compaction();
+
+    std::optional<CompactionTask> pick_tiered_compaction();
+
+    // merge the sstables of `task` into new sstables sorted by key, nullopt
+    // if an output cannot be written
+    std::optional<vector<shared_ptr<SSTable>>> run_compaction(const CompactionTask& task);
+
+    // boundaries splitting `task` into at most `max_subcompactions` key
+    // ranges of similar size, picked among the first keys of its blocks
+    vector<KeySlice> split_compaction(const CompactionTask& task);
+
+    // merge the keys of `task` within the bounds
+    std::optional<vector<shared_ptr<SSTable>>> run_subcompaction(const CompactionTask& task,
+        const Bound& lower_bound, const Bound& upper_bound);
+
+    // replace the inputs of `task` by `outputs` and delete their files
+    void install_compaction(const CompactionTask& task,
+        const vector<shared_ptr<SSTable>>& outputs);
+
+    // targeted size of level `level`, which is at least 1
+    u64 level_target_size(size_t level) const;
+
+    // number of sorted runs a read may have to merge, memtables aside
+    size_t num_of_sorted_runs(const StorageState& state) const;
+};
+
+}
+
+#endif
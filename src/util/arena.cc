@@ -0,0 +1,78 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-09-20 14:02:37
+ * @Description: implementation of arena
+ */
+
+#include "util/arena.h"
+
+namespace minilsm {
+
+static inline size_t align_up(size_t bytes) {
+    constexpr size_t align = alignof(std::max_align_t);
+    return (bytes + align - 1) & ~(align - 1);
+}
+
+Arena::Arena(size_t block_size) :
+        block_size_(block_size),
+        current_(nullptr),
+        memory_usage_(0),
+        allocated_bytes_(0) {
+    // not shared yet, no need to lock
+    this->current_.store(this->new_block(this->block_size_), std::memory_order_release);
+}
+
+u8* Arena::allocate(size_t bytes) {
+    bytes = align_up(bytes ? bytes : 1);
+    this->allocated_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+
+    auto blk = this->current_.load(std::memory_order_acquire);
+    // oversized requests always go to a dedicated block
+    if (bytes <= this->block_size_ / 4) {
+        auto offset = blk->used.fetch_add(bytes, std::memory_order_relaxed);
+        if (offset + bytes <= blk->capacity) {
+            return blk->data.get() + offset;
+        }
+    }
+    return this->allocate_fallback(bytes, blk);
+}
+
+u8* Arena::allocate_fallback(size_t bytes, ArenaBlock* observed) {
+    std::lock_guard<mutex> lock(this->mtx_);
+    if (bytes > this->block_size_ / 4) {
+        return this->new_block(bytes)->data.get();
+    }
+
+    // another thread may have switched the block meanwhile
+    auto blk = this->current_.load(std::memory_order_acquire);
+    if (blk == observed) {
+        blk = this->new_block(this->block_size_);
+        this->current_.store(blk, std::memory_order_release);
+    }
+
+    while (true) {
+        auto offset = blk->used.fetch_add(bytes, std::memory_order_relaxed);
+        if (offset + bytes <= blk->capacity) {
+            return blk->data.get() + offset;
+        }
+        // the fresh block got drained by the lock-free path
+        blk = this->new_block(this->block_size_);
+        this->current_.store(blk, std::memory_order_release);
+    }
+}
+
+Arena::ArenaBlock* Arena::new_block(size_t capacity) {
+    this->blocks_.emplace_back(new ArenaBlock(capacity));
+    this->memory_usage_.fetch_add(capacity, std::memory_order_relaxed);
+    return this->blocks_.back().get();
+}
+
+size_t Arena::memory_usage() const {
+    return this->memory_usage_.load(std::memory_order_relaxed);
+}
+
+size_t Arena::allocated_bytes() const {
+    return this->allocated_bytes_.load(std::memory_order_relaxed);
+}
+
+}
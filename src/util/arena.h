@@ -0,0 +1,82 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-09-20 14:02:37
+ * @Description: concurrent bump allocator backing memtable entries
+ */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "defs.h"
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace minilsm {
+
+using std::atomic;
+using std::mutex;
+using std::vector;
+using std::unique_ptr;
+
+// Arena hands out memory by bumping an offset inside the current block,
+// memory is only released when the whole arena is destroyed. Allocation is
+// lock-free on the fast path, a mutex is taken only when a new block is
+// required.
+class Arena {
+private:
+    struct ArenaBlock {
+        unique_ptr<u8[]> data;
+        size_t capacity;
+        atomic<size_t> used;
+
+        ArenaBlock(size_t capacity) :
+            data(new u8[capacity]),
+            capacity(capacity),
+            used(0) {}
+    };
+
+    // size of the regular blocks
+    size_t block_size_;
+    // block serving the fast path
+    atomic<ArenaBlock*> current_;
+    // every block ever allocated, owned by the arena
+    vector<unique_ptr<ArenaBlock>> blocks_;
+    // protects `blocks_` and the switch of `current_`
+    mutex mtx_;
+    // bytes reserved from the system
+    atomic<size_t> memory_usage_;
+    // bytes handed out to callers
+    atomic<size_t> allocated_bytes_;
+
+public:
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+    Arena(size_t block_size = DEFAULT_BLOCK_SIZE);
+
+    Arena(const Arena&) = delete;
+
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() = default;
+
+    // allocate `bytes` bytes aligned to `alignof(max_align_t)`,
+    // safe to be called concurrently
+    u8* allocate(size_t bytes);
+
+    // total bytes reserved from the system, including unused tails
+    size_t memory_usage() const;
+
+    // total bytes handed out by `allocate`
+    size_t allocated_bytes() const;
+
+private:
+    u8* allocate_fallback(size_t bytes, ArenaBlock* observed);
+
+    ArenaBlock* new_block(size_t capacity);
+};
+
+}
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-02 15:12:40
+ * @Description: implementation of cache-line-blocked bloom filter
+ */
+
+#include "util/blocked_bloom.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define BLOOM_AVX2_KERNEL
+#endif
+
+namespace minilsm {
+
+namespace {
+
+// odd multipliers deriving the bit of every word from the same 32-bit hash
+alignas(32) const u32 SALT[8] = {
+    0x47B6137BU, 0x44974D91U, 0x8824AD5BU, 0xA2B7289DU,
+    0x705495C7U, 0x2DF1424BU, 0x9EFC4947U, 0x5C6BFB31U
+};
+
+inline u32 probe_mask(u32 hash, size_t i) {
+    return 1U << ((hash * SALT[i]) >> 27);
+}
+
+#ifdef BLOOM_AVX2_KERNEL
+// compiled for avx2 regardless of the target flags, only called after the
+// cpu has been checked
+__attribute__((target("avx2"))) 
+inline __m256i probe_mask_avx2(u32 hash) {
+    auto salt = _mm256_load_si256(reinterpret_cast<const __m256i*>(SALT));
+    auto bits = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(hash), salt), 27);
+    return _mm256_sllv_epi32(_mm256_set1_epi32(1), bits);
+}
+
+__attribute__((target("avx2"))) 
+bool contains_avx2(const u32* words, u32 hash) {
+    auto bucket = _mm256_load_si256(reinterpret_cast<const __m256i*>(words));
+    // set when every bit of the mask is set in the bucket
+    return _mm256_testc_si256(bucket, probe_mask_avx2(hash));
+}
+
+__attribute__((target("avx2"))) 
+void insert_avx2(u32* words, u32 hash) {
+    auto bucket = _mm256_load_si256(reinterpret_cast<const __m256i*>(words));
+    bucket = _mm256_or_si256(bucket, probe_mask_avx2(hash));
+    _mm256_store_si256(reinterpret_cast<__m256i*>(words), bucket);
+}
+
+const bool HAS_AVX2 = __builtin_cpu_supports("avx2");
+#endif
+
+}
+
+BlockedBloomFilter::BlockedBloomFilter(size_t num_of_keys, double bits_per_key) {
+    auto bits = static_cast<size_t>(std::ceil(num_of_keys * bits_per_key));
+    auto num = std::max<size_t>(1, (bits + BUCKET_SIZE * 8 - 1) / (BUCKET_SIZE * 8));
+    this->buckets_.resize(num, Bucket{});
+}
+
+BlockedBloomFilter::BlockedBloomFilter(const Bytes& buf, size_t offset) {
+    auto num = buf.get(offset, sizeof(u32));
+    DCHECK(offset + sizeof(u32) + num * BUCKET_SIZE <= buf.size());
+    this->buckets_.resize(num);
+    memcpy(this->buckets_.data(), buf.outstream(offset + sizeof(u32)), num * BUCKET_SIZE);
+}
+
+double BlockedBloomFilter::bits_per_key(double rate) {
+    DCHECK(rate > 0 && rate < 1);
+    // an optimal classic filter needs -log2(rate) / ln2 bits per key, the 
+    // fixed eight probes and uneven bucket loads cost about a fifth more
+    return -std::log2(rate) / std::log(2.0) * 1.2 + 1;
+}
+
+void BlockedBloomFilter::insert_hash(u64 hash) {
+    DCHECK(!this->buckets_.empty());
+    auto& bucket = this->buckets_[this->bucket_idx(hash)];
+#ifdef BLOOM_AVX2_KERNEL
+    if (HAS_AVX2) { return insert_avx2(bucket.words, static_cast<u32>(hash)); }
+#endif
+    for (size_t i = 0; i < 8; i++) {
+        bucket.words[i] |= probe_mask(static_cast<u32>(hash), i);
+    }
+}
+
+bool BlockedBloomFilter::contains_hash(u64 hash) const {
+    // an empty filter knows nothing about the keys
+    if (this->buckets_.empty()) { return true; }
+    auto& bucket = this->buckets_[this->bucket_idx(hash)];
+#ifdef BLOOM_AVX2_KERNEL
+    if (HAS_AVX2) { return contains_avx2(bucket.words, static_cast<u32>(hash)); }
+#endif
+    for (size_t i = 0; i < 8; i++) {
+        auto mask = probe_mask(static_cast<u32>(hash), i);
+        if ((bucket.words[i] & mask) != mask) { return false; }
+    }
+    return true;
+}
+
+void BlockedBloomFilter::serialize(Bytes& buf) const {
+    buf.push(this->buckets_.size(), sizeof(u32));
+    buf.instream(reinterpret_cast<const u8*>(this->buckets_.data()), this->buckets_.size() * BUCKET_SIZE);
+}
+
+}
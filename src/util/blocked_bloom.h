@@ -0,0 +1,92 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-02 15:12:40
+ * @Description: cache-line-blocked bloom filter
+ */
+#ifndef BLOCKED_BLOOM_H
+#define BLOCKED_BLOOM_H
+
+#include "defs.h"
+#include "util/bytes.h"
+#include "util/hash.h"
+#include <cstddef>
+#include <vector>
+
+namespace minilsm {
+
+using std::vector;
+
+/*
+ * split block bloom filter: the filter is an array of 32-byte buckets, each
+ * made of eight 32-bit words. the high half of a key's hash picks a bucket
+ * and the low half sets one bit in every word of it, so all probes of a key
+ * touch a single cache line and are checked with one vector compare.
+ *
+ * serialized format:
+ * --------------------------------------------------------------
+ * | num_of_buckets (u32) | Bucket #1 (32B) | ... | Bucket #N (32B) |
+ * --------------------------------------------------------------
+ */
+class BlockedBloomFilter {
+private:
+    struct alignas(32) Bucket {
+        u32 words[8];
+    };
+
+    // buckets never straddle a cache line
+    vector<Bucket> buckets_;
+
+public:
+    static constexpr size_t BUCKET_SIZE = sizeof(Bucket);
+
+    BlockedBloomFilter() = default;
+
+    // sized for `num_of_keys` keys with `bits_per_key` bits each
+    BlockedBloomFilter(size_t num_of_keys, double bits_per_key);
+
+    // deserialize from Bytes
+    BlockedBloomFilter(const Bytes& buf, size_t offset = 0);
+
+    // bits per key needed to keep the false positive rate around `rate`,
+    // slightly more than a classic bloom filter needs
+    static double bits_per_key(double rate);
+
+    static u64 hash(const u8* key, size_t len) { return hash64(key, len); }
+
+    void insert_hash(u64 hash);
+
+    bool contains_hash(u64 hash) const;
+
+    // pull the bucket of `hash` into the cache ahead of `contains_hash`,
+    // so that the probes of a batch of keys overlap their cache misses
+    void prefetch_hash(u64 hash) const {
+        if (!this->buckets_.empty()) { __builtin_prefetch(&this->buckets_[this->bucket_idx(hash)]); }
+    }
+
+    void insert(const u8* key, size_t len) { this->insert_hash(hash(key, len)); }
+
+    bool contains(const u8* key, size_t len) const { return this->contains_hash(hash(key, len)); }
+
+    size_t num_of_buckets() const { return this->buckets_.size(); }
+
+    size_t estimated_size() const { return sizeof(u32) + this->buckets_.size() * BUCKET_SIZE; }
+
+    void serialize(Bytes& buf) const;
+
+#ifdef Debug
+    bool debug_equal(const BlockedBloomFilter& other) const {
+        return this->buckets_.size() == other.buckets_.size() && 
+            !memcmp(this->buckets_.data(), other.buckets_.data(), this->buckets_.size() * BUCKET_SIZE);
+    }
+#endif
+
+private:
+    // maps the high 32 bits onto [0, num_of_buckets) without a division
+    size_t bucket_idx(u64 hash) const {
+        return ((hash >> 32) * this->buckets_.size()) >> 32;
+    }
+};
+
+}
+
+#endif
@@ -9,6 +9,7 @@
 #include "defs.h"
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <iterator>
 #include <limits>
 #include <sys/stat.h>
@@ -20,6 +21,16 @@ namespace minilsm {
 
 using std::vector;
 
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, 
+    "encoded integers are read in place as little-endian");
+
+// read the integers written by `Bytes::push` straight from encoded memory
+inline u16 decode_u16(const u8* src) { u16 value; memcpy(&value, src, sizeof(u16)); return value; }
+
+inline u32 decode_u32(const u8* src) { u32 value; memcpy(&value, src, sizeof(u32)); return value; }
+
+inline u64 decode_u64(const u8* src) { u64 value; memcpy(&value, src, sizeof(u64)); return value; }
+
 class Bytes {
 private:
     vector<u8> data_;
@@ -35,9 +46,7 @@ public:
     }
 
     void instream(const u8* is, size_t size) {
-        for (size_t i = 0; i < size; i++) {
-            this->data_.push_back(is[i]);
-        }
+        this->data_.insert(this->data_.end(), is, is + size);
     }
 
     auto get(size_t start, size_t size = 1) const {
@@ -0,0 +1,141 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-21 20:16:48
+ * @Description: implementation of block compression codecs
+ */
+
+#include "util/compression.h"
+#include <cstring>
+
+namespace minilsm {
+
+const Codec* get_codec(CompressionType type) {
+    static const LzCodec lz;
+    switch (type) {
+        case CompressionType::LZ: return &lz;
+        default: return nullptr;
+    }
+}
+
+namespace {
+
+inline size_t hash_of(const u8* ptr) {
+    return (decode_u32(ptr) * 2654435761U) >> (32 - LzCodec::HASH_BITS);
+}
+
+// write `len` as a nibble of the token and the following extension bytes
+inline u8* write_len(u8* op, size_t len) {
+    for (len -= 15; len >= 255; len -= 255) { *op++ = 255; }
+    *op++ = len;
+    return op;
+}
+
+// read the extension bytes following a full nibble
+inline bool read_len(const u8*& ip, const u8* end, size_t& len) {
+    u8 byte;
+    do {
+        if (ip == end) { return false; }
+        byte = *ip++;
+        len += byte;
+    } while (byte == 255);
+    return true;
+}
+
+u8* write_sequence(u8* op, const u8* literals, size_t literal_len, size_t offset, size_t match_len) {
+    auto token = op++;
+    *token = (literal_len < 15 ? literal_len : 15) << 4;
+    if (literal_len >= 15) { op = write_len(op, literal_len); }
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+    // the last sequence has no match
+    if (!match_len) { return op; }
+
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+    match_len -= LzCodec::MIN_MATCH;
+    *token |= match_len < 15 ? match_len : 15;
+    if (match_len >= 15) { op = write_len(op, match_len); }
+    return op;
+}
+
+}
+
+void LzCodec::compress(const u8* src, size_t size, Bytes& dst) const {
+    DCHECK(size <= UINT32_MAX);
+    auto base = dst.size();
+    dst.resize(base + max_compressed_size(size));
+    auto op = dst.data() + base;
+    dst.push(base, size, sizeof(u32));
+    op += sizeof(u32);
+
+    // last position of every hashed 4 bytes, stale entries are rejected by
+    // comparing the bytes
+    u32 table[1 << HASH_BITS] = {0};
+    size_t anchor = 0;
+    size_t pos = 1;
+    while (pos + MIN_MATCH <= size) {
+        auto& candidate = table[hash_of(src + pos)];
+        size_t match = candidate;
+        candidate = pos;
+        if (pos - match > MAX_OFFSET || decode_u32(src + match) != decode_u32(src + pos)) {
+            // skip faster through data that does not compress
+            pos += 1 + ((pos - anchor) >> 6);
+            continue;
+        }
+
+        size_t len = MIN_MATCH;
+        while (pos + len < size && src[match + len] == src[pos + len]) { len++; }
+        op = write_sequence(op, src + anchor, pos - anchor, pos - match, len);
+        pos += len;
+        anchor = pos;
+    }
+    op = write_sequence(op, src + anchor, size - anchor, 0, 0);
+    dst.resize(op - dst.data());
+}
+
+bool LzCodec::decompress(const u8* src, size_t size, Bytes& dst, size_t limit) const {
+    if (size < sizeof(u32)) { return false; }
+    size_t raw_size = decode_u32(src);
+    if (raw_size > limit) { return false; }
+    auto base = dst.size();
+    dst.resize(base + raw_size);
+    if (!this->decode_sequences(src + sizeof(u32), src + size, dst.data() + base, raw_size)) {
+        dst.resize(base);
+        return false;
+    }
+    return true;
+}
+
+bool LzCodec::decode_sequences(const u8* ip, const u8* end, u8* out, size_t raw_size) const {
+    size_t op = 0;
+    // the input must end with the literals of the last sequence
+    while (ip < end) {
+        auto token = *ip++;
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && !read_len(ip, end, literal_len)) { return false; }
+        if (literal_len > size_t(end - ip) || literal_len > raw_size - op) { return false; }
+        memcpy(out + op, ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+        if (ip == end) { return op == raw_size; }
+
+        if (end - ip < 2) { return false; }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t match_len = token & 15;
+        if (match_len == 15 && !read_len(ip, end, match_len)) { return false; }
+        match_len += MIN_MATCH;
+        if (!offset || offset > op || match_len > raw_size - op) { return false; }
+        // a match may overlap the bytes it produces
+        auto from = out + op - offset;
+        if (offset >= match_len) {
+            memcpy(out + op, from, match_len);
+        } else {
+            for (size_t i = 0; i < match_len; i++) { out[op + i] = from[i]; }
+        }
+        op += match_len;
+    }
+    return false;
+}
+
+}
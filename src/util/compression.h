@@ -0,0 +1,78 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-21 20:16:48
+ * @Description: block compression codecs
+ */
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include "defs.h"
+#include "util/bytes.h"
+#include <cstddef>
+
+namespace minilsm {
+
+// stored in the trailer of every block, values must not be reused
+enum class CompressionType : u8 {
+    NONE = 0,
+    LZ = 1,
+};
+
+class Codec {
+public:
+    virtual ~Codec() = default;
+
+    virtual CompressionType type() const = 0;
+
+    // append the compressed `size` bytes at `src` to `dst`
+    virtual void compress(const u8* src, size_t size, Bytes& dst) const = 0;
+
+    // append the bytes decompressed from the `size` bytes at `src` to
+    // `dst`, false with `dst` unchanged if the input is corrupted or would
+    // decompress to more than `limit` bytes
+    virtual bool decompress(const u8* src, size_t size, Bytes& dst, size_t limit) const = 0;
+};
+
+// codec of `type`, null for `NONE` and unknown types
+const Codec* get_codec(CompressionType type);
+
+/*
+ * byte-oriented LZ77 codec in the spirit of LZ4, trading ratio for speed:
+ * ----------------------------------------------------------------------
+ * | raw size (4B) | Sequence #1 | ... | Sequence #N |
+ * ----------------------------------------------------------------------
+ * sequence:
+ * ------------------------------------------------------------------------------------------------
+ * | token (1B) | literal len ext | literals | match offset (2B) | match len ext |
+ * ------------------------------------------------------------------------------------------------
+ * the high nibble of the token is the number of literals, the low one the
+ * match length minus `MIN_MATCH`. a nibble of 15 is followed by bytes
+ * added to it up to the first one below 255. the last sequence ends after
+ * its literals and has no match.
+ */
+class LzCodec : public Codec {
+private:
+    // decode the sequences in [ip, end) into the `raw_size` bytes at `out`
+    bool decode_sequences(const u8* ip, const u8* end, u8* out, size_t raw_size) const;
+
+public:
+    static constexpr size_t MIN_MATCH = 4;
+    // matches are searched in the last 64KB
+    static constexpr size_t MAX_OFFSET = UINT16_MAX;
+    static constexpr size_t HASH_BITS = 12;
+
+    CompressionType type() const override { return CompressionType::LZ; }
+
+    void compress(const u8* src, size_t size, Bytes& dst) const override;
+
+    bool decompress(const u8* src, size_t size, Bytes& dst, size_t limit) const override;
+
+    // upper bound of the compressed size of `size` bytes
+    static size_t max_compressed_size(size_t size) {
+        return sizeof(u32) + size + size / 255 + 16;
+    }
+};
+
+}
+
+#endif
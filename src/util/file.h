@@ -8,30 +8,53 @@
 
 #include "defs.h"
 #include "util/bytes.h"
+#include <cerrno>
 #include <cstddef>
-#include <fstream>
+#include <fcntl.h>
 #include <ios>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace minilsm {
 
 using std::string;
-using std::fstream;
 using std::ios;
 
+// file accessed through a raw descriptor, reads are positional (`pread`)
+// so that concurrent readers never share a file offset
 class File {
 private:
     string path_;
-    fstream stream_;
+    int fd_;
 
 public:
-    File(const string& name, std::ios_base::openmode mod) : path_(name) {
-        this->stream_.open(name, mod);
+    File(const string& name, std::ios_base::openmode mod) : path_(name), fd_(-1) {
+        int flags = O_CLOEXEC;
+        if ((mod & ios::in) && (mod & ios::out)) { flags |= O_RDWR | O_CREAT; }
+        else if (mod & ios::out) { flags |= O_WRONLY | O_CREAT; }
+        else { flags |= O_RDONLY; }
+        if (mod & ios::trunc) { flags |= O_TRUNC; }
+        if (mod & ios::app) { flags |= O_APPEND; }
+        this->fd_ = ::open(name.c_str(), flags, 0644);
     }
 
-    bool is_open() { return this->stream_.good(); }
+    File(const File&) = delete;
+
+    File& operator=(const File&) = delete;
+
+    File(File&& other) : path_(std::move(other.path_)), fd_(other.fd_) { other.fd_ = -1; }
+
+    ~File() { this->close(); }
+
+    bool is_open() { return this->fd_ >= 0; }
+
+    int fd() const { return this->fd_; }
+
+    const string& path() const { return this->path_; }
 
     bool remove() {
-        this->stream_.close();
+        this->close();
         if (std::remove(path_.c_str())) {
             return false;
         }
@@ -39,45 +62,109 @@ public:
     }
 
     bool write(const u8* src, size_t size) {
-        if (stream_.good()) {
-            stream_.write(reinterpret_cast<const char*>(src), size);
-            return true;
-        } 
-        return false;
+        if (!this->is_open()) { return false; }
+        while (size) {
+            auto res = ::write(this->fd_, src, size);
+            if (res < 0) {
+                if (errno == EINTR) { continue; }
+                return false;
+            }
+            src += res;
+            size -= res;
+        }
+        return true;
     }
 
-    Bytes read(size_t offset, size_t len) {
+    // read `len` bytes at `offset` into `dst`, safe to be called concurrently
+    bool read(size_t offset, size_t len, u8* dst) const {
+        if (this->fd_ < 0) { return false; }
+        while (len) {
+            auto res = ::pread(this->fd_, dst, len, offset);
+            if (res < 0) {
+                if (errno == EINTR) { continue; }
+                return false;
+            }
+            if (res == 0) { return false; }
+            dst += res;
+            offset += res;
+            len -= res;
+        }
+        return true;
+    }
+
+    Bytes read(size_t offset, size_t len) const {
         Bytes buf;
-        if (stream_.good()) {
+        if (this->fd_ >= 0) {
             buf.resize(len);
-            stream_.seekp(offset);
-            stream_.read(reinterpret_cast<char*>(buf.data()), len);
-        } 
+            if (!this->read(offset, len, buf.data())) { buf.resize(0); }
+        }
         return buf;
     }
 
-    auto size() { 
-        stream_.seekg(0, ios::end);
-        return stream_.tellg();
+    size_t size() const {
+        struct stat st;
+        if (this->fd_ < 0 || fstat(this->fd_, &st)) { return 0; }
+        return st.st_size;
     }
 
-    bool flush() {
-        if (stream_.good()) {
-            stream_.flush();
-            return true;
-        }
-        return false;
+    // make written data durable
+    bool sync() {
+        return this->is_open() && !fdatasync(this->fd_);
     }
 
     bool close() {
-        if (stream_.good()) {
-            stream_.close();
-            return true;
+        if (this->is_open()) {
+            auto res = ::close(this->fd_);
+            this->fd_ = -1;
+            return !res;
         }
         return false;
     }
 };
 
+// directory holding the file `path`
+inline string dir_of(const string& path) {
+    auto file_path = std::filesystem::path(path);
+    return file_path.has_parent_path() ? file_path.parent_path().string() : ".";
+}
+
+// make the entries of directory `path` durable, after a file in it was
+// created, renamed or removed
+inline bool sync_dir(const string& path) {
+    File dir(path, ios::in);
+    return dir.is_open() && !fsync(dir.fd());
+}
+
+// read-only mapping of a whole file, unmapped once the last holder is gone
+class MmapRegion {
+private:
+    u8* data_;
+    size_t size_;
+
+public:
+    MmapRegion(const File& file) : data_(nullptr), size_(file.size()) {
+        if (!this->size_) { return; }
+        auto addr = mmap(nullptr, this->size_, PROT_READ, MAP_SHARED, file.fd(), 0);
+        if (addr != MAP_FAILED) {
+            this->data_ = static_cast<u8*>(addr);
+        }
+    }
+
+    MmapRegion(const MmapRegion&) = delete;
+
+    MmapRegion& operator=(const MmapRegion&) = delete;
+
+    ~MmapRegion() {
+        if (this->data_) { munmap(this->data_, this->size_); }
+    }
+
+    bool is_valid() const { return this->data_ != nullptr; }
+
+    const u8* data() const { return this->data_; }
+
+    size_t size() const { return this->size_; }
+};
+
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,46 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-02 15:12:40
+ * @Description: hash functions for keys
+ */
+#ifndef HASH_H
+#define HASH_H
+
+#include "defs.h"
+#include <cstddef>
+#include <cstring>
+
+namespace minilsm {
+
+// 64-bit MurmurHash2 (MurmurHash64A) by Austin Appleby, reads the input
+// eight bytes at a time
+inline u64 hash64(const u8* data, size_t len, u64 seed = 0xA5A5A5A55A5A5A5AULL) {
+    const u64 m = 0xC6A4A7935BD1E995ULL;
+    const int r = 47;
+    u64 h = seed ^ (len * m);
+
+    auto end = data + (len & ~size_t(7));
+    for (; data != end; data += sizeof(u64)) {
+        u64 k;
+        memcpy(&k, data, sizeof(u64));
+        k *= m; k ^= k >> r; k *= m;
+        h ^= k; h *= m;
+    }
+
+    switch (len & 7) {
+        case 7: h ^= u64(data[6]) << 48; [[fallthrough]];
+        case 6: h ^= u64(data[5]) << 40; [[fallthrough]];
+        case 5: h ^= u64(data[4]) << 32; [[fallthrough]];
+        case 4: h ^= u64(data[3]) << 24; [[fallthrough]];
+        case 3: h ^= u64(data[2]) << 16; [[fallthrough]];
+        case 2: h ^= u64(data[1]) << 8; [[fallthrough]];
+        case 1: h ^= u64(data[0]); h *= m;
+    }
+
+    h ^= h >> r; h *= m; h ^= h >> r;
+    return h;
+}
+
+}
+
+#endif
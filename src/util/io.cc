@@ -0,0 +1,302 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-26 16:42:09
+ * @Description: implementation of io backends
+ */
+
+#include "util/io.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace minilsm {
+
+bool ReadBatch::wait() {
+    std::unique_lock<mutex> lock(this->mtx_);
+    this->cv_.wait(lock, [this]() { return !this->pending_; });
+    for (auto& req : this->requests) {
+        if (!req.ok) { return false; }
+    }
+    return true;
+}
+
+bool ReadBatch::is_done() {
+    std::lock_guard<mutex> lock(this->mtx_);
+    return !this->pending_;
+}
+
+void ReadBatch::complete(size_t n) {
+    // notified under the lock, the batch may be gone once it is released
+    std::lock_guard<mutex> lock(this->mtx_);
+    DCHECK(this->pending_ >= n);
+    this->pending_ -= n;
+    if (!this->pending_) { this->cv_.notify_all(); }
+}
+
+void IoBackend::submit(const shared_ptr<ReadBatch>& batch) {
+    for (auto& req : batch->requests) {
+        req.buf.resize(req.len);
+        req.ok = false;
+    }
+    batch->start();
+    if (batch->requests.empty()) { return; }
+    this->do_submit(batch);
+}
+
+shared_ptr<IoBackend> IoBackend::create(IoBackendType type) {
+    if (type == IoBackendType::IO_URING) {
+        if (auto backend = IoUringBackend::create()) { return std::move(backend); }
+    }
+    return pread_backend();
+}
+
+shared_ptr<IoBackend> IoBackend::pread_backend() {
+    static auto backend = std::make_shared<PreadBackend>();
+    return backend;
+}
+
+void IoBackend::complete(ReadBatch& batch, size_t idx, bool ok) {
+    batch.requests[idx].ok = ok;
+    batch.complete();
+}
+
+bool IoBackend::pread_all(int fd, ReadRequest& req, size_t done) {
+    if (fd < 0) { return false; }
+    while (done < req.len) {
+        auto res = ::pread(fd, req.buf.data() + done, req.len - done, req.offset + done);
+        if (res < 0) {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+        if (res == 0) { return false; }
+        done += res;
+    }
+    return true;
+}
+
+void PreadBackend::do_submit(const shared_ptr<ReadBatch>& batch) {
+    for (size_t i = 0; i < batch->requests.size(); i++) {
+        complete(*batch, i, pread_all(batch->fd, batch->requests[i]));
+    }
+}
+
+static int io_uring_setup(u32 entries, io_uring_params* params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, u32 to_submit, u32 min_complete, u32 flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+IoUringBackend::IoUringBackend() :
+        ring_fd_(-1),
+        sq_ring_(MAP_FAILED),
+        sq_ring_size_(0),
+        cq_ring_(MAP_FAILED),
+        cq_ring_size_(0),
+        sqes_(nullptr),
+        sqes_size_(0),
+        inflight_(0),
+        closed_(false) {}
+
+std::unique_ptr<IoUringBackend> IoUringBackend::create(u32 entries) {
+    std::unique_ptr<IoUringBackend> backend(new IoUringBackend());
+    if (!backend->setup(entries)) { return nullptr; }
+    backend->reaper_ = std::thread(&IoUringBackend::reap_loop, backend.get());
+    return backend;
+}
+
+bool IoUringBackend::setup(u32 entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    this->ring_fd_ = io_uring_setup(entries, &params);
+    if (this->ring_fd_ < 0) { return false; }
+    this->sq_entries_ = params.sq_entries;
+    this->cq_entries_ = params.cq_entries;
+
+    // both rings share one mapping on kernels with `IORING_FEAT_SINGLE_MMAP`
+    this->sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(u32);
+    this->cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        this->sq_ring_size_ = this->cq_ring_size_ = std::max(this->sq_ring_size_, this->cq_ring_size_);
+    }
+    this->sq_ring_ = mmap(nullptr, this->sq_ring_size_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, this->ring_fd_, IORING_OFF_SQ_RING);
+    if (this->sq_ring_ == MAP_FAILED) { return false; }
+    if (single_mmap) {
+        this->cq_ring_ = this->sq_ring_;
+    } else {
+        this->cq_ring_ = mmap(nullptr, this->cq_ring_size_, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, this->ring_fd_, IORING_OFF_CQ_RING);
+        if (this->cq_ring_ == MAP_FAILED) { return false; }
+    }
+    this->sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    auto sqes = mmap(nullptr, this->sqes_size_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, this->ring_fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) { return false; }
+    this->sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    auto sq = static_cast<u8*>(this->sq_ring_);
+    this->sq_tail_ = reinterpret_cast<u32*>(sq + params.sq_off.tail);
+    this->sq_mask_ = reinterpret_cast<u32*>(sq + params.sq_off.ring_mask);
+    this->sq_array_ = reinterpret_cast<u32*>(sq + params.sq_off.array);
+    auto cq = static_cast<u8*>(this->cq_ring_);
+    this->cq_head_ = reinterpret_cast<u32*>(cq + params.cq_off.head);
+    this->cq_tail_ = reinterpret_cast<u32*>(cq + params.cq_off.tail);
+    this->cq_mask_ = reinterpret_cast<u32*>(cq + params.cq_off.ring_mask);
+    this->cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+}
+
+IoUringBackend::~IoUringBackend() {
+    if (this->reaper_.joinable()) {
+        std::lock_guard<mutex> sq_lock(this->sq_mtx_);
+        {
+            std::unique_lock<mutex> lock(this->mtx_);
+            this->closed_ = true;
+            this->cv_.wait(lock, [this]() { return !this->inflight_; });
+        }
+        // wake the reaper up with a nop carrying no read
+        auto tail = *this->sq_tail_;
+        auto idx = tail & *this->sq_mask_;
+        auto sqe = &this->sqes_[idx];
+        memset(sqe, 0, sizeof(io_uring_sqe));
+        sqe->opcode = IORING_OP_NOP;
+        this->sq_array_[idx] = idx;
+        __atomic_store_n(this->sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        if (this->enter(1)) {
+            this->reaper_.join();
+        } else {
+            // the reaper is left blocked in the kernel, closing the ring
+            // would free what it waits on
+            this->reaper_.detach();
+            return;
+        }
+    }
+
+    if (this->sqes_) { munmap(this->sqes_, this->sqes_size_); }
+    if (this->cq_ring_ != MAP_FAILED && this->cq_ring_ != this->sq_ring_) {
+        munmap(this->cq_ring_, this->cq_ring_size_);
+    }
+    if (this->sq_ring_ != MAP_FAILED) { munmap(this->sq_ring_, this->sq_ring_size_); }
+    if (this->ring_fd_ >= 0) { close(this->ring_fd_); }
+}
+
+void IoUringBackend::push(int fd, u8* dst, size_t len, size_t offset, u64 user_data) {
+    // no sqpoll thread, the kernel consumes every sqe on `io_uring_enter`
+    auto tail = *this->sq_tail_;
+    auto idx = tail & *this->sq_mask_;
+    auto sqe = &this->sqes_[idx];
+    memset(sqe, 0, sizeof(io_uring_sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<u64>(dst);
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    this->sq_array_[idx] = idx;
+    __atomic_store_n(this->sq_tail_, tail + 1, __ATOMIC_RELEASE);
+}
+
+u32 IoUringBackend::enter(u32 to_submit) {
+    u32 submitted = 0;
+    while (submitted < to_submit) {
+        auto res = io_uring_enter(this->ring_fd_, to_submit - submitted, 0, 0);
+        if (res > 0) {
+            submitted += res;
+            continue;
+        }
+        // EAGAIN and EBUSY clear up as the reaper drains completions
+        if (res < 0 && errno == EINTR) { continue; }
+        if (res < 0 && (errno == EAGAIN || errno == EBUSY)) {
+            std::this_thread::yield();
+            continue;
+        }
+        LOG(ERROR) << "io_uring_enter failed: " << (res < 0 ? strerror(errno) : "nothing submitted");
+        break;
+    }
+    // no sqpoll thread, the kernel has not seen the sqes left
+    if (submitted < to_submit) {
+        __atomic_store_n(this->sq_tail_, *this->sq_tail_ - (to_submit - submitted), __ATOMIC_RELEASE);
+    }
+    return submitted;
+}
+
+void IoUringBackend::do_submit(const shared_ptr<ReadBatch>& batch) {
+    auto& requests = batch->requests;
+    std::lock_guard<mutex> sq_lock(this->sq_mtx_);
+    for (size_t i = 0; i < requests.size();) {
+        // keep the completions in flight within the completion ring
+        u32 to_submit;
+        {
+            std::unique_lock<mutex> lock(this->mtx_);
+            DCHECK(!this->closed_);
+            this->cv_.wait(lock, [this]() { return this->inflight_ < this->cq_entries_; });
+            to_submit = std::min<size_t>({requests.size() - i, this->sq_entries_,
+                this->cq_entries_ - this->inflight_});
+            this->inflight_ += to_submit;
+        }
+        vector<Pending*> pendings;
+        for (u32 j = 0; j < to_submit; j++) {
+            auto& req = requests[i + j];
+            pendings.push_back(new Pending{batch.get(), i + j});
+            this->push(batch->fd, req.buf.data(), req.len, req.offset, reinterpret_cast<u64>(pendings.back()));
+        }
+        auto submitted = this->enter(to_submit);
+        if (submitted == to_submit) {
+            i += to_submit;
+            continue;
+        }
+
+        // the reads not submitted fail, along with the rest of the batch
+        for (auto j = submitted; j < to_submit; j++) { delete pendings[j]; }
+        {
+            std::lock_guard<mutex> lock(this->mtx_);
+            this->inflight_ -= to_submit - submitted;
+        }
+        this->cv_.notify_all();
+        for (i += submitted; i < requests.size(); i++) { complete(*batch, i, false); }
+    }
+}
+
+void IoUringBackend::reap_loop() {
+    while (true) {
+        auto head = *this->cq_head_;
+        if (head == __atomic_load_n(this->cq_tail_, __ATOMIC_ACQUIRE)) {
+            auto res = io_uring_enter(this->ring_fd_, 0, 1, IORING_ENTER_GETEVENTS);
+            DCHECK(res >= 0 || errno == EINTR);
+            continue;
+        }
+
+        auto cqe = this->cqes_[head & *this->cq_mask_];
+        __atomic_store_n(this->cq_head_, head + 1, __ATOMIC_RELEASE);
+        // the nop posted on destruction
+        if (!cqe.user_data) { return; }
+
+        auto pending = reinterpret_cast<Pending*>(cqe.user_data);
+        auto& batch = *pending->batch;
+        auto idx = pending->idx;
+        delete pending;
+        auto& req = batch.requests[idx];
+        // failed reads (e.g. `IORING_OP_READ` unsupported by an old kernel)
+        // and short reads are rare, finish them with `pread`
+        bool ok = cqe.res >= 0 && size_t(cqe.res) == req.len;
+        if (!ok) { ok = pread_all(batch.fd, req, std::max(cqe.res, 0)); }
+
+        // the read is no longer counted once its batch may go away, along
+        // with the backend it may hold last
+        {
+            std::lock_guard<mutex> lock(this->mtx_);
+            this->inflight_--;
+        }
+        this->cv_.notify_all();
+        complete(batch, idx, ok);
+    }
+}
+
+}
@@ -0,0 +1,202 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-26 16:42:09
+ * @Description: backends submitting batches of positional reads
+ */
+#ifndef IO_H
+#define IO_H
+
+#include "defs.h"
+#include "util/bytes.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace minilsm {
+
+using std::vector;
+using std::shared_ptr;
+using std::mutex;
+using std::condition_variable;
+
+enum class IoBackendType {
+    // blocking `pread`, one read at a time
+    PREAD,
+    // io_uring, falls back to `PREAD` if the kernel does not support it
+    IO_URING,
+};
+
+struct ReadRequest {
+    size_t offset;
+    size_t len;
+    // sized to `len` when the request is submitted
+    Bytes buf;
+    bool ok = false;
+};
+
+// reads submitted together, completing in any order. the backend refers to
+// the batch without owning it, dropping a batch waits for its reads.
+class ReadBatch {
+private:
+    mutex mtx_;
+    condition_variable cv_;
+    size_t pending_;
+
+public:
+    int fd;
+    vector<ReadRequest> requests;
+    // keeps `fd` open until the batch completes
+    shared_ptr<const void> holder;
+
+    ReadBatch(int fd, shared_ptr<const void> holder = nullptr) :
+        pending_(0), fd(fd), holder(holder) {}
+
+    ReadBatch(const ReadBatch&) = delete;
+
+    ReadBatch& operator=(const ReadBatch&) = delete;
+
+    ~ReadBatch() { this->wait(); }
+
+    void add(size_t offset, size_t len) { this->requests.push_back(ReadRequest{offset, len}); }
+
+    // block until every request completes, true if all of them succeeded
+    bool wait();
+
+    bool is_done();
+
+private:
+    friend class IoBackend;
+
+    void start() { this->pending_ = this->requests.size(); }
+
+    void complete(size_t n = 1);
+};
+
+class IoBackend {
+public:
+    virtual ~IoBackend() = default;
+
+    virtual IoBackendType type() const = 0;
+
+    // whether `submit` returns before the reads complete
+    virtual bool is_async() const = 0;
+
+    // start every read of `batch`, whose results are ready once
+    // `ReadBatch::wait` returns
+    void submit(const shared_ptr<ReadBatch>& batch);
+
+    // backend of `type`, the `PREAD` one if it is not available
+    static shared_ptr<IoBackend> create(IoBackendType type);
+
+    // stateless blocking backend shared by files opened without a backend
+    static shared_ptr<IoBackend> pread_backend();
+
+protected:
+    virtual void do_submit(const shared_ptr<ReadBatch>& batch) = 0;
+
+    // mark the `idx`-th request of `batch` as done
+    static void complete(ReadBatch& batch, size_t idx, bool ok);
+
+    // read the request synchronously from `offset` on
+    static bool pread_all(int fd, ReadRequest& req, size_t done = 0);
+};
+
+class PreadBackend : public IoBackend {
+public:
+    IoBackendType type() const override { return IoBackendType::PREAD; }
+
+    bool is_async() const override { return false; }
+
+protected:
+    void do_submit(const shared_ptr<ReadBatch>& batch) override;
+};
+
+/*
+ * io_uring driven through raw syscalls. the reads of a batch are queued in
+ * the submission ring and submitted with a single `io_uring_enter`, a
+ * background thread reaps the completions. at most `entries` reads are
+ * submitted at once and at most the size of the completion ring are in
+ * flight, submitters wait for room beyond that.
+ */
+class IoUringBackend : public IoBackend {
+private:
+    // a read in flight, its address is the user data of the sqe. the batch
+    // is kept alive by its submitter, never by the reaper: the batch may
+    // hold the last reference to the backend itself.
+    struct Pending {
+        ReadBatch* batch;
+        size_t idx;
+    };
+
+    int ring_fd_;
+    u32 sq_entries_;
+    u32 cq_entries_;
+    void* sq_ring_;
+    size_t sq_ring_size_;
+    void* cq_ring_;
+    size_t cq_ring_size_;
+    io_uring_sqe* sqes_;
+    size_t sqes_size_;
+    u32* sq_tail_;
+    u32* sq_mask_;
+    u32* sq_array_;
+    u32* cq_head_;
+    u32* cq_tail_;
+    u32* cq_mask_;
+    io_uring_cqe* cqes_;
+
+    // serializes the submitters filling the submission ring
+    mutex sq_mtx_;
+    // protects `inflight_` and `closed_`, never held while waiting on the
+    // kernel so that the reaper always drains the completions
+    mutex mtx_;
+    condition_variable cv_;
+    size_t inflight_;
+    bool closed_;
+    std::thread reaper_;
+
+public:
+    static constexpr u32 DEFAULT_ENTRIES = 256;
+
+    // null if io_uring is not supported
+    static std::unique_ptr<IoUringBackend> create(u32 entries = DEFAULT_ENTRIES);
+
+    IoUringBackend(const IoUringBackend&) = delete;
+
+    IoUringBackend& operator=(const IoUringBackend&) = delete;
+
+    ~IoUringBackend();
+
+    IoBackendType type() const override { return IoBackendType::IO_URING; }
+
+    bool is_async() const override { return true; }
+
+protected:
+    void do_submit(const shared_ptr<ReadBatch>& batch) override;
+
+private:
+    IoUringBackend();
+
+    // map the rings of `ring_fd_`, false on failure
+    bool setup(u32 entries);
+
+    // queue a read, the caller holds `sq_mtx_` and made room in the rings
+    void push(int fd, u8* dst, size_t len, size_t offset, u64 user_data);
+
+    // submit the queued sqes, the caller holds `sq_mtx_`. the number of
+    // sqes submitted, fewer than `to_submit` on a persistent error, whose
+    // sqes are taken back from the ring.
+    u32 enter(u32 to_submit);
+
+    void reap_loop();
+};
+
+}
+
+#endif
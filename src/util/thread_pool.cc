@@ -0,0 +1,43 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-23 21:08:15
+ * @Description: implementation of thread pool
+ */
+
+#include "util/thread_pool.h"
+
+namespace minilsm {
+
+ThreadPool::ThreadPool(size_t num_threads) : closed_(false) {
+    DCHECK(num_threads > 0);
+    for (size_t i = 0; i < num_threads; i++) {
+        this->threads_.emplace_back(&ThreadPool::run, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<mutex> lock(this->mtx_);
+        this->closed_ = true;
+    }
+    this->cv_.notify_all();
+    for (auto& thd : this->threads_) {
+        thd.join();
+    }
+}
+
+void ThreadPool::run() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<mutex> lock(this->mtx_);
+            this->cv_.wait(lock, [this]() { return this->closed_ || !this->tasks_.empty(); });
+            if (this->tasks_.empty()) { return; }
+            task = std::move(this->tasks_.front());
+            this->tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+}
@@ -0,0 +1,65 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-23 21:08:15
+ * @Description: fixed-size pool of background threads
+ */
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "defs.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace minilsm {
+
+using std::vector;
+using std::deque;
+using std::mutex;
+using std::condition_variable;
+
+// tasks run in submission order on `num_threads` threads, tasks still
+// queued when the pool is destroyed run before it returns
+class ThreadPool {
+private:
+    mutex mtx_;
+    condition_variable cv_;
+    deque<std::function<void()>> tasks_;
+    vector<std::thread> threads_;
+    bool closed_;
+
+public:
+    ThreadPool(size_t num_threads);
+
+    ThreadPool(const ThreadPool&) = delete;
+
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool();
+
+    // run `func` in the background, its result is delivered by the future
+    template <typename F>
+    auto submit(F&& func) -> std::future<decltype(func())> {
+        auto task = std::make_shared<std::packaged_task<decltype(func())()>>(std::forward<F>(func));
+        auto res = task->get_future();
+        {
+            std::lock_guard<mutex> lock(this->mtx_);
+            DCHECK(!this->closed_);
+            this->tasks_.emplace_back([task]() { (*task)(); });
+        }
+        this->cv_.notify_one();
+        return res;
+    }
+
+private:
+    void run();
+};
+
+}
+
+#endif
@@ -0,0 +1,359 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-09-22 10:41:15
+ * @Description: implementation of write-ahead log
+ */
+
+#include "wal/wal.h"
+#include "util/file.h"
+#include "folly/hash/Checksum.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace minilsm {
+
+static const size_t RECORD_HEADER_SIZE = sizeof(u32) + sizeof(u32);
+static const u32 WAL_MAGIC = 0x57414c47;
+static const size_t SEGMENT_HEADER_SIZE = sizeof(u32) + sizeof(u32);
+
+static string segment_path(const string& path, u64 seq) {
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), ".%06lu", (unsigned long)seq);
+    return path + suffix;
+}
+
+Wal::Wal(const string& path, const WalOptions& options, u64 seq) :
+        path_(path),
+        options_(options),
+        fd_(-1),
+        segment_seq_(seq),
+        segment_size_(0),
+        dirty_(false),
+        leading_(false),
+        removed_(false),
+        closed_(false) {}
+
+Wal::~Wal() {
+    {
+        std::lock_guard<mutex> lock(this->mtx_);
+        this->closed_ = true;
+    }
+    this->syncer_cv_.notify_all();
+    if (this->syncer_.joinable()) {
+        this->syncer_.join();
+    }
+    if (this->fd_ >= 0 && this->options_.sync_policy != WalSyncPolicy::NONE) {
+        fdatasync(this->fd_);
+    }
+    this->close_fd();
+}
+
+void Wal::start() {
+    if (this->options_.sync_policy == WalSyncPolicy::INTERVAL) {
+        this->syncer_ = std::thread(&Wal::sync_loop, this);
+    }
+}
+
+std::unique_ptr<Wal> Wal::recover(const string& path,
+        const function<void(ValueType, const KeySlice&, const Slice&)>& callback,
+        const WalOptions& options) {
+    auto segments = list_segments(path);
+    bool torn = false;
+    for (auto& segment : segments) {
+        if (torn) {
+            // nothing behind a torn record has ever been acknowledged
+            std::filesystem::remove(segment.second);
+            continue;
+        }
+
+        // an unreadable segment is not torn, its records may be intact
+        File file(segment.second, std::ios_base::in);
+        if (!file.is_open()) { return nullptr; }
+        size_t len = file.size();
+        auto buf = file.read(0, len);
+        if (buf.size() != len) { return nullptr; }
+        file.close();
+
+        // a header cut short is the tail of a segment just started
+        size_t idx = 0;
+        if (len >= SEGMENT_HEADER_SIZE) {
+            if (buf.get(0, sizeof(u32)) != WAL_MAGIC) {
+                LOG(ERROR) << segment.second << " is not a wal segment";
+                return nullptr;
+            }
+            auto version = buf.get(sizeof(u32), sizeof(u32));
+            if (version != WAL_FORMAT_VERSION) {
+                LOG(ERROR) << "unsupported version " << version << " of wal segment " << segment.second;
+                return nullptr;
+            }
+            idx = SEGMENT_HEADER_SIZE;
+        }
+        while (idx + RECORD_HEADER_SIZE <= len) {
+            auto checksum_crc_stored = buf.get(idx, sizeof(u32));
+            auto payload_len = buf.get(idx + sizeof(u32), sizeof(u32));
+            if (idx + RECORD_HEADER_SIZE + payload_len > len) { break; }
+            auto checksum_crc = folly::crc32(
+                buf.outstream(idx + sizeof(u32)), sizeof(u32) + payload_len);
+            if (checksum_crc != checksum_crc_stored) { break; }
+
+            auto pos = idx + RECORD_HEADER_SIZE;
+            auto type = ValueType(buf.get(pos)); pos += sizeof(u8);
+            auto ts = buf.get(pos, sizeof(u64)); pos += sizeof(u64);
+            auto key_len = buf.get(pos, sizeof(u16)); pos += sizeof(u16);
+            KeySlice key(buf.outstream(pos), key_len); pos += key_len;
+            key.set_ts(ts);
+            auto value_len = buf.get(pos, sizeof(u16)); pos += sizeof(u16);
+            Slice value(buf.outstream(pos), value_len);
+            callback(type, key, value);
+
+            idx += RECORD_HEADER_SIZE + payload_len;
+        }
+
+        if (idx != len) {
+            torn = true;
+            std::error_code ec;
+            std::filesystem::resize_file(segment.second, idx, ec);
+            if (ec) { return nullptr; }
+        }
+    }
+
+    auto next_seq = segments.empty() ? 0 : segments.back().first + 1;
+    auto wal = std::unique_ptr<Wal>(new Wal(path, options, next_seq));
+    if (!wal->open_segment(next_seq)) { return nullptr; }
+    wal->start();
+    return wal;
+}
+
+std::unique_ptr<Wal> Wal::create(const string& path, const WalOptions& options) {
+    for (auto& segment : list_segments(path)) {
+        std::filesystem::remove(segment.second);
+    }
+    auto wal = std::unique_ptr<Wal>(new Wal(path, options, 0));
+    if (!wal->open_segment(0)) {
+        LOG(ERROR) << "failed to create wal " << path;
+        return nullptr;
+    }
+    wal->start();
+    return wal;
+}
+
+bool Wal::put(const Slice& key, const Slice& value, ValueType type, u64 ts) {
+    Writer writer;
+    return this->append(writer, key, value, type, ts) && this->wait(writer);
+}
+
+bool Wal::append(Writer& writer, const Slice& key, const Slice& value, ValueType type, u64 ts) {
+    if (!encode_record(type, ts, key, value, writer.buf)) { return false; }
+    writer.record = &writer.buf;
+    return this->enqueue(writer);
+}
+
+bool Wal::sync() {
+    Writer writer;
+    writer.sync = true;
+    return this->commit(writer);
+}
+
+bool Wal::commit(Writer& writer) {
+    return this->enqueue(writer) && this->wait(writer);
+}
+
+bool Wal::enqueue(Writer& writer) {
+    std::lock_guard<mutex> lock(this->mtx_);
+    if (this->removed_) { return false; }
+    this->writers_.push_back(&writer);
+    return true;
+}
+
+bool Wal::wait(Writer& writer) {
+    std::unique_lock<mutex> lock(this->mtx_);
+    while (!writer.done && &writer != this->writers_.front()) {
+        writer.cv.wait(lock);
+    }
+    if (writer.done) { return writer.ok; }
+
+    // `writer` is the leader now, it writes on behalf of the queued
+    // followers. new writers keep queueing behind the group meanwhile.
+    bool need_sync = this->options_.sync_policy == WalSyncPolicy::EVERY_WRITE;
+    size_t group_cnt = 0, group_size = 0;
+    for (auto follower : this->writers_) {
+        if (follower->record) {
+            auto size = follower->record->size();
+            if (group_size && group_size + size > this->options_.max_group_size) { break; }
+            group_size += size;
+        }
+        need_sync |= follower->sync;
+        group_cnt++;
+    }
+
+    Bytes group;
+    const Bytes* buf = writer.record;
+    if (group_cnt > 1) {
+        group.reserve(group_size);
+        for (size_t i = 0; i < group_cnt; i++) {
+            auto record = this->writers_[i]->record;
+            if (record) { group.instream(record->outstream(), record->size()); }
+        }
+        buf = &group;
+    }
+    need_sync &= group_size > 0 || this->dirty_;
+    this->leading_ = true;
+    lock.unlock();
+
+    bool ok = this->fd_ >= 0;
+    if (ok && group_size) {
+        ok = this->write_all(buf->outstream(), group_size);
+        this->segment_size_ += group_size;
+    }
+    if (ok && need_sync) {
+        ok = !fdatasync(this->fd_);
+    }
+    if (ok && this->segment_size_ >= this->options_.segment_size) {
+        if (this->options_.sync_policy != WalSyncPolicy::NONE && !need_sync) {
+            ok = !fdatasync(this->fd_);
+        }
+        ok = this->open_segment(this->segment_seq_ + 1) && ok;
+        need_sync = true;
+    }
+
+    lock.lock();
+    this->leading_ = false;
+    this->leader_cv_.notify_all();
+    if (ok) {
+        this->dirty_ = !need_sync && (this->dirty_ || group_size);
+    }
+    for (size_t i = 0; i < group_cnt; i++) {
+        auto follower = this->writers_.front();
+        this->writers_.pop_front();
+        follower->ok = ok;
+        follower->done = true;
+        if (follower != &writer) { follower->cv.notify_one(); }
+    }
+    if (!this->writers_.empty()) {
+        this->writers_.front()->cv.notify_one();
+    }
+    return ok;
+}
+
+bool Wal::remove() {
+    std::unique_lock<mutex> lock(this->mtx_);
+    this->leader_cv_.wait(lock, [this]() { return !this->leading_; });
+    this->close_fd();
+    this->removed_ = true;
+    // the memtable holding the queued records is persisted already
+    for (auto writer : this->writers_) {
+        writer->ok = true;
+        writer->done = true;
+        writer->cv.notify_one();
+    }
+    this->writers_.clear();
+
+    bool res = true;
+    for (auto& segment : list_segments(this->path_)) {
+        res &= std::filesystem::remove(segment.second);
+    }
+    // segments coming back after a crash would be replayed again
+    if (this->options_.sync_policy != WalSyncPolicy::NONE) {
+        res &= sync_dir(dir_of(this->path_));
+    }
+    return res;
+}
+
+bool Wal::encode_record(ValueType type, u64 ts, const Slice& key, const Slice& value, Bytes& buf) {
+    if (key.size() > std::numeric_limits<u16>::max() || 
+            value.size() > std::numeric_limits<u16>::max()) {
+        return false;
+    }
+    auto payload_len = sizeof(u8) + sizeof(u64) + sizeof(u16) + key.size() + sizeof(u16) + value.size();
+
+    buf.reserve(RECORD_HEADER_SIZE + payload_len);
+    buf.push(0, sizeof(u32)); // crc placeholder
+    buf.push(payload_len, sizeof(u32));
+    buf.push(static_cast<u8>(type), sizeof(u8));
+    buf.push(ts, sizeof(u64));
+    buf.push(key.size(), sizeof(u16));
+    buf.instream(key.data(), key.size());
+    buf.push(value.size(), sizeof(u16));
+    buf.instream(value.data(), value.size());
+
+    auto checksum_crc = folly::crc32(buf.outstream(sizeof(u32)), sizeof(u32) + payload_len);
+    buf.push(0, checksum_crc, sizeof(u32));
+    return true;
+}
+
+vector<std::pair<u64, string>> Wal::list_segments(const string& path) {
+    vector<std::pair<u64, string>> res;
+    auto file_path = std::filesystem::path(path);
+    auto dir = file_path.has_parent_path() ? file_path.parent_path() : std::filesystem::path(".");
+    auto prefix = file_path.filename().string() + ".";
+    if (!std::filesystem::exists(dir)) { return res; }
+
+    for (auto& entry : std::filesystem::directory_iterator(dir)) {
+        auto name = entry.path().filename().string();
+        if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix)) { continue; }
+        auto suffix = name.substr(prefix.size());
+        if (suffix.find_first_not_of("0123456789") != string::npos) { continue; }
+        res.emplace_back(std::stoull(suffix), entry.path().string());
+    }
+    std::sort(res.begin(), res.end());
+    return res;
+}
+
+bool Wal::open_segment(u64 seq) {
+    this->close_fd();
+    this->fd_ = ::open(segment_path(this->path_, seq).c_str(),
+        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    this->segment_seq_ = seq;
+    this->segment_size_ = 0;
+    if (this->fd_ < 0) { return false; }
+    Bytes header;
+    header.push(WAL_MAGIC, sizeof(u32));
+    header.push(WAL_FORMAT_VERSION, sizeof(u32));
+    if (!this->write_all(header.outstream(), header.size())) {
+        this->close_fd();
+        return false;
+    }
+    this->segment_size_ = header.size();
+    if (this->options_.sync_policy == WalSyncPolicy::NONE) { return true; }
+    // writes to a segment that may vanish on a crash would not be durable
+    if (!sync_dir(dir_of(this->path_))) {
+        this->close_fd();
+        return false;
+    }
+    return true;
+}
+
+bool Wal::write_all(const u8* data, size_t size) {
+    while (size) {
+        auto res = ::write(this->fd_, data, size);
+        if (res < 0) {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+        data += res;
+        size -= res;
+    }
+    return true;
+}
+
+void Wal::close_fd() {
+    if (this->fd_ >= 0) {
+        ::close(this->fd_);
+        this->fd_ = -1;
+    }
+}
+
+void Wal::sync_loop() {
+    auto interval = std::chrono::milliseconds(this->options_.sync_interval_ms);
+    std::unique_lock<mutex> lock(this->mtx_);
+    while (!this->closed_) {
+        this->syncer_cv_.wait_for(lock, interval);
+        if (this->closed_ || !this->dirty_) { continue; }
+        lock.unlock();
+        this->sync();
+        lock.lock();
+    }
+}
+
+}
@@ -0,0 +1,177 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-09-22 10:41:15
+ * @Description: write-ahead log of memtable
+ */
+#ifndef WAL_H
+#define WAL_H
+
+#include "defs.h"
+#include "mvcc/key.h"
+#include "slice.h"
+#include "util/bytes.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <string>
+#include <thread>
+
+namespace minilsm {
+
+using std::string;
+using std::deque;
+using std::mutex;
+using std::condition_variable;
+using std::function;
+
+enum class WalSyncPolicy : u8 {
+    // every acknowledged write has been synced
+    EVERY_WRITE,
+    // synced by a background thread every `sync_interval_ms`
+    INTERVAL,
+    // left to the os
+    NONE,
+};
+
+struct WalOptions {
+    WalSyncPolicy sync_policy = WalSyncPolicy::EVERY_WRITE;
+    // only used by `WalSyncPolicy::INTERVAL`
+    u64 sync_interval_ms = 10;
+    // a new segment is started once the current one exceeds this size
+    size_t segment_size = 64 * 1024 * 1024;
+    // upper bound of the bytes written by one group commit
+    size_t max_group_size = 1024 * 1024;
+};
+
+/*
+ * the log is split into segments named `<path>.<seq>`, each segment starts
+ * with a header:
+ * ------------------------------
+ * | magic (4B) | version (4B) |
+ * ------------------------------
+ * a segment of any other version is rejected. the records follow it:
+ * ---------------------------------------------------------------------------------------------------
+ * |                                           Record #1                                       | ... |
+ * ---------------------------------------------------------------------------------------------------
+ * | crc (4B) | payload_len (4B) | type (1B) | ts (8B) | key_len (2B) | key | value_len (2B) | value |
+ * ---------------------------------------------------------------------------------------------------
+ * `type` is a `ValueType` and `ts` the timestamp of the write. the crc covers `payload_len` and the
+ * payload.
+ * recovery stops at the first torn or corrupted record, which can only be
+ * the unacknowledged tail.
+ */
+// bumped whenever the encoding of the records changes
+static constexpr u32 WAL_FORMAT_VERSION = 1;
+
+class Wal {
+public:
+    // pending write of a caller, lives on the caller's stack from `append`
+    // until `wait` returns
+    struct Writer {
+        // encoded record of `append`
+        Bytes buf;
+        // record to append, null for a pure sync request
+        const Bytes* record = nullptr;
+        // force a sync regardless of the policy
+        bool sync = false;
+        bool done = false;
+        bool ok = false;
+        condition_variable cv;
+    };
+
+private:
+    string path_;
+    WalOptions options_;
+    int fd_;
+    u64 segment_seq_;
+    size_t segment_size_;
+
+    // protects the fields below as well as `fd_` and the segment state
+    mutex mtx_;
+    deque<Writer*> writers_;
+    // bytes written but not synced yet
+    bool dirty_;
+    // a leader is writing to `fd_` without holding `mtx_`
+    bool leading_;
+    // set by `remove`, nothing is appended afterwards
+    bool removed_;
+    // signaled when the leader is done writing
+    condition_variable leader_cv_;
+
+    // background syncer for `WalSyncPolicy::INTERVAL`
+    std::thread syncer_;
+    condition_variable syncer_cv_;
+    bool closed_;
+
+public:
+    Wal(const Wal&) = delete;
+
+    Wal& operator=(const Wal&) = delete;
+
+    ~Wal();
+
+    // create a new log, removing any stale segments under `path`. null if
+    // its first segment cannot be created.
+    static std::unique_ptr<Wal> create(const string& path, const WalOptions& options = WalOptions());
+
+    // open an existing log, replay every intact record through `callback`
+    // and keep appending to a new segment. the timestamp of a record is
+    // the one of its key. null if a segment cannot be read, is of another
+    // format, or the new one cannot be created.
+    static std::unique_ptr<Wal> recover(const string& path,
+        const function<void(ValueType, const KeySlice&, const Slice&)>& callback,
+        const WalOptions& options = WalOptions());
+
+    // append a record, concurrent callers are batched into one write (and
+    // one sync when the policy asks for it). returns after the record is as
+    // durable as the sync policy promises. false if it cannot be written,
+    // or if the key or value is longer than a u16 can tell.
+    bool put(const Slice& key, const Slice& value, ValueType type = ValueType::VALUE, u64 ts = 0);
+
+    // `put` in two steps: the record is queued behind those appended before
+    // without any io, and written by the time `wait` returns. false if it
+    // cannot be queued, `wait` must not be called then.
+    bool append(Writer& writer, const Slice& key, const Slice& value, ValueType type, u64 ts);
+
+    bool wait(Writer& writer);
+
+    // force buffered records to stable storage
+    bool sync();
+
+    // close and delete every segment, called once the memtable is flushed.
+    // waits for the running group commit, the records still queued are
+    // persisted by the flush and acknowledged, later appends fail.
+    bool remove();
+
+    const string& path() const { return this->path_; }
+
+private:
+    Wal(const string& path, const WalOptions& options, u64 seq);
+
+    void start();
+
+    // queue `writer` and either wait for a leader to serve it, or become 
+    // the leader and serve the whole queued group
+    bool commit(Writer& writer);
+
+    bool enqueue(Writer& writer);
+
+    static bool encode_record(ValueType type, u64 ts, const Slice& key, const Slice& value, Bytes& buf);
+
+    static vector<std::pair<u64, string>> list_segments(const string& path);
+
+    // start segment `seq` with its header, its directory entry is synced
+    // unless the policy is `WalSyncPolicy::NONE`
+    bool open_segment(u64 seq);
+
+    bool write_all(const u8* data, size_t size);
+
+    void close_fd();
+
+    void sync_loop();
+};
+
+}
+
+#endif
@@ -6,7 +6,9 @@
  
 #include "defs.h"
 #include "block/block.h"
+#include "block/index.h"
 #include "block/iterator.h"
+#include "block/range_del.h"
 #include "mvcc/key.h"
 #include "slice.h"
 #include "gtest/gtest.h"
@@ -259,4 +261,287 @@ TEST_F(BlockTest, iterator) {
         auto iter_4 = new_block->create_iterator(idx_3);
         EXPECT_EQ(key_6.compare(iter_4->key()), 0);
     }
-}
\ No newline at end of file
+}
+
+TEST_F(BlockTest, restart) {
+    for (size_t interval : {1, 2, 3, 16}) {
+        BlockBuilder builder(65536, interval);
+        std::vector<std::string> keys;
+        for (int i = 0; i < 500; i++) {
+            char buff[64];
+            sprintf(buff, "tenant-%04d/table-%04d/row-%06d", i / 100, i / 10, i);
+            keys.emplace_back(buff);
+            EXPECT_TRUE(builder.add(KeySlice(keys.back()), Slice(std::to_string(i))));
+        }
+
+        auto block = builder.build();
+        auto new_block = std::make_shared<Block>(block->serialize());
+        EXPECT_TRUE(block->debug_equal(*new_block));
+        EXPECT_EQ(new_block->num_of_keys(), keys.size());
+        EXPECT_EQ(new_block->restart_interval(), interval);
+
+        for (size_t i = 0; i < keys.size(); i++) {
+            EXPECT_EQ(new_block->get_key(i).compare(KeySlice(keys[i])), 0);
+            EXPECT_EQ(new_block->locate_key(KeySlice(keys[i])), i);
+            EXPECT_EQ(new_block->locate_key(KeySlice(keys[i]), true, false), i + 1);
+        }
+
+        // iterators starting in the middle of a restart interval
+        for (size_t start : {0, 1, 15, 16, 17, 499}) {
+            auto iter = new_block->create_iterator(start);
+            for (size_t i = start; i < keys.size(); i++) {
+                EXPECT_TRUE(iter->is_valid());
+                EXPECT_EQ(iter->key().compare(KeySlice(keys[i])), 0);
+                EXPECT_EQ(iter->value().compare(Slice(std::to_string(i))), 0);
+                iter->next();
+            }
+            EXPECT_FALSE(iter->is_valid());
+        }
+    }
+
+    // shared prefixes shrink the block compared to storing every key in full
+    BlockBuilder sparse(65536, 1), dense(65536, 16);
+    for (int i = 0; i < 500; i++) {
+        char buff[64];
+        sprintf(buff, "tenant-0001/table-0002/row-%06d", i);
+        sparse.add(KeySlice(std::string(buff)), Slice());
+        dense.add(KeySlice(std::string(buff)), Slice());
+    }
+    EXPECT_LT(dense.estimated_size() * 2, sparse.estimated_size());
+}
+
+TEST_F(BlockTest, versions) {
+    // versions of a key, the newest first, spread over restart intervals
+    BlockBuilder builder(65536, 3);
+    for (size_t i = 0; i < 10; i++) {
+        for (u64 ts = 5; ts >= 1; ts--) {
+            KeySlice key("k" + std::to_string(i));
+            key.set_ts(ts);
+            EXPECT_TRUE(builder.add(key, Slice("k" + std::to_string(i) + "@" + std::to_string(ts))));
+        }
+    }
+    auto block = std::make_shared<Block>(builder.build()->serialize());
+    EXPECT_EQ(block->num_of_keys(), 50);
+
+    for (size_t i = 0; i < 10; i++) {
+        auto key = "k" + std::to_string(i);
+        for (u64 ts = 1; ts <= 5; ts++) {
+            u64 version_ts = 0;
+            auto value = block->get(Slice(key), ts, &version_ts);
+            ASSERT_TRUE(value.has_value());
+            EXPECT_EQ(value->compare(Slice(key + "@" + std::to_string(ts))), 0);
+            EXPECT_EQ(version_ts, ts);
+        }
+        EXPECT_EQ(block->get(Slice(key))->compare(Slice(key + "@5")), 0);
+        EXPECT_FALSE(block->get(Slice(key), 0).has_value());
+
+        // scans start at the newest version and end after the oldest one
+        EXPECT_EQ(block->locate_key(Slice(key)), i * 5);
+        EXPECT_EQ(block->locate_key(Slice(key), true, false), i * 5 + 5);
+        EXPECT_EQ(block->locate_key(Slice(key), false, true), i * 5);
+        EXPECT_EQ(block->locate_key(Slice(key), false, false), i * 5);
+    }
+    EXPECT_FALSE(block->get(Slice("k5x")).has_value());
+
+    auto iter = block->create_iterator(7);
+    for (u64 ts = 3; ts >= 1; ts--, iter->next()) {
+        ASSERT_TRUE(iter->is_valid());
+        EXPECT_EQ(iter->key_view().compare(Slice("k1")), 0);
+        EXPECT_EQ(iter->key_view().get_ts(), ts);
+    }
+    EXPECT_EQ(iter->key_view().compare(Slice("k2")), 0);
+}
+
+TEST_F(BlockTest, encoding) {
+    BlockBuilder builder(4096, 4);
+    for (int i = 0; i < 10; i++) {
+        EXPECT_TRUE(builder.add(KeySlice("key" + std::to_string(i)), Slice("value")));
+    }
+    auto buf = builder.serialize();
+    EXPECT_TRUE(Block::is_valid_encoding(buf.data(), buf.size()));
+    EXPECT_FALSE(Block::is_valid_encoding(buf.data(), 3));
+
+    // a block of another format version is rejected
+    auto version = buf.data() + buf.size() - sizeof(u16);
+    version[1] ^= 1;
+    EXPECT_FALSE(Block::is_valid_encoding(buf.data(), buf.size()));
+    version[1] ^= 1;
+
+    // as is a restart point past the data section
+    auto restart = buf.data() + buf.size() - 5 * sizeof(u16);
+    restart[0] = 0xff;
+    EXPECT_FALSE(Block::is_valid_encoding(buf.data(), buf.size()));
+
+    // a block is closed once its entries pass the reach of restart offsets
+    BlockBuilder large(SIZE_MAX);
+    std::string value(1000, 'v');
+    size_t added = 0;
+    while (large.add(KeySlice("key" + std::to_string(added)), Slice(value))) { added++; }
+    auto large_buf = large.serialize();
+    EXPECT_GT(large_buf.size(), UINT16_MAX);
+    EXPECT_LE(large_buf.size(), MAX_BLOCK_SIZE);
+    auto block = large.build();
+    EXPECT_EQ(block->num_of_keys(), added + 1);
+    EXPECT_EQ(block->get_key(added).compare(Slice("key" + std::to_string(added))), 0);
+}
+
+TEST_F(BlockTest, index) {
+    // large enough for offsets beyond 64KB
+    size_t block_cnt = 8000;
+    IndexBlockBuilder builder;
+    vector<std::string> separators;
+    for (size_t i = 0; i < block_cnt; i++) {
+        char separator[32];
+        snprintf(separator, sizeof(separator), "tenant-0042-key-%08lu", i * 10 + 5);
+        builder.add(SliceView(Slice(separator)), i * 4096);
+        separators.emplace_back(separator);
+    }
+    Bytes buf;
+    builder.serialize(buf);
+    EXPECT_EQ(buf.size(), builder.estimated_size());
+    EXPECT_GT(buf.size(), 64 * 1024);
+    // separators share long prefixes with the previous block
+    EXPECT_LT(buf.size(), block_cnt * separators[0].size());
+    IndexBlock index(std::move(buf));
+    ASSERT_EQ(index.num_of_entries(), block_cnt);
+
+    size_t idx = 0;
+    for (IndexCursor cursor(&index); cursor.is_valid(); cursor.next(), idx++) {
+        auto& entry = cursor.entry();
+        EXPECT_EQ(entry.separator.compare(SliceView(Slice(separators[idx]))), 0);
+        EXPECT_EQ(entry.block_offset, idx * 4096);
+    }
+    EXPECT_EQ(idx, block_cnt);
+    EXPECT_EQ(IndexCursor(&index, 1234).entry().block_offset, 1234 * 4096);
+
+    for (size_t i = 0; i < 1000; i++) {
+        auto num = this->generate_random_int(block_cnt * 10 + 20);
+        char key[32];
+        snprintf(key, sizeof(key), "tenant-0042-key-%08lu", num);
+        Slice key_slice(key);
+        // first block whose separator is not less than the key
+        auto expected = num % 10 <= 5 ? num / 10 : num / 10 + 1;
+        EXPECT_EQ(index.locate(SliceView(key_slice)), std::min(expected, block_cnt)) << key;
+    }
+    EXPECT_EQ(index.locate(SliceView(Slice("tenant-0042-key-"))), 0);
+}
+
+TEST_F(BlockTest, tombstone) {
+    BlockBuilder builder(4096);
+    builder.add(KeySlice(std::string("a")), Slice("1"));
+    builder.add(KeySlice(std::string("b")), Slice(), ValueType::DELETION);
+    builder.add(KeySlice(std::string("c")), Slice("3"));
+    auto block = builder.build();
+
+    auto type = ValueType::VALUE;
+    ASSERT_TRUE(block->get(SliceView(Slice("b")), UINT64_MAX, nullptr, &type).has_value());
+    EXPECT_EQ(type, ValueType::DELETION);
+    ASSERT_TRUE(block->get(SliceView(Slice("c")), UINT64_MAX, nullptr, &type).has_value());
+    EXPECT_EQ(type, ValueType::VALUE);
+
+    auto iter = block->create_iterator();
+    std::vector<ValueType> types;
+    for (; iter->is_valid(); iter->next()) { types.push_back(iter->value_type()); }
+    EXPECT_EQ(types, std::vector<ValueType>({ValueType::VALUE, ValueType::DELETION, ValueType::VALUE}));
+}
+
+TEST_F(BlockTest, range_tombstones) {
+    // length first: "ff" < "000" and "9" < "00"
+    EXPECT_EQ(key_after(Slice("a")).compare(Slice("b")), 0);
+    EXPECT_EQ(key_after(Slice("\xff\xff")).compare(Slice(std::string(3, '\0'))), 0);
+    EXPECT_EQ(key_before(Slice("b")).compare(Slice("a")), 0);
+    EXPECT_EQ(key_before(Slice(std::string(2, '\0'))).compare(Slice("\xff")), 0);
+    EXPECT_EQ(key_before(key_after(Slice("key-42"))).compare(Slice("key-42")), 0);
+
+    RangeTombstones tombstones;
+    tombstones.add(Slice("k20"), Slice("k29"));
+    tombstones.add(Slice("k50"), Slice("k59"));
+    // overlapping and touching ones are merged
+    tombstones.add(Slice("k25"), Slice("k34"));
+    tombstones.add(Slice("k35"), Slice("k39"));
+    tombstones.add(Slice("k70"), Slice("k70"));
+    ASSERT_EQ(tombstones.size(), 3);
+    EXPECT_EQ(tombstones[0].first.compare(Slice("k20")), 0);
+    EXPECT_EQ(tombstones[0].last.compare(Slice("k39")), 0);
+
+    EXPECT_EQ(tombstones.find(Slice("k19")), nullptr);
+    EXPECT_EQ(tombstones.find(Slice("k33")), &tombstones[0]);
+    EXPECT_EQ(tombstones.find(Slice("k70")), &tombstones[2]);
+    EXPECT_EQ(tombstones.find(Slice("k71")), nullptr);
+    EXPECT_TRUE(tombstones.covers(Slice("k21"), Slice("k39")));
+    EXPECT_FALSE(tombstones.covers(Slice("k21"), Slice("k50")));
+
+    // [k30, k55)
+    auto clipped = tombstones.clip(Bound(Slice("k30")), Bound(Slice("k55"), false));
+    ASSERT_EQ(clipped.size(), 2);
+    EXPECT_EQ(clipped[0].first.compare(Slice("k30")), 0);
+    EXPECT_EQ(clipped[1].last.compare(Slice("k54")), 0);
+    EXPECT_EQ(tombstones.clip(Bound(Slice("k40")), Bound(Slice("k50"), false)).size(), 0);
+    EXPECT_EQ(tombstones.clip(Bound(false), Bound(true)).size(), 3);
+
+    Bytes buf;
+    tombstones.encode(buf);
+    RangeTombstones decoded;
+    size_t pos = 0;
+    ASSERT_TRUE(decoded.decode(buf.outstream(), buf.size(), pos));
+    EXPECT_EQ(pos, buf.size());
+    ASSERT_EQ(decoded.size(), tombstones.size());
+    for (size_t i = 0; i < decoded.size(); i++) {
+        EXPECT_EQ(decoded[i].first.compare(tombstones[i].first), 0);
+        EXPECT_EQ(decoded[i].last.compare(tombstones[i].last), 0);
+    }
+    pos = 0;
+    EXPECT_FALSE(decoded.decode(buf.outstream(), buf.size() - 1, pos));
+
+    // keys looked up in order
+    RangeTombstoneCursor cursor(std::make_shared<RangeTombstones>(tombstones));
+    EXPECT_EQ(cursor.seek(Slice("k10")), nullptr);
+    EXPECT_NE(cursor.seek(Slice("k20")), nullptr);
+    EXPECT_EQ(cursor.seek(Slice("k45")), nullptr);
+    EXPECT_NE(cursor.seek(Slice("k59")), nullptr);
+    EXPECT_EQ(cursor.seek(Slice("k99")), nullptr);
+}
+
+TEST_F(BlockTest, range_tombstone_versions) {
+    // [k20, k39] at 10 and [k30, k49] at 20 overlap on [k30, k39]
+    RangeTombstones tombstones(Slice("k20"), Slice("k39"), 10);
+    tombstones.add(Slice("k30"), Slice("k49"), 20);
+    ASSERT_EQ(tombstones.size(), 3);
+    EXPECT_EQ(tombstones[1].timestamps, std::vector<u64>({20, 10}));
+    EXPECT_EQ(tombstones.max_ts(), 20);
+
+    auto tombstone = tombstones.find(Slice("k35"));
+    ASSERT_NE(tombstone, nullptr);
+    EXPECT_TRUE(tombstone->deletes(15, UINT64_MAX));
+    EXPECT_FALSE(tombstone->deletes(15, 19));
+    EXPECT_TRUE(tombstone->deletes(5, 19));
+    EXPECT_FALSE(tombstone->newest(9).has_value());
+
+    // reads at 15 see the older deletion only, it spans the overlap
+    auto visible = tombstones.visible(15);
+    ASSERT_EQ(visible.size(), 1);
+    EXPECT_EQ(visible[0].last.compare(Slice("k39")), 0);
+    EXPECT_EQ(tombstones.visible(25).size(), 3);
+
+    // nothing reads below 15, the deletion at 10 is the newest one there
+    auto compacted = tombstones.compact(15, false);
+    ASSERT_EQ(compacted.size(), 3);
+    EXPECT_EQ(compacted[1].timestamps, std::vector<u64>({20, 10}));
+    compacted = tombstones.compact(25, false);
+    EXPECT_EQ(compacted[1].timestamps, std::vector<u64>({20}));
+    // with nothing older below, only the deletions newer than 15 are left
+    compacted = tombstones.compact(15, true);
+    ASSERT_EQ(compacted.size(), 1);
+    EXPECT_EQ(compacted[0].first.compare(Slice("k30")), 0);
+    EXPECT_TRUE(tombstones.compact(25, true).empty());
+
+    Bytes buf;
+    tombstones.encode(buf);
+    RangeTombstones decoded;
+    size_t pos = 0;
+    ASSERT_TRUE(decoded.decode(buf.outstream(), buf.size(), pos));
+    ASSERT_EQ(decoded.size(), tombstones.size());
+    for (size_t i = 0; i < decoded.size(); i++) {
+        EXPECT_EQ(decoded[i].timestamps, tombstones[i].timestamps);
+    }
+}
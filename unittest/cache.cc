@@ -0,0 +1,167 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-09-25 21:08:13
+ * @Description: test for block cache
+ */
+
+#include "defs.h"
+#include "block/block.h"
+#include "cache/block_cache.h"
+#include "cache/table_cache.h"
+#include "mvcc/key.h"
+#include "slice.h"
+#include "sstable/sstable.h"
+#include "gtest/gtest.h"
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace minilsm;
+
+class CacheTest : public ::testing::Test {
+public:
+    std::string sst_dir = string(PROJECT_ROOT_PATH) + "/binary/unittest/table_cache";
+
+public:
+    void SetUp() override {}
+
+    shared_ptr<Block> create_block(size_t key_cnt) {
+        BlockBuilder builder(102400);
+        for (size_t i = 0; i < key_cnt; i++) {
+            builder.add(KeySlice(std::to_string(i)), Slice(std::to_string(i)));
+        }
+        return builder.build();
+    }
+};
+
+int main() {
+    ::testing::InitGoogleTest();
+    return RUN_ALL_TESTS();
+}
+
+TEST_F(CacheTest, key) {
+    BlockCache cache;
+    auto block_1 = create_block(10);
+    auto block_2 = create_block(20);
+    cache.insert(1, 0, block_1);
+    cache.insert(2, 0, block_2);
+
+    // same block index in different sstables
+    EXPECT_EQ(cache.lookup(1, 0), block_1);
+    EXPECT_EQ(cache.lookup(2, 0), block_2);
+    EXPECT_EQ(cache.lookup(3, 0), nullptr);
+
+    cache.erase(1, 0);
+    EXPECT_EQ(cache.lookup(1, 0), nullptr);
+
+    auto stats = cache.stats();
+    EXPECT_EQ(stats.hits, 2);
+    EXPECT_EQ(stats.misses, 2);
+    EXPECT_EQ(stats.insertions, 2);
+    EXPECT_EQ(stats.entries, 1);
+    EXPECT_EQ(stats.usage, block_2->memory_usage());
+}
+
+TEST_F(CacheTest, eviction) {
+    auto block = create_block(100);
+    size_t capacity = block->memory_usage() * 10;
+    // single shard to get a deterministic lru order
+    BlockCache cache(capacity, 0);
+
+    for (size_t i = 0; i < 10; i++) {
+        cache.insert(0, i, block);
+    }
+    EXPECT_EQ(cache.stats().evictions, 0);
+
+    // refresh block 0, so block 1 is the victim
+    EXPECT_NE(cache.lookup(0, 0), nullptr);
+    cache.insert(0, 10, block);
+    EXPECT_EQ(cache.stats().evictions, 1);
+    EXPECT_NE(cache.lookup(0, 0), nullptr);
+    EXPECT_EQ(cache.lookup(0, 1), nullptr);
+    EXPECT_LE(cache.stats().usage, capacity);
+
+    cache.clear();
+    EXPECT_EQ(cache.stats().usage, 0);
+    EXPECT_EQ(cache.lookup(0, 0), nullptr);
+}
+
+TEST_F(CacheTest, concurrent) {
+    auto block = create_block(10);
+    BlockCache cache(block->memory_usage() * 64);
+
+    i32 thread_num = 8;
+    std::vector<std::thread> threads(thread_num);
+    for (i32 i = 0; i < thread_num; i++) {
+        threads[i] = std::thread([&, i]() {
+            for (size_t j = 0; j < 10000; j++) {
+                if (!cache.lookup(i, j % 128)) {
+                    cache.insert(i, j % 128, block);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) { thread.join(); }
+
+    auto stats = cache.stats();
+    EXPECT_EQ(stats.hits + stats.misses, thread_num * 10000);
+    EXPECT_LE(stats.usage, cache.capacity() + block->memory_usage() * 16);
+}
+
+TEST_F(CacheTest, table) {
+    std::filesystem::remove_all(sst_dir);
+    std::filesystem::create_directories(sst_dir);
+    auto block_cache = std::make_shared<BlockCache>();
+    auto table_cache = std::make_shared<TableCache>(2);
+
+    // sstables reopened from what the manifest would know of them
+    vector<shared_ptr<SSTable>> ssts;
+    for (size_t id = 0; id < 4; id++) {
+        SSTableBuilder builder(256, 100, 0.01);
+        for (size_t i = 0; i < 100; i++) {
+            auto key = std::to_string(id * 1000 + i);
+            builder.add(KeySlice(key), Slice(key));
+        }
+        auto path = sst_dir + "/" + std::to_string(id) + ".sst";
+        auto built = builder.build(id, nullptr, path);
+        ssts.push_back(std::make_shared<SSTable>(id, built->first_key, built->last_key,
+            built->max_ts, built->table_size(), block_cache, table_cache, path));
+    }
+    // nothing is opened before the first read
+    EXPECT_EQ(table_cache->stats().entries, 0);
+
+    for (size_t round = 0; round < 2; round++) {
+        for (size_t id = 0; id < 4; id++) {
+            auto key = std::to_string(id * 1000 + 42);
+            auto res = ssts[id]->get(SliceView(key));
+            ASSERT_TRUE(res.has_value());
+            EXPECT_TRUE(*res == Slice(key));
+            EXPECT_LE(table_cache->stats().entries, 2);
+        }
+    }
+    auto stats = table_cache->stats();
+    EXPECT_EQ(stats.entries, 2);
+    EXPECT_GT(stats.evictions, 0);
+
+    // an obsolete sstable drops its handle once dropped, the file is
+    // removed by the next purge
+    auto path = sst_dir + "/3.sst";
+    ssts[3]->mark_obsolete();
+    EXPECT_TRUE(std::filesystem::exists(path));
+    ssts.pop_back();
+    EXPECT_EQ(table_cache->stats().entries, 1);
+    EXPECT_TRUE(std::filesystem::exists(path));
+    table_cache->purge_obsolete();
+    EXPECT_FALSE(std::filesystem::exists(path));
+
+    // a file failing to open is not read as an empty one
+    auto missing = std::make_shared<SSTable>(2, ssts[2]->first_key, ssts[2]->last_key,
+        ssts[2]->max_ts, ssts[2]->table_size(), block_cache, table_cache, sst_dir + "/2.sst");
+    std::filesystem::remove(sst_dir + "/2.sst");
+    table_cache->erase(2);
+    EXPECT_FALSE(table_cache->get(2, sst_dir + "/2.sst"));
+    auto key = std::to_string(2 * 1000 + 42);
+    EXPECT_FALSE(missing->get(SliceView(key)).has_value());
+    EXPECT_EQ(missing->num_of_blocks(), 0);
+}
@@ -15,6 +15,7 @@
 #include <algorithm>
 #include <cstddef>
 #include <ctime>
+#include <map>
 #include <random>
 
 using namespace minilsm;
@@ -246,7 +247,8 @@ TEST_F(IteratorTest, mergemultiiterator) {
 
         auto merge_iter = make_shared<MergeMultiIterator>(iter_vec);
         while (merge_iter->is_valid()) {
-            auto key_int = std::stoi(reinterpret_cast<const char*>(merge_iter->key().data()));
+            auto key = merge_iter->key();
+            auto key_int = std::stoi(std::string(reinterpret_cast<const char*>(key.data()), key.size()));
             if (mem_set.find(key_int) != mem_set.end()) {
                 EXPECT_EQ(merge_iter->value().compare(V(-1)), 0);
             } else {
@@ -263,4 +265,53 @@ TEST_F(IteratorTest, mergemultiiterator) {
             merge_iter->next();
         }
     }
-}
\ No newline at end of file
+}
+
+TEST_F(IteratorTest, losertree) {
+    for (size_t run_cnt : {1, 2, 3, 7, 37}) {
+        size_t key_size = 2000;
+        std::mt19937 gen(run_cnt);
+        std::uniform_int_distribution<size_t> distrib(0, run_cnt * 2);
+
+        // `newest[key]` is the first run holding the key
+        vector<shared_ptr<MemTable>> runs;
+        for (size_t i = 0; i < run_cnt; i++) { runs.push_back(make_shared<MemTable>(i)); }
+        std::map<std::string, size_t> newest;
+        for (size_t key = 0; key < key_size; key++) {
+            for (size_t i = 0; i < run_cnt; i++) {
+                if (distrib(gen) < 2) {
+                    runs[i]->put(K(key), V(i));
+                    newest.emplace(std::to_string(key), i);
+                }
+            }
+        }
+
+        vector<shared_ptr<Iterator>> iter_vec;
+        for (auto& run : runs) { iter_vec.push_back(run->create_iterator()); }
+        // exhausted children are skipped
+        iter_vec.push_back(make_shared<MemTable>(run_cnt)->create_iterator());
+
+        MergeMultiIterator merge_iter(iter_vec);
+        vector<std::pair<std::string, size_t>> merged;
+        while (merge_iter.is_valid()) {
+            auto key = merge_iter.key_view();
+            auto value = merge_iter.value_view();
+            merged.emplace_back(
+                std::string(reinterpret_cast<const char*>(key.data()), key.size()),
+                std::stoul(std::string(reinterpret_cast<const char*>(value.data()), value.size())));
+            merge_iter.next();
+        }
+        EXPECT_EQ(merge_iter.num_active_iterators(), 0);
+
+        // keys come out once each, in order, with the value of the newest run
+        ASSERT_EQ(merged.size(), newest.size());
+        for (size_t i = 0; i < merged.size(); i++) {
+            if (i) { EXPECT_LT(Slice(merged[i - 1].first).compare(Slice(merged[i].first)), 0); }
+            EXPECT_EQ(newest[merged[i].first], merged[i].second);
+        }
+    }
+
+    vector<shared_ptr<Iterator>> iter_vec;
+    MergeMultiIterator empty_iter(iter_vec);
+    EXPECT_FALSE(empty_iter.is_valid());
+}
@@ -9,6 +9,7 @@
 #include "memtable/memtable.h"
 #include "slice.h"
 #include "gtest/gtest.h"
+#include <algorithm>
 #include <cstdio>
 #include <string>
 #include <thread>
@@ -152,3 +153,211 @@ TEST_F(MemTableTest, MulThd) {
     EXPECT_TRUE(pass);
 }
 
+
+TEST_F(MemTableTest, Arena) {
+    // the reserved block is not counted
+    EXPECT_LT(memtable->get_approximate_size(), Arena::DEFAULT_BLOCK_SIZE);
+    for (i32 i = 0; i < 10000; i++) {
+        memtable->put(std::to_string(i), std::string(100, 'v'));
+    }
+    EXPECT_GE(memtable->get_approximate_size(), 10000 * 100);
+
+    Arena arena(1024);
+    i32 thread_num = 8, alloc_num = 1000;
+    std::vector<std::thread> threads(thread_num);
+    std::vector<std::vector<u8*>> ptrs(thread_num);
+    for (i32 i = 0; i < thread_num; i++) {
+        threads[i] = std::thread([&, i]() {
+            for (i32 j = 0; j < alloc_num; j++) {
+                auto ptr = arena.allocate(16);
+                memset(ptr, i, 16);
+                ptrs[i].push_back(ptr);
+            }
+        });
+    }
+    for (auto& thread : threads) { thread.join(); }
+
+    bool pass = true;
+    for (i32 i = 0; i < thread_num; i++) {
+        for (auto ptr : ptrs[i]) {
+            for (i32 k = 0; k < 16; k++) {
+                if (ptr[k] != i) { pass = false; }
+            }
+        }
+    }
+    EXPECT_TRUE(pass);
+    EXPECT_EQ(arena.allocated_bytes(), thread_num * alloc_num * 16);
+}
+
+TEST_F(MemTableTest, MultiFind) {
+    for (i32 i = 0; i < 1000; i += 2) {
+        memtable->put(std::to_string(i), std::to_string(i * 2));
+    }
+
+    // every key once, sorted as the memtable orders them
+    std::vector<i32> nums(1000);
+    for (i32 i = 0; i < 1000; i++) { nums[i] = i; }
+    std::sort(nums.begin(), nums.end(), [](i32 a, i32 b) {
+        return Slice(std::to_string(a)).compare(Slice(std::to_string(b))) < 0;
+    });
+    std::vector<Slice> keys;
+    for (auto num : nums) { keys.push_back(Slice(std::to_string(num))); }
+
+    std::vector<std::optional<Slice>> values(keys.size());
+    memtable->multi_find(keys, values);
+    bool pass = true;
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (nums[i] % 2) {
+            if (values[i].has_value()) { pass = false; }
+        } else if (!values[i].has_value() || values[i]->compare(std::to_string(nums[i] * 2))) {
+            pass = false;
+        }
+    }
+    EXPECT_TRUE(pass);
+}
+
+TEST_F(MemTableTest, KeySize) {
+    std::string longest(MAX_KEY_SIZE, 'k');
+    std::string too_long(MAX_KEY_SIZE + 1, 'k');
+    EXPECT_TRUE(memtable->put(Slice(longest), Slice("1"), 1));
+    EXPECT_FALSE(memtable->put(Slice(too_long), Slice("2"), 2));
+    EXPECT_FALSE(memtable->remove(Slice(too_long), 3));
+    EXPECT_FALSE(memtable->delete_range(Slice("a"), Slice(too_long), 4));
+    EXPECT_EQ(memtable->find(Slice(longest))->compare(Slice("1")), 0);
+    EXPECT_EQ(memtable->max_ts(), 1);
+
+    // values are checked whether or not there is a wal
+    std::string largest(MAX_VALUE_SIZE, 'v');
+    EXPECT_TRUE(memtable->put(Slice("b"), Slice(largest), 5));
+    EXPECT_FALSE(memtable->put(Slice("c"), Slice(largest + "v"), 6));
+    EXPECT_FALSE(memtable->find(Slice("c")).has_value());
+    EXPECT_EQ(memtable->find(Slice("b"))->size(), MAX_VALUE_SIZE);
+}
+
+TEST_F(MemTableTest, Rollback) {
+    memtable->put(Slice("a"), Slice("1"), 1);
+    memtable->delete_range(Slice("a"), Slice("c"), 2);
+    // writes whose records failed to be logged are undone
+    memtable->apply(ValueType::VALUE, Slice("a"), Slice("2"), 3);
+    memtable->apply(ValueType::DELETION, Slice("b"), Slice(), 4);
+    memtable->apply(ValueType::RANGE_DELETION, Slice("c"), Slice("d"), 5);
+    memtable->rollback(ValueType::VALUE, Slice("a"), Slice("2"), 3);
+    memtable->rollback(ValueType::DELETION, Slice("b"), Slice(), 4);
+    memtable->rollback(ValueType::RANGE_DELETION, Slice("c"), Slice("d"), 5);
+
+    bool deleted = false;
+    EXPECT_FALSE(memtable->find(Slice("a"), &deleted).has_value());
+    EXPECT_TRUE(deleted);
+    EXPECT_EQ(memtable->find(Slice("a"), nullptr, 1)->compare(Slice("1")), 0);
+    size_t cnt = 0;
+    for (auto iter = memtable->create_iterator(); iter->is_valid(); iter->next()) { cnt++; }
+    EXPECT_EQ(cnt, 1);
+    auto tombstones = memtable->range_tombstones();
+    ASSERT_NE(tombstones, nullptr);
+    ASSERT_EQ(tombstones->size(), 1);
+    EXPECT_EQ((*tombstones)[0].timestamps, std::vector<u64>({2}));
+
+    memtable->rollback(ValueType::RANGE_DELETION, Slice("a"), Slice("c"), 2);
+    EXPECT_EQ(memtable->range_tombstones(), nullptr);
+}
+
+TEST_F(MemTableTest, Delete) {
+    // every write carries a newer timestamp
+    u64 ts = 0;
+    for (i32 i = 100; i < 200; i++) {
+        memtable->put(std::to_string(i), std::to_string(i), ++ts);
+    }
+    EXPECT_TRUE(memtable->remove(Slice("110"), ++ts));
+    EXPECT_TRUE(memtable->delete_range(Slice("120"), Slice("130"), ++ts));
+    // nothing between an end not greater than the begin
+    EXPECT_TRUE(memtable->delete_range(Slice("150"), Slice("150"), ++ts));
+    // a key written after the deletion is visible again
+    memtable->put(Slice("125"), Slice("new"), ++ts);
+
+    for (i32 i = 100; i < 200; i++) {
+        bool deleted = false;
+        auto value = memtable->find(std::to_string(i), &deleted);
+        bool expect_deleted = i == 110 || (i >= 120 && i < 130 && i != 125);
+        EXPECT_EQ(deleted, expect_deleted) << i;
+        EXPECT_EQ(value.has_value(), !expect_deleted) << i;
+    }
+    EXPECT_EQ(memtable->find(Slice("125"))->compare(Slice("new")), 0);
+    // absent keys in the range hide the older tables
+    bool deleted = false;
+    EXPECT_FALSE(memtable->find(Slice("12a"), &deleted).has_value());
+    EXPECT_TRUE(deleted);
+    // reads before the deletions still see the deleted versions
+    EXPECT_EQ(memtable->find(Slice("110"), nullptr, 100)->compare(Slice("110")), 0);
+    EXPECT_EQ(memtable->find(Slice("125"), nullptr, 101)->compare(Slice("125")), 0);
+    deleted = false;
+    EXPECT_FALSE(memtable->find(Slice("12a"), &deleted, 101).has_value());
+    EXPECT_FALSE(deleted);
+
+    // scans surface every version, point tombstones included, and skip
+    // keys deleted by newer tables
+    auto newer = std::make_shared<RangeTombstones>(Slice("140"), Slice("159"), ts);
+    size_t num_of_values = 0, num_of_deletions = 0;
+    for (auto iter = memtable->scan(Bound(false), Bound(true), newer); iter->is_valid(); iter->next()) {
+        EXPECT_FALSE(newer->find(iter->key_view()));
+        if (iter->value_type() == ValueType::DELETION) {
+            num_of_deletions++;
+        } else {
+            num_of_values++;
+        }
+    }
+    EXPECT_EQ(num_of_deletions, 1);
+    EXPECT_EQ(num_of_values, 81);
+
+    std::vector<Slice> keys = {Slice("100"), Slice("110"), Slice("121"), Slice("125"), Slice("12a")};
+    std::vector<std::optional<Slice>> values(keys.size());
+    std::vector<bool> deletions(keys.size());
+    memtable->multi_find(keys, values, &deletions);
+    EXPECT_EQ(deletions, std::vector<bool>({false, true, true, false, true}));
+    EXPECT_TRUE(values[0].has_value() && values[3].has_value());
+
+    // only range tombstones still need a flush
+    MemTable empty(1);
+    EXPECT_TRUE(empty.is_empty());
+    empty.delete_range(Slice("a"), Slice("b"));
+    EXPECT_FALSE(empty.is_empty());
+}
+
+TEST_F(MemTableTest, Versions) {
+    // versions written in any order are kept from the newest
+    for (u64 ts : {3, 1, 5, 2, 4}) {
+        memtable->put(Slice("b"), Slice(std::to_string(ts)), ts * 10);
+    }
+    memtable->put(Slice("a"), Slice("a"), 7);
+    memtable->put(Slice("c"), Slice("c"), 1);
+    memtable->remove(Slice("b"), 60);
+
+    EXPECT_FALSE(memtable->find(Slice("b"), nullptr, 5).has_value());
+    for (u64 ts = 10; ts <= 50; ts++) {
+        auto value = memtable->find(Slice("b"), nullptr, ts);
+        ASSERT_TRUE(value.has_value()) << ts;
+        EXPECT_EQ(value->compare(Slice(std::to_string(ts / 10))), 0) << ts;
+    }
+    bool deleted = false;
+    EXPECT_FALSE(memtable->find(Slice("b"), &deleted).has_value());
+    EXPECT_TRUE(deleted);
+    EXPECT_EQ(memtable->max_ts(), 60);
+
+    std::vector<Slice> keys = {Slice("a"), Slice("b"), Slice("c")};
+    std::vector<std::optional<Slice>> values(keys.size());
+    memtable->multi_find(keys, values, nullptr, 25);
+    EXPECT_TRUE(values[0].has_value() && values[2].has_value());
+    ASSERT_TRUE(values[1].has_value());
+    EXPECT_EQ(values[1]->compare(Slice("2")), 0);
+
+    // every version is surfaced, the newest first
+    std::vector<u64> timestamps;
+    for (auto iter = memtable->scan(Bound(Slice("b")), Bound(Slice("b"))); iter->is_valid(); iter->next()) {
+        EXPECT_TRUE(iter->key_view().compare(Slice("b")) == 0);
+        timestamps.push_back(iter->key_view().get_ts());
+    }
+    EXPECT_EQ(timestamps, std::vector<u64>({60, 50, 40, 30, 20, 10}));
+    // an excluded start key is skipped with all of its versions
+    auto iter = memtable->scan(Bound(Slice("b"), false), Bound(true));
+    ASSERT_TRUE(iter->is_valid());
+    EXPECT_TRUE(iter->key_view().compare(Slice("c")) == 0);
+}
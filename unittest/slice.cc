@@ -4,10 +4,13 @@
  * @Description: test for slice
  */
 
+#include "mvcc/key.h"
 #include "slice.h"
 #include "gtest/gtest.h"
 #include <cstring>
+#include <random>
 #include <string>
+#include <vector>
 
 using namespace minilsm;
 
@@ -57,4 +60,48 @@ TEST_F(SliceTest, Cmp) {
     EXPECT_EQ(key2.compare(key1), 1);
     EXPECT_EQ(key1.compare(key3), 1);
     EXPECT_EQ(key1.compare(key4), 0);
-}
\ No newline at end of file
+}
+
+TEST_F(SliceTest, InternalKey) {
+    // keys of mixed lengths with bytes on both sides of the length prefix,
+    // versions spanning the bytes of the inverted timestamp
+    std::mt19937 seed(0);
+    std::vector<std::string> keys = {"", std::string(1, '\0'), std::string(1, '\xff'), "a", "ab", "b",
+        std::string(2, '\xff'), std::string(300, 'a'), std::string(256, 'z')};
+    for (int i = 0; i < 50; i++) {
+        std::string key(seed() % 4, '\0');
+        for (auto& c : key) { c = seed() % 4 ? 'a' + seed() % 3 : '\xff'; }
+        keys.push_back(key);
+    }
+    std::vector<u64> timestamps = {0, 1, 255, 256, 1ull << 40, UINT64_MAX - 1, UINT64_MAX};
+
+    std::vector<std::vector<u8>> encoded;
+    std::vector<std::pair<size_t, u64>> versions;
+    for (size_t i = 0; i < keys.size(); i++) {
+        for (auto ts : timestamps) {
+            auto key = SliceView(reinterpret_cast<const u8*>(keys[i].data()), keys[i].size());
+            encoded.emplace_back();
+            encode_internal_key(key, ts, encoded.back());
+            EXPECT_EQ(encoded.back().size(), keys[i].size() + INTERNAL_KEY_OVERHEAD);
+            auto decoded = decode_internal_key(SliceView(encoded.back().data(), encoded.back().size()));
+            EXPECT_EQ(decoded.compare(key), 0);
+            EXPECT_EQ(decoded.get_ts(), ts);
+            versions.emplace_back(i, ts);
+        }
+    }
+
+    // a memcmp of the internal keys orders them like `compare_internal`
+    auto sign = [](int res) { return (res > 0) - (res < 0); };
+    for (size_t a = 0; a < encoded.size(); a++) {
+        for (size_t b = 0; b < encoded.size(); b++) {
+            auto& key_a = keys[versions[a].first];
+            auto& key_b = keys[versions[b].first];
+            auto expected = compare_internal(
+                KeyView(reinterpret_cast<const u8*>(key_a.data()), key_a.size(), versions[a].second),
+                KeyView(reinterpret_cast<const u8*>(key_b.data()), key_b.size(), versions[b].second));
+            auto res = compare_internal_keys(SliceView(encoded[a].data(), encoded[a].size()),
+                SliceView(encoded[b].data(), encoded[b].size()));
+            ASSERT_EQ(sign(res), sign(expected)) << a << " " << b;
+        }
+    }
+}
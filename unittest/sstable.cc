@@ -10,12 +10,17 @@
 #include "slice.h"
 #include "sstable/sstable.h"
 #include "sstable/iterator.h"
+#include "cache/table_cache.h"
 #include "gtest/gtest.h"
 #include <algorithm>
+#include <chrono>
 #include <cstddef>
 #include <filesystem>
+#include <fstream>
+#include <future>
 #include <random>
 #include <string>
+#include <thread>
 
 using namespace minilsm;
 
@@ -70,6 +75,21 @@ public:
         }
         EXPECT_EQ(key - span, end);
     }
+
+    // the separator of every block lies between its last key and the first
+    // key of the next block
+    void check_separators(SSTable& sstable) {
+        for (size_t i = 0; i < sstable.num_of_blocks(); i++) {
+            auto block_ptr = sstable.get_block(i);
+            auto separator = sstable.block_separator(i);
+            auto last_key = block_ptr->get_key(block_ptr->num_of_keys() - 1);
+            EXPECT_LE(last_key.compare(KeySlice(separator)), 0);
+            if (i + 1 < sstable.num_of_blocks()) {
+                KeySlice next_key = sstable.get_block(i + 1)->first_key;
+                EXPECT_LE(KeySlice(separator).compare(next_key), 0);
+            }
+        }
+    }
 };  
 
 int main() {
@@ -95,12 +115,7 @@ TEST_F(SSTableTest, sstable) {
 
         block_cache->clear();
         SSTable sstable(0, block_cache, sst_path);
-        EXPECT_EQ(sstable.num_of_blocks(), sstable.debug_get_block_meta().size());
-        for (size_t i = 0; i < sstable.num_of_blocks(); i++) {
-            auto block_ptr = sstable.get_block(i);
-            KeySlice first_key = block_ptr->first_key;
-            EXPECT_EQ(first_key.compare(sstable.debug_get_block_meta()[i].first_key), 0);
-        }
+        this->check_separators(sstable);
 
         EXPECT_EQ(sstable.first_key.compare(KeySlice(std::to_string(0))), 0);
         EXPECT_EQ(sstable.last_key.compare(KeySlice(std::to_string(999))), 0);
@@ -123,12 +138,7 @@ TEST_F(SSTableTest, sstable) {
 
         // block_cache->clear();
         SSTable sstable(0, block_cache, sst_path);
-        EXPECT_EQ(sstable.num_of_blocks(), sstable.debug_get_block_meta().size());
-        for (size_t i = 0; i < sstable.num_of_blocks(); i++) {
-            auto block_ptr = sstable.get_block(i);
-            KeySlice first_key = block_ptr->first_key;
-            EXPECT_EQ(first_key.compare(sstable.debug_get_block_meta()[i].first_key), 0);
-        }
+        this->check_separators(sstable);
 
         EXPECT_EQ(sstable.first_key.compare(KeySlice(std::to_string(0))), 0);
         EXPECT_EQ(sstable.last_key.compare(KeySlice(std::to_string(99))), 0);
@@ -162,7 +172,6 @@ TEST_F(SSTableTest, sstable) {
         builder.build(0, block_cache, sst_path);
 
         SSTable sstable(0, block_cache, sst_path);
-        EXPECT_EQ(sstable.num_of_blocks(), sstable.debug_get_block_meta().size());
 
         size_t hit_cnt = 0;
         for (size_t i = 0; i < key_size * 2; i++) {
@@ -171,18 +180,15 @@ TEST_F(SSTableTest, sstable) {
                 hit_cnt++;
             }
             auto block_idx = sstable.locate_block(key);
-            DCHECK(block_idx < sstable.debug_get_block_meta().size());
+            DCHECK(block_idx < sstable.num_of_blocks());
             auto block = sstable.get_block(block_idx);
-            EXPECT_NE(block->first_key.compare(key), 1);
+            auto last_key = block->get_key(block->num_of_keys() - 1);
+            EXPECT_TRUE(last_key.compare(key) >= 0 || block_idx + 1 == sstable.num_of_blocks());
         }
         EXPECT_GE(hit_cnt, key_size);
         EXPECT_LE((double)(hit_cnt - keys.size()) / (keys.size() * 2), expected_false_rate);
 
-        for (size_t i = 0; i < sstable.num_of_blocks(); i++) {
-            auto block_ptr = sstable.get_block(i);
-            KeySlice first_key = block_ptr->first_key;
-            EXPECT_EQ(first_key.compare(sstable.debug_get_block_meta()[i].first_key), 0);
-        }
+        this->check_separators(sstable);
 
         EXPECT_EQ(sstable.first_key.compare(KeySlice(std::to_string(0))), 0);
         EXPECT_EQ(sstable.last_key.compare(KeySlice(std::to_string((key_size - 1) * 2))), 0);
@@ -248,7 +254,6 @@ TEST_F(SSTableTest, iterator) {
         builder.build(0, block_cache, sst_path);
 
         auto sst_ptr =  make_shared<SSTable>(0, block_cache, sst_path);
-        EXPECT_EQ(sst_ptr->num_of_blocks(), sst_ptr->debug_get_block_meta().size());
 
         auto iter = sst_ptr->create_iterator();
         int idx = 0;
@@ -293,7 +298,6 @@ TEST_F(SSTableTest, iterator) {
         builder.build(0, block_cache, sst_path);
 
         auto sst_ptr =  make_shared<SSTable>(0, block_cache, sst_path);
-        EXPECT_EQ(sst_ptr->num_of_blocks(), sst_ptr->debug_get_block_meta().size());
 
         auto out_of_low_bound_key = KeySlice(std::to_string(2));
         auto low_bound_key = KeySlice(std::to_string(5));
@@ -305,7 +309,7 @@ TEST_F(SSTableTest, iterator) {
 
         EXPECT_EQ(sst_ptr->locate_block(out_of_low_bound_key), 0);
         EXPECT_EQ(sst_ptr->locate_block(low_bound_key), 0);
-        EXPECT_EQ(sst_ptr->locate_block(min_key_1), 0);
+        EXPECT_EQ(sst_ptr->locate_block(min_key_1), 1);
         EXPECT_EQ(sst_ptr->locate_block(mid_key_2), 1);
         EXPECT_EQ(sst_ptr->locate_block(mid_key_3), 1);
         EXPECT_EQ(sst_ptr->locate_block(up_bound_key), 9);
@@ -387,3 +391,643 @@ TEST_F(SSTableTest, iterator) {
         EXPECT_FALSE(iter);
     }
 }
+
+TEST_F(SSTableTest, concurrent) {
+    std::string sst_path = sst_dir + "/sstable-6.sst";
+    size_t key_size = 4096;
+
+    {
+        SSTableBuilder builder(256, key_size, 0.01);
+        for (size_t i = 0; i < key_size; i++) {
+            builder.add(
+                KeySlice(std::to_string(i)), 
+                Slice(std::to_string(i * 2))
+            );
+        }
+        builder.build(0, nullptr, sst_path);
+    }
+
+    for (auto use_mmap : {false, true}) {
+        // no block cache, every access goes to the file
+        auto sst_ptr = make_shared<SSTable>(0, nullptr, sst_path, use_mmap);
+        
+        size_t thread_num = 8;
+        std::vector<size_t> key_cnt(thread_num, 0);
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < thread_num; i++) {
+            threads.emplace_back([&, i]() {
+                auto iter = sst_ptr->create_iterator();
+                for (size_t idx = 0; iter->is_valid(); iter->next(), idx++) {
+                    if (!iter->key().compare(KeySlice(std::to_string(idx)))
+                            && !iter->value().compare(Slice(std::to_string(idx * 2)))) {
+                        key_cnt[i]++;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) { thread.join(); }
+
+        for (size_t i = 0; i < thread_num; i++) {
+            EXPECT_EQ(key_cnt[i], key_size);
+        }
+    }
+}
+
+TEST_F(SSTableTest, bloom) {
+    size_t key_cnt = 100000;
+    for (double rate : {0.1, 0.01, 0.001}) {
+        BlockedBloomFilter bloom(key_cnt, BlockedBloomFilter::bits_per_key(rate));
+        for (size_t i = 0; i < key_cnt; i++) {
+            auto key = "key-" + std::to_string(i);
+            bloom.insert(reinterpret_cast<const u8*>(key.data()), key.size());
+        }
+
+        // no false negatives
+        for (size_t i = 0; i < key_cnt; i++) {
+            auto key = "key-" + std::to_string(i);
+            EXPECT_TRUE(bloom.contains(reinterpret_cast<const u8*>(key.data()), key.size()));
+        }
+
+        size_t hit_cnt = 0;
+        for (size_t i = key_cnt; i < key_cnt * 2; i++) {
+            auto key = "key-" + std::to_string(i);
+            hit_cnt += bloom.contains(reinterpret_cast<const u8*>(key.data()), key.size());
+        }
+        EXPECT_LE((double)hit_cnt / key_cnt, rate);
+
+        Bytes buf;
+        bloom.serialize(buf);
+        EXPECT_EQ(buf.size(), bloom.estimated_size());
+        EXPECT_TRUE(BlockedBloomFilter(buf).debug_equal(bloom));
+    }
+
+    // an empty filter rejects nothing
+    BlockedBloomFilter empty;
+    EXPECT_TRUE(empty.contains(reinterpret_cast<const u8*>("key"), 3));
+}
+
+TEST_F(SSTableTest, get) {
+    {
+        std::string sst_path = sst_dir + "/sstable-get-1.sst";
+        size_t key_size = 2000;
+
+        auto block_cache = make_shared<BlockCache>();
+        SSTableBuilder builder(1024, key_size, 0.01);
+        for (size_t i = 0; i < key_size; i++) {
+            builder.add(
+                KeySlice(std::to_string(i * 2)), 
+                Slice(std::to_string(i * 4))
+            );
+        }
+        builder.build(0, block_cache, sst_path);
+
+        block_cache->clear();
+        SSTable sstable(0, block_cache, sst_path);
+        for (size_t i = 0; i < key_size; i++) {
+            auto value = sstable.get(Slice(std::to_string(i * 2)));
+            EXPECT_TRUE(value.has_value());
+            EXPECT_EQ(value->compare(Slice(std::to_string(i * 4))), 0);
+        }
+
+        // absent keys are mostly rejected by the bloom filter without 
+        // touching any block
+        auto stats = block_cache->stats();
+        for (size_t i = 0; i < key_size; i++) {
+            EXPECT_FALSE(sstable.get(Slice(std::to_string(i * 2 + 1))).has_value());
+        }
+        auto new_stats = block_cache->stats();
+        EXPECT_LE(new_stats.hits + new_stats.misses - stats.hits - stats.misses, key_size / 20);
+
+        EXPECT_FALSE(sstable.get(Slice(std::to_string(key_size * 2))).has_value());
+    }
+
+    {
+        // versions of a key spread over several blocks
+        std::string sst_path = sst_dir + "/sstable-get-2.sst";
+
+        auto block_cache = make_shared<BlockCache>();
+        SSTableBuilder builder(64, 128, 0.01);
+        builder.add(KeySlice("a"), Slice("a"));
+        for (u64 ts = 50; ts >= 1; ts--) {
+            KeySlice key("b");
+            key.set_ts(ts * 2);
+            builder.add(key, Slice(std::to_string(ts * 2)));
+        }
+        builder.add(KeySlice("c"), Slice("c"));
+        auto sstable = builder.build(0, block_cache, sst_path);
+        EXPECT_GT(sstable->num_of_blocks(), 2);
+
+        EXPECT_EQ(sstable->get(Slice("b"))->compare(Slice("100")), 0);
+        EXPECT_EQ(sstable->get(Slice("b"), 51)->compare(Slice("50")), 0);
+        EXPECT_EQ(sstable->get(Slice("b"), 2)->compare(Slice("2")), 0);
+        EXPECT_FALSE(sstable->get(Slice("b"), 1).has_value());
+        EXPECT_EQ(sstable->get(Slice("a"))->compare(Slice("a")), 0);
+        EXPECT_EQ(sstable->get(Slice("c"))->compare(Slice("c")), 0);
+    }
+
+    {
+        // index kept in the block cache, read again once evicted
+        std::string sst_path = sst_dir + "/sstable-get-3.sst";
+        size_t key_size = 2000;
+
+        auto block_cache = make_shared<BlockCache>();
+        SSTableBuilder builder(256, key_size, 0.01);
+        for (size_t i = 0; i < key_size; i++) {
+            builder.add(KeySlice(std::to_string(i)), Slice(std::to_string(i * 2)));
+        }
+        auto sstable = builder.build(0, block_cache, sst_path, false, nullptr, true);
+        EXPECT_NE(block_cache->lookup_index(0), nullptr);
+
+        block_cache->clear();
+        for (size_t i = 0; i < key_size; i += 7) {
+            auto value = sstable->get(Slice(std::to_string(i)));
+            ASSERT_TRUE(value.has_value());
+            EXPECT_EQ(value->compare(Slice(std::to_string(i * 2))), 0);
+        }
+        EXPECT_NE(block_cache->lookup_index(0), nullptr);
+        EXPECT_EQ(sstable->locate_block(KeySlice("0")), 0);
+    }
+}
+
+TEST_F(SSTableTest, compression) {
+    auto codec = get_codec(CompressionType::LZ);
+    ASSERT_NE(codec, nullptr);
+    EXPECT_EQ(get_codec(CompressionType::NONE), nullptr);
+
+    std::string text;
+    for (size_t i = 0; i < 5000; i++) { text += "value-" + std::to_string(i % 300) + ";"; }
+    std::string random(100 * 1024, 0);
+    for (auto& c : random) { c = this->seed(); }
+    // matches overlapping their own output, and beyond the 64KB window
+    std::vector<std::string> inputs = {
+        "", "a", "abcd", std::string(1000, 'x'), text, random, random + random.substr(0, 1000)};
+    for (auto& input : inputs) {
+        auto src = reinterpret_cast<const u8*>(input.data());
+        Bytes compressed;
+        codec->compress(src, input.size(), compressed);
+        EXPECT_LE(compressed.size(), LzCodec::max_compressed_size(input.size()));
+        Bytes output;
+        ASSERT_TRUE(codec->decompress(compressed.data(), compressed.size(), output, input.size()));
+        ASSERT_EQ(output.size(), input.size());
+        EXPECT_EQ(memcmp(output.data(), input.data(), input.size()), 0);
+
+        // a truncated input is rejected
+        if (input.size() > 1) {
+            Bytes truncated;
+            EXPECT_FALSE(codec->decompress(compressed.data(), compressed.size() - 1, truncated, input.size()));
+            EXPECT_EQ(truncated.size(), 0);
+            // as is a raw size beyond the limit
+            EXPECT_FALSE(codec->decompress(compressed.data(), compressed.size(), truncated, input.size() - 1));
+            EXPECT_EQ(truncated.size(), 0);
+        }
+    }
+    // the raw size is a fixed little-endian u32
+    Bytes header;
+    codec->compress(reinterpret_cast<const u8*>("abcd"), 4, header);
+    EXPECT_EQ(header.get(0, sizeof(u32)), 4);
+    Bytes compressed;
+    codec->compress(reinterpret_cast<const u8*>(text.data()), text.size(), compressed);
+    EXPECT_LT(compressed.size() * 3, text.size());
+
+    // the same sstable written raw and compressed
+    size_t key_size = 5000;
+    vector<shared_ptr<SSTable>> ssts;
+    for (auto type : {CompressionType::NONE, CompressionType::LZ}) {
+        std::string sst_path = sst_dir + "/sstable-compression-" + std::to_string(ssts.size()) + ".sst";
+        auto block_cache = make_shared<BlockCache>();
+        SSTableBuilder builder(4096, key_size, 0.01, type);
+        for (size_t i = 0; i < key_size; i++) {
+            builder.add(KeySlice(std::to_string(i)), Slice("value-" + std::to_string(i % 10) + text.substr(0, 64)));
+        }
+        builder.build(0, block_cache, sst_path);
+        ssts.push_back(make_shared<SSTable>(0, block_cache, sst_path));
+    }
+    EXPECT_LT(ssts[1]->table_size() * 3, ssts[0]->table_size());
+
+    for (auto use_mmap : {false, true}) {
+        std::string sst_path = sst_dir + "/sstable-compression-1.sst";
+        auto block_cache = make_shared<BlockCache>();
+        SSTable sstable(0, block_cache, sst_path, use_mmap);
+        for (size_t i = 0; i < key_size; i++) {
+            auto value = sstable.get(Slice(std::to_string(i)));
+            ASSERT_TRUE(value.has_value());
+            EXPECT_EQ(value->compare(Slice("value-" + std::to_string(i % 10) + text.substr(0, 64))), 0);
+        }
+    }
+    size_t idx = 0;
+    for (auto iter = ssts[1]->create_iterator(); iter->is_valid(); iter->next(), idx++) {
+        EXPECT_EQ(iter->key().compare(KeySlice(std::to_string(idx))), 0);
+    }
+    EXPECT_EQ(idx, key_size);
+}
+
+TEST_F(SSTableTest, readahead) {
+    std::string sst_path = sst_dir + "/sstable-readahead.sst";
+    size_t key_size = 20000;
+
+    auto block_cache = make_shared<BlockCache>();
+    SSTableBuilder builder(256, key_size, 0.01);
+    for (size_t i = 0; i < key_size; i++) {
+        builder.add(KeySlice(std::to_string(i)), Slice(std::to_string(i * 2)));
+    }
+    auto sstable = builder.build(0, block_cache, sst_path);
+    ASSERT_GT(sstable->num_of_blocks(), SSTableIterator::MAX_READAHEAD_BLOCKS * 2);
+    auto pool = make_shared<ThreadPool>(4);
+
+    {
+        // without a pool nothing is read ahead
+        auto iter = sstable->create_iterator();
+        for (size_t i = 0; i < 1000; i++) { iter->next(); }
+        EXPECT_EQ(iter->debug_get_num_of_readahead(), 0);
+    }
+
+    {
+        // nothing is read ahead within the first block
+        block_cache->clear();
+        auto iter = sstable->create_iterator(0, 0, pool);
+        size_t idx = 0;
+        size_t max_readahead = 0;
+        for (; iter->is_valid(); iter->next(), idx++) {
+            EXPECT_EQ(iter->key().compare(KeySlice(std::to_string(idx))), 0);
+            EXPECT_EQ(iter->value().compare(Slice(std::to_string(idx * 2))), 0);
+            if (idx < sstable->get_block(0)->num_of_keys()) {
+                EXPECT_EQ(iter->debug_get_num_of_readahead(), 0);
+            }
+            max_readahead = std::max(max_readahead, iter->debug_get_num_of_readahead());
+        }
+        EXPECT_EQ(idx, key_size);
+        // the window grows with the scan
+        EXPECT_EQ(iter->debug_get_readahead_blocks(), SSTableIterator::MAX_READAHEAD_BLOCKS);
+        EXPECT_GT(max_readahead, SSTableIterator::MAX_READAHEAD_BLOCKS / 2);
+    }
+
+    {
+        // blocks beyond the limit are not read
+        block_cache->clear();
+        size_t limit = 10;
+        auto iter = make_shared<SSTableIterator>(sstable, 0, 0, limit, 0, nullptr, pool);
+        size_t keys_in_limit = 0;
+        for (size_t i = 0; i < limit; i++) { keys_in_limit += sstable->get_block(i)->num_of_keys(); }
+        block_cache->clear();
+        for (size_t i = 0; i < keys_in_limit; i++) {
+            ASSERT_TRUE(iter->is_valid());
+            iter->next();
+        }
+        EXPECT_EQ(iter->debug_get_num_of_readahead(), 0);
+        for (size_t i = limit + 1; i < sstable->num_of_blocks(); i++) {
+            EXPECT_EQ(block_cache->lookup(sstable->id, i), nullptr) << i;
+        }
+    }
+
+    {
+        // the reads queued by an abandoned iterator are skipped
+        auto single = make_shared<ThreadPool>(1);
+        std::promise<void> release;
+        auto released = release.get_future().share();
+        single->submit([released]() { released.wait(); });
+        block_cache->clear();
+        auto iter = sstable->create_iterator(0, 0, single);
+        while (iter->debug_get_num_of_readahead() < SSTableIterator::INITIAL_READAHEAD_BLOCKS) { iter->next(); }
+        iter.reset();
+        release.set_value();
+        single.reset();
+        for (size_t i = 2; i < sstable->num_of_blocks(); i++) {
+            EXPECT_EQ(block_cache->lookup(sstable->id, i), nullptr) << i;
+        }
+    }
+}
+
+TEST_F(SSTableTest, level_readahead) {
+    auto key_of = [](size_t i) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "k%06lu", i);
+        return std::string(buf);
+    };
+    size_t key_size = 20000;
+    size_t num_of_ssts = 4;
+    auto block_cache = make_shared<BlockCache>();
+    vector<shared_ptr<SSTable>> ssts;
+    for (size_t i = 0; i < num_of_ssts; i++) {
+        std::string sst_path = sst_dir + "/sstable-level-readahead-" + std::to_string(i) + ".sst";
+        SSTableBuilder builder(256, key_size, 0.01);
+        for (size_t j = 0; j < key_size; j++) {
+            builder.add(KeySlice(key_of(i * key_size + j)), Slice(std::to_string(j)));
+        }
+        ssts.push_back(builder.build(i, block_cache, sst_path));
+    }
+    auto level = make_shared<Level>(1, ssts);
+    auto pool = make_shared<ThreadPool>(4);
+
+    // a scan across the sstables, ending within the third one
+    size_t end_key = 2 * key_size + key_size / 2;
+    auto iter = level->scan(Bound(false), Bound(Slice(key_of(end_key)), false), nullptr, pool);
+    size_t idx = 0;
+    for (; iter->is_valid(); iter->next(), idx++) {
+        ASSERT_EQ(iter->key_view().compare(SliceView(Slice(key_of(idx)))), 0);
+        if (idx + 1 != key_size) { continue; }
+        // at the end of the first sstable the next one is read ahead
+        for (size_t i = 0; i < 1000 && !block_cache->lookup(ssts[1]->id, 1); i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        EXPECT_NE(block_cache->lookup(ssts[1]->id, 1), nullptr);
+    }
+    EXPECT_EQ(idx, end_key);
+    iter.reset();
+
+    // nothing is read past the upper bound
+    auto end_block = ssts[2]->locate_block(KeySlice(key_of(end_key)));
+    for (size_t i = end_block + 1; i < ssts[2]->num_of_blocks(); i++) {
+        EXPECT_EQ(block_cache->lookup(ssts[2]->id, i), nullptr) << i;
+    }
+    for (size_t i = 0; i < ssts[3]->num_of_blocks(); i++) {
+        EXPECT_EQ(block_cache->lookup(ssts[3]->id, i), nullptr) << i;
+    }
+
+    // no sstable is opened for a range beyond the level
+    EXPECT_EQ(level->scan(Bound(Slice(key_of(num_of_ssts * key_size))), Bound(true), nullptr, pool), nullptr);
+    EXPECT_EQ(level->scan(Bound(false), Bound(Slice(key_of(0)), false), nullptr, pool), nullptr);
+
+    // the last sstable has no block when its meta cannot be read
+    std::string broken_path = sst_dir + "/sstable-level-readahead-broken.sst";
+    std::ofstream(broken_path) << "torn";
+    auto last = KeySlice(key_of(num_of_ssts * key_size));
+    ssts.push_back(make_shared<SSTable>(num_of_ssts, last, last, 0, 4, block_cache, nullptr, broken_path));
+    level = make_shared<Level>(1, ssts);
+    EXPECT_EQ(ssts.back()->num_of_blocks(), 0);
+    iter = level->scan(Bound(Slice(key_of(num_of_ssts * key_size - 1))), Bound(true), nullptr, pool);
+    ASSERT_NE(iter, nullptr);
+    ASSERT_TRUE(iter->is_valid());
+    EXPECT_EQ(iter->key_view().compare(SliceView(Slice(key_of(num_of_ssts * key_size - 1)))), 0);
+}
+
+TEST_F(SSTableTest, io_backend) {
+    std::string path = sst_dir + "/io-backend.data";
+    std::string content(1 << 20, 0);
+    for (auto& c : content) { c = this->seed(); }
+    {
+        FileObject file(path, false);
+        Bytes buf;
+        buf.instream(reinterpret_cast<const u8*>(content.data()), content.size());
+        file.write(buf);
+    }
+
+    for (auto type : {IoBackendType::PREAD, IoBackendType::IO_URING}) {
+        auto io = IoBackend::create(type);
+        if (io->type() != type) { continue; }
+        EXPECT_EQ(io->is_async(), type == IoBackendType::IO_URING);
+        auto file = make_shared<FileObject>(path, true, false, io);
+
+        // more reads than fit in the rings at once
+        vector<pair<size_t, size_t>> ranges;
+        for (size_t i = 0; i < 2000; i++) {
+            auto offset = this->seed() % content.size();
+            auto len = std::min<size_t>(this->seed() % 8192 + 1, content.size() - offset);
+            ranges.emplace_back(offset, len);
+        }
+        auto batch = file->read_async(ranges);
+        ASSERT_TRUE(batch->wait());
+        EXPECT_TRUE(batch->is_done());
+        for (size_t i = 0; i < ranges.size(); i++) {
+            auto& req = batch->requests[i];
+            ASSERT_EQ(req.buf.size(), ranges[i].second);
+            EXPECT_EQ(memcmp(req.buf.data(), content.data() + ranges[i].first, ranges[i].second), 0);
+        }
+
+        // reads beyond the end of the file fail on their own
+        batch = file->read_async({{0, 16}, {content.size() - 8, 16}});
+        EXPECT_FALSE(batch->wait());
+        EXPECT_TRUE(batch->requests[0].ok);
+        EXPECT_FALSE(batch->requests[1].ok);
+
+        // a batch dropped before it completes, holding the last reference
+        // to the file and the backend
+        {
+            auto last_io = IoBackend::create(type);
+            auto last_file = make_shared<FileObject>(path, true, false, last_io);
+            last_io.reset();
+            auto last_batch = last_file->read_async(ranges);
+            last_file.reset();
+        }
+
+        // blocks of an sstable fetched in one batch, and read ahead
+        std::string sst_path = sst_dir + "/sstable-io-backend.sst";
+        auto table_cache = make_shared<TableCache>(TableCache::DEFAULT_CAPACITY, false, io);
+        auto block_cache = make_shared<BlockCache>();
+        size_t key_size = 10000;
+        SSTableBuilder builder(256, key_size, 0.01);
+        for (size_t i = 0; i < key_size; i++) {
+            builder.add(KeySlice(std::to_string(i)), Slice(std::to_string(i * 2)));
+        }
+        auto sstable = builder.build(0, block_cache, sst_path, false, table_cache);
+        EXPECT_EQ(sstable->has_async_io(), io->is_async());
+        block_cache->clear();
+
+        vector<size_t> block_idxs;
+        for (size_t i = 0; i < sstable->num_of_blocks(); i += 3) { block_idxs.push_back(i); }
+        auto blocks = sstable->get_blocks(block_idxs);
+        // the same blocks read one by one with `pread`, through a cache of
+        // their own
+        auto reference = make_shared<SSTable>(1, make_shared<BlockCache>(), sst_path);
+        for (size_t i = 0; i < block_idxs.size(); i++) {
+            ASSERT_NE(blocks[i], nullptr);
+            auto expected = reference->get_block(block_idxs[i])->serialize();
+            auto actual = blocks[i]->serialize();
+            ASSERT_EQ(actual.size(), expected.size());
+            EXPECT_EQ(memcmp(actual.data(), expected.data(), expected.size()), 0) << block_idxs[i];
+            EXPECT_EQ(block_cache->lookup(sstable->id, block_idxs[i]), blocks[i]);
+        }
+
+        block_cache->clear();
+        size_t idx = 0;
+        auto pool = make_shared<ThreadPool>(4);
+        for (auto iter = sstable->create_iterator(0, 0, pool); iter->is_valid(); iter->next(), idx++) {
+            ASSERT_EQ(iter->key().compare(KeySlice(std::to_string(idx))), 0);
+            ASSERT_EQ(iter->value().compare(Slice(std::to_string(idx * 2))), 0);
+        }
+        EXPECT_EQ(idx, key_size);
+    }
+}
+
+TEST_F(SSTableTest, multi_get) {
+    {
+        std::string sst_path = sst_dir + "/sstable-multi-get-1.sst";
+        size_t key_size = 2000;
+
+        auto block_cache = make_shared<BlockCache>();
+        SSTableBuilder builder(256, key_size, 0.01);
+        for (size_t i = 0; i < key_size; i++) {
+            builder.add(KeySlice(std::to_string(i * 2)), Slice(std::to_string(i * 4)));
+        }
+        builder.build(0, block_cache, sst_path);
+
+        block_cache->clear();
+        SSTable sstable(0, block_cache, sst_path);
+        // present and absent keys, some out of the range of the sstable
+        std::vector<size_t> nums;
+        for (size_t i = 0; i < key_size * 2 + 100; i += 3) { nums.push_back(i); }
+        std::sort(nums.begin(), nums.end(), [](size_t a, size_t b) {
+            return Slice(std::to_string(a)).compare(Slice(std::to_string(b))) < 0;
+        });
+        std::vector<Slice> keys;
+        for (auto num : nums) { keys.push_back(Slice(std::to_string(num))); }
+
+        std::vector<std::optional<Slice>> values(keys.size());
+        sstable.multi_get(keys, values);
+        for (size_t i = 0; i < keys.size(); i++) {
+            auto value = sstable.get(keys[i]);
+            ASSERT_EQ(values[i].has_value(), value.has_value()) << nums[i];
+            ASSERT_EQ(values[i].has_value(), nums[i] % 2 == 0 && nums[i] < key_size * 2) << nums[i];
+            if (value) { EXPECT_EQ(values[i]->compare(*value), 0); }
+        }
+    }
+
+    {
+        // versions of a key spread over several blocks
+        std::string sst_path = sst_dir + "/sstable-multi-get-2.sst";
+
+        auto block_cache = make_shared<BlockCache>();
+        SSTableBuilder builder(64, 128, 0.01);
+        builder.add(KeySlice("a"), Slice("a"));
+        for (u64 ts = 50; ts >= 1; ts--) {
+            KeySlice key("b");
+            key.set_ts(ts * 2);
+            builder.add(key, Slice(std::to_string(ts * 2)));
+        }
+        builder.add(KeySlice("c"), Slice("c"));
+        auto sstable = builder.build(0, block_cache, sst_path);
+
+        std::vector<Slice> keys = {Slice("a"), Slice("b"), Slice("c"), Slice("d")};
+        std::vector<std::optional<Slice>> values(keys.size());
+        sstable->multi_get(keys, values);
+        EXPECT_EQ(values[0]->compare(Slice("a")), 0);
+        EXPECT_EQ(values[1]->compare(Slice("100")), 0);
+        EXPECT_EQ(values[2]->compare(Slice("c")), 0);
+        EXPECT_FALSE(values[3].has_value());
+
+        std::fill(values.begin(), values.end(), std::nullopt);
+        sstable->multi_get(keys, values, 51);
+        EXPECT_EQ(values[1]->compare(Slice("50")), 0);
+    }
+}
+
+TEST_F(SSTableTest, tombstone) {
+    auto key_of = [](size_t i) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "k%04lu", i);
+        return std::string(buf);
+    };
+    std::string sst_path = sst_dir + "/sstable-tombstone-1.sst";
+    auto block_cache = make_shared<BlockCache>();
+    SSTableBuilder builder(256, 1000, 0.01);
+    // the points are written at 10, after the range deletions at 5
+    for (size_t i = 1000; i < 2000; i++) {
+        KeySlice key(key_of(i));
+        key.set_ts(10);
+        if (i % 10 == 3) {
+            builder.add(key, Slice(), ValueType::DELETION);
+        } else {
+            builder.add(key, Slice(std::to_string(i)));
+        }
+    }
+    RangeTombstones tombstones;
+    tombstones.add(Slice(key_of(500)), Slice(key_of(1099)), 5);
+    tombstones.add(Slice(key_of(2500)), Slice(key_of(2999)), 5);
+    builder.add_range_tombstones(tombstones);
+    builder.build(0, block_cache, sst_path);
+
+    block_cache->clear();
+    auto sstable = make_shared<SSTable>(0, block_cache, sst_path);
+    // the key range covers the range tombstones
+    EXPECT_EQ(sstable->first_key.compare(Slice(key_of(500))), 0);
+    EXPECT_EQ(sstable->last_key.compare(Slice(key_of(2999))), 0);
+    ASSERT_TRUE(sstable->has_range_tombstones());
+    ASSERT_EQ(sstable->range_tombstones().size(), 2);
+    EXPECT_EQ(sstable->range_tombstones()[1].first.compare(Slice(key_of(2500))), 0);
+
+    for (size_t i = 0; i < 3500; i += 7) {
+        bool deleted = false;
+        auto value = sstable->get(SliceView(Slice(key_of(i))), UINT64_MAX, &deleted);
+        // the points of the sstable are newer than its range tombstones
+        bool expect_value = i >= 1000 && i < 2000 && i % 10 != 3;
+        bool expect_deleted = (i >= 1000 && i < 2000 && i % 10 == 3) ||
+            (i >= 500 && i < 1000) || (i >= 2500 && i < 3000);
+        EXPECT_EQ(value.has_value(), expect_value) << i;
+        EXPECT_EQ(deleted, expect_deleted) << i;
+    }
+    // reads between the deletions and the points see only the deletions,
+    // reads before both see nothing
+    bool deleted = false;
+    EXPECT_FALSE(sstable->get(SliceView(Slice(key_of(1050))), 7, &deleted).has_value());
+    EXPECT_TRUE(deleted);
+    deleted = false;
+    EXPECT_FALSE(sstable->get(SliceView(Slice(key_of(1050))), 4, &deleted).has_value());
+    EXPECT_FALSE(deleted);
+
+    std::vector<Slice> keys;
+    for (size_t i = 0; i < 3500; i += 3) { keys.push_back(Slice(key_of(i))); }
+    for (u64 ts : {UINT64_MAX, u64(7)}) {
+        std::vector<std::optional<Slice>> values(keys.size());
+        std::vector<bool> deleted(keys.size());
+        sstable->multi_get(keys, values, ts, &deleted);
+        for (size_t j = 0; j < keys.size(); j++) {
+            bool expected = false;
+            auto value = sstable->get(SliceView(keys[j]), ts, &expected);
+            EXPECT_EQ(values[j].has_value(), value.has_value()) << j;
+            EXPECT_EQ(deleted[j], expected) << j;
+        }
+    }
+
+    // keys deleted by newer tables are skipped, point tombstones are not
+    vector<shared_ptr<SSTable>> ssts = {sstable};
+    auto level = make_shared<Level>(1, ssts);
+    auto newer = make_shared<RangeTombstones>(Slice(key_of(1100)), Slice(key_of(1849)));
+    size_t num_of_values = 0, num_of_deletions = 0;
+    for (auto iter = level->scan(Bound(false), Bound(true), newer); iter->is_valid(); iter->next()) {
+        EXPECT_FALSE(newer->find(iter->key_view())) << iter->key();
+        if (iter->value_type() == ValueType::DELETION) {
+            num_of_deletions++;
+        } else {
+            num_of_values++;
+        }
+    }
+    EXPECT_EQ(num_of_deletions, 25);
+    EXPECT_EQ(num_of_values, 225);
+
+    // starting within a tombstone, ending before its last key
+    auto iter = level->scan(Bound(Slice(key_of(1200))), Bound(Slice(key_of(1900)), false), newer);
+    ASSERT_TRUE(iter->is_valid());
+    EXPECT_EQ(iter->key().compare(Slice(key_of(1850))), 0);
+    size_t cnt = 0;
+    for (; iter->is_valid(); iter->next()) { cnt++; }
+    EXPECT_EQ(cnt, 50);
+    EXPECT_FALSE(level->scan(Bound(false), Bound(true),
+        make_shared<RangeTombstones>(Slice(key_of(0)), Slice(key_of(9999))))->is_valid());
+}
+
+TEST_F(SSTableTest, range_tombstone_only) {
+    std::string sst_path = sst_dir + "/sstable-tombstone-2.sst";
+    auto block_cache = make_shared<BlockCache>();
+    SSTableBuilder builder(256, 0, 0.01);
+    builder.add_range_tombstones(RangeTombstones(Slice("b"), Slice("d")));
+    auto sstable = builder.build(0, block_cache, sst_path);
+    ASSERT_EQ(sstable->num_of_blocks(), 1);
+    EXPECT_EQ(sstable->first_key.compare(Slice("b")), 0);
+    EXPECT_EQ(sstable->last_key.compare(Slice("d")), 0);
+
+    // opened lazily, as listed in the manifest
+    SSTable reopened(1, sstable->first_key, sstable->last_key, sstable->max_ts, sstable->table_size(),
+        block_cache, nullptr, sst_path, false, sstable->has_range_tombstones());
+    for (auto key : {"a", "b", "c", "d", "e"}) {
+        bool deleted = false;
+        EXPECT_FALSE(reopened.get(SliceView(Slice(key)), UINT64_MAX, &deleted).has_value());
+        EXPECT_EQ(deleted, key[0] >= 'b' && key[0] <= 'd') << key;
+    }
+}
+
+TEST_F(SSTableTest, empty) {
+    std::string sst_path = sst_dir + "/sstable-empty.sst";
+    std::filesystem::remove(sst_path);
+    SSTableBuilder builder(256, 0, 0.01);
+    EXPECT_EQ(builder.build(0, make_shared<BlockCache>(), sst_path), nullptr);
+    EXPECT_FALSE(std::filesystem::exists(sst_path));
+}
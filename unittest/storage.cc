@@ -0,0 +1,778 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-10-08 14:05:12
+ * @Description: test for lsm storage engine
+ */
+
+#include "defs.h"
+#include "mvcc/snapshot.h"
+#include "slice.h"
+#include "sstable/iterator.h"
+#include "storage/storage.h"
+#include "gtest/gtest.h"
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace minilsm;
+
+class StorageTest : public ::testing::Test {
+public:
+    std::string storage_dir = string(PROJECT_ROOT_PATH) + "/binary/unittest/storage";
+    std::mt19937 seed;
+
+public:
+    void SetUp() override {
+        std::filesystem::remove_all(storage_dir);
+        std::filesystem::create_directories(storage_dir);
+    }
+
+    // keys of equal length, so that slice order matches numeric order
+    std::string key_of(size_t i) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "key-%06lu", i);
+        return buf;
+    }
+
+    StorageOptions small_options() {
+        StorageOptions options;
+        options.block_size = 256;
+        options.memtable_size = 128 * 1024;
+        options.max_immutable_memtables = 2;
+        options.wal_options.sync_policy = WalSyncPolicy::NONE;
+        options.num_compaction_threads = 0;
+        return options;
+    }
+
+    // files of the sstables opened by the process
+    size_t num_of_open_sstables() {
+        size_t res = 0;
+        for (auto& entry : std::filesystem::directory_iterator("/proc/self/fd")) {
+            std::error_code ec;
+            auto target = std::filesystem::read_symlink(entry.path(), ec);
+            if (!ec && target.extension() == ".sst") { res++; }
+        }
+        return res;
+    }
+
+    StorageOptions compaction_options() {
+        auto options = this->small_options();
+        options.num_compaction_threads = 2;
+        options.level0_compaction_trigger = 2;
+        options.level_size_base = 256 * 1024;
+        options.level_size_multiplier = 4;
+        options.target_file_size = 64 * 1024;
+        return options;
+    }
+
+    void check_scan(LsmStorage& storage, const std::map<std::string, std::string>& expected,
+            size_t lower, size_t upper) {
+        auto iter = storage.scan(Bound(Slice(key_of(lower))), Bound(Slice(key_of(upper)), false));
+        auto it = expected.lower_bound(key_of(lower));
+        for (; iter->is_valid(); iter->next()) {
+            ASSERT_NE(it, expected.end());
+            ASSERT_TRUE(iter->key() == Slice(it->first)) << iter->key() << " " << it->first;
+            ASSERT_TRUE(iter->value() == Slice(it->second));
+            it++;
+        }
+        ASSERT_TRUE(it == expected.end() || it->first >= key_of(upper));
+    }
+
+    // fill the storage and check the shape of the levels once the
+    // compaction settles down
+    void check_leveled(const StorageOptions& options,
+            const std::function<void(LsmStorage&)>& check = nullptr) {
+        auto storage = LsmStorage::open(storage_dir, options);
+        std::map<std::string, std::string> expected;
+        for (size_t i = 0; i < 60000; i++) {
+            auto key = this->key_of(this->seed() % 20000);
+            auto value = std::to_string(i);
+            ASSERT_TRUE(storage->put(Slice(key), Slice(value)));
+            expected[key] = value;
+        }
+        storage->force_freeze();
+        storage->wait_for_flush();
+        storage->wait_for_compaction();
+
+        auto state = storage->snapshot();
+        ASSERT_LT(state->l0_sstables.size(), 2);
+        ASSERT_EQ(state->levels.size(), options.max_levels);
+        size_t num_of_ssts = 0;
+        for (auto& level : state->levels) {
+            auto& ssts = level->sstables();
+            for (size_t i = 0; i < ssts.size(); i++) {
+                ASSERT_LE(ssts[i]->first_key.compare(ssts[i]->last_key), 0);
+                if (i) { ASSERT_LT(ssts[i - 1]->last_key.compare(ssts[i]->first_key), 0); }
+            }
+            num_of_ssts += ssts.size();
+        }
+        ASSERT_GT(num_of_ssts, 1);
+        ASSERT_GT(state->levels[1]->num_of_ssts(), 0);
+
+        for (auto& [key, value] : expected) {
+            auto res = storage->get(Slice(key));
+            ASSERT_TRUE(res.has_value()) << key;
+            ASSERT_TRUE(*res == Slice(value)) << key;
+        }
+        this->check_scan(*storage, expected, 0, 20000);
+        this->check_scan(*storage, expected, 5000, 6000);
+        if (check) { check(*storage); }
+    }
+
+    void check_expected(LsmStorage& storage, const std::map<std::string, std::string>& expected,
+            size_t num_of_keys) {
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < num_of_keys; i++) {
+            auto key = this->key_of(i);
+            auto res = storage.get(Slice(key));
+            auto iter = expected.find(key);
+            ASSERT_EQ(res.has_value(), iter != expected.end()) << key;
+            if (res) { ASSERT_TRUE(*res == Slice(iter->second)) << key; }
+            keys.push_back(key);
+        }
+        std::vector<Slice> key_slices(keys.begin(), keys.end());
+        auto values = storage.multi_get(key_slices);
+        for (size_t i = 0; i < keys.size(); i++) {
+            ASSERT_EQ(values[i].has_value(), expected.count(keys[i]) > 0) << keys[i];
+        }
+        this->check_scan(storage, expected, 0, num_of_keys);
+        this->check_scan(storage, expected, num_of_keys / 3, num_of_keys / 2);
+    }
+
+    // mix point and range deletions into the writes, then check every
+    // key while the deletions live in memtables, sstables and after the
+    // compaction and a reopen
+    void check_deletions(const StorageOptions& options) {
+        std::map<std::string, std::string> expected;
+        {
+            auto storage = LsmStorage::open(storage_dir, options);
+            for (size_t i = 0; i < 40000; i++) {
+                auto num = this->seed() % 10000;
+                auto key = this->key_of(num);
+                auto op = this->seed() % 100;
+                if (op < 75) {
+                    ASSERT_TRUE(storage->put(Slice(key), Slice(std::to_string(i))));
+                    expected[key] = std::to_string(i);
+                } else if (op < 99) {
+                    ASSERT_TRUE(storage->remove(Slice(key)));
+                    expected.erase(key);
+                } else {
+                    auto end = this->key_of(num + this->seed() % 100);
+                    ASSERT_TRUE(storage->delete_range(Slice(key), Slice(end)));
+                    expected.erase(expected.lower_bound(key), expected.lower_bound(end));
+                }
+                if (i == 20000) { this->check_expected(*storage, expected, 10000); }
+            }
+            this->check_expected(*storage, expected, 10000);
+            storage->force_freeze();
+            storage->wait_for_flush();
+            storage->wait_for_compaction();
+            this->check_expected(*storage, expected, 10000);
+
+            // a range deletion wiping out most of the keys
+            ASSERT_TRUE(storage->delete_range(Slice(this->key_of(1000)), Slice(this->key_of(9000))));
+            expected.erase(expected.lower_bound(this->key_of(1000)), expected.lower_bound(this->key_of(9000)));
+            this->check_expected(*storage, expected, 10000);
+        }
+        auto storage = LsmStorage::open(storage_dir, options);
+        this->check_expected(*storage, expected, 10000);
+        storage->wait_for_compaction();
+        this->check_expected(*storage, expected, 10000);
+    }
+};
+
+int main() {
+    ::testing::InitGoogleTest();
+    return RUN_ALL_TESTS();
+}
+
+TEST_F(StorageTest, putget) {
+    auto storage = LsmStorage::open(storage_dir, this->small_options());
+    ASSERT_TRUE(storage->put(Slice("a"), Slice("1")));
+    ASSERT_TRUE(storage->put(Slice("b"), Slice("2")));
+    ASSERT_TRUE(storage->put(Slice("a"), Slice("3")));
+
+    ASSERT_TRUE(*storage->get(Slice("a")) == Slice("3"));
+    ASSERT_TRUE(*storage->get(Slice("b")) == Slice("2"));
+    ASSERT_FALSE(storage->get(Slice("c")).has_value());
+
+    // an overwrite in the memtable shadows the flushed value
+    storage->force_freeze();
+    storage->wait_for_flush();
+    ASSERT_EQ(storage->snapshot()->l0_sstables.size(), 1);
+    ASSERT_TRUE(storage->put(Slice("b"), Slice("4")));
+    ASSERT_TRUE(*storage->get(Slice("a")) == Slice("3"));
+    ASSERT_TRUE(*storage->get(Slice("b")) == Slice("4"));
+
+    // keys whose internal key overflows the u16 lengths are rejected
+    std::string longest(MAX_KEY_SIZE, 'k');
+    std::string too_long(MAX_KEY_SIZE + 1, 'k');
+    ASSERT_TRUE(storage->put(Slice(longest), Slice("5")));
+    ASSERT_FALSE(storage->put(Slice(too_long), Slice("6")));
+    ASSERT_FALSE(storage->remove(Slice(too_long)));
+    ASSERT_FALSE(storage->put(Slice("c"), Slice(std::string(MAX_VALUE_SIZE + 1, 'v'))));
+    ASSERT_FALSE(storage->get(Slice(too_long)).has_value());
+    storage->force_freeze();
+    storage->wait_for_flush();
+    ASSERT_TRUE(*storage->get(Slice(longest)) == Slice("5"));
+    auto values = storage->multi_get({Slice("a"), Slice(longest), Slice(too_long)});
+    ASSERT_TRUE(*values[1] == Slice("5"));
+    ASSERT_FALSE(values[2].has_value());
+}
+
+TEST_F(StorageTest, flush) {
+    auto storage = LsmStorage::open(storage_dir, this->small_options());
+    std::map<std::string, std::string> expected;
+    for (size_t round = 0; round < 4; round++) {
+        for (size_t i = 0; i < 2000; i++) {
+            auto key = this->key_of(this->seed() % 3000);
+            auto value = std::to_string(round) + "-" + std::to_string(i);
+            ASSERT_TRUE(storage->put(Slice(key), Slice(value)));
+            expected[key] = value;
+        }
+    }
+    storage->wait_for_flush();
+    ASSERT_GT(storage->snapshot()->l0_sstables.size(), 1);
+
+    for (auto& [key, value] : expected) {
+        auto res = storage->get(Slice(key));
+        ASSERT_TRUE(res.has_value()) << key;
+        ASSERT_TRUE(*res == Slice(value)) << key;
+    }
+    this->check_scan(*storage, expected, 0, 3000);
+    this->check_scan(*storage, expected, 100, 200);
+    this->check_scan(*storage, expected, 2990, 5000);
+}
+
+TEST_F(StorageTest, concurrency) {
+    auto storage = LsmStorage::open(storage_dir, this->small_options());
+    size_t thd_cnt = 4;
+    size_t key_cnt = 3000;
+
+    vector<std::thread> thds;
+    for (size_t t = 0; t < thd_cnt; t++) {
+        thds.emplace_back([&, t]() {
+            for (size_t i = t; i < key_cnt; i += thd_cnt) {
+                storage->put(Slice(this->key_of(i)), Slice(std::to_string(i)));
+            }
+        });
+    }
+    for (auto& thd : thds) { thd.join(); }
+
+    for (size_t i = 0; i < key_cnt; i++) {
+        auto res = storage->get(Slice(this->key_of(i)));
+        ASSERT_TRUE(res.has_value());
+        ASSERT_TRUE(*res == Slice(std::to_string(i)));
+    }
+}
+
+TEST_F(StorageTest, recover) {
+    std::map<std::string, std::string> expected;
+    {
+        auto storage = LsmStorage::open(storage_dir, this->small_options());
+        for (size_t i = 0; i < 1500; i++) {
+            auto key = this->key_of(i);
+            storage->put(Slice(key), Slice(std::to_string(i)));
+            expected[key] = std::to_string(i);
+        }
+    }
+    {
+        // everything was flushed when the storage was closed
+        auto storage = LsmStorage::open(storage_dir, this->small_options());
+        ASSERT_TRUE(storage->snapshot()->imm_memtables.empty());
+        for (size_t i = 0; i < 1500; i += 2) {
+            auto key = this->key_of(i);
+            storage->put(Slice(key), Slice("new"));
+            expected[key] = "new";
+        }
+        // simulate a crash: the wal of the unflushed memtable is kept
+        storage->force_freeze();
+        storage->wait_for_flush();
+        storage->put(Slice(this->key_of(0)), Slice("newer"));
+        expected[this->key_of(0)] = "newer";
+        std::filesystem::copy(storage_dir, storage_dir + ".crash");
+    }
+    std::filesystem::remove_all(storage_dir);
+    std::filesystem::rename(storage_dir + ".crash", storage_dir);
+
+    auto storage = LsmStorage::open(storage_dir, this->small_options());
+    for (auto& [key, value] : expected) {
+        auto res = storage->get(Slice(key));
+        ASSERT_TRUE(res.has_value()) << key;
+        ASSERT_TRUE(*res == Slice(value)) << key;
+    }
+    this->check_scan(*storage, expected, 0, 1500);
+}
+
+TEST_F(StorageTest, compaction) {
+    this->check_leveled(this->compaction_options());
+}
+
+TEST_F(StorageTest, subcompaction) {
+    auto options = this->compaction_options();
+    options.max_subcompactions = 4;
+    options.target_file_size = 16 * 1024;
+    this->check_leveled(options, [](LsmStorage& storage) {
+        // some compaction was split into several key ranges
+        ASSERT_GT(storage.debug_num_of_subcompactions(), 1);
+    });
+}
+
+TEST_F(StorageTest, compaction_recover) {
+    std::map<std::string, std::string> expected;
+    size_t num_of_ssts = 0;
+    {
+        auto storage = LsmStorage::open(storage_dir, this->compaction_options());
+        for (size_t i = 0; i < 60000; i++) {
+            auto key = this->key_of(this->seed() % 20000);
+            auto value = std::to_string(i);
+            ASSERT_TRUE(storage->put(Slice(key), Slice(value)));
+            expected[key] = value;
+        }
+        storage->force_freeze();
+        storage->wait_for_flush();
+        storage->wait_for_compaction();
+        for (auto& level : storage->snapshot()->levels) { num_of_ssts += level->num_of_ssts(); }
+    }
+    ASSERT_GT(num_of_ssts, 0);
+
+    // the levels are found as they were, compaction outputs do not shadow
+    // the newer sstables of L0
+    auto storage = LsmStorage::open(storage_dir, this->small_options());
+    auto state = storage->snapshot();
+    size_t recovered = 0;
+    for (auto& level : state->levels) {
+        auto& ssts = level->sstables();
+        for (size_t i = 1; i < ssts.size(); i++) {
+            ASSERT_LT(ssts[i - 1]->last_key.compare(ssts[i]->first_key), 0);
+        }
+        recovered += ssts.size();
+    }
+    ASSERT_EQ(recovered, num_of_ssts);
+
+    for (auto& [key, value] : expected) {
+        auto res = storage->get(Slice(key));
+        ASSERT_TRUE(res.has_value()) << key;
+        ASSERT_TRUE(*res == Slice(value)) << key;
+    }
+    this->check_scan(*storage, expected, 0, 20000);
+}
+
+TEST_F(StorageTest, compression) {
+    // L0 raw, compressed below
+    auto options = this->compaction_options();
+    options.compression_per_level = {CompressionType::NONE, CompressionType::LZ};
+    this->check_leveled(options);
+
+    auto storage = LsmStorage::open(storage_dir, options);
+    u64 raw_size = 0, compressed_size = 0;
+    for (auto& level : storage->snapshot()->levels) {
+        for (auto& sst : level->sstables()) {
+            for (size_t i = 0; i < sst->num_of_blocks(); i++) {
+                raw_size += sst->get_block(i)->serialize().size() + BLOCK_TRAILER_SIZE;
+                compressed_size += sst->block_size(i);
+            }
+        }
+    }
+    ASSERT_GT(raw_size, 0);
+    EXPECT_LT(compressed_size, raw_size);
+}
+
+TEST_F(StorageTest, tiered) {
+    auto options = this->compaction_options();
+    options.compaction_style = CompactionStyle::TIERED;
+    options.level0_compaction_trigger = 4;
+    auto storage = LsmStorage::open(storage_dir, options);
+    std::map<std::string, std::string> expected;
+    for (size_t i = 0; i < 60000; i++) {
+        auto key = this->key_of(this->seed() % 20000);
+        auto value = std::to_string(i);
+        ASSERT_TRUE(storage->put(Slice(key), Slice(value)));
+        expected[key] = value;
+    }
+    storage->force_freeze();
+    storage->wait_for_flush();
+    storage->wait_for_compaction();
+
+    // every run is sorted, but runs overlap each other
+    auto state = storage->snapshot();
+    ASSERT_LT(state->l0_sstables.size() + state->levels.size(), 4);
+    ASSERT_GT(state->levels.size(), 0);
+    for (auto& run : state->levels) {
+        auto& ssts = run->sstables();
+        ASSERT_GT(ssts.size(), 0);
+        for (size_t i = 1; i < ssts.size(); i++) {
+            ASSERT_LT(ssts[i - 1]->last_key.compare(ssts[i]->first_key), 0);
+        }
+    }
+
+    for (auto& [key, value] : expected) {
+        auto res = storage->get(Slice(key));
+        ASSERT_TRUE(res.has_value()) << key;
+        ASSERT_TRUE(*res == Slice(value)) << key;
+    }
+    this->check_scan(*storage, expected, 0, 20000);
+    this->check_scan(*storage, expected, 5000, 6000);
+}
+
+TEST_F(StorageTest, manifest) {
+    for (auto style : {CompactionStyle::LEVELED, CompactionStyle::TIERED}) {
+        std::filesystem::remove_all(storage_dir);
+        auto options = this->compaction_options();
+        options.compaction_style = style;
+        std::map<std::string, std::string> expected;
+        vector<vector<u64>> shape;
+        {
+            auto storage = LsmStorage::open(storage_dir, options);
+            for (size_t i = 0; i < 30000; i++) {
+                auto key = this->key_of(this->seed() % 10000);
+                auto value = std::to_string(i);
+                ASSERT_TRUE(storage->put(Slice(key), Slice(value)));
+                expected[key] = value;
+            }
+            storage->force_freeze();
+            storage->wait_for_flush();
+            storage->wait_for_compaction();
+
+            auto state = storage->snapshot();
+            shape.emplace_back();
+            for (auto& sst : state->l0_sstables) { shape.back().push_back(sst->id); }
+            for (auto& level : state->levels) {
+                shape.emplace_back();
+                for (auto& sst : level->sstables()) { shape.back().push_back(sst->id); }
+            }
+        }
+
+        // an sstable unknown to the manifest is removed
+        std::ofstream(storage_dir + "/99999.sst") << "torn";
+
+        options.num_compaction_threads = 0;
+        auto storage = LsmStorage::open(storage_dir, options);
+        ASSERT_FALSE(std::filesystem::exists(storage_dir + "/99999.sst"));
+        auto state = storage->snapshot();
+        ASSERT_EQ(state->levels.size() + 1, shape.size());
+        for (size_t i = 0; i < shape.size(); i++) {
+            auto& ssts = i ? state->levels[i - 1]->sstables() : state->l0_sstables;
+            ASSERT_EQ(ssts.size(), shape[i].size());
+            for (size_t j = 0; j < ssts.size(); j++) {
+                ASSERT_EQ(ssts[j]->id, shape[i][j]);
+            }
+        }
+
+        for (auto& [key, value] : expected) {
+            auto res = storage->get(Slice(key));
+            ASSERT_TRUE(res.has_value()) << key;
+            ASSERT_TRUE(*res == Slice(value)) << key;
+        }
+        this->check_scan(*storage, expected, 0, 10000);
+    }
+}
+
+TEST_F(StorageTest, flush_failure) {
+    auto options = this->small_options();
+    std::string sst_path;
+    {
+        auto storage = LsmStorage::open(storage_dir, options);
+        ASSERT_TRUE(storage->put(Slice("a"), Slice("1")));
+        // the sstable of the memtable cannot be created
+        char name[32];
+        snprintf(name, sizeof(name), "/%05lu.sst", storage->snapshot()->memtable->get_id());
+        sst_path = storage_dir + name;
+        std::filesystem::create_directory(sst_path);
+        storage->force_freeze();
+        storage->wait_for_flush();
+
+        // the memtable is kept along with its wal
+        auto state = storage->snapshot();
+        ASSERT_TRUE(state->l0_sstables.empty());
+        ASSERT_EQ(state->imm_memtables.size(), 1);
+        ASSERT_TRUE(*storage->get(Slice("a")) == Slice("1"));
+    }
+
+    std::filesystem::remove(sst_path);
+    auto storage = LsmStorage::open(storage_dir, options);
+    ASSERT_TRUE(*storage->get(Slice("a")) == Slice("1"));
+}
+
+TEST_F(StorageTest, compaction_failure) {
+    auto options = this->compaction_options();
+    auto storage = LsmStorage::open(storage_dir, options);
+    // the flushes are logged, the compaction they trigger is not
+    storage->debug_fail_manifest_after(options.level0_compaction_trigger);
+    for (size_t i = 0; i < options.level0_compaction_trigger; i++) {
+        ASSERT_TRUE(storage->put(Slice(this->key_of(i)), Slice(std::to_string(i))));
+        storage->force_freeze();
+        storage->wait_for_flush();
+    }
+    storage->wait_for_compaction();
+
+    // nothing is compacted again, the ids would be used up otherwise
+    auto state = storage->snapshot();
+    ASSERT_EQ(state->l0_sstables.size(), options.level0_compaction_trigger);
+    ASSERT_TRUE(state->levels.empty() || !state->levels[0]->num_of_ssts());
+    ASSERT_TRUE(storage->put(Slice("a"), Slice("1")));
+    storage->force_freeze();
+    auto id = storage->snapshot()->memtable->get_id();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_TRUE(storage->put(Slice("b"), Slice("2")));
+    storage->force_freeze();
+    ASSERT_EQ(storage->snapshot()->memtable->get_id(), id + 1);
+    for (size_t i = 0; i < options.level0_compaction_trigger; i++) {
+        ASSERT_TRUE(*storage->get(Slice(this->key_of(i))) == Slice(std::to_string(i)));
+    }
+}
+
+TEST_F(StorageTest, manifest_corruption) {
+    auto count_ssts = [this]() {
+        size_t cnt = 0;
+        for (auto& entry : std::filesystem::directory_iterator(storage_dir)) {
+            cnt += entry.path().extension() == ".sst";
+        }
+        return cnt;
+    };
+    auto write = [this](size_t begin) {
+        auto storage = LsmStorage::open(storage_dir, this->small_options());
+        ASSERT_TRUE(storage);
+        for (size_t i = begin; i < begin + 1000; i++) {
+            ASSERT_TRUE(storage->put(Slice(key_of(i)), Slice(std::to_string(i))));
+        }
+        storage->force_freeze();
+        storage->wait_for_flush();
+    };
+    write(0);
+
+    // a torn tail is dropped
+    auto manifest = storage_dir + "/MANIFEST";
+    std::ofstream(manifest, std::ios::app | std::ios::binary) << std::string("\x01\x02\x03\x04\xff\x00\x00\x00torn", 12);
+    write(1000);
+    auto num_of_ssts = count_ssts();
+    ASSERT_GT(num_of_ssts, 1);
+
+    // as is a manifest of another version
+    auto corrupt = [&](size_t offset) {
+        std::fstream file(manifest, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekg(offset);
+        auto byte = file.get();
+        file.seekp(offset);
+        file.put(byte ^ 1);
+    };
+    corrupt(7);
+    ASSERT_FALSE(LsmStorage::open(storage_dir, this->small_options()));
+    corrupt(7);
+
+    // a bad record followed by others is corruption, nothing is swept
+    corrupt(20);
+    std::ofstream(storage_dir + "/99999.sst") << "torn";
+    ASSERT_FALSE(LsmStorage::open(storage_dir, this->small_options()));
+    ASSERT_EQ(count_ssts(), num_of_ssts + 1);
+
+    // so are sstables without a manifest
+    std::filesystem::remove(manifest);
+    ASSERT_FALSE(LsmStorage::open(storage_dir, this->small_options()));
+    ASSERT_EQ(count_ssts(), num_of_ssts + 1);
+}
+
+TEST_F(StorageTest, table_cache) {
+    auto options = this->compaction_options();
+    options.max_open_files = 2;
+    std::map<std::string, std::string> expected;
+    {
+        auto storage = LsmStorage::open(storage_dir, options);
+        for (size_t i = 0; i < 30000; i++) {
+            auto key = this->key_of(this->seed() % 10000);
+            auto value = std::to_string(i);
+            ASSERT_TRUE(storage->put(Slice(key), Slice(value)));
+            expected[key] = value;
+        }
+        storage->force_freeze();
+        storage->wait_for_flush();
+        storage->wait_for_compaction();
+    }
+
+    options.num_compaction_threads = 0;
+    options.cache_index_blocks = true;
+    // scans read ahead in batches where io_uring is supported
+    options.io_backend = IoBackendType::IO_URING;
+    auto storage = LsmStorage::open(storage_dir, options);
+    size_t num_of_ssts = storage->snapshot()->l0_sstables.size();
+    for (auto& level : storage->snapshot()->levels) { num_of_ssts += level->num_of_ssts(); }
+    ASSERT_GT(num_of_ssts, options.max_open_files);
+    // sstables are opened lazily
+    ASSERT_EQ(this->num_of_open_sstables(), 0);
+
+    for (auto& [key, value] : expected) {
+        auto res = storage->get(Slice(key));
+        ASSERT_TRUE(res.has_value()) << key;
+        ASSERT_TRUE(*res == Slice(value)) << key;
+    }
+    ASSERT_LE(this->num_of_open_sstables(), options.max_open_files);
+    this->check_scan(*storage, expected, 0, 10000);
+    ASSERT_LE(this->num_of_open_sstables(), options.max_open_files);
+}
+
+TEST_F(StorageTest, multi_get) {
+    auto storage = LsmStorage::open(storage_dir, this->compaction_options());
+    std::map<std::string, std::string> expected;
+    for (size_t i = 0; i < 30000; i++) {
+        auto key = this->key_of(this->seed() % 10000);
+        auto value = std::to_string(i);
+        ASSERT_TRUE(storage->put(Slice(key), Slice(value)));
+        expected[key] = value;
+        // leave the newest values in the memtables
+        if (i == 25000) {
+            storage->force_freeze();
+            storage->wait_for_flush();
+            storage->wait_for_compaction();
+        }
+    }
+    size_t num_of_ssts = 0;
+    for (auto& level : storage->snapshot()->levels) { num_of_ssts += level->num_of_ssts(); }
+    ASSERT_GT(num_of_ssts, 1);
+
+    // unsorted keys with duplicates and absent ones
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < 5000; i++) { keys.push_back(this->key_of(this->seed() % 12000)); }
+    std::vector<Slice> key_slices(keys.begin(), keys.end());
+    auto values = storage->multi_get(key_slices);
+    ASSERT_EQ(values.size(), keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        auto iter = expected.find(keys[i]);
+        if (iter == expected.end()) {
+            ASSERT_FALSE(values[i].has_value()) << keys[i];
+        } else {
+            ASSERT_TRUE(values[i].has_value()) << keys[i];
+            ASSERT_TRUE(*values[i] == Slice(iter->second)) << keys[i];
+        }
+    }
+    ASSERT_TRUE(storage->multi_get({}).empty());
+}
+
+TEST_F(StorageTest, delete_range) {
+    // flushed to L0 only
+    this->check_deletions(this->small_options());
+    std::filesystem::remove_all(storage_dir);
+
+    // tombstones are kept until they reach the last level holding data
+    auto options = this->compaction_options();
+    options.max_subcompactions = 4;
+    options.target_file_size = 8 * 1024;
+    options.level_size_base = 32 * 1024;
+    this->check_deletions(options);
+    std::filesystem::remove_all(storage_dir);
+
+    options.compaction_style = CompactionStyle::TIERED;
+    options.level0_compaction_trigger = 4;
+    this->check_deletions(options);
+}
+
+TEST_F(StorageTest, snapshot) {
+    auto storage = LsmStorage::open(storage_dir, this->compaction_options());
+    const size_t num_of_keys = 5000;
+    auto value_of = [](size_t round, size_t i) {
+        return std::to_string(round) + "-" + std::to_string(i) + std::string(48, 'v');
+    };
+    for (size_t i = 0; i < num_of_keys; i++) {
+        ASSERT_TRUE(storage->put(Slice(key_of(i)), Slice(value_of(0, i))));
+    }
+    auto snapshot = storage->create_snapshot();
+
+    // overwrites and deletions after the snapshot, flushed and compacted
+    std::map<std::string, std::string> expected;
+    for (size_t round = 1; round <= 4; round++) {
+        for (size_t i = 0; i < num_of_keys; i++) {
+            ASSERT_TRUE(storage->put(Slice(key_of(i)), Slice(value_of(round, i))));
+            expected[key_of(i)] = value_of(round, i);
+        }
+    }
+    for (size_t i = 0; i < num_of_keys; i += 7) {
+        ASSERT_TRUE(storage->remove(Slice(key_of(i))));
+        expected.erase(key_of(i));
+    }
+    ASSERT_TRUE(storage->delete_range(Slice(key_of(1000)), Slice(key_of(2000))));
+    expected.erase(expected.lower_bound(key_of(1000)), expected.lower_bound(key_of(2000)));
+
+    for (int step = 0; step < 2; step++) {
+        // the snapshot reads the values written before it
+        vector<std::string> keys;
+        for (size_t i = 0; i < num_of_keys; i++) {
+            auto res = storage->get(Slice(key_of(i)), snapshot->ts());
+            ASSERT_TRUE(res.has_value()) << key_of(i);
+            ASSERT_TRUE(*res == Slice(value_of(0, i))) << key_of(i);
+            keys.push_back(key_of(i));
+        }
+        vector<Slice> key_slices(keys.begin(), keys.end());
+        auto values = storage->multi_get(key_slices, snapshot->ts());
+        for (size_t i = 0; i < num_of_keys; i++) {
+            ASSERT_TRUE(values[i].has_value() && *values[i] == Slice(value_of(0, i))) << key_of(i);
+        }
+        size_t i = 0;
+        for (auto iter = storage->scan(Bound(false), Bound(true), snapshot->ts()); iter->is_valid(); iter->next()) {
+            ASSERT_TRUE(iter->key() == Slice(key_of(i)));
+            ASSERT_TRUE(iter->value() == Slice(value_of(0, i)));
+            i++;
+        }
+        ASSERT_EQ(i, num_of_keys);
+        // the versions of a bound key may continue over several blocks
+        auto iter = storage->scan(Bound(Slice(key_of(2))), Bound(Slice(key_of(2))), snapshot->ts());
+        ASSERT_TRUE(iter->is_valid());
+        ASSERT_TRUE(iter->value() == Slice(value_of(0, 2)));
+
+        // the newest reads see everything written since
+        this->check_expected(*storage, expected, num_of_keys);
+
+        storage->force_freeze();
+        storage->wait_for_flush();
+        storage->wait_for_compaction();
+    }
+    ASSERT_GT(storage->snapshot()->levels[0]->num_of_ssts(), 0);
+}
+
+TEST_F(StorageTest, version_gc) {
+    const size_t num_of_keys = 2000;
+    // entries of every sstable, versions and tombstones included
+    auto num_of_entries = [](LsmStorage& storage) {
+        auto state = storage.snapshot();
+        auto levels = state->levels;
+        for (auto& sst : state->l0_sstables) {
+            vector<shared_ptr<SSTable>> ssts = {sst};
+            levels.push_back(std::make_shared<Level>(0, ssts));
+        }
+        size_t res = 0;
+        for (auto& level : levels) {
+            // null for an empty level
+            auto iter = level->scan();
+            for (; iter && iter->is_valid(); iter->next()) { res++; }
+        }
+        return res;
+    };
+
+    // two flushes of the same keys trigger a compaction merging them, the
+    // older versions are dropped unless a snapshot still reads them
+    for (bool hold_snapshot : {false, true}) {
+        std::filesystem::remove_all(storage_dir);
+        auto storage = LsmStorage::open(storage_dir, this->compaction_options());
+        shared_ptr<const Snapshot> snapshot;
+        for (size_t round = 0; round < 2; round++) {
+            for (size_t i = 0; i < num_of_keys; i++) {
+                ASSERT_TRUE(storage->put(Slice(key_of(i)), Slice(std::to_string(round))));
+            }
+            if (!round && hold_snapshot) { snapshot = storage->create_snapshot(); }
+            storage->force_freeze();
+            storage->wait_for_flush();
+        }
+        storage->wait_for_compaction();
+
+        auto state = storage->snapshot();
+        ASSERT_TRUE(state->l0_sstables.empty());
+        ASSERT_EQ(num_of_entries(*storage), hold_snapshot ? 2 * num_of_keys : num_of_keys);
+        for (size_t i = 0; i < num_of_keys; i++) {
+            ASSERT_TRUE(*storage->get(Slice(key_of(i))) == Slice("1"));
+            if (snapshot) { ASSERT_TRUE(*storage->get(Slice(key_of(i)), snapshot->ts()) == Slice("0")); }
+        }
+    }
+}
@@ -0,0 +1,283 @@
+/*
+ * @Author: lxc
+ * @Date: 2024-09-22 16:20:47
+ * @Description: test for write-ahead log
+ */
+
+#include "defs.h"
+#include "memtable/memtable.h"
+#include "wal/wal.h"
+#include "slice.h"
+#include "gtest/gtest.h"
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace minilsm;
+
+class WalTest : public ::testing::Test {
+public:
+    std::string wal_dir = string(PROJECT_ROOT_PATH) + "/binary/unittest/wal";
+
+public:
+    void SetUp() override {
+        std::filesystem::remove_all(wal_dir);
+        std::filesystem::create_directories(wal_dir);
+    }
+
+    size_t num_of_segments(const std::string& path) {
+        size_t cnt = 0;
+        for (auto& entry : std::filesystem::directory_iterator(wal_dir)) {
+            if (entry.path().filename().string().find(
+                    std::filesystem::path(path).filename().string()) == 0) {
+                cnt++;
+            }
+        }
+        return cnt;
+    }
+};
+
+int main() {
+    ::testing::InitGoogleTest();
+    return RUN_ALL_TESTS();
+}
+
+TEST_F(WalTest, recover) {
+    std::string path = wal_dir + "/memtable-0.wal";
+    {
+        auto memtable = MemTable::create_with_wal(0, path);
+        for (i32 i = 0; i < 1000; i++) {
+            EXPECT_TRUE(memtable->put(std::to_string(i), std::to_string(i * 2)));
+        }
+    }
+
+    auto memtable = MemTable::recover_from_wal(0, path);
+    EXPECT_EQ(memtable->get_size(), 1000);
+    for (i32 i = 0; i < 1000; i++) {
+        EXPECT_EQ(memtable->get(std::to_string(i)).compare(std::to_string(i * 2)), 0);
+    }
+
+    // the recovered memtable keeps logging
+    for (i32 i = 1000; i < 1100; i++) {
+        EXPECT_TRUE(memtable->put(std::to_string(i), std::to_string(i * 2)));
+    }
+    memtable.reset();
+    memtable = MemTable::recover_from_wal(0, path);
+    EXPECT_EQ(memtable->get_size(), 1100);
+}
+
+TEST_F(WalTest, groupcommit) {
+    std::string path = wal_dir + "/memtable-1.wal";
+    i32 thread_num = 8, key_num = 2000;
+    {
+        auto memtable = MemTable::create_with_wal(1, path);
+        std::vector<std::thread> threads(thread_num);
+        for (i32 i = 0; i < thread_num; i++) {
+            threads[i] = std::thread([&, i]() {
+                for (i32 j = i; j < key_num; j += thread_num) {
+                    memtable->put(std::to_string(j), std::to_string(j));
+                }
+            });
+        }
+        for (auto& thread : threads) { thread.join(); }
+        EXPECT_EQ(memtable->get_size(), key_num);
+    }
+
+    auto memtable = MemTable::recover_from_wal(1, path);
+    EXPECT_EQ(memtable->get_size(), key_num);
+    for (i32 i = 0; i < key_num; i++) {
+        EXPECT_EQ(memtable->get(std::to_string(i)).compare(std::to_string(i)), 0);
+    }
+}
+
+TEST_F(WalTest, segment) {
+    std::string path = wal_dir + "/memtable-2.wal";
+    WalOptions options;
+    options.sync_policy = WalSyncPolicy::INTERVAL;
+    options.sync_interval_ms = 1;
+    options.segment_size = 1024;
+    {
+        auto memtable = MemTable::create_with_wal(2, path, options);
+        for (i32 i = 0; i < 1000; i++) {
+            memtable->put(std::to_string(i), std::string(10, 'v'));
+        }
+        EXPECT_TRUE(memtable->sync_wal());
+    }
+    EXPECT_GT(num_of_segments(path), 1);
+
+    auto memtable = MemTable::recover_from_wal(2, path, options);
+    EXPECT_EQ(memtable->get_size(), 1000);
+}
+
+TEST_F(WalTest, torn) {
+    std::string path = wal_dir + "/memtable-3.wal";
+    {
+        auto wal = Wal::create(path);
+        ASSERT_NE(wal, nullptr);
+        for (i32 i = 0; i < 100; i++) {
+            wal->put(std::to_string(i), std::to_string(i));
+        }
+    }
+    {
+        // a half-written record at the tail
+        std::ofstream out(path + ".000000", std::ios::app | std::ios::binary);
+        out.write("\x01\x02\x03\x04\x10\x00", 6);
+    }
+
+    size_t cnt = 0;
+    auto wal = Wal::recover(path, [&](ValueType, const Slice&, const Slice&) { cnt++; });
+    EXPECT_EQ(cnt, 100);
+    wal->put("100", "100");
+    wal.reset();
+
+    cnt = 0;
+    wal = Wal::recover(path, [&](ValueType, const Slice&, const Slice&) { cnt++; });
+    EXPECT_EQ(cnt, 101);
+    EXPECT_TRUE(wal->remove());
+    EXPECT_EQ(num_of_segments(path), 0);
+}
+
+TEST_F(WalTest, version) {
+    std::string path = wal_dir + "/memtable-7.wal";
+    auto segment = path + ".000000";
+    auto corrupt = [&](size_t offset) {
+        std::fstream file(segment, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekg(offset);
+        char byte = file.get();
+        file.seekp(offset);
+        file.put(byte ^ 1);
+    };
+    auto recover = [&]() { return Wal::recover(path, [](ValueType, const Slice&, const Slice&) {}); };
+    {
+        auto wal = Wal::create(path);
+        ASSERT_NE(wal, nullptr);
+        EXPECT_TRUE(wal->put("a", "1"));
+    }
+
+    // a segment of another version or no segment at all is rejected
+    corrupt(4);
+    EXPECT_EQ(recover(), nullptr);
+    corrupt(4);
+    corrupt(0);
+    EXPECT_EQ(recover(), nullptr);
+    corrupt(0);
+
+    size_t cnt = 0;
+    EXPECT_NE(Wal::recover(path, [&](ValueType, const Slice&, const Slice&) { cnt++; }), nullptr);
+    EXPECT_EQ(cnt, 1);
+
+    // a header cut short is a torn tail
+    std::filesystem::resize_file(path + ".000001", 3);
+    cnt = 0;
+    EXPECT_NE(Wal::recover(path, [&](ValueType, const Slice&, const Slice&) { cnt++; }), nullptr);
+    EXPECT_EQ(cnt, 1);
+}
+
+TEST_F(WalTest, deletion) {
+    std::string path = wal_dir + "/memtable-4.wal";
+    {
+        auto memtable = MemTable::create_with_wal(4, path);
+        u64 ts = 0;
+        for (i32 i = 100; i < 200; i++) {
+            EXPECT_TRUE(memtable->put(std::to_string(i), std::to_string(i), ++ts));
+        }
+        EXPECT_TRUE(memtable->remove(Slice("105"), ++ts));
+        EXPECT_TRUE(memtable->delete_range(Slice("150"), Slice("160"), ++ts));
+        // the key is written after the deletion
+        EXPECT_TRUE(memtable->put(Slice("155"), Slice("new"), ++ts));
+    }
+
+    std::vector<ValueType> types;
+    std::vector<u64> timestamps;
+    auto wal = Wal::recover(path, [&](ValueType type, const KeySlice& key, const Slice&) {
+        types.push_back(type);
+        timestamps.push_back(key.get_ts());
+    });
+    ASSERT_EQ(types.size(), 103);
+    // every record keeps the timestamp of its write
+    for (size_t i = 0; i < timestamps.size(); i++) { EXPECT_EQ(timestamps[i], i + 1); }
+    EXPECT_EQ(types[100], ValueType::DELETION);
+    EXPECT_EQ(types[101], ValueType::RANGE_DELETION);
+    EXPECT_EQ(types[102], ValueType::VALUE);
+    wal.reset();
+
+    auto memtable = MemTable::recover_from_wal(4, path);
+    for (i32 i = 100; i < 200; i++) {
+        bool deleted = false;
+        auto value = memtable->find(std::to_string(i), &deleted);
+        bool expect_deleted = i == 105 || (i >= 150 && i < 160 && i != 155);
+        EXPECT_EQ(deleted, expect_deleted) << i;
+        EXPECT_EQ(value.has_value(), !expect_deleted) << i;
+    }
+    EXPECT_EQ(memtable->find(Slice("155"))->compare(Slice("new")), 0);
+    ASSERT_TRUE(memtable->range_tombstones());
+    EXPECT_EQ(memtable->range_tombstones()->size(), 1);
+    EXPECT_EQ(memtable->max_ts(), 103);
+}
+
+TEST_F(WalTest, create) {
+    // the first segment cannot be created in a missing directory
+    std::string path = wal_dir + "/missing/memtable-8.wal";
+    EXPECT_EQ(Wal::create(path), nullptr);
+    EXPECT_EQ(MemTable::create_with_wal(8, path), nullptr);
+}
+
+TEST_F(WalTest, remove) {
+    std::string path = wal_dir + "/memtable-5.wal";
+    auto wal = Wal::create(path);
+    ASSERT_NE(wal, nullptr);
+    // lengths are stored as u16
+    EXPECT_FALSE(wal->put(Slice(std::string(70000, 'k')), Slice("v")));
+    EXPECT_FALSE(wal->put(Slice("k"), Slice(std::string(70000, 'v'))));
+
+    // removed under running group commits, which fail afterwards instead
+    // of writing to a closed descriptor
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> threads;
+    for (i32 i = 0; i < 4; i++) {
+        threads.emplace_back([&]() {
+            while (!stop) { wal->put("key", "value"); }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_TRUE(wal->remove());
+    EXPECT_FALSE(wal->put("key", "value"));
+    stop = true;
+    for (auto& thread : threads) { thread.join(); }
+    EXPECT_EQ(num_of_segments(path), 0);
+}
+
+TEST_F(WalTest, append) {
+    std::string path = wal_dir + "/memtable-6.wal";
+    {
+        auto wal = Wal::create(path);
+        ASSERT_NE(wal, nullptr);
+        // records reach the log in the order of `append`, the first waiter
+        // writes both
+        Wal::Writer first, second;
+        EXPECT_TRUE(wal->append(first, "b", "1", ValueType::VALUE, 2));
+        EXPECT_TRUE(wal->append(second, "a", "2", ValueType::VALUE, 1));
+        EXPECT_TRUE(wal->wait(first));
+        EXPECT_TRUE(wal->wait(second));
+
+        // a record queued when the log is removed is acknowledged
+        Wal::Writer queued;
+        EXPECT_TRUE(wal->append(queued, "c", "3", ValueType::VALUE, 3));
+        std::filesystem::copy_file(path + ".000000", path + ".copy");
+        EXPECT_TRUE(wal->remove());
+        EXPECT_TRUE(wal->wait(queued));
+        Wal::Writer late;
+        EXPECT_FALSE(wal->append(late, "d", "4", ValueType::VALUE, 4));
+    }
+
+    std::filesystem::rename(path + ".copy", path + ".000000");
+    std::vector<u64> timestamps;
+    auto wal = Wal::recover(path, [&](ValueType, const KeySlice& key, const Slice&) {
+        timestamps.push_back(key.get_ts());
+    });
+    ASSERT_TRUE(wal);
+    EXPECT_EQ(timestamps, std::vector<u64>({2, 1}));
+}